@@ -0,0 +1,145 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** latency histogram **
+// host side, NOT a md part, although the md code carries the probes: a probe reads the host
+// tick counter and bumps a histogram which the md code never reads, so nothing flows back
+// into the state. A probe whose histogram pointer is NULL costs one predicted branch.
+//
+// log-linear buckets like HdrHistogram: a value below 2^SUB_BITS has a bucket of its own,
+// above that every power of 2 is cut into 2^SUB_BITS buckets, so a bucket is never wider
+// than 1/2^SUB_BITS of its lower bound. Values are host ticks, see `latency_histogram_ticks`.
+//
+// one writer at a time: the executor owns the histograms of the cell it runs. The counters
+// are bumped with relaxed atomic stores, no locked read-modify-write, so a reader in another
+// process never blocks the writer and never sees a torn counter. It may see a sample in its
+// bucket but not yet in ct, which is good enough for monitoring.
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include<stdint.h>
+#include<time.h>
+
+#define LATENCY_HISTOGRAM_SUB_BITS      3
+#define LATENCY_HISTOGRAM_MAX_BITS      48      // larger values are clamped to 2^48 - 1
+#define LATENCY_HISTOGRAM_BUCKET_CT     \
+    ((LATENCY_HISTOGRAM_MAX_BITS - LATENCY_HISTOGRAM_SUB_BITS + 1) << LATENCY_HISTOGRAM_SUB_BITS)
+
+typedef struct {
+    uint64_t ct;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[LATENCY_HISTOGRAM_BUCKET_CT];
+} latency_histogram_t;
+
+// a cycle counter where there is one, which is what keeps a probe in the tens of ns
+// always_inline
+inline uint64_t
+latency_histogram_ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// always_inline
+inline uint32_t
+latency_histogram_bucket_idx(uint64_t v){
+    uint32_t e;
+    if(v < ((uint64_t)1 << LATENCY_HISTOGRAM_SUB_BITS)){
+        return (uint32_t)v;
+    }
+    if(v >= ((uint64_t)1 << LATENCY_HISTOGRAM_MAX_BITS)){
+        v = ((uint64_t)1 << LATENCY_HISTOGRAM_MAX_BITS) - 1;
+    }
+    e = 63 - __builtin_clzll(v);
+    return ((e - LATENCY_HISTOGRAM_SUB_BITS + 1) << LATENCY_HISTOGRAM_SUB_BITS) |
+        (uint32_t)((v >> (e - LATENCY_HISTOGRAM_SUB_BITS)) &
+            (((uint64_t)1 << LATENCY_HISTOGRAM_SUB_BITS) - 1));
+}
+
+// smallest value of the bucket
+// always_inline
+inline uint64_t
+latency_histogram_bucket_low(uint32_t idx){
+    uint32_t e;
+    if(idx < ((uint32_t)1 << LATENCY_HISTOGRAM_SUB_BITS)){
+        return idx;
+    }
+    e = (idx >> LATENCY_HISTOGRAM_SUB_BITS) + LATENCY_HISTOGRAM_SUB_BITS - 1;
+    return ((uint64_t)((idx & (((uint32_t)1 << LATENCY_HISTOGRAM_SUB_BITS) - 1)) |
+        ((uint32_t)1 << LATENCY_HISTOGRAM_SUB_BITS))) << (e - LATENCY_HISTOGRAM_SUB_BITS);
+}
+
+// always_inline
+inline void
+latency_histogram_record(latency_histogram_t* hp, uint64_t v){
+    uint32_t idx = latency_histogram_bucket_idx(v);
+    __atomic_store_n(&hp->buckets[idx], hp->buckets[idx] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hp->sum, hp->sum + v, __ATOMIC_RELAXED);
+    if(v > hp->max){
+        __atomic_store_n(&hp->max, v, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&hp->ct, hp->ct + 1, __ATOMIC_RELEASE);
+}
+
+// the probe pair: t0 = latency_histogram_probe_begin(histp) ... latency_histogram_probe_end
+// always_inline
+inline uint64_t
+latency_histogram_probe_begin(latency_histogram_t* hp){
+    return hp ? latency_histogram_ticks() : 0;
+}
+
+// always_inline
+inline void
+latency_histogram_probe_end(latency_histogram_t* hp, uint64_t t0){
+    if(hp){
+        latency_histogram_record(hp, latency_histogram_ticks() - t0);
+    }
+}
+
+// on a copy taken by the reader, q in [0, 1]
+// ret u64: lower bound of the bucket holding the sample of rank q * ct | 0 if empty
+uint64_t
+latency_histogram_quantile(const latency_histogram_t* hp, double q){
+    uint64_t ct = 0, rank, seen = 0;
+    uint32_t i;
+    for(i = 0; i < LATENCY_HISTOGRAM_BUCKET_CT; i++){
+        ct += hp->buckets[i];
+    }
+    if(ct == 0){
+        return 0;
+    }
+    rank = (uint64_t)(q * (double)ct);
+    if(rank >= ct){
+        rank = ct - 1;
+    }
+    for(i = 0; i < LATENCY_HISTOGRAM_BUCKET_CT; i++){
+        seen += hp->buckets[i];
+        if(seen > rank){
+            return latency_histogram_bucket_low(i);
+        }
+    }
+    return hp->max;
+}
+
+#endif
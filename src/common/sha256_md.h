@@ -0,0 +1,173 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** sha256 (FIPS 180-4) **
+// one-shot, or incremental through sha256_ctx_t. Used to name content-addressed chunks,
+// so its result is part of the md state and must never depend on the host.
+
+#ifndef SHA256_MD_H
+#define SHA256_MD_H
+
+#include<stdint.h>
+
+#define SHA256_DIGEST_SIZE  32
+
+const uint32_t gl_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// always_inline
+inline uint32_t
+sha256_rotr(uint32_t x, uint8_t n){
+    return (x >> n) | (x << (32 - n));
+}
+
+// always_inline
+inline void
+sha256_compress(uint32_t h[8], const uint8_t block[64]){
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, hh, t1, t2;
+    uint8_t i;
+    for(i = 0; i < 16; i++){
+        w[i] = (((uint32_t)block[i * 4]) << 24) | (((uint32_t)block[i * 4 + 1]) << 16) |
+            (((uint32_t)block[i * 4 + 2]) << 8) | ((uint32_t)block[i * 4 + 3]);
+    }
+    for(i = 16; i < 64; i++){
+        w[i] = w[i - 16] + w[i - 7] +
+            (sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+            (sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    }
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+    for(i = 0; i < 64; i++){
+        t1 = hh + (sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^ sha256_rotr(e, 25)) +
+            ((e & f) ^ ((~e) & g)) + gl_sha256_k[i] + w[i];
+        t2 = (sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^ sha256_rotr(a, 22)) +
+            ((a & b) ^ (a & c) ^ (b & c));
+        hh = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+void
+sha256(const uint8_t* data, uint32_t len, uint8_t digest[SHA256_DIGEST_SIZE]){
+    uint32_t h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    uint8_t tail[128];
+    uint32_t i, tail_len;
+    uint64_t bit_len = ((uint64_t)len) << 3;
+    for(i = 0; i + 64 <= len; i += 64){
+        sha256_compress(h, data + i);
+    }
+    tail_len = len - i;
+    for(i = 0; i < tail_len; i++){
+        tail[i] = data[len - tail_len + i];
+    }
+    tail[tail_len++] = 0x80;
+    while(tail_len % 64 != 56){
+        tail[tail_len++] = 0;
+    }
+    for(i = 0; i < 8; i++){
+        tail[tail_len++] = (uint8_t)(bit_len >> (56 - i * 8));
+    }
+    for(i = 0; i < tail_len; i += 64){
+        sha256_compress(h, tail + i);
+    }
+    for(i = 0; i < 8; i++){
+        digest[i * 4] = (uint8_t)(h[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(h[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(h[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)h[i];
+    }
+}
+
+// incremental form, for a message which is not in one piece
+typedef struct {
+    uint32_t h[8];
+    uint8_t block[64];
+    uint32_t block_len;
+    uint64_t len;
+} sha256_ctx_t;
+
+void
+sha256_init(sha256_ctx_t* ctxp){
+    ctxp->h[0] = 0x6a09e667; ctxp->h[1] = 0xbb67ae85;
+    ctxp->h[2] = 0x3c6ef372; ctxp->h[3] = 0xa54ff53a;
+    ctxp->h[4] = 0x510e527f; ctxp->h[5] = 0x9b05688c;
+    ctxp->h[6] = 0x1f83d9ab; ctxp->h[7] = 0x5be0cd19;
+    ctxp->block_len = 0;
+    ctxp->len = 0;
+}
+
+void
+sha256_update(sha256_ctx_t* ctxp, const uint8_t* data, uint64_t len){
+    uint64_t i = 0;
+    ctxp->len += len;
+    if(ctxp->block_len){
+        while(i < len && ctxp->block_len < 64){
+            ctxp->block[ctxp->block_len++] = data[i++];
+        }
+        if(ctxp->block_len < 64){
+            return;
+        }
+        sha256_compress(ctxp->h, ctxp->block);
+        ctxp->block_len = 0;
+    }
+    for(; i + 64 <= len; i += 64){
+        sha256_compress(ctxp->h, data + i);
+    }
+    while(i < len){
+        ctxp->block[ctxp->block_len++] = data[i++];
+    }
+}
+
+void
+sha256_final(sha256_ctx_t* ctxp, uint8_t digest[SHA256_DIGEST_SIZE]){
+    uint64_t bit_len = ctxp->len << 3;
+    uint32_t i;
+    ctxp->block[ctxp->block_len++] = 0x80;
+    if(ctxp->block_len > 56){
+        while(ctxp->block_len < 64){
+            ctxp->block[ctxp->block_len++] = 0;
+        }
+        sha256_compress(ctxp->h, ctxp->block);
+        ctxp->block_len = 0;
+    }
+    while(ctxp->block_len < 56){
+        ctxp->block[ctxp->block_len++] = 0;
+    }
+    for(i = 0; i < 8; i++){
+        ctxp->block[56 + i] = (uint8_t)(bit_len >> (56 - i * 8));
+    }
+    sha256_compress(ctxp->h, ctxp->block);
+    for(i = 0; i < 8; i++){
+        digest[i * 4] = (uint8_t)(ctxp->h[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctxp->h[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctxp->h[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctxp->h[i];
+    }
+}
+
+#endif
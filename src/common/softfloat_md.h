@@ -0,0 +1,1179 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** softfloat: IEEE-754 binary32 and binary64 on integers only **
+// Nothing here touches a host float, so neither the host FPU flags nor a contraction of the
+// compiler nor x87 could change a bit of a result: every operation is exact integer code
+// which rounds once, by the mode of the context. The choices left open by IEEE-754 are the
+// ones of the ARM VFP (ARM DDI 0100I part C):
+//  - tininess is detected before rounding
+//  - a NaN result is the first signaling NaN of (a, b) quietened, else the first quiet NaN,
+//    and an invalid operation gives the default NaN 0x7fc00000 (0x7ff8000000000000)
+//  - flush to zero: a denormal operand reads as the zero of its sign (INPUT_DENORMAL), and a
+//    result which is tiny before rounding is the zero of its sign (UNDERFLOW, not INEXACT)
+//  - default NaN mode: every NaN result is the default NaN
+// Add, sub, mul and the conversions are the algorithms of SoftFloat release 2 by John R.
+// Hauser, div and sqrt are exact bitwise long divisions here.
+
+#ifndef SOFTFLOAT_MD_H
+#define SOFTFLOAT_MD_H
+
+#include<stdint.h>
+
+// the values of FPSCR.RMode
+#define SOFTFLOAT_ROUND_NEAREST_EVEN    0
+#define SOFTFLOAT_ROUND_PLUS_INF        1
+#define SOFTFLOAT_ROUND_MINUS_INF       2
+#define SOFTFLOAT_ROUND_ZERO            3
+
+// the bits of the FPSCR cumulative exception flags
+#define SOFTFLOAT_FLAG_INVALID          ((uint32_t)0x01)
+#define SOFTFLOAT_FLAG_DIVBYZERO        ((uint32_t)0x02)
+#define SOFTFLOAT_FLAG_OVERFLOW         ((uint32_t)0x04)
+#define SOFTFLOAT_FLAG_UNDERFLOW        ((uint32_t)0x08)
+#define SOFTFLOAT_FLAG_INEXACT          ((uint32_t)0x10)
+#define SOFTFLOAT_FLAG_INPUT_DENORMAL   ((uint32_t)0x80)
+
+// the NZCV of a compare, in bits[3:0]
+#define SOFTFLOAT_CMP_LESS              ((uint8_t)0x8)
+#define SOFTFLOAT_CMP_EQUAL             ((uint8_t)0x6)
+#define SOFTFLOAT_CMP_GREATER           ((uint8_t)0x2)
+#define SOFTFLOAT_CMP_UNORDERED         ((uint8_t)0x3)
+
+#define SOFTFLOAT_F32_DEFAULT_NAN       ((uint32_t)0x7fc00000)
+#define SOFTFLOAT_F64_DEFAULT_NAN       ((uint64_t)0x7ff8000000000000)
+
+typedef struct {
+    uint8_t round_mode;             // SOFTFLOAT_ROUND_*
+    uint8_t flush_to_zero_flag;
+    uint8_t default_nan_flag;
+    uint32_t flags;                 // SOFTFLOAT_FLAG_*, accumulated
+} softfloat_ctx_t;
+
+// ** integer helpers **
+
+// always_inline
+inline uint8_t
+softfloat_clz32(uint32_t a){
+    uint8_t n = 0;
+    if(a == 0){
+        return 32;
+    }
+    if((a & (uint32_t)0xffff0000) == 0){
+        n += 16;
+        a <<= 16;
+    }
+    if((a & (uint32_t)0xff000000) == 0){
+        n += 8;
+        a <<= 8;
+    }
+    if((a & (uint32_t)0xf0000000) == 0){
+        n += 4;
+        a <<= 4;
+    }
+    if((a & (uint32_t)0xc0000000) == 0){
+        n += 2;
+        a <<= 2;
+    }
+    if((a & (uint32_t)0x80000000) == 0){
+        n += 1;
+    }
+    return n;
+}
+
+// always_inline
+inline uint8_t
+softfloat_clz64(uint64_t a){
+    if((a >> 32) == 0){
+        return 32 + softfloat_clz32((uint32_t)a);
+    }
+    return softfloat_clz32((uint32_t)(a >> 32));
+}
+
+// shift right, any bit shifted out is ORed into bit 0 (the sticky bit)
+// always_inline
+inline uint32_t
+softfloat_shift32_right_jamming(uint32_t a, int32_t ct){
+    if(ct == 0){
+        return a;
+    }
+    if(ct < 32){
+        return (a >> ct) | (uint32_t)((a << (32 - ct)) != 0);
+    }
+    return (uint32_t)(a != 0);
+}
+
+// always_inline
+inline uint64_t
+softfloat_shift64_right_jamming(uint64_t a, int32_t ct){
+    if(ct == 0){
+        return a;
+    }
+    if(ct < 64){
+        return (a >> ct) | (uint64_t)((a << (64 - ct)) != 0);
+    }
+    return (uint64_t)(a != 0);
+}
+
+// always_inline
+inline void
+softfloat_mul64_to_128(uint64_t a, uint64_t b, uint64_t* hip, uint64_t* lop){
+    uint64_t a_hi = a >> 32, a_lo = a & (uint64_t)0xffffffff;
+    uint64_t b_hi = b >> 32, b_lo = b & (uint64_t)0xffffffff;
+    uint64_t lo = a_lo * b_lo;
+    uint64_t mid = a_lo * b_hi;
+    uint64_t mid2 = a_hi * b_lo;
+    uint64_t hi = a_hi * b_hi;
+    mid += mid2;
+    hi += ((uint64_t)(mid < mid2) << 32) + (mid >> 32);
+    mid <<= 32;
+    lo += mid;
+    hi += (uint64_t)(lo < mid);
+    *hip = hi;
+    *lop = lo;
+}
+
+// ret: floor((a << 64) / b) with the sticky bit of the remainder, a < b / 2
+// always_inline
+inline uint64_t
+softfloat_div128_by_64(uint64_t a, uint64_t b){
+    uint64_t rem = a, q = 0, carry;
+    uint8_t i;
+    for(i = 0; i < 64; i++){
+        carry = rem >> 63;
+        rem <<= 1;
+        q <<= 1;
+        if(carry || rem >= b){
+            rem -= b;
+            q |= 1;
+        }
+    }
+    return q | (uint64_t)(rem != 0);
+}
+
+// ret: floor(sqrt(a)) with the sticky bit of the remainder, digit by digit
+// always_inline
+inline uint32_t
+softfloat_sqrt64(uint64_t a){
+    uint64_t rem = 0, root = 0, trial;
+    int32_t i;
+    for(i = 31; i >= 0; i--){
+        rem = (rem << 2) | ((a >> (2 * i)) & 3);
+        trial = (root << 2) | 1;
+        root <<= 1;
+        if(rem >= trial){
+            rem -= trial;
+            root |= 1;
+        }
+    }
+    return (uint32_t)root | (uint32_t)(rem != 0);
+}
+
+// ret: floor(sqrt(hi:lo)) with the sticky bit of the remainder, hi < 2^62
+// always_inline
+inline uint64_t
+softfloat_sqrt128(uint64_t hi, uint64_t lo){
+    uint64_t rem_hi = 0, rem_lo = 0, trial_hi, trial_lo, root = 0, two;
+    int32_t i;
+    for(i = 63; i >= 0; i--){
+        two = i >= 32 ? (hi >> (2 * i - 64)) & 3 : (lo >> (2 * i)) & 3;
+        rem_hi = (rem_hi << 2) | (rem_lo >> 62);
+        rem_lo = (rem_lo << 2) | two;
+        trial_hi = root >> 62;
+        trial_lo = (root << 2) | 1;
+        root <<= 1;
+        if(rem_hi > trial_hi || (rem_hi == trial_hi && rem_lo >= trial_lo)){
+            rem_hi = rem_hi - trial_hi - (uint64_t)(rem_lo < trial_lo);
+            rem_lo -= trial_lo;
+            root |= 1;
+        }
+    }
+    return root | (uint64_t)((rem_hi | rem_lo) != 0);
+}
+
+// ** binary32 **
+
+// always_inline
+inline uint32_t
+softfloat_f32_pack(uint8_t sign, int32_t exp, uint32_t sig){
+    return ((uint32_t)sign << 31) + ((uint32_t)exp << 23) + sig;
+}
+
+// always_inline
+inline uint8_t
+softfloat_f32_is_nan(uint32_t a){
+    return (a << 1) > (uint32_t)0xff000000;
+}
+
+// always_inline
+inline uint8_t
+softfloat_f32_is_snan(uint32_t a){
+    return ((a >> 22) & 0x1ff) == 0x1fe && (a & (uint32_t)0x003fffff);
+}
+
+// always_inline
+inline uint32_t
+softfloat_f32_flush_input(softfloat_ctx_t* ctxp, uint32_t a){
+    if(ctxp->flush_to_zero_flag && (a & (uint32_t)0x7f800000) == 0 &&
+        (a & (uint32_t)0x007fffff)){
+
+        ctxp->flags |= SOFTFLOAT_FLAG_INPUT_DENORMAL;
+        return a & (uint32_t)0x80000000;
+    }
+    return a;
+}
+
+// a or b is a NaN, pass a twice for an operation of one operand
+// always_inline
+inline uint32_t
+softfloat_f32_propagate_nan(softfloat_ctx_t* ctxp, uint32_t a, uint32_t b){
+    uint32_t z;
+    if(softfloat_f32_is_snan(a) || softfloat_f32_is_snan(b)){
+        ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        z = softfloat_f32_is_snan(a) ? a : b;
+    }else{
+        z = softfloat_f32_is_nan(a) ? a : b;
+    }
+    return ctxp->default_nan_flag ? SOFTFLOAT_F32_DEFAULT_NAN : z | (uint32_t)0x00400000;
+}
+
+// sig has its leading bit at bit 30 and 7 bits below the result, exp is the biased exponent
+// of the result minus 1
+uint32_t
+softfloat_f32_round_pack(softfloat_ctx_t* ctxp, uint8_t sign, int32_t exp, uint32_t sig){
+    uint8_t nearest_even_flag = ctxp->round_mode == SOFTFLOAT_ROUND_NEAREST_EVEN;
+    uint32_t inc = 0x40, round_bits;
+    if(!nearest_even_flag){
+        if(ctxp->round_mode == SOFTFLOAT_ROUND_ZERO ||
+            ctxp->round_mode == (sign ? SOFTFLOAT_ROUND_PLUS_INF : SOFTFLOAT_ROUND_MINUS_INF)){
+            inc = 0;
+        }else{
+            inc = 0x7f;
+        }
+    }
+    round_bits = sig & 0x7f;
+    if(exp >= 0xfd || exp < 0){
+        if(exp > 0xfd || (exp == 0xfd && (int32_t)(sig + inc) < 0)){
+            ctxp->flags |= SOFTFLOAT_FLAG_OVERFLOW | SOFTFLOAT_FLAG_INEXACT;
+            return softfloat_f32_pack(sign, 0xff, 0) - (uint32_t)(inc == 0);
+        }
+        if(exp < 0){
+            if(ctxp->flush_to_zero_flag){
+                ctxp->flags |= SOFTFLOAT_FLAG_UNDERFLOW;
+                return softfloat_f32_pack(sign, 0, 0);
+            }
+            sig = softfloat_shift32_right_jamming(sig, -exp);
+            exp = 0;
+            round_bits = sig & 0x7f;
+            if(round_bits){
+                ctxp->flags |= SOFTFLOAT_FLAG_UNDERFLOW;
+            }
+        }
+    }
+    if(round_bits){
+        ctxp->flags |= SOFTFLOAT_FLAG_INEXACT;
+    }
+    sig = (sig + inc) >> 7;
+    sig &= ~(uint32_t)(round_bits == 0x40 && nearest_even_flag);
+    if(sig == 0){
+        exp = 0;
+    }
+    return softfloat_f32_pack(sign, exp, sig);
+}
+
+// sig is not 0 and below bit 31
+// always_inline
+inline uint32_t
+softfloat_f32_normalize_round_pack(softfloat_ctx_t* ctxp, uint8_t sign, int32_t exp,
+    uint32_t sig){
+
+    uint8_t shift = softfloat_clz32(sig) - 1;
+    return softfloat_f32_round_pack(ctxp, sign, exp - shift, sig << shift);
+}
+
+// the sig of a denormal gets its leading bit at bit 23
+// always_inline
+inline void
+softfloat_f32_normalize_subnormal(uint32_t sig, int32_t* expp, uint32_t* sigp){
+    uint8_t shift = softfloat_clz32(sig) - 8;
+    *sigp = sig << shift;
+    *expp = 1 - (int32_t)shift;
+}
+
+// |a| + |b| with the sign z_sign, neither is a NaN
+uint32_t
+softfloat_f32_add_sigs(softfloat_ctx_t* ctxp, uint32_t a, uint32_t b, uint8_t z_sign){
+    int32_t a_exp = (a >> 23) & 0xff, b_exp = (b >> 23) & 0xff, z_exp, exp_diff;
+    uint32_t a_sig = (a & (uint32_t)0x007fffff) << 6, b_sig = (b & (uint32_t)0x007fffff) << 6;
+    uint32_t z_sig;
+    exp_diff = a_exp - b_exp;
+    if(exp_diff > 0){
+        if(a_exp == 0xff){
+            return a;
+        }
+        if(b_exp == 0){
+            exp_diff--;
+        }else{
+            b_sig |= (uint32_t)0x20000000;
+        }
+        b_sig = softfloat_shift32_right_jamming(b_sig, exp_diff);
+        z_exp = a_exp;
+    }else if(exp_diff < 0){
+        if(b_exp == 0xff){
+            return softfloat_f32_pack(z_sign, 0xff, 0);
+        }
+        if(a_exp == 0){
+            exp_diff++;
+        }else{
+            a_sig |= (uint32_t)0x20000000;
+        }
+        a_sig = softfloat_shift32_right_jamming(a_sig, -exp_diff);
+        z_exp = b_exp;
+    }else{
+        if(a_exp == 0xff){
+            return a;
+        }
+        if(a_exp == 0){ // exact
+            return softfloat_f32_pack(z_sign, 0, (a_sig + b_sig) >> 6);
+        }
+        z_sig = (uint32_t)0x40000000 + a_sig + b_sig;
+        return softfloat_f32_round_pack(ctxp, z_sign, a_exp, z_sig);
+    }
+    a_sig |= (uint32_t)0x20000000;
+    z_sig = (a_sig + b_sig) << 1;
+    z_exp--;
+    if((int32_t)z_sig < 0){
+        z_sig = a_sig + b_sig;
+        z_exp++;
+    }
+    return softfloat_f32_round_pack(ctxp, z_sign, z_exp, z_sig);
+}
+
+// |a| - |b| with the sign z_sign, neither is a NaN
+uint32_t
+softfloat_f32_sub_sigs(softfloat_ctx_t* ctxp, uint32_t a, uint32_t b, uint8_t z_sign){
+    int32_t a_exp = (a >> 23) & 0xff, b_exp = (b >> 23) & 0xff, z_exp, exp_diff;
+    uint32_t a_sig = (a & (uint32_t)0x007fffff) << 7, b_sig = (b & (uint32_t)0x007fffff) << 7;
+    uint32_t z_sig;
+    exp_diff = a_exp - b_exp;
+    if(exp_diff > 0){
+        if(a_exp == 0xff){
+            return a;
+        }
+        if(b_exp == 0){
+            exp_diff--;
+        }else{
+            b_sig |= (uint32_t)0x40000000;
+        }
+        b_sig = softfloat_shift32_right_jamming(b_sig, exp_diff);
+        a_sig |= (uint32_t)0x40000000;
+        goto A_BIGGER;
+    }
+    if(exp_diff < 0){
+        if(b_exp == 0xff){
+            return softfloat_f32_pack(z_sign ^ 1, 0xff, 0);
+        }
+        if(a_exp == 0){
+            exp_diff++;
+        }else{
+            a_sig |= (uint32_t)0x40000000;
+        }
+        a_sig = softfloat_shift32_right_jamming(a_sig, -exp_diff);
+        b_sig |= (uint32_t)0x40000000;
+        goto B_BIGGER;
+    }
+    if(a_exp == 0xff){ // inf - inf
+        ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        return SOFTFLOAT_F32_DEFAULT_NAN;
+    }
+    if(a_exp == 0){
+        a_exp = 1;
+        b_exp = 1;
+    }
+    if(b_sig < a_sig){
+        goto A_BIGGER;
+    }
+    if(a_sig < b_sig){
+        goto B_BIGGER;
+    }
+    return softfloat_f32_pack(ctxp->round_mode == SOFTFLOAT_ROUND_MINUS_INF, 0, 0);
+
+    B_BIGGER:;
+    z_sig = b_sig - a_sig;
+    z_exp = b_exp;
+    z_sign ^= 1;
+    return softfloat_f32_normalize_round_pack(ctxp, z_sign, z_exp - 1, z_sig);
+
+    A_BIGGER:;
+    z_sig = a_sig - b_sig;
+    z_exp = a_exp;
+    return softfloat_f32_normalize_round_pack(ctxp, z_sign, z_exp - 1, z_sig);
+}
+
+uint32_t
+softfloat_f32_add(softfloat_ctx_t* ctxp, uint32_t a, uint32_t b){
+    a = softfloat_f32_flush_input(ctxp, a);
+    b = softfloat_f32_flush_input(ctxp, b);
+    if(softfloat_f32_is_nan(a) || softfloat_f32_is_nan(b)){
+        return softfloat_f32_propagate_nan(ctxp, a, b);
+    }
+    if((a >> 31) == (b >> 31)){
+        return softfloat_f32_add_sigs(ctxp, a, b, a >> 31);
+    }
+    return softfloat_f32_sub_sigs(ctxp, a, b, a >> 31);
+}
+
+uint32_t
+softfloat_f32_sub(softfloat_ctx_t* ctxp, uint32_t a, uint32_t b){
+    a = softfloat_f32_flush_input(ctxp, a);
+    b = softfloat_f32_flush_input(ctxp, b);
+    if(softfloat_f32_is_nan(a) || softfloat_f32_is_nan(b)){
+        return softfloat_f32_propagate_nan(ctxp, a, b);
+    }
+    if((a >> 31) == (b >> 31)){
+        return softfloat_f32_sub_sigs(ctxp, a, b, a >> 31);
+    }
+    return softfloat_f32_add_sigs(ctxp, a, b, a >> 31);
+}
+
+uint32_t
+softfloat_f32_mul(softfloat_ctx_t* ctxp, uint32_t a, uint32_t b){
+    int32_t a_exp, b_exp, z_exp;
+    uint32_t a_sig, b_sig, z_sig;
+    uint8_t z_sign;
+    a = softfloat_f32_flush_input(ctxp, a);
+    b = softfloat_f32_flush_input(ctxp, b);
+    if(softfloat_f32_is_nan(a) || softfloat_f32_is_nan(b)){
+        return softfloat_f32_propagate_nan(ctxp, a, b);
+    }
+    a_exp = (a >> 23) & 0xff;
+    b_exp = (b >> 23) & 0xff;
+    a_sig = a & (uint32_t)0x007fffff;
+    b_sig = b & (uint32_t)0x007fffff;
+    z_sign = (a ^ b) >> 31;
+    if(a_exp == 0xff || b_exp == 0xff){
+        if((a_exp == 0 && a_sig == 0) || (b_exp == 0 && b_sig == 0)){ // inf * 0
+            ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+            return SOFTFLOAT_F32_DEFAULT_NAN;
+        }
+        return softfloat_f32_pack(z_sign, 0xff, 0);
+    }
+    if(a_exp == 0){
+        if(a_sig == 0){
+            return softfloat_f32_pack(z_sign, 0, 0);
+        }
+        softfloat_f32_normalize_subnormal(a_sig, &a_exp, &a_sig);
+    }
+    if(b_exp == 0){
+        if(b_sig == 0){
+            return softfloat_f32_pack(z_sign, 0, 0);
+        }
+        softfloat_f32_normalize_subnormal(b_sig, &b_exp, &b_sig);
+    }
+    z_exp = a_exp + b_exp - 0x7f;
+    a_sig = (a_sig | (uint32_t)0x00800000) << 7;
+    b_sig = (b_sig | (uint32_t)0x00800000) << 8;
+    z_sig = (uint32_t)softfloat_shift64_right_jamming((uint64_t)a_sig * b_sig, 32);
+    if((int32_t)(z_sig << 1) >= 0){
+        z_sig <<= 1;
+        z_exp--;
+    }
+    return softfloat_f32_round_pack(ctxp, z_sign, z_exp, z_sig);
+}
+
+uint32_t
+softfloat_f32_div(softfloat_ctx_t* ctxp, uint32_t a, uint32_t b){
+    int32_t a_exp, b_exp, z_exp;
+    uint32_t a_sig, b_sig;
+    uint64_t z_sig;
+    uint8_t z_sign;
+    a = softfloat_f32_flush_input(ctxp, a);
+    b = softfloat_f32_flush_input(ctxp, b);
+    if(softfloat_f32_is_nan(a) || softfloat_f32_is_nan(b)){
+        return softfloat_f32_propagate_nan(ctxp, a, b);
+    }
+    a_exp = (a >> 23) & 0xff;
+    b_exp = (b >> 23) & 0xff;
+    a_sig = a & (uint32_t)0x007fffff;
+    b_sig = b & (uint32_t)0x007fffff;
+    z_sign = (a ^ b) >> 31;
+    if(a_exp == 0xff){
+        if(b_exp == 0xff){ // inf / inf
+            ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+            return SOFTFLOAT_F32_DEFAULT_NAN;
+        }
+        return softfloat_f32_pack(z_sign, 0xff, 0);
+    }
+    if(b_exp == 0xff){
+        return softfloat_f32_pack(z_sign, 0, 0);
+    }
+    if(b_exp == 0){
+        if(b_sig == 0){
+            if(a_exp == 0 && a_sig == 0){ // 0 / 0
+                ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+                return SOFTFLOAT_F32_DEFAULT_NAN;
+            }
+            ctxp->flags |= SOFTFLOAT_FLAG_DIVBYZERO;
+            return softfloat_f32_pack(z_sign, 0xff, 0);
+        }
+        softfloat_f32_normalize_subnormal(b_sig, &b_exp, &b_sig);
+    }
+    if(a_exp == 0){
+        if(a_sig == 0){
+            return softfloat_f32_pack(z_sign, 0, 0);
+        }
+        softfloat_f32_normalize_subnormal(a_sig, &a_exp, &a_sig);
+    }
+    z_exp = a_exp - b_exp + 0x7d;
+    a_sig = (a_sig | (uint32_t)0x00800000) << 7;
+    b_sig = (b_sig | (uint32_t)0x00800000) << 8;
+    if(b_sig <= a_sig + a_sig){
+        a_sig >>= 1;
+        z_exp++;
+    }
+    z_sig = ((uint64_t)a_sig << 32) / b_sig;
+    z_sig |= (uint64_t)(z_sig * b_sig != (uint64_t)a_sig << 32);
+    return softfloat_f32_round_pack(ctxp, z_sign, z_exp, (uint32_t)z_sig);
+}
+
+uint32_t
+softfloat_f32_sqrt(softfloat_ctx_t* ctxp, uint32_t a){
+    int32_t a_exp, exp;
+    uint32_t a_sig;
+    a = softfloat_f32_flush_input(ctxp, a);
+    if(softfloat_f32_is_nan(a)){
+        return softfloat_f32_propagate_nan(ctxp, a, a);
+    }
+    a_exp = (a >> 23) & 0xff;
+    a_sig = a & (uint32_t)0x007fffff;
+    if(a_exp == 0 && a_sig == 0){ // sqrt(-0) is -0
+        return a;
+    }
+    if(a >> 31){
+        ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        return SOFTFLOAT_F32_DEFAULT_NAN;
+    }
+    if(a_exp == 0xff){
+        return a;
+    }
+    if(a_exp == 0){
+        softfloat_f32_normalize_subnormal(a_sig, &a_exp, &a_sig);
+    }
+    // a = sig * 2^(exp - 23), the exponent made even, the root gets its leading bit at bit 30
+    a_sig |= (uint32_t)0x00800000;
+    exp = a_exp - 0x7f;
+    if(exp & 1){
+        a_sig <<= 1;
+        exp--;
+    }
+    return softfloat_f32_round_pack(ctxp, 0, exp / 2 + 0x7e,
+        softfloat_sqrt64((uint64_t)a_sig << 37));
+}
+
+// ret u8: SOFTFLOAT_CMP_*, a NaN operand is invalid if it is signaling or signaling_flag is
+//  set (FCMPE)
+uint8_t
+softfloat_f32_compare(softfloat_ctx_t* ctxp, uint32_t a, uint32_t b, uint8_t signaling_flag){
+    a = softfloat_f32_flush_input(ctxp, a);
+    b = softfloat_f32_flush_input(ctxp, b);
+    if(softfloat_f32_is_nan(a) || softfloat_f32_is_nan(b)){
+        if(signaling_flag || softfloat_f32_is_snan(a) || softfloat_f32_is_snan(b)){
+            ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        }
+        return SOFTFLOAT_CMP_UNORDERED;
+    }
+    if(a == b || ((a | b) << 1) == 0){
+        return SOFTFLOAT_CMP_EQUAL;
+    }
+    if((a >> 31) != (b >> 31)){
+        return (a >> 31) ? SOFTFLOAT_CMP_LESS : SOFTFLOAT_CMP_GREATER;
+    }
+    return ((a < b) ^ (uint8_t)(a >> 31)) ? SOFTFLOAT_CMP_LESS : SOFTFLOAT_CMP_GREATER;
+}
+
+uint32_t
+softfloat_f32_from_i32(softfloat_ctx_t* ctxp, uint32_t a){
+    uint8_t sign = a >> 31;
+    if(a == 0){
+        return 0;
+    }
+    if(a == (uint32_t)0x80000000){
+        return softfloat_f32_pack(1, 0x9e, 0);
+    }
+    return softfloat_f32_normalize_round_pack(ctxp, sign, 0x9c, sign ? 0 - a : a);
+}
+
+uint32_t
+softfloat_f32_from_u32(softfloat_ctx_t* ctxp, uint32_t a){
+    if(a == 0){
+        return 0;
+    }
+    if(a >> 31){
+        return softfloat_f32_round_pack(ctxp, 0, 0x9d, softfloat_shift32_right_jamming(a, 1));
+    }
+    return softfloat_f32_normalize_round_pack(ctxp, 0, 0x9c, a);
+}
+
+// ** binary64 **
+
+// always_inline
+inline uint64_t
+softfloat_f64_pack(uint8_t sign, int32_t exp, uint64_t sig){
+    return ((uint64_t)sign << 63) + ((uint64_t)(uint32_t)exp << 52) + sig;
+}
+
+// always_inline
+inline uint8_t
+softfloat_f64_is_nan(uint64_t a){
+    return (a << 1) > (uint64_t)0xffe0000000000000;
+}
+
+// always_inline
+inline uint8_t
+softfloat_f64_is_snan(uint64_t a){
+    return ((a >> 51) & 0xfff) == 0xffe && (a & (uint64_t)0x0007ffffffffffff);
+}
+
+// always_inline
+inline uint64_t
+softfloat_f64_flush_input(softfloat_ctx_t* ctxp, uint64_t a){
+    if(ctxp->flush_to_zero_flag && (a & (uint64_t)0x7ff0000000000000) == 0 &&
+        (a & (uint64_t)0x000fffffffffffff)){
+
+        ctxp->flags |= SOFTFLOAT_FLAG_INPUT_DENORMAL;
+        return a & (uint64_t)0x8000000000000000;
+    }
+    return a;
+}
+
+// always_inline
+inline uint64_t
+softfloat_f64_propagate_nan(softfloat_ctx_t* ctxp, uint64_t a, uint64_t b){
+    uint64_t z;
+    if(softfloat_f64_is_snan(a) || softfloat_f64_is_snan(b)){
+        ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        z = softfloat_f64_is_snan(a) ? a : b;
+    }else{
+        z = softfloat_f64_is_nan(a) ? a : b;
+    }
+    return ctxp->default_nan_flag ? SOFTFLOAT_F64_DEFAULT_NAN : z | (uint64_t)0x0008000000000000;
+}
+
+// sig has its leading bit at bit 62 and 10 bits below the result, exp is the biased exponent
+// of the result minus 1
+uint64_t
+softfloat_f64_round_pack(softfloat_ctx_t* ctxp, uint8_t sign, int32_t exp, uint64_t sig){
+    uint8_t nearest_even_flag = ctxp->round_mode == SOFTFLOAT_ROUND_NEAREST_EVEN;
+    uint64_t inc = 0x200, round_bits;
+    if(!nearest_even_flag){
+        if(ctxp->round_mode == SOFTFLOAT_ROUND_ZERO ||
+            ctxp->round_mode == (sign ? SOFTFLOAT_ROUND_PLUS_INF : SOFTFLOAT_ROUND_MINUS_INF)){
+            inc = 0;
+        }else{
+            inc = 0x3ff;
+        }
+    }
+    round_bits = sig & 0x3ff;
+    if(exp >= 0x7fd || exp < 0){
+        if(exp > 0x7fd || (exp == 0x7fd && (int64_t)(sig + inc) < 0)){
+            ctxp->flags |= SOFTFLOAT_FLAG_OVERFLOW | SOFTFLOAT_FLAG_INEXACT;
+            return softfloat_f64_pack(sign, 0x7ff, 0) - (uint64_t)(inc == 0);
+        }
+        if(exp < 0){
+            if(ctxp->flush_to_zero_flag){
+                ctxp->flags |= SOFTFLOAT_FLAG_UNDERFLOW;
+                return softfloat_f64_pack(sign, 0, 0);
+            }
+            sig = softfloat_shift64_right_jamming(sig, -exp);
+            exp = 0;
+            round_bits = sig & 0x3ff;
+            if(round_bits){
+                ctxp->flags |= SOFTFLOAT_FLAG_UNDERFLOW;
+            }
+        }
+    }
+    if(round_bits){
+        ctxp->flags |= SOFTFLOAT_FLAG_INEXACT;
+    }
+    sig = (sig + inc) >> 10;
+    sig &= ~(uint64_t)(round_bits == 0x200 && nearest_even_flag);
+    if(sig == 0){
+        exp = 0;
+    }
+    return softfloat_f64_pack(sign, exp, sig);
+}
+
+// always_inline
+inline uint64_t
+softfloat_f64_normalize_round_pack(softfloat_ctx_t* ctxp, uint8_t sign, int32_t exp,
+    uint64_t sig){
+
+    uint8_t shift = softfloat_clz64(sig) - 1;
+    return softfloat_f64_round_pack(ctxp, sign, exp - shift, sig << shift);
+}
+
+// the sig of a denormal gets its leading bit at bit 52
+// always_inline
+inline void
+softfloat_f64_normalize_subnormal(uint64_t sig, int32_t* expp, uint64_t* sigp){
+    uint8_t shift = softfloat_clz64(sig) - 11;
+    *sigp = sig << shift;
+    *expp = 1 - (int32_t)shift;
+}
+
+uint64_t
+softfloat_f64_add_sigs(softfloat_ctx_t* ctxp, uint64_t a, uint64_t b, uint8_t z_sign){
+    int32_t a_exp = (a >> 52) & 0x7ff, b_exp = (b >> 52) & 0x7ff, z_exp, exp_diff;
+    uint64_t a_sig = (a & (uint64_t)0x000fffffffffffff) << 9;
+    uint64_t b_sig = (b & (uint64_t)0x000fffffffffffff) << 9;
+    uint64_t z_sig;
+    exp_diff = a_exp - b_exp;
+    if(exp_diff > 0){
+        if(a_exp == 0x7ff){
+            return a;
+        }
+        if(b_exp == 0){
+            exp_diff--;
+        }else{
+            b_sig |= (uint64_t)0x2000000000000000;
+        }
+        b_sig = softfloat_shift64_right_jamming(b_sig, exp_diff);
+        z_exp = a_exp;
+    }else if(exp_diff < 0){
+        if(b_exp == 0x7ff){
+            return softfloat_f64_pack(z_sign, 0x7ff, 0);
+        }
+        if(a_exp == 0){
+            exp_diff++;
+        }else{
+            a_sig |= (uint64_t)0x2000000000000000;
+        }
+        a_sig = softfloat_shift64_right_jamming(a_sig, -exp_diff);
+        z_exp = b_exp;
+    }else{
+        if(a_exp == 0x7ff){
+            return a;
+        }
+        if(a_exp == 0){
+            return softfloat_f64_pack(z_sign, 0, (a_sig + b_sig) >> 9);
+        }
+        z_sig = (uint64_t)0x4000000000000000 + a_sig + b_sig;
+        return softfloat_f64_round_pack(ctxp, z_sign, a_exp, z_sig);
+    }
+    a_sig |= (uint64_t)0x2000000000000000;
+    z_sig = (a_sig + b_sig) << 1;
+    z_exp--;
+    if((int64_t)z_sig < 0){
+        z_sig = a_sig + b_sig;
+        z_exp++;
+    }
+    return softfloat_f64_round_pack(ctxp, z_sign, z_exp, z_sig);
+}
+
+uint64_t
+softfloat_f64_sub_sigs(softfloat_ctx_t* ctxp, uint64_t a, uint64_t b, uint8_t z_sign){
+    int32_t a_exp = (a >> 52) & 0x7ff, b_exp = (b >> 52) & 0x7ff, z_exp, exp_diff;
+    uint64_t a_sig = (a & (uint64_t)0x000fffffffffffff) << 10;
+    uint64_t b_sig = (b & (uint64_t)0x000fffffffffffff) << 10;
+    uint64_t z_sig;
+    exp_diff = a_exp - b_exp;
+    if(exp_diff > 0){
+        if(a_exp == 0x7ff){
+            return a;
+        }
+        if(b_exp == 0){
+            exp_diff--;
+        }else{
+            b_sig |= (uint64_t)0x4000000000000000;
+        }
+        b_sig = softfloat_shift64_right_jamming(b_sig, exp_diff);
+        a_sig |= (uint64_t)0x4000000000000000;
+        goto A_BIGGER;
+    }
+    if(exp_diff < 0){
+        if(b_exp == 0x7ff){
+            return softfloat_f64_pack(z_sign ^ 1, 0x7ff, 0);
+        }
+        if(a_exp == 0){
+            exp_diff++;
+        }else{
+            a_sig |= (uint64_t)0x4000000000000000;
+        }
+        a_sig = softfloat_shift64_right_jamming(a_sig, -exp_diff);
+        b_sig |= (uint64_t)0x4000000000000000;
+        goto B_BIGGER;
+    }
+    if(a_exp == 0x7ff){
+        ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        return SOFTFLOAT_F64_DEFAULT_NAN;
+    }
+    if(a_exp == 0){
+        a_exp = 1;
+        b_exp = 1;
+    }
+    if(b_sig < a_sig){
+        goto A_BIGGER;
+    }
+    if(a_sig < b_sig){
+        goto B_BIGGER;
+    }
+    return softfloat_f64_pack(ctxp->round_mode == SOFTFLOAT_ROUND_MINUS_INF, 0, 0);
+
+    B_BIGGER:;
+    z_sig = b_sig - a_sig;
+    z_exp = b_exp;
+    z_sign ^= 1;
+    return softfloat_f64_normalize_round_pack(ctxp, z_sign, z_exp - 1, z_sig);
+
+    A_BIGGER:;
+    z_sig = a_sig - b_sig;
+    z_exp = a_exp;
+    return softfloat_f64_normalize_round_pack(ctxp, z_sign, z_exp - 1, z_sig);
+}
+
+uint64_t
+softfloat_f64_add(softfloat_ctx_t* ctxp, uint64_t a, uint64_t b){
+    a = softfloat_f64_flush_input(ctxp, a);
+    b = softfloat_f64_flush_input(ctxp, b);
+    if(softfloat_f64_is_nan(a) || softfloat_f64_is_nan(b)){
+        return softfloat_f64_propagate_nan(ctxp, a, b);
+    }
+    if((a >> 63) == (b >> 63)){
+        return softfloat_f64_add_sigs(ctxp, a, b, a >> 63);
+    }
+    return softfloat_f64_sub_sigs(ctxp, a, b, a >> 63);
+}
+
+uint64_t
+softfloat_f64_sub(softfloat_ctx_t* ctxp, uint64_t a, uint64_t b){
+    a = softfloat_f64_flush_input(ctxp, a);
+    b = softfloat_f64_flush_input(ctxp, b);
+    if(softfloat_f64_is_nan(a) || softfloat_f64_is_nan(b)){
+        return softfloat_f64_propagate_nan(ctxp, a, b);
+    }
+    if((a >> 63) == (b >> 63)){
+        return softfloat_f64_sub_sigs(ctxp, a, b, a >> 63);
+    }
+    return softfloat_f64_add_sigs(ctxp, a, b, a >> 63);
+}
+
+uint64_t
+softfloat_f64_mul(softfloat_ctx_t* ctxp, uint64_t a, uint64_t b){
+    int32_t a_exp, b_exp, z_exp;
+    uint64_t a_sig, b_sig, z_sig, z_sig_lo;
+    uint8_t z_sign;
+    a = softfloat_f64_flush_input(ctxp, a);
+    b = softfloat_f64_flush_input(ctxp, b);
+    if(softfloat_f64_is_nan(a) || softfloat_f64_is_nan(b)){
+        return softfloat_f64_propagate_nan(ctxp, a, b);
+    }
+    a_exp = (a >> 52) & 0x7ff;
+    b_exp = (b >> 52) & 0x7ff;
+    a_sig = a & (uint64_t)0x000fffffffffffff;
+    b_sig = b & (uint64_t)0x000fffffffffffff;
+    z_sign = (a ^ b) >> 63;
+    if(a_exp == 0x7ff || b_exp == 0x7ff){
+        if((a_exp == 0 && a_sig == 0) || (b_exp == 0 && b_sig == 0)){
+            ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+            return SOFTFLOAT_F64_DEFAULT_NAN;
+        }
+        return softfloat_f64_pack(z_sign, 0x7ff, 0);
+    }
+    if(a_exp == 0){
+        if(a_sig == 0){
+            return softfloat_f64_pack(z_sign, 0, 0);
+        }
+        softfloat_f64_normalize_subnormal(a_sig, &a_exp, &a_sig);
+    }
+    if(b_exp == 0){
+        if(b_sig == 0){
+            return softfloat_f64_pack(z_sign, 0, 0);
+        }
+        softfloat_f64_normalize_subnormal(b_sig, &b_exp, &b_sig);
+    }
+    z_exp = a_exp + b_exp - 0x3ff;
+    a_sig = (a_sig | (uint64_t)0x0010000000000000) << 10;
+    b_sig = (b_sig | (uint64_t)0x0010000000000000) << 11;
+    softfloat_mul64_to_128(a_sig, b_sig, &z_sig, &z_sig_lo);
+    z_sig |= (uint64_t)(z_sig_lo != 0);
+    if((int64_t)(z_sig << 1) >= 0){
+        z_sig <<= 1;
+        z_exp--;
+    }
+    return softfloat_f64_round_pack(ctxp, z_sign, z_exp, z_sig);
+}
+
+uint64_t
+softfloat_f64_div(softfloat_ctx_t* ctxp, uint64_t a, uint64_t b){
+    int32_t a_exp, b_exp, z_exp;
+    uint64_t a_sig, b_sig;
+    uint8_t z_sign;
+    a = softfloat_f64_flush_input(ctxp, a);
+    b = softfloat_f64_flush_input(ctxp, b);
+    if(softfloat_f64_is_nan(a) || softfloat_f64_is_nan(b)){
+        return softfloat_f64_propagate_nan(ctxp, a, b);
+    }
+    a_exp = (a >> 52) & 0x7ff;
+    b_exp = (b >> 52) & 0x7ff;
+    a_sig = a & (uint64_t)0x000fffffffffffff;
+    b_sig = b & (uint64_t)0x000fffffffffffff;
+    z_sign = (a ^ b) >> 63;
+    if(a_exp == 0x7ff){
+        if(b_exp == 0x7ff){
+            ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+            return SOFTFLOAT_F64_DEFAULT_NAN;
+        }
+        return softfloat_f64_pack(z_sign, 0x7ff, 0);
+    }
+    if(b_exp == 0x7ff){
+        return softfloat_f64_pack(z_sign, 0, 0);
+    }
+    if(b_exp == 0){
+        if(b_sig == 0){
+            if(a_exp == 0 && a_sig == 0){
+                ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+                return SOFTFLOAT_F64_DEFAULT_NAN;
+            }
+            ctxp->flags |= SOFTFLOAT_FLAG_DIVBYZERO;
+            return softfloat_f64_pack(z_sign, 0x7ff, 0);
+        }
+        softfloat_f64_normalize_subnormal(b_sig, &b_exp, &b_sig);
+    }
+    if(a_exp == 0){
+        if(a_sig == 0){
+            return softfloat_f64_pack(z_sign, 0, 0);
+        }
+        softfloat_f64_normalize_subnormal(a_sig, &a_exp, &a_sig);
+    }
+    z_exp = a_exp - b_exp + 0x3fd;
+    a_sig = (a_sig | (uint64_t)0x0010000000000000) << 10;
+    b_sig = (b_sig | (uint64_t)0x0010000000000000) << 11;
+    if(b_sig <= a_sig + a_sig){
+        a_sig >>= 1;
+        z_exp++;
+    }
+    return softfloat_f64_round_pack(ctxp, z_sign, z_exp, softfloat_div128_by_64(a_sig, b_sig));
+}
+
+uint64_t
+softfloat_f64_sqrt(softfloat_ctx_t* ctxp, uint64_t a){
+    int32_t a_exp, exp;
+    uint64_t a_sig;
+    a = softfloat_f64_flush_input(ctxp, a);
+    if(softfloat_f64_is_nan(a)){
+        return softfloat_f64_propagate_nan(ctxp, a, a);
+    }
+    a_exp = (a >> 52) & 0x7ff;
+    a_sig = a & (uint64_t)0x000fffffffffffff;
+    if(a_exp == 0 && a_sig == 0){
+        return a;
+    }
+    if(a >> 63){
+        ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        return SOFTFLOAT_F64_DEFAULT_NAN;
+    }
+    if(a_exp == 0x7ff){
+        return a;
+    }
+    if(a_exp == 0){
+        softfloat_f64_normalize_subnormal(a_sig, &a_exp, &a_sig);
+    }
+    // a = sig * 2^(exp - 52), the radicand is sig << 72, the root gets its leading bit at 62
+    a_sig |= (uint64_t)0x0010000000000000;
+    exp = a_exp - 0x3ff;
+    if(exp & 1){
+        a_sig <<= 1;
+        exp--;
+    }
+    return softfloat_f64_round_pack(ctxp, 0, exp / 2 + 0x3fe, softfloat_sqrt128(a_sig << 8, 0));
+}
+
+uint8_t
+softfloat_f64_compare(softfloat_ctx_t* ctxp, uint64_t a, uint64_t b, uint8_t signaling_flag){
+    a = softfloat_f64_flush_input(ctxp, a);
+    b = softfloat_f64_flush_input(ctxp, b);
+    if(softfloat_f64_is_nan(a) || softfloat_f64_is_nan(b)){
+        if(signaling_flag || softfloat_f64_is_snan(a) || softfloat_f64_is_snan(b)){
+            ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        }
+        return SOFTFLOAT_CMP_UNORDERED;
+    }
+    if(a == b || ((a | b) << 1) == 0){
+        return SOFTFLOAT_CMP_EQUAL;
+    }
+    if((a >> 63) != (b >> 63)){
+        return (a >> 63) ? SOFTFLOAT_CMP_LESS : SOFTFLOAT_CMP_GREATER;
+    }
+    return ((a < b) ^ (uint8_t)(a >> 63)) ? SOFTFLOAT_CMP_LESS : SOFTFLOAT_CMP_GREATER;
+}
+
+// exact
+uint64_t
+softfloat_f64_from_i32(uint32_t a){
+    uint8_t sign = a >> 31;
+    uint32_t abs = sign ? 0 - a : a;
+    uint8_t shift;
+    if(a == 0){
+        return 0;
+    }
+    shift = softfloat_clz32(abs) + 21;
+    return softfloat_f64_pack(sign, 0x432 - shift, (uint64_t)abs << shift);
+}
+
+// exact
+uint64_t
+softfloat_f64_from_u32(uint32_t a){
+    uint8_t shift;
+    if(a == 0){
+        return 0;
+    }
+    shift = softfloat_clz32(a) + 21;
+    return softfloat_f64_pack(0, 0x432 - shift, (uint64_t)a << shift);
+}
+
+// FTOSI/FTOUI: a NaN is 0 and an out of range value saturates, both invalid and not inexact
+// ret u32: the integer, of two's complement if signed_flag is set
+uint32_t
+softfloat_f64_to_int32(softfloat_ctx_t* ctxp, uint64_t a, uint8_t round_mode,
+    uint8_t signed_flag){
+
+    int32_t exp;
+    uint64_t sig, fixed, mag, inc = 0;
+    uint32_t frac;
+    uint8_t sign;
+    a = softfloat_f64_flush_input(ctxp, a);
+    if(softfloat_f64_is_nan(a)){
+        ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        return 0;
+    }
+    sign = a >> 63;
+    exp = (a >> 52) & 0x7ff;
+    sig = a & (uint64_t)0x000fffffffffffff;
+    if(exp >= 0x41f){ // |a| >= 2^32
+        mag = (uint64_t)1 << 32;
+        goto SATURATE;
+    }
+    if(exp){
+        sig |= (uint64_t)0x0010000000000000;
+    }
+    // 32.32 fixed point
+    fixed = softfloat_shift64_right_jamming(sig << 11, 0x41e - exp);
+    frac = (uint32_t)fixed;
+    mag = fixed >> 32;
+    if(round_mode == SOFTFLOAT_ROUND_NEAREST_EVEN){
+        inc = frac > (uint32_t)0x80000000 || (frac == (uint32_t)0x80000000 && (mag & 1));
+    }else if(round_mode == SOFTFLOAT_ROUND_PLUS_INF){
+        inc = frac && !sign;
+    }else if(round_mode == SOFTFLOAT_ROUND_MINUS_INF){
+        inc = frac && sign;
+    }
+    mag += inc;
+    if(signed_flag){
+        if(mag > (sign ? (uint64_t)0x80000000 : (uint64_t)0x7fffffff)){
+            goto SATURATE;
+        }
+    }else if(mag > (uint64_t)0xffffffff || (sign && mag)){
+        goto SATURATE;
+    }
+    if(frac){
+        ctxp->flags |= SOFTFLOAT_FLAG_INEXACT;
+    }
+    return sign ? 0 - (uint32_t)mag : (uint32_t)mag;
+
+    SATURATE:;
+    ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+    if(signed_flag){
+        return sign ? (uint32_t)0x80000000 : (uint32_t)0x7fffffff;
+    }
+    return sign ? 0 : (uint32_t)0xffffffff;
+}
+
+// ** conversions between the formats **
+
+uint64_t
+softfloat_f32_to_f64(softfloat_ctx_t* ctxp, uint32_t a){
+    int32_t exp;
+    uint32_t sig;
+    uint8_t sign;
+    a = softfloat_f32_flush_input(ctxp, a);
+    sign = a >> 31;
+    exp = (a >> 23) & 0xff;
+    sig = a & (uint32_t)0x007fffff;
+    if(softfloat_f32_is_nan(a)){
+        if(softfloat_f32_is_snan(a)){
+            ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        }
+        if(ctxp->default_nan_flag){
+            return SOFTFLOAT_F64_DEFAULT_NAN;
+        }
+        return softfloat_f64_pack(sign, 0x7ff, (uint64_t)0x0008000000000000 | (uint64_t)sig << 29);
+    }
+    if(exp == 0xff){
+        return softfloat_f64_pack(sign, 0x7ff, 0);
+    }
+    if(exp == 0){
+        if(sig == 0){
+            return softfloat_f64_pack(sign, 0, 0);
+        }
+        softfloat_f32_normalize_subnormal(sig, &exp, &sig);
+        exp--; // the leading bit of sig is added to the exponent by the pack
+    }
+    return softfloat_f64_pack(sign, exp + 0x380, (uint64_t)sig << 29);
+}
+
+uint32_t
+softfloat_f64_to_f32(softfloat_ctx_t* ctxp, uint64_t a){
+    int32_t exp;
+    uint64_t sig;
+    uint32_t z_sig;
+    uint8_t sign;
+    a = softfloat_f64_flush_input(ctxp, a);
+    sign = a >> 63;
+    exp = (a >> 52) & 0x7ff;
+    sig = a & (uint64_t)0x000fffffffffffff;
+    if(softfloat_f64_is_nan(a)){
+        if(softfloat_f64_is_snan(a)){
+            ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        }
+        if(ctxp->default_nan_flag){
+            return SOFTFLOAT_F32_DEFAULT_NAN;
+        }
+        return softfloat_f32_pack(sign, 0xff, (uint32_t)0x00400000 | (uint32_t)(sig >> 29));
+    }
+    if(exp == 0x7ff){
+        return softfloat_f32_pack(sign, 0xff, 0);
+    }
+    z_sig = (uint32_t)softfloat_shift64_right_jamming(sig, 22);
+    if(exp || z_sig){
+        z_sig |= (uint32_t)0x40000000;
+        exp -= 0x381;
+    }
+    return softfloat_f32_round_pack(ctxp, sign, exp, z_sig);
+}
+
+// always_inline
+inline uint32_t
+softfloat_f32_to_int32(softfloat_ctx_t* ctxp, uint32_t a, uint8_t round_mode,
+    uint8_t signed_flag){
+
+    a = softfloat_f32_flush_input(ctxp, a);
+    if(softfloat_f32_is_nan(a)){
+        ctxp->flags |= SOFTFLOAT_FLAG_INVALID;
+        return 0;
+    }
+    // the widening is exact and raises nothing
+    return softfloat_f64_to_int32(ctxp, softfloat_f32_to_f64(ctxp, a), round_mode, signed_flag);
+}
+
+#endif
@@ -0,0 +1,179 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** io event queue: min-heap of io device deadlines **
+// a deadline is a value of the cpu inst counter `inst_executed_ct_total`
+// every io device owns at most one pending event, indexed by its device id, so re-arming
+// or cancelling a device timer is O(log n) without any search
+// events with the same deadline are ordered by device id, which keeps the firing order
+// deterministic on every replica
+
+#ifndef IO_EVENT_QUEUE_MD_H
+#define IO_EVENT_QUEUE_MD_H
+
+#include<stdint.h>
+
+#define IO_EVENT_QUEUE_DEVICE_MAX       16
+#define IO_EVENT_QUEUE_POS_NONE         ((uint8_t)0xff)
+#define IO_EVENT_QUEUE_DEADLINE_NONE    ((uint64_t)0xffffffffffffffff)
+
+typedef struct {
+    uint64_t deadline[IO_EVENT_QUEUE_DEVICE_MAX];   // indexed by device id
+    uint8_t pos[IO_EVENT_QUEUE_DEVICE_MAX];         // device id -> heap idx
+    uint8_t heap[IO_EVENT_QUEUE_DEVICE_MAX];        // heap idx -> device id
+    uint8_t len;
+
+    // temp bellow
+    // called when the earliest deadline moves earlier, so that the running cpu could cut
+    // its inst budget
+    void (*head_moved_earlier_cb)(void* cb_arg, uint64_t deadline);
+    void* cb_arg;
+} io_event_queue_t;
+
+// always_inline
+inline void
+io_event_queue_init(io_event_queue_t* eqp){
+    uint8_t i;
+    for(i = 0; i < IO_EVENT_QUEUE_DEVICE_MAX; i++){
+        eqp->deadline[i] = IO_EVENT_QUEUE_DEADLINE_NONE;
+        eqp->pos[i] = IO_EVENT_QUEUE_POS_NONE;
+    }
+    eqp->len = 0;
+    eqp->head_moved_earlier_cb = 0;
+    eqp->cb_arg = 0;
+}
+
+// ret u8: 1 if event of device a should fire before the one of device b
+// always_inline
+inline uint8_t
+io_event_queue_is_before(io_event_queue_t* eqp, uint8_t a, uint8_t b){
+    if(eqp->deadline[a] != eqp->deadline[b]){
+        return eqp->deadline[a] < eqp->deadline[b];
+    }
+    return a < b;
+}
+
+// always_inline
+inline void
+io_event_queue_swap(io_event_queue_t* eqp, uint8_t i, uint8_t j){
+    uint8_t a = eqp->heap[i];
+    uint8_t b = eqp->heap[j];
+    eqp->heap[i] = b;
+    eqp->heap[j] = a;
+    eqp->pos[b] = i;
+    eqp->pos[a] = j;
+}
+
+// always_inline
+inline void
+io_event_queue_sift_up(io_event_queue_t* eqp, uint8_t i){
+    while(i > 0){
+        uint8_t parent = (i - 1) >> 1;
+        if(io_event_queue_is_before(eqp, eqp->heap[i], eqp->heap[parent])){
+            io_event_queue_swap(eqp, i, parent);
+            i = parent;
+        }else{
+            break;
+        }
+    }
+}
+
+// always_inline
+inline void
+io_event_queue_sift_down(io_event_queue_t* eqp, uint8_t i){
+    for(;;){
+        uint8_t l = (i << 1) + 1;
+        uint8_t r = l + 1;
+        uint8_t min = i;
+        if(l < eqp->len && io_event_queue_is_before(eqp, eqp->heap[l], eqp->heap[min])){
+            min = l;
+        }
+        if(r < eqp->len && io_event_queue_is_before(eqp, eqp->heap[r], eqp->heap[min])){
+            min = r;
+        }
+        if(min == i){
+            break;
+        }
+        io_event_queue_swap(eqp, i, min);
+        i = min;
+    }
+}
+
+// ret: earliest deadline or IO_EVENT_QUEUE_DEADLINE_NONE if the queue is empty
+// always_inline
+inline uint64_t
+io_event_queue_peek_deadline(io_event_queue_t* eqp){
+    if(eqp->len == 0){
+        return IO_EVENT_QUEUE_DEADLINE_NONE;
+    }
+    return eqp->deadline[eqp->heap[0]];
+}
+
+// always_inline
+inline void
+io_event_queue_cancel(io_event_queue_t* eqp, uint8_t dev_id){
+    uint8_t i = eqp->pos[dev_id];
+    if(i == IO_EVENT_QUEUE_POS_NONE){
+        return;
+    }
+    eqp->len--;
+    if(i != eqp->len){
+        uint8_t moved;
+        io_event_queue_swap(eqp, i, eqp->len);
+        moved = eqp->heap[i];
+        io_event_queue_sift_up(eqp, i);
+        io_event_queue_sift_down(eqp, eqp->pos[moved]);
+    }
+    eqp->pos[dev_id] = IO_EVENT_QUEUE_POS_NONE;
+    eqp->deadline[dev_id] = IO_EVENT_QUEUE_DEADLINE_NONE;
+}
+
+// arm (or re-arm) the event of device dev_id
+// always_inline
+inline void
+io_event_queue_set(io_event_queue_t* eqp, uint8_t dev_id, uint64_t deadline){
+    uint64_t old_head = io_event_queue_peek_deadline(eqp);
+    uint8_t i = eqp->pos[dev_id];
+    if(i == IO_EVENT_QUEUE_POS_NONE){
+        i = eqp->len;
+        eqp->len++;
+        eqp->heap[i] = dev_id;
+        eqp->pos[dev_id] = i;
+        eqp->deadline[dev_id] = deadline;
+        io_event_queue_sift_up(eqp, i);
+    }else{
+        eqp->deadline[dev_id] = deadline;
+        io_event_queue_sift_up(eqp, i);
+        io_event_queue_sift_down(eqp, eqp->pos[dev_id]);
+    }
+    if(deadline < old_head && eqp->head_moved_earlier_cb){
+        eqp->head_moved_earlier_cb(eqp->cb_arg, deadline);
+    }
+}
+
+// pop the earliest event if its deadline <= now
+// ret: device id or IO_EVENT_QUEUE_POS_NONE if no event is due
+// always_inline
+inline uint8_t
+io_event_queue_pop_due(io_event_queue_t* eqp, uint64_t now){
+    uint8_t dev_id;
+    if(eqp->len == 0 || eqp->deadline[eqp->heap[0]] > now){
+        return IO_EVENT_QUEUE_POS_NONE;
+    }
+    dev_id = eqp->heap[0];
+    io_event_queue_cancel(eqp, dev_id);
+    return dev_id;
+}
+
+#endif
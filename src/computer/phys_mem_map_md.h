@@ -0,0 +1,475 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** physical memory map **
+// every 4KB page of the physical address space is classified as
+//  RAM:      ram_hostp points to the host memory of this page, never reaches the device path
+//  MMIO:     mmiop points to the register handler table of the device of this page
+//  unmapped: both NULL, the access aborts
+//
+// a RAM page whose ram_write_hostp is NULL is write protected. A store to it, and any access
+// to an unmapped page, goes to the fault_cb of the map (if any) before it aborts, which is
+// how the private views of the vCPUs in SMP mode are built (see turingcell_smp_md.h)
+//
+// a RAM page whose code bit is set may have insts cached by the cpu (see the predecode cache
+// of armv4cpu_md.c). Every write to such a page, from the cpu or from a device, reports the
+// written range to the code_write_cb of the map, so only the entries of that range are
+// dropped. A store to a page without the bit stays on the fast path, it only tests one bit
+// of a small bitmap. The bit is sticky until the map is initialized again
+//
+// the guest memory is little-endian, the byte order is composed explicitly so that the
+// result never depends on the host
+
+#ifndef PHYS_MEM_MAP_MD_H
+#define PHYS_MEM_MAP_MD_H
+
+#include<stdint.h>
+#include<string.h>
+#include "../io_device/io_device_md.h"
+
+#ifndef if_likely
+#define if_likely(x)    if(__builtin_expect(!!(x), 1))
+#define if_unlikely(x)  if(__builtin_expect(!!(x), 0))
+#endif
+
+#define PHYS_MEM_PAGE_SHIFT     12
+#define PHYS_MEM_PAGE_SIZE      ((uint32_t)1 << PHYS_MEM_PAGE_SHIFT)
+#define PHYS_MEM_PAGE_MASK      (PHYS_MEM_PAGE_SIZE - 1)
+#define PHYS_MEM_MAP_SPAN       ((uint32_t)0x20000000)  // [0, 512MB) could be mapped
+#define PHYS_MEM_MAP_PAGE_CT    (PHYS_MEM_MAP_SPAN >> PHYS_MEM_PAGE_SHIFT)
+
+typedef struct {
+    uint8_t* ram_hostp;
+    uint8_t* ram_write_hostp;   // equals to ram_hostp | NULL if write protected
+    io_device_mmio_table_t* mmiop;
+} phys_mem_page_t;
+
+// ret u8: 1 if the page has been fixed up and the access should be retried | 0 if it aborts
+typedef uint8_t (*phys_mem_map_fault_cb_t)(void* cb_arg, phys_mem_page_t* pagep, uint32_t paddr);
+
+// [paddr, paddr + len) has been written, it never crosses a page
+typedef void (*phys_mem_map_code_write_cb_t)(void* cb_arg, uint32_t paddr, uint32_t len);
+
+typedef struct {
+    phys_mem_page_t pages[PHYS_MEM_MAP_PAGE_CT];    // indexed by page frame number
+    phys_mem_map_fault_cb_t fault_cb;
+    void* fault_cb_arg;
+    uint32_t code_page_bits[PHYS_MEM_MAP_PAGE_CT >> 5]; // bit i for page frame number i
+    phys_mem_map_code_write_cb_t code_write_cb;
+    void* code_write_cb_arg;
+    // host time of every fault_cb call, NULL if not measured (see latency_histogram.h)
+    latency_histogram_t* fault_histp;
+} phys_mem_map_t;
+
+// always_inline
+inline void
+phys_mem_map_init(phys_mem_map_t* mapp){
+    uint32_t i;
+    for(i = 0; i < PHYS_MEM_MAP_PAGE_CT; i++){
+        mapp->pages[i].ram_hostp = 0;
+        mapp->pages[i].ram_write_hostp = 0;
+        mapp->pages[i].mmiop = 0;
+    }
+    mapp->fault_cb = 0;
+    mapp->fault_cb_arg = 0;
+    memset(mapp->code_page_bits, 0, sizeof(mapp->code_page_bits));
+    mapp->code_write_cb = 0;
+    mapp->code_write_cb_arg = 0;
+    mapp->fault_histp = 0;
+}
+
+// paddr and size must be page aligned
+// always_inline
+inline void
+phys_mem_map_add_ram(phys_mem_map_t* mapp, uint32_t paddr, uint32_t size, uint8_t* hostp){
+    uint32_t i;
+    for(i = 0; i < (size >> PHYS_MEM_PAGE_SHIFT); i++){
+        mapp->pages[(paddr >> PHYS_MEM_PAGE_SHIFT) + i].ram_hostp = hostp + (i << PHYS_MEM_PAGE_SHIFT);
+        mapp->pages[(paddr >> PHYS_MEM_PAGE_SHIFT) + i].ram_write_hostp = hostp + (i << PHYS_MEM_PAGE_SHIFT);
+        mapp->pages[(paddr >> PHYS_MEM_PAGE_SHIFT) + i].mmiop = 0;
+    }
+}
+
+// paddr must be page aligned
+// always_inline
+inline void
+phys_mem_map_add_mmio(phys_mem_map_t* mapp, uint32_t paddr, io_device_t* devp){
+    mapp->pages[paddr >> PHYS_MEM_PAGE_SHIFT].ram_hostp = 0;
+    mapp->pages[paddr >> PHYS_MEM_PAGE_SHIFT].ram_write_hostp = 0;
+    mapp->pages[paddr >> PHYS_MEM_PAGE_SHIFT].mmiop = &devp->mmio_table;
+}
+
+// ret u8: 1 if the access should be retried | 0 if it aborts
+// always_inline
+inline uint8_t
+phys_mem_map_fault(phys_mem_map_t* mapp, phys_mem_page_t* pagep, uint32_t paddr){
+    uint64_t t0;
+    uint8_t ret;
+    if(mapp->fault_cb == 0){
+        return 0;
+    }
+    t0 = latency_histogram_probe_begin(mapp->fault_histp);
+    ret = mapp->fault_cb(mapp->fault_cb_arg, pagep, paddr);
+    latency_histogram_probe_end(mapp->fault_histp, t0);
+    return ret;
+}
+
+// register access of the device of an mmio page
+// always_inline
+inline uint32_t
+phys_mem_map_mmio_read(io_device_mmio_table_t* mmiop, uint32_t paddr, uint64_t now){
+    uint32_t offset = paddr & PHYS_MEM_PAGE_MASK;
+    latency_histogram_t* histp = mmiop->devp->histp;
+    uint64_t t0;
+    uint32_t v;
+    if_likely(histp == 0){
+        return mmiop->read[IO_DEVICE_MMIO_REG_IDX(offset)](
+            mmiop->devp, now, offset & ((IO_DEVICE_MMIO_REG_CT << 2) - 1));
+    }
+    t0 = latency_histogram_ticks();
+    v = mmiop->read[IO_DEVICE_MMIO_REG_IDX(offset)](
+        mmiop->devp, now, offset & ((IO_DEVICE_MMIO_REG_CT << 2) - 1));
+    latency_histogram_record(histp, latency_histogram_ticks() - t0);
+    return v;
+}
+
+// always_inline
+inline void
+phys_mem_map_mmio_write(io_device_mmio_table_t* mmiop, uint32_t paddr, uint32_t u32, uint64_t now){
+    uint32_t offset = paddr & PHYS_MEM_PAGE_MASK;
+    latency_histogram_t* histp = mmiop->devp->histp;
+    uint64_t t0;
+    if_likely(histp == 0){
+        mmiop->write[IO_DEVICE_MMIO_REG_IDX(offset)](
+            mmiop->devp, now, offset & ((IO_DEVICE_MMIO_REG_CT << 2) - 1), u32);
+        return;
+    }
+    t0 = latency_histogram_ticks();
+    mmiop->write[IO_DEVICE_MMIO_REG_IDX(offset)](
+        mmiop->devp, now, offset & ((IO_DEVICE_MMIO_REG_CT << 2) - 1), u32);
+    latency_histogram_record(histp, latency_histogram_ticks() - t0);
+}
+
+// paddr must belong to the span
+// always_inline
+inline void
+phys_mem_map_code_page_mark(phys_mem_map_t* mapp, uint32_t paddr){
+    uint32_t pfn = paddr >> PHYS_MEM_PAGE_SHIFT;
+    mapp->code_page_bits[pfn >> 5] |= ((uint32_t)1) << (pfn & 31);
+}
+
+// paddr must belong to the span
+// always_inline
+inline void
+phys_mem_map_code_page_unmark(phys_mem_map_t* mapp, uint32_t paddr){
+    uint32_t pfn = paddr >> PHYS_MEM_PAGE_SHIFT;
+    mapp->code_page_bits[pfn >> 5] &= ~(((uint32_t)1) << (pfn & 31));
+}
+
+// paddr must belong to the span
+// ret u8: 1 if the page may have insts cached | 0 if not
+// always_inline
+inline uint8_t
+phys_mem_map_code_page_test(phys_mem_map_t* mapp, uint32_t paddr){
+    uint32_t pfn = paddr >> PHYS_MEM_PAGE_SHIFT;
+    return (mapp->code_page_bits[pfn >> 5] >> (pfn & 31)) & 1;
+}
+
+// report a write of [paddr, paddr + len) to the code_write_cb, page by page, for the pages
+// whose code bit is set
+// the range must have passed `phys_mem_map_ram_range_check`
+// always_inline
+inline void
+phys_mem_map_code_write(phys_mem_map_t* mapp, uint32_t paddr, uint32_t len){
+    uint32_t n;
+    while(len){
+        n = PHYS_MEM_PAGE_SIZE - (paddr & PHYS_MEM_PAGE_MASK);
+        if(n > len){
+            n = len;
+        }
+        if_unlikely(phys_mem_map_code_page_test(mapp, paddr) && mapp->code_write_cb){
+            mapp->code_write_cb(mapp->code_write_cb_arg, paddr, n);
+        }
+        paddr += n;
+        len -= n;
+    }
+}
+
+// always_inline
+inline uint32_t
+phys_mem_load_le32(uint8_t* p){
+    return ((uint32_t)p[0]) | (((uint32_t)p[1]) << 8) |
+        (((uint32_t)p[2]) << 16) | (((uint32_t)p[3]) << 24);
+}
+
+// always_inline
+inline void
+phys_mem_store_le32(uint8_t* p, uint32_t u32){
+    p[0] = (uint8_t)u32;
+    p[1] = (uint8_t)(u32 >> 8);
+    p[2] = (uint8_t)(u32 >> 16);
+    p[3] = (uint8_t)(u32 >> 24);
+}
+
+// ret: page of paddr, or NULL if paddr is out of the span
+// always_inline
+inline phys_mem_page_t*
+phys_mem_map_page(phys_mem_map_t* mapp, uint32_t paddr){
+    if_unlikely(paddr >= PHYS_MEM_MAP_SPAN){
+        return 0;
+    }
+    return &mapp->pages[paddr >> PHYS_MEM_PAGE_SHIFT];
+}
+
+// ret: host address of paddr, or NULL if paddr is not in RAM
+// always_inline
+inline uint8_t*
+phys_mem_map_ram_hostp(phys_mem_map_t* mapp, uint32_t paddr){
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    if(pagep == 0 || pagep->ram_hostp == 0){
+        return 0;
+    }
+    return pagep->ram_hostp + (paddr & PHYS_MEM_PAGE_MASK);
+}
+
+// ret: host address of paddr for a write of a device inside its page, paddr must be RAM.
+//  A write protected page is shown to the fault_cb first, like a store of the cpu, but the
+//  device always writes the RAM of the computer itself
+// always_inline
+inline uint8_t*
+phys_mem_map_ram_write_hostp(phys_mem_map_t* mapp, uint32_t paddr){
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    if_unlikely(pagep->ram_write_hostp == 0){
+        phys_mem_map_fault(mapp, pagep, paddr);
+    }
+    return pagep->ram_hostp + (paddr & PHYS_MEM_PAGE_MASK);
+}
+
+// ret: host address of paddr for a direct access of the cpu inside its page, or NULL if
+//  paddr is not in RAM. A write access gets a write protected page fixed up by the fault_cb
+//  first (NULL if it could not be)
+// always_inline
+inline uint8_t*
+phys_mem_map_ram_access_hostp(phys_mem_map_t* mapp, uint32_t paddr, uint8_t write_flag){
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    if(pagep == 0 || pagep->ram_hostp == 0){
+        return 0;
+    }
+    if(write_flag){
+        if(pagep->ram_write_hostp == 0 && !phys_mem_map_fault(mapp, pagep, paddr)){
+            return 0;
+        }
+        // the caller may write up to the end of the page
+        phys_mem_map_code_write(mapp, paddr, PHYS_MEM_PAGE_SIZE - (paddr & PHYS_MEM_PAGE_MASK));
+        return pagep->ram_write_hostp + (paddr & PHYS_MEM_PAGE_MASK);
+    }
+    return pagep->ram_hostp + (paddr & PHYS_MEM_PAGE_MASK);
+}
+
+// ret u8: 1 if [paddr, paddr + len) is all RAM | 0 if not
+// always_inline
+inline uint8_t
+phys_mem_map_ram_range_check(phys_mem_map_t* mapp, uint32_t paddr, uint32_t len){
+    uint32_t page_paddr;
+    if(len == 0){
+        return 1;
+    }
+    if(paddr + len < paddr){
+        return 0;
+    }
+    for(page_paddr = paddr & (~PHYS_MEM_PAGE_MASK); page_paddr < paddr + len;
+        page_paddr += PHYS_MEM_PAGE_SIZE){
+        if(phys_mem_map_ram_hostp(mapp, page_paddr) == 0){
+            return 0;
+        }
+        if(page_paddr + PHYS_MEM_PAGE_SIZE < page_paddr){
+            break;
+        }
+    }
+    return 1;
+}
+
+// copy between the guest RAM and the host, page by page
+// the range must have passed `phys_mem_map_ram_range_check`
+// always_inline
+inline void
+phys_mem_map_ram_copy_out(phys_mem_map_t* mapp, uint32_t paddr, uint8_t* dst, uint32_t len){
+    uint32_t n;
+    while(len){
+        n = PHYS_MEM_PAGE_SIZE - (paddr & PHYS_MEM_PAGE_MASK);
+        if(n > len){
+            n = len;
+        }
+        memcpy(dst, phys_mem_map_ram_hostp(mapp, paddr), n);
+        paddr += n;
+        dst += n;
+        len -= n;
+    }
+}
+
+// always_inline
+inline void
+phys_mem_map_ram_copy_in(phys_mem_map_t* mapp, uint32_t paddr, const uint8_t* src, uint32_t len){
+    uint32_t n;
+    while(len){
+        n = PHYS_MEM_PAGE_SIZE - (paddr & PHYS_MEM_PAGE_MASK);
+        if(n > len){
+            n = len;
+        }
+        memcpy(phys_mem_map_ram_write_hostp(mapp, paddr), src, n);
+        phys_mem_map_code_write(mapp, paddr, n);
+        paddr += n;
+        src += n;
+        len -= n;
+    }
+}
+
+// inst could only be fetched from RAM
+// paddr must be 4 bytes aligned, *abort_flagp is set to 1 if the access aborts
+// always_inline
+inline uint32_t
+phys_mem_map_fetch_4bytes(phys_mem_map_t* mapp, uint32_t paddr, uint8_t* abort_flagp){
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    if_likely(pagep && pagep->ram_hostp){
+        return phys_mem_load_le32(pagep->ram_hostp + (paddr & PHYS_MEM_PAGE_MASK));
+    }
+    *abort_flagp = 1;
+    return 0;
+}
+
+// paddr must be 4 bytes aligned
+// always_inline
+inline uint32_t
+phys_mem_map_read_4bytes(phys_mem_map_t* mapp, uint32_t paddr, uint64_t now, uint8_t* abort_flagp){
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    if_likely(pagep && pagep->ram_hostp){
+        return phys_mem_load_le32(pagep->ram_hostp + (paddr & PHYS_MEM_PAGE_MASK));
+    }
+    if_likely(pagep && pagep->mmiop){
+        return phys_mem_map_mmio_read(pagep->mmiop, paddr, now);
+    }
+    if(pagep && phys_mem_map_fault(mapp, pagep, paddr)){
+        return phys_mem_map_read_4bytes(mapp, paddr, now, abort_flagp);
+    }
+    *abort_flagp = 1;
+    return 0;
+}
+
+// paddr must be 4 bytes aligned
+// always_inline
+inline void
+phys_mem_map_write_4bytes(phys_mem_map_t* mapp, uint32_t paddr, uint32_t u32,
+    uint64_t now, uint8_t* abort_flagp){
+
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    if_likely(pagep && pagep->ram_write_hostp){
+        phys_mem_store_le32(pagep->ram_write_hostp + (paddr & PHYS_MEM_PAGE_MASK), u32);
+        if_unlikely(phys_mem_map_code_page_test(mapp, paddr)){
+            phys_mem_map_code_write(mapp, paddr, 4);
+        }
+        return;
+    }
+    if_likely(pagep && pagep->mmiop){
+        phys_mem_map_mmio_write(pagep->mmiop, paddr, u32, now);
+        return;
+    }
+    if(pagep && phys_mem_map_fault(mapp, pagep, paddr)){
+        phys_mem_map_write_4bytes(mapp, paddr, u32, now, abort_flagp);
+        return;
+    }
+    *abort_flagp = 1;
+}
+
+// a halfword access to a device register reads the whole register / writes the
+// zero-extended halfword to it
+// paddr must be 2 bytes aligned
+// always_inline
+inline uint16_t
+phys_mem_map_read_2bytes(phys_mem_map_t* mapp, uint32_t paddr, uint64_t now, uint8_t* abort_flagp){
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    uint8_t* p;
+    if_likely(pagep && pagep->ram_hostp){
+        p = pagep->ram_hostp + (paddr & PHYS_MEM_PAGE_MASK);
+        return ((uint16_t)p[0]) | (((uint16_t)p[1]) << 8);
+    }
+    return (uint16_t)(phys_mem_map_read_4bytes(mapp, paddr & (~(uint32_t)3), now, abort_flagp)
+        >> ((paddr & 2) << 3));
+}
+
+// paddr must be 2 bytes aligned
+// always_inline
+inline void
+phys_mem_map_write_2bytes(phys_mem_map_t* mapp, uint32_t paddr, uint16_t u16,
+    uint64_t now, uint8_t* abort_flagp){
+
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    uint8_t* p;
+    if_likely(pagep && pagep->ram_write_hostp){
+        p = pagep->ram_write_hostp + (paddr & PHYS_MEM_PAGE_MASK);
+        p[0] = (uint8_t)u16;
+        p[1] = (uint8_t)(u16 >> 8);
+        if_unlikely(phys_mem_map_code_page_test(mapp, paddr)){
+            phys_mem_map_code_write(mapp, paddr, 2);
+        }
+        return;
+    }
+    if(pagep && pagep->ram_hostp){ // write protected
+        if(phys_mem_map_fault(mapp, pagep, paddr)){
+            phys_mem_map_write_2bytes(mapp, paddr, u16, now, abort_flagp);
+        }else{
+            *abort_flagp = 1;
+        }
+        return;
+    }
+    phys_mem_map_write_4bytes(mapp, paddr & (~(uint32_t)3), (uint32_t)u16, now, abort_flagp);
+}
+
+// a byte access to a device register reads the whole register / writes the zero-extended
+// byte to it
+// always_inline
+inline uint8_t
+phys_mem_map_read_1byte(phys_mem_map_t* mapp, uint32_t paddr, uint64_t now, uint8_t* abort_flagp){
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    if_likely(pagep && pagep->ram_hostp){
+        return pagep->ram_hostp[paddr & PHYS_MEM_PAGE_MASK];
+    }
+    return (uint8_t)(phys_mem_map_read_4bytes(mapp, paddr & (~(uint32_t)3), now, abort_flagp)
+        >> ((paddr & 3) << 3));
+}
+
+// always_inline
+inline void
+phys_mem_map_write_1byte(phys_mem_map_t* mapp, uint32_t paddr, uint8_t u8,
+    uint64_t now, uint8_t* abort_flagp){
+
+    phys_mem_page_t* pagep = phys_mem_map_page(mapp, paddr);
+    if_likely(pagep && pagep->ram_write_hostp){
+        pagep->ram_write_hostp[paddr & PHYS_MEM_PAGE_MASK] = u8;
+        if_unlikely(phys_mem_map_code_page_test(mapp, paddr)){
+            phys_mem_map_code_write(mapp, paddr, 1);
+        }
+        return;
+    }
+    if(pagep && pagep->ram_hostp){ // write protected
+        if(phys_mem_map_fault(mapp, pagep, paddr)){
+            phys_mem_map_write_1byte(mapp, paddr, u8, now, abort_flagp);
+        }else{
+            *abort_flagp = 1;
+        }
+        return;
+    }
+    phys_mem_map_write_4bytes(mapp, paddr & (~(uint32_t)3), (uint32_t)u8, now, abort_flagp);
+}
+
+#endif
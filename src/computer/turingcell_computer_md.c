@@ -0,0 +1,1156 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** turingcell computer: cpu + io devices, and the mdf over them **
+// the whole computer is built as one translation unit, so that all the `inline` md functions
+// of the cpu and the io devices could be inlined into the execute loop
+//
+// mdf
+//     pre_cpu_exec_phase
+//     cpu_exec_phase
+//         loop until the exact inst amount of this mdf is executed
+//             armv4cpu_execute(inst amount until the earliest event deadline)
+//             io_device_cpuclk_timer_routine of every device whose deadline is reached
+//     post_cpu_exec_phase
+// in SMP mode every `armv4cpu_execute` above is a quantum of all the vCPUs, see
+// turingcell_smp_md.h
+// mdf_computer_io_input / mdf_computer_io_output
+//     the io entries of the tape, applied to one device between two mdf
+
+#include<stdint.h>
+#include<string.h>
+
+#include "../cpu/armv4cpu_md.c"
+#include "io_event_queue_md.h"
+#include "phys_mem_map_md.h"
+#include "turingcell_smp_md.h"
+#include "../io_device/io_device_md.h"
+#include "../io_device/io_device_timer_md.h"
+#include "../io_device/io_device_intc_md.h"
+#include "../io_device/io_device_uart_md.h"
+#include "../io_device/io_device_disk_md.h"
+#include "../io_device/io_device_pv_blk_md.h"
+#include "../io_device/io_device_pv_console_md.h"
+#include "../io_device/io_device_smp_md.h"
+
+#define TURINGCELL_COMPUTER_IO_DEVICE_ID_TIMER  0
+#define TURINGCELL_COMPUTER_IO_DEVICE_ID_INTC   1
+#define TURINGCELL_COMPUTER_IO_DEVICE_ID_UART   2
+#define TURINGCELL_COMPUTER_IO_DEVICE_ID_DISK   3
+#define TURINGCELL_COMPUTER_IO_DEVICE_ID_PV_BLK 4
+#define TURINGCELL_COMPUTER_IO_DEVICE_ID_PV_CONSOLE 5
+#define TURINGCELL_COMPUTER_IO_DEVICE_ID_SMP    6
+#define TURINGCELL_COMPUTER_IO_DEVICE_CT        7
+
+// interrupt lines of the interrupt controller
+#define TURINGCELL_COMPUTER_IRQ_NO_TIMER        0
+#define TURINGCELL_COMPUTER_IRQ_NO_UART         1
+#define TURINGCELL_COMPUTER_IRQ_NO_DISK         2
+#define TURINGCELL_COMPUTER_IRQ_NO_PV_BLK       3
+#define TURINGCELL_COMPUTER_IRQ_NO_PV_CONSOLE   4
+
+// physical address layout
+#define TURINGCELL_COMPUTER_PADDR_RAM           ((uint32_t)0x00000000)  // at most 256MB
+#define TURINGCELL_COMPUTER_PADDR_TIMER         ((uint32_t)0x10000000)
+#define TURINGCELL_COMPUTER_PADDR_INTC          ((uint32_t)0x10001000)
+#define TURINGCELL_COMPUTER_PADDR_UART          ((uint32_t)0x10002000)
+#define TURINGCELL_COMPUTER_PADDR_DISK          ((uint32_t)0x10003000)
+#define TURINGCELL_COMPUTER_PADDR_PV_BLK        ((uint32_t)0x10004000)
+#define TURINGCELL_COMPUTER_PADDR_PV_CONSOLE    ((uint32_t)0x10005000)
+#define TURINGCELL_COMPUTER_PADDR_SMP           ((uint32_t)0x10006000)
+
+// ** metrics **
+// latency histograms of one computer (see latency_histogram.h), in host ticks. They live
+// wherever the runtime wants, usually in a shared memory segment read by a scraper (see
+// cell_metrics.h), and are only written by the thread running the computer; each vCPU of an
+// SMP quantum has its own.
+#define TURINGCELL_COMPUTER_METRIC_MDF_PRE          0   // pre_cpu_exec_phase
+#define TURINGCELL_COMPUTER_METRIC_MDF_CPU_EXEC     1   // cpu_exec_phase
+#define TURINGCELL_COMPUTER_METRIC_MDF_POST         2   // post_cpu_exec_phase
+// every handler call of the device: phase handlers, cpuclk routine, registers, io entries
+#define TURINGCELL_COMPUTER_METRIC_DEVICE(dev_id)   (3 + (dev_id))
+// exception entry of the vCPU
+#define TURINGCELL_COMPUTER_METRIC_EXCEPTION(cpu_id) \
+    (TURINGCELL_COMPUTER_METRIC_DEVICE(TURINGCELL_COMPUTER_IO_DEVICE_CT) + (cpu_id))
+// fault_cb of the page table the vCPU runs on: the copy on write of SMP, the dirty tracking
+#define TURINGCELL_COMPUTER_METRIC_MEM_FAULT(cpu_id) \
+    (TURINGCELL_COMPUTER_METRIC_EXCEPTION(TURINGCELL_SMP_VCPU_CT_MAX) + (cpu_id))
+// writing a snapshot of the state, recorded by the runtime which writes it
+#define TURINGCELL_COMPUTER_METRIC_CHECKPOINT       \
+    TURINGCELL_COMPUTER_METRIC_MEM_FAULT(TURINGCELL_SMP_VCPU_CT_MAX)
+#define TURINGCELL_COMPUTER_METRIC_CT               (TURINGCELL_COMPUTER_METRIC_CHECKPOINT + 1)
+
+typedef struct {
+    latency_histogram_t hists[TURINGCELL_COMPUTER_METRIC_CT];
+} turingcell_computer_metrics_t;
+
+// the first write to the RAM page ram_pfn (paddr - TURINGCELL_COMPUTER_PADDR_RAM >> page shift)
+// since the watch was armed is about to happen, on the thread running the computer
+typedef void (*turingcell_computer_ram_write_cb_t)(void* cb_arg, uint32_t ram_pfn);
+
+// the inst counter has reached now, a multiple of the interval of the step watch, on the
+// thread running the computer
+typedef void (*turingcell_computer_step_cb_t)(void* cb_arg, uint64_t now);
+
+// run fn(arg, 0) ... fn(arg, ct - 1) in any order or in parallel, return when all are done
+typedef void (*turingcell_computer_parallel_run_cb_t)(void* ctx,
+    void (*fn)(void* arg, uint32_t idx), void* arg, uint32_t ct);
+
+// host resources of one computer, provided by the runtime
+typedef struct {
+    uint8_t* ram_hostp;
+    uint32_t ram_size;                          // page aligned
+    phys_mem_map_t* pmmp;                       // page table of this computer
+    io_device_uart_tx_ring_t* uart_txp;         // shared memory segment of the uart tx ring
+    uint32_t uart_tx_size;                      // power of 2
+    io_device_disk_hash_t* disk_block_map;
+    uint32_t disk_block_ct;
+    const io_device_disk_backend_t* disk_backendp;
+    // SMP, only used if vcpu_ct > 1
+    uint8_t vcpu_ct;                            // [1, TURINGCELL_SMP_VCPU_CT_MAX], 0 means 1
+    phys_mem_map_t* smp_pmmps;                  // vcpu_ct page tables, private views
+    uint8_t* smp_shadow_hostp;                  // vcpu_ct * TURINGCELL_SMP_SHADOW_PAGE_CT pages
+    turingcell_computer_parallel_run_cb_t parallel_run_cb;  // NULL: the vCPUs run one by one
+    void* parallel_run_ctx;
+} turingcell_computer_host_env_t;
+
+typedef struct {
+    armv4cpu_md_t cpu;                      // vCPU 0
+    armv4cpu_md_t smp_cpus[TURINGCELL_SMP_VCPU_CT_MAX - 1];    // vCPU 1 ... vcpu_ct - 1
+    uint8_t vcpu_ct;
+    uint8_t* ram_hostp;
+    uint32_t ram_size;
+    io_event_queue_t event_queue;
+    uint64_t applied_tape_idx;      // index of the latest tape entry applied
+
+    io_device_timer_t timer;
+    io_device_intc_t intc;
+    io_device_uart_t uart;
+    io_device_disk_t disk;
+    io_device_pv_blk_t pv_blk;
+    io_device_pv_console_t pv_console;
+    io_device_smp_t smp;
+
+    // temp bellow
+    io_device_t* io_devices[TURINGCELL_COMPUTER_IO_DEVICE_CT];   // indexed by device id
+    phys_mem_map_t* pmmp;
+    turingcell_smp_vcpu_t vcpus[TURINGCELL_SMP_VCPU_CT_MAX];
+    uint64_t smp_quantum_inst_ct;
+    turingcell_computer_parallel_run_cb_t parallel_run_cb;
+    void* parallel_run_ctx;
+    uint8_t smp_merge_buf[PHYS_MEM_PAGE_SIZE];
+    turingcell_computer_metrics_t* metricsp;    // NULL if not measured
+    turingcell_computer_ram_write_cb_t ram_write_cb;    // NULL if the RAM is not watched
+    void* ram_write_cb_arg;
+    turingcell_computer_step_cb_t step_cb;              // NULL if the insts are not watched
+    void* step_cb_arg;
+    uint64_t step_inst_ct;
+} turingcell_computer_t;
+
+// always_inline
+inline armv4cpu_md_t*
+turingcell_computer_vcpu(turingcell_computer_t* cp, uint8_t cpu_id){
+    if(cpu_id == 0){
+        return &cp->cpu;
+    }
+    return &cp->smp_cpus[cpu_id - 1];
+}
+
+// ret latency_histogram_t*: NULL if the computer is not measured
+// always_inline
+inline latency_histogram_t*
+turingcell_computer_metric(turingcell_computer_t* cp, uint32_t metric_id){
+    if_likely(cp->metricsp == NULL){
+        return NULL;
+    }
+    return &cp->metricsp->hists[metric_id];
+}
+
+// ** dependent api of the cpu **
+
+// always_inline
+inline phys_mem_map_t*
+turingcell_computer_cpu_pmmp(armv4cpu_md_t* cpup){
+    return (phys_mem_map_t*)cpup->phys_mem_ctx;
+}
+
+uint32_t
+armv4cpu_phys_mem_fetch_4bytes(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp){
+    return phys_mem_map_fetch_4bytes(turingcell_computer_cpu_pmmp(cpup), paddr, abort_flagp);
+}
+
+uint32_t
+armv4cpu_phys_mem_read_4bytes(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp){
+    return phys_mem_map_read_4bytes(turingcell_computer_cpu_pmmp(cpup), paddr,
+        cpup->inst_executed_ct_total, abort_flagp);
+}
+
+uint8_t
+armv4cpu_phys_mem_read_1byte(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp){
+    return phys_mem_map_read_1byte(turingcell_computer_cpu_pmmp(cpup), paddr,
+        cpup->inst_executed_ct_total, abort_flagp);
+}
+
+uint16_t
+armv4cpu_phys_mem_read_2bytes(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp){
+    return phys_mem_map_read_2bytes(turingcell_computer_cpu_pmmp(cpup), paddr,
+        cpup->inst_executed_ct_total, abort_flagp);
+}
+
+void
+armv4cpu_phys_mem_write_4bytes(
+    armv4cpu_md_t* cpup, uint32_t paddr, uint32_t u32, uint8_t* abort_flagp){
+
+    phys_mem_map_write_4bytes(turingcell_computer_cpu_pmmp(cpup), paddr, u32,
+        cpup->inst_executed_ct_total, abort_flagp);
+}
+
+void
+armv4cpu_phys_mem_write_2bytes(
+    armv4cpu_md_t* cpup, uint32_t paddr, uint16_t u16, uint8_t* abort_flagp){
+
+    phys_mem_map_write_2bytes(turingcell_computer_cpu_pmmp(cpup), paddr, u16,
+        cpup->inst_executed_ct_total, abort_flagp);
+}
+
+void
+armv4cpu_phys_mem_write_1byte(
+    armv4cpu_md_t* cpup, uint32_t paddr, uint8_t u8, uint8_t* abort_flagp){
+
+    phys_mem_map_write_1byte(turingcell_computer_cpu_pmmp(cpup), paddr, u8,
+        cpup->inst_executed_ct_total, abort_flagp);
+}
+
+uint8_t*
+armv4cpu_phys_mem_ram_hostp(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t write_flag){
+    return phys_mem_map_ram_access_hostp(turingcell_computer_cpu_pmmp(cpup), paddr, write_flag);
+}
+
+void
+armv4cpu_phys_mem_code_page_mark(armv4cpu_md_t* cpup, uint32_t paddr){
+    phys_mem_map_code_page_mark(turingcell_computer_cpu_pmmp(cpup), paddr);
+}
+
+// a code page of the computer has been written, by a device or by a vCPU at the barrier
+void
+turingcell_computer_code_write_cb(void* cb_arg, uint32_t paddr, uint32_t len){
+    turingcell_computer_t* cp = (turingcell_computer_t*)cb_arg;
+    uint8_t i;
+    for(i = 0; i < cp->vcpu_ct; i++){
+        armv4cpu_code_cache_invalidate(turingcell_computer_vcpu(cp, i), paddr, len);
+    }
+}
+
+#if ARMV4CPU_CODE_PAGE_SHIFT != PHYS_MEM_PAGE_SHIFT
+#error "the cpu unmarks the code pages of the memory map, their sizes must agree"
+#endif
+
+// the page table of the computer is shared by the vCPUs, the page stays a code page until
+// none of them may have an inst of it cached; a private view of a vCPU is its own
+void
+armv4cpu_phys_mem_code_page_unmark(armv4cpu_md_t* cpup, uint32_t paddr){
+    phys_mem_map_t* pmmp = turingcell_computer_cpu_pmmp(cpup);
+    turingcell_computer_t* cp;
+    uint8_t i;
+    if(pmmp->code_write_cb == turingcell_computer_code_write_cb){
+        cp = (turingcell_computer_t*)pmmp->code_write_cb_arg;
+        for(i = 0; i < cp->vcpu_ct; i++){
+            if(armv4cpu_code_cache_page_maybe_cached(turingcell_computer_vcpu(cp, i), paddr)){
+                return;
+            }
+        }
+    }
+    phys_mem_map_code_page_unmark(pmmp, paddr);
+}
+
+// the earliest deadline moved earlier while the cpu is running
+void
+turingcell_computer_event_queue_head_moved_earlier_cb(void* cb_arg, uint64_t deadline){
+    turingcell_computer_t* cp = (turingcell_computer_t*)cb_arg;
+    armv4cpu_execute_limit_to_deadline(&cp->cpu, deadline);
+}
+
+// device interrupt line -> interrupt controller
+void
+turingcell_computer_irq_line_set_cb(void* cb_arg, uint8_t irq_no, uint8_t level){
+    turingcell_computer_t* cp = (turingcell_computer_t*)cb_arg;
+    io_device_intc_line_set(&cp->intc, irq_no, level);
+}
+
+// interrupt controller output -> vCPU 0, IPI i -> vCPU i
+// always_inline
+inline void
+turingcell_computer_cpu_lines_update(turingcell_computer_t* cp){
+    uint8_t i;
+    armv4cpu_set_interrupt_lines(&cp->cpu,
+        cp->intc.irq_out || (cp->smp.ipi_pending & 1), cp->intc.fiq_out);
+    for(i = 1; i < cp->vcpu_ct; i++){
+        armv4cpu_set_interrupt_lines(turingcell_computer_vcpu(cp, i),
+            (cp->smp.ipi_pending >> i) & 1, 0);
+    }
+}
+
+void
+turingcell_computer_cpu_lines_set_cb(void* cb_arg, uint8_t irq_line, uint8_t fiq_line){
+    turingcell_computer_cpu_lines_update((turingcell_computer_t*)cb_arg);
+}
+
+void
+turingcell_computer_ipi_lines_set_cb(void* cb_arg, uint32_t ipi_pending){
+    turingcell_computer_cpu_lines_update((turingcell_computer_t*)cb_arg);
+}
+
+// always_inline
+inline void
+turingcell_computer_attach_io_device(turingcell_computer_t* cp, io_device_t* devp,
+    uint8_t dev_id, uint8_t irq_no){
+
+    devp->id = dev_id;
+    devp->irq_no = irq_no;
+    devp->eqp = &cp->event_queue;
+    devp->tape_idxp = &cp->applied_tape_idx;
+    devp->irq_line_set_cb = turingcell_computer_irq_line_set_cb;
+    devp->irq_cb_arg = cp;
+    cp->io_devices[dev_id] = devp;
+}
+
+// ** RAM write watch **
+// host side observers of the guest RAM, such as the copy on write views of follower reads:
+// while a watch is set, the RAM pages of the page table of the computer are write protected
+// and the first write to each of them, by a vCPU, a device or the SMP merge, is reported
+// to ram_write_cb before it happens. The page stays writable until the watch is rearmed.
+// Nothing flows back into the state, the guest can not tell whether it is watched.
+
+uint8_t
+turingcell_computer_ram_fault_cb(void* cb_arg, phys_mem_page_t* pagep, uint32_t paddr){
+    turingcell_computer_t* cp = (turingcell_computer_t*)cb_arg;
+    if(pagep->ram_hostp == 0){
+        return 0;
+    }
+    cp->ram_write_cb(cp->ram_write_cb_arg,
+        (paddr - TURINGCELL_COMPUTER_PADDR_RAM) >> PHYS_MEM_PAGE_SHIFT);
+    pagep->ram_write_hostp = pagep->ram_hostp;
+    return 1;
+}
+
+// write protect every RAM page again, its next write is reported once more
+// not while the computer is running
+void
+turingcell_computer_ram_watch_rearm(turingcell_computer_t* cp){
+    phys_mem_map_t* pmmp = cp->pmmp;
+    uint32_t pfn;
+    pmmp->fault_cb = turingcell_computer_ram_fault_cb;
+    pmmp->fault_cb_arg = cp;
+    for(pfn = TURINGCELL_COMPUTER_PADDR_RAM >> PHYS_MEM_PAGE_SHIFT;
+        pfn < (TURINGCELL_COMPUTER_PADDR_RAM + cp->ram_size) >> PHYS_MEM_PAGE_SHIFT; pfn++){
+        pmmp->pages[pfn].ram_write_hostp = 0;
+    }
+}
+
+// write protect the RAM page ram_pfn again, e.g. right after an observer copied it
+// not while the computer is running, the watch is set
+// always_inline
+inline void
+turingcell_computer_ram_watch_rearm_page(turingcell_computer_t* cp, uint32_t ram_pfn){
+    cp->pmmp->pages[(TURINGCELL_COMPUTER_PADDR_RAM >> PHYS_MEM_PAGE_SHIFT) + ram_pfn]
+        .ram_write_hostp = 0;
+}
+
+// start watching with cb, or stop if NULL; not while the computer is running
+// like the metrics, `turingcell_computer_init` and the rebinding of the page table keep it
+void
+turingcell_computer_ram_watch(turingcell_computer_t* cp, turingcell_computer_ram_write_cb_t cb,
+    void* cb_arg){
+
+    phys_mem_map_t* pmmp = cp->pmmp;
+    uint32_t pfn;
+    cp->ram_write_cb = cb;
+    cp->ram_write_cb_arg = cb_arg;
+    if(cb){
+        turingcell_computer_ram_watch_rearm(cp);
+        return;
+    }
+    pmmp->fault_cb = 0;
+    pmmp->fault_cb_arg = 0;
+    for(pfn = TURINGCELL_COMPUTER_PADDR_RAM >> PHYS_MEM_PAGE_SHIFT;
+        pfn < (TURINGCELL_COMPUTER_PADDR_RAM + cp->ram_size) >> PHYS_MEM_PAGE_SHIFT; pfn++){
+        pmmp->pages[pfn].ram_write_hostp = pmmp->pages[pfn].ram_hostp;
+    }
+}
+
+// ** inst step watch **
+// host side observers of the execution at a finer grain than the mdf, such as the trace of
+// tape_replay.h: while a watch is set, the cpu_exec_phase also breaks its runs at every
+// multiple of step_inst_ct of the inst counter and calls step_cb there, between two insts and
+// before the device events due at that count. Like a run broken at an event deadline, the
+// state at the end does not depend on where the runs were broken, the guest can not tell
+// whether it is watched. In SMP mode the vCPUs only meet at the barrier of a quantum, so the
+// interval is rounded up to whole quanta.
+
+// start watching every inst_ct insts with cb, or stop if NULL; not while the computer is running
+// like the RAM watch, `turingcell_computer_init` keeps it
+void
+turingcell_computer_step_watch(turingcell_computer_t* cp, uint64_t inst_ct,
+    turingcell_computer_step_cb_t cb, void* cb_arg){
+
+    if(cp->vcpu_ct > 1){
+        inst_ct = (inst_ct + TURINGCELL_SMP_QUANTUM_INST_CT - 1) / TURINGCELL_SMP_QUANTUM_INST_CT *
+            TURINGCELL_SMP_QUANTUM_INST_CT;
+    }
+    if(inst_ct == 0){
+        cb = 0;
+    }
+    cp->step_cb = cb;
+    cp->step_cb_arg = cb_arg;
+    cp->step_inst_ct = inst_ct;
+}
+
+// ** disk block map watch **
+// the counterpart of the RAM write watch for the disk block map: the backend of the disk and
+// of the paravirtual block device is replaced by one forwarding every call to it, which
+// reports each block map delta to delta_cb before the block map changes. Watches chain, each
+// forwards to the backend set before it; stop them in the reverse order of start.
+
+// block_no is about to map to another chunk, the block map still holds the previous one
+typedef void (*turingcell_computer_disk_delta_cb_t)(void* cb_arg, uint32_t block_no);
+
+typedef struct {
+    io_device_disk_backend_t backend;           // given to the devices
+    const io_device_disk_backend_t* innerp;     // the one forwarded to
+    turingcell_computer_disk_delta_cb_t delta_cb;
+    void* delta_cb_arg;
+} turingcell_computer_disk_watch_t;
+
+// io_device_disk_backend_t, forwarding
+int
+turingcell_computer_disk_watch_chunk_get(void* ctx, const io_device_disk_hash_t* hashp,
+    uint8_t* dst){
+
+    turingcell_computer_disk_watch_t* wp = (turingcell_computer_disk_watch_t*)ctx;
+    return wp->innerp->chunk_get(wp->innerp->ctx, hashp, dst);
+}
+
+int
+turingcell_computer_disk_watch_chunk_put(void* ctx, const io_device_disk_hash_t* hashp,
+    const uint8_t* src){
+
+    turingcell_computer_disk_watch_t* wp = (turingcell_computer_disk_watch_t*)ctx;
+    return wp->innerp->chunk_put(wp->innerp->ctx, hashp, src);
+}
+
+void
+turingcell_computer_disk_watch_chunk_prefetch(void* ctx, const io_device_disk_hash_t* hashp){
+    turingcell_computer_disk_watch_t* wp = (turingcell_computer_disk_watch_t*)ctx;
+    if(wp->innerp->chunk_prefetch){
+        wp->innerp->chunk_prefetch(wp->innerp->ctx, hashp);
+    }
+}
+
+void
+turingcell_computer_disk_watch_block_map_delta(void* ctx, uint32_t block_no,
+    const io_device_disk_hash_t* hashp){
+
+    turingcell_computer_disk_watch_t* wp = (turingcell_computer_disk_watch_t*)ctx;
+    wp->delta_cb(wp->delta_cb_arg, block_no);
+    if(wp->innerp->block_map_delta){
+        wp->innerp->block_map_delta(wp->innerp->ctx, block_no, hashp);
+    }
+}
+
+// not while the computer is running
+void
+turingcell_computer_disk_watch_start(turingcell_computer_t* cp,
+    turingcell_computer_disk_watch_t* wp, turingcell_computer_disk_delta_cb_t cb, void* cb_arg){
+
+    wp->innerp = cp->disk.backendp;
+    wp->delta_cb = cb;
+    wp->delta_cb_arg = cb_arg;
+    wp->backend.chunk_get = turingcell_computer_disk_watch_chunk_get;
+    wp->backend.chunk_put = turingcell_computer_disk_watch_chunk_put;
+    wp->backend.chunk_prefetch = turingcell_computer_disk_watch_chunk_prefetch;
+    wp->backend.block_map_delta = turingcell_computer_disk_watch_block_map_delta;
+    wp->backend.ctx = wp;
+    cp->disk.backendp = &wp->backend;
+    cp->pv_blk.backendp = &wp->backend;
+}
+
+// not while the computer is running, wp is the latest watch started
+void
+turingcell_computer_disk_watch_stop(turingcell_computer_t* cp,
+    turingcell_computer_disk_watch_t* wp){
+
+    cp->disk.backendp = wp->innerp;
+    cp->pv_blk.backendp = wp->innerp;
+}
+
+// (re)build the page table pointed by pmmp for this computer and make it the current one
+// the page table is derived from the configuration only, so a runtime could keep one per
+// host thread and switch it to whichever computer the thread runs, see
+// `turingcell_computer_rebind_phys_mem_map`
+void
+turingcell_computer_bind_phys_mem_map(turingcell_computer_t* cp, phys_mem_map_t* pmmp){
+    uint8_t i;
+    cp->pmmp = pmmp;
+    cp->cpu.phys_mem_ctx = pmmp;
+    cp->disk.pmmp = pmmp;
+    cp->pv_blk.pv.pmmp = pmmp;
+    cp->pv_console.pv.pmmp = pmmp;
+    phys_mem_map_init(pmmp);
+    phys_mem_map_add_ram(pmmp, TURINGCELL_COMPUTER_PADDR_RAM, cp->ram_size, cp->ram_hostp);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_TIMER, &cp->timer.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_INTC, &cp->intc.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_UART, &cp->uart.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_DISK, &cp->disk.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_PV_BLK, &cp->pv_blk.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_PV_CONSOLE, &cp->pv_console.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_SMP, &cp->smp.dev);
+    pmmp->code_write_cb = turingcell_computer_code_write_cb;
+    pmmp->code_write_cb_arg = cp;
+    pmmp->fault_histp = turingcell_computer_metric(cp, TURINGCELL_COMPUTER_METRIC_MEM_FAULT(0));
+    for(i = 0; i < cp->vcpu_ct; i++){
+        cp->vcpus[i].shared_pmmp = pmmp;
+        turingcell_computer_vcpu(cp, i)->phys_mem_ctx = pmmp;
+        armv4cpu_code_cache_flush(turingcell_computer_vcpu(cp, i)); // no code page known yet
+    }
+    if_unlikely(cp->ram_write_cb){ // a page seen already may be reported once more
+        turingcell_computer_ram_watch_rearm(cp);
+    }
+}
+
+// switch the page table pointed by pmmp, last built for another computer (or just initialized
+// by `phys_mem_map_init`) which does not use it any more, to this computer
+// every computer maps the same pages but the RAM, whose size differs, so only the RAM and the
+// mmio entries are rewritten and the ~130K others are left as they are. The predecode caches
+// are kept: the RAM is only written through a page table, and nothing runs this computer
+// while it is away, so its cached insts are still valid, their pages are marked again instead
+void
+turingcell_computer_rebind_phys_mem_map(turingcell_computer_t* cp, phys_mem_map_t* pmmp){
+    armv4cpu_md_t* cpup;
+    uint32_t pfn, pfn_end, idx;
+    uint8_t i;
+    cp->pmmp = pmmp;
+    cp->cpu.phys_mem_ctx = pmmp;
+    cp->disk.pmmp = pmmp;
+    cp->pv_blk.pv.pmmp = pmmp;
+    cp->pv_console.pv.pmmp = pmmp;
+    // the RAM of the previous computer past ours, the insts are only fetched from RAM so
+    // its code bits are there too
+    pfn = (TURINGCELL_COMPUTER_PADDR_RAM + cp->ram_size) >> PHYS_MEM_PAGE_SHIFT;
+    pfn_end = TURINGCELL_COMPUTER_PADDR_TIMER >> PHYS_MEM_PAGE_SHIFT;
+    for(; pfn < pfn_end && pmmp->pages[pfn].ram_hostp; pfn++){
+        pmmp->pages[pfn].ram_hostp = 0;
+        pmmp->pages[pfn].ram_write_hostp = 0;
+        pmmp->code_page_bits[pfn >> 5] &= ~(((uint32_t)1) << (pfn & 31));
+    }
+    for(pfn = TURINGCELL_COMPUTER_PADDR_RAM >> PHYS_MEM_PAGE_SHIFT;
+        pfn < (TURINGCELL_COMPUTER_PADDR_RAM + cp->ram_size) >> PHYS_MEM_PAGE_SHIFT; pfn++){
+        pmmp->code_page_bits[pfn >> 5] &= ~(((uint32_t)1) << (pfn & 31));
+    }
+    phys_mem_map_add_ram(pmmp, TURINGCELL_COMPUTER_PADDR_RAM, cp->ram_size, cp->ram_hostp);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_TIMER, &cp->timer.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_INTC, &cp->intc.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_UART, &cp->uart.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_DISK, &cp->disk.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_PV_BLK, &cp->pv_blk.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_PV_CONSOLE, &cp->pv_console.dev);
+    phys_mem_map_add_mmio(pmmp, TURINGCELL_COMPUTER_PADDR_SMP, &cp->smp.dev);
+    pmmp->fault_cb = 0;
+    pmmp->fault_cb_arg = 0;
+    pmmp->code_write_cb = turingcell_computer_code_write_cb;
+    pmmp->code_write_cb_arg = cp;
+    pmmp->fault_histp = turingcell_computer_metric(cp, TURINGCELL_COMPUTER_METRIC_MEM_FAULT(0));
+    for(i = 0; i < cp->vcpu_ct; i++){
+        cp->vcpus[i].shared_pmmp = pmmp;
+        cpup = turingcell_computer_vcpu(cp, i);
+        cpup->phys_mem_ctx = pmmp;
+        for(idx = 0; idx < ARMV4CPU_CODE_CACHE_ENTRY_CT; idx++){
+            if(cpup->code_cache[idx].paddr != ARMV4CPU_CODE_CACHE_TAG_NONE){
+                phys_mem_map_code_page_mark(pmmp, cpup->code_cache[idx].paddr);
+            }
+        }
+    }
+    if_unlikely(cp->ram_write_cb){ // a page seen already may be reported once more
+        turingcell_computer_ram_watch_rearm(cp);
+    }
+}
+
+// start measuring into metricsp, or stop if NULL; not while the computer is running
+// the probes of the computer, of its devices, of its vCPUs and of its page tables are derived
+// from metricsp, `turingcell_computer_init` keeps the current one
+void
+turingcell_computer_metrics_attach(turingcell_computer_t* cp,
+    turingcell_computer_metrics_t* metricsp){
+
+    uint8_t i;
+    cp->metricsp = metricsp;
+    for(i = 0; i < TURINGCELL_COMPUTER_IO_DEVICE_CT; i++){
+        cp->io_devices[i]->histp =
+            turingcell_computer_metric(cp, TURINGCELL_COMPUTER_METRIC_DEVICE(i));
+    }
+    for(i = 0; i < cp->vcpu_ct; i++){
+        turingcell_computer_vcpu(cp, i)->exception_histp =
+            turingcell_computer_metric(cp, TURINGCELL_COMPUTER_METRIC_EXCEPTION(i));
+        if(cp->vcpu_ct > 1){
+            cp->vcpus[i].pmmp->fault_histp =
+                turingcell_computer_metric(cp, TURINGCELL_COMPUTER_METRIC_MEM_FAULT(i));
+        }
+    }
+    cp->pmmp->fault_histp = turingcell_computer_metric(cp, TURINGCELL_COMPUTER_METRIC_MEM_FAULT(0));
+}
+
+// the state of every vCPU is loaded by the caller
+void
+turingcell_computer_init(turingcell_computer_t* cp, const turingcell_computer_host_env_t* envp){
+    phys_mem_map_t* pmmp = envp->pmmp;
+    uint8_t i;
+    cp->applied_tape_idx = 0;
+    cp->ram_hostp = envp->ram_hostp;
+    cp->ram_size = envp->ram_size;
+    cp->vcpu_ct = envp->vcpu_ct ? envp->vcpu_ct : 1;
+    cp->parallel_run_cb = envp->parallel_run_cb;
+    cp->parallel_run_ctx = envp->parallel_run_ctx;
+    for(i = 0; i < cp->vcpu_ct && cp->vcpu_ct > 1; i++){
+        turingcell_smp_vcpu_init(&cp->vcpus[i], turingcell_computer_vcpu(cp, i),
+            &envp->smp_pmmps[i], envp->smp_shadow_hostp +
+                (((uint64_t)i * TURINGCELL_SMP_SHADOW_PAGE_CT) << PHYS_MEM_PAGE_SHIFT),
+            TURINGCELL_COMPUTER_PADDR_RAM, cp->ram_hostp, cp->ram_size);
+    }
+
+    io_event_queue_init(&cp->event_queue);
+    cp->event_queue.head_moved_earlier_cb = turingcell_computer_event_queue_head_moved_earlier_cb;
+    cp->event_queue.cb_arg = cp;
+
+    // before the interrupt controller, whose reset drives the cpu lines
+    turingcell_computer_attach_io_device(cp, &cp->smp.dev,
+        TURINGCELL_COMPUTER_IO_DEVICE_ID_SMP, 0);
+    cp->smp.ipi_lines_set_cb = turingcell_computer_ipi_lines_set_cb;
+    cp->smp.ipi_cb_arg = cp;
+    io_device_smp_hwreset(&cp->smp, cp->vcpu_ct);
+
+    turingcell_computer_attach_io_device(cp, &cp->intc.dev,
+        TURINGCELL_COMPUTER_IO_DEVICE_ID_INTC, 0);
+    cp->intc.pending = 0;
+    cp->intc.cpu_lines_set_cb = turingcell_computer_cpu_lines_set_cb;
+    cp->intc.cpu_cb_arg = cp;
+    io_device_intc_hwreset(&cp->intc);
+
+    turingcell_computer_attach_io_device(cp, &cp->timer.dev,
+        TURINGCELL_COMPUTER_IO_DEVICE_ID_TIMER, TURINGCELL_COMPUTER_IRQ_NO_TIMER);
+    io_device_timer_hwreset(&cp->timer);
+
+    turingcell_computer_attach_io_device(cp, &cp->uart.dev,
+        TURINGCELL_COMPUTER_IO_DEVICE_ID_UART, TURINGCELL_COMPUTER_IRQ_NO_UART);
+    io_device_uart_hwreset(&cp->uart, envp->uart_txp, envp->uart_tx_size);
+
+    turingcell_computer_attach_io_device(cp, &cp->disk.dev,
+        TURINGCELL_COMPUTER_IO_DEVICE_ID_DISK, TURINGCELL_COMPUTER_IRQ_NO_DISK);
+    io_device_disk_hwreset(&cp->disk, envp->disk_block_map, envp->disk_block_ct,
+        envp->disk_backendp, pmmp);
+
+    turingcell_computer_attach_io_device(cp, &cp->pv_blk.dev,
+        TURINGCELL_COMPUTER_IO_DEVICE_ID_PV_BLK, TURINGCELL_COMPUTER_IRQ_NO_PV_BLK);
+    io_device_pv_blk_hwreset(&cp->pv_blk, envp->disk_block_map, envp->disk_block_ct,
+        envp->disk_backendp, pmmp);
+
+    turingcell_computer_attach_io_device(cp, &cp->pv_console.dev,
+        TURINGCELL_COMPUTER_IO_DEVICE_ID_PV_CONSOLE, TURINGCELL_COMPUTER_IRQ_NO_PV_CONSOLE);
+    io_device_pv_console_hwreset(&cp->pv_console, &cp->uart, pmmp);
+
+    turingcell_computer_bind_phys_mem_map(cp, pmmp);
+    turingcell_computer_metrics_attach(cp, cp->metricsp);
+}
+
+// always_inline
+inline uint64_t
+turingcell_computer_now(turingcell_computer_t* cp){
+    return cp->cpu.inst_executed_ct_total;
+}
+
+// always_inline
+inline void
+turingcell_computer_pre_cpu_exec_phase(turingcell_computer_t* cp){
+    uint64_t t0;
+    uint8_t i;
+    for(i = 0; i < TURINGCELL_COMPUTER_IO_DEVICE_CT; i++){
+        io_device_t* devp = cp->io_devices[i];
+        if(devp->ops->pre_cpu_exec_phase_handler){
+            t0 = latency_histogram_probe_begin(devp->histp);
+            devp->ops->pre_cpu_exec_phase_handler(devp, turingcell_computer_now(cp));
+            latency_histogram_probe_end(devp->histp, t0);
+        }
+    }
+}
+
+// always_inline
+inline void
+turingcell_computer_post_cpu_exec_phase(turingcell_computer_t* cp){
+    uint64_t t0;
+    uint8_t i;
+    for(i = 0; i < TURINGCELL_COMPUTER_IO_DEVICE_CT; i++){
+        io_device_t* devp = cp->io_devices[i];
+        if(devp->ops->post_cpu_exec_phase_handler){
+            t0 = latency_histogram_probe_begin(devp->histp);
+            devp->ops->post_cpu_exec_phase_handler(devp, turingcell_computer_now(cp));
+            latency_histogram_probe_end(devp->histp, t0);
+        }
+    }
+}
+
+// always_inline
+inline void
+turingcell_computer_fire_due_events(turingcell_computer_t* cp){
+    uint64_t t0;
+    uint8_t dev_id;
+    for(;;){
+        dev_id = io_event_queue_pop_due(&cp->event_queue, turingcell_computer_now(cp));
+        if(dev_id == IO_EVENT_QUEUE_POS_NONE){
+            break;
+        }
+        io_device_t* devp = cp->io_devices[dev_id];
+        t0 = latency_histogram_probe_begin(devp->histp);
+        devp->ops->cpuclk_timer_routine(devp, turingcell_computer_now(cp));
+        latency_histogram_probe_end(devp->histp, t0);
+    }
+}
+
+// one vCPU inside a quantum, against its private view
+// the code pages marked in a private view only track the stores of its own vCPU, the guest
+// RAM may be changed by the others at the barrier, so the predecode cache is left empty, which
+// unmarks its pages in the view too. It starts empty as well: the insts cached against the
+// page table of the computer (the deferred inst) are flushed before the quantum
+void
+turingcell_computer_smp_vcpu_run(void* arg, uint32_t idx){
+    turingcell_computer_t* cp = (turingcell_computer_t*)arg;
+    armv4cpu_md_t* cpup = cp->vcpus[idx].cpup;
+    cpup->phys_mem_ctx = cp->vcpus[idx].pmmp;
+    cpup->atomic_inst_need_defer_flag = 1;
+    armv4cpu_execute(cpup, cp->smp_quantum_inst_ct);
+    armv4cpu_code_cache_flush(cpup);
+    cpup->phys_mem_ctx = cp->pmmp;
+    cpup->atomic_inst_need_defer_flag = 0;
+}
+
+// one quantum of all the vCPUs, then the barrier
+// always_inline
+inline void
+turingcell_computer_smp_execute(turingcell_computer_t* cp, uint64_t inst_amount){
+    uint64_t end_ct = turingcell_computer_now(cp) + inst_amount;
+    armv4cpu_md_t* cpup;
+    uint8_t i;
+    cp->smp_quantum_inst_ct = inst_amount;
+    for(i = 0; i < cp->vcpu_ct; i++){ // before the parallel run, the page table is shared
+        armv4cpu_code_cache_flush(cp->vcpus[i].cpup);
+    }
+    if(cp->parallel_run_cb){
+        cp->parallel_run_cb(cp->parallel_run_ctx, turingcell_computer_smp_vcpu_run, cp, cp->vcpu_ct);
+    }else{
+        for(i = 0; i < cp->vcpu_ct; i++){
+            turingcell_computer_smp_vcpu_run(cp, i);
+        }
+    }
+    turingcell_smp_merge(cp->vcpus, cp->vcpu_ct, cp->smp_merge_buf);
+    for(i = 0; i < cp->vcpu_ct; i++){
+        cpup = cp->vcpus[i].cpup;
+        if_unlikely(cpup->inst_deferred_flag){
+            cp->smp.cur_cpu_id = i;
+            cpup->inst_executed_ct_total = end_ct - 1;
+            // replay exactly the deferred inst, a pending interrupt is not taken on the entry
+            // of this execute but after the inst, on the entry of the next one
+            cpup->interrupt_possible_flag = 0;
+            armv4cpu_execute(cpup, 1);
+            armv4cpu_update_interrupt_possible_flag(cpup);
+        }
+        cpup->inst_executed_ct_total = end_ct; // stalled until the barrier
+    }
+    cp->smp.cur_cpu_id = 0;
+}
+
+// the cpu runs unbroken until the earliest event deadline, devices are never polled
+// always_inline
+inline void
+turingcell_computer_cpu_exec_phase(turingcell_computer_t* cp, uint64_t inst_amount){
+    uint64_t end_ct = turingcell_computer_now(cp) + inst_amount;
+    uint64_t stop_ct;
+    uint64_t quantum_end_ct;
+    uint64_t step_end_ct;
+    for(;;){
+        turingcell_computer_fire_due_events(cp);
+        if(turingcell_computer_now(cp) >= end_ct){
+            break;
+        }
+        stop_ct = io_event_queue_peek_deadline(&cp->event_queue);
+        if(stop_ct > end_ct){
+            stop_ct = end_ct;
+        }
+        if_unlikely(cp->step_cb){
+            step_end_ct = (turingcell_computer_now(cp) / cp->step_inst_ct + 1) * cp->step_inst_ct;
+            if(stop_ct > step_end_ct){
+                stop_ct = step_end_ct;
+            }
+        }
+        if_likely(cp->vcpu_ct == 1){
+            armv4cpu_execute(&cp->cpu, stop_ct - turingcell_computer_now(cp));
+        }else{
+            quantum_end_ct = (turingcell_computer_now(cp) / TURINGCELL_SMP_QUANTUM_INST_CT + 1) *
+                TURINGCELL_SMP_QUANTUM_INST_CT;
+            if(stop_ct > quantum_end_ct){
+                stop_ct = quantum_end_ct;
+            }
+            turingcell_computer_smp_execute(cp, stop_ct - turingcell_computer_now(cp));
+        }
+        if_unlikely(cp->step_cb && turingcell_computer_now(cp) % cp->step_inst_ct == 0){
+            cp->step_cb(cp->step_cb_arg, turingcell_computer_now(cp));
+        }
+    }
+}
+
+// RSM instruction
+// tape_idx is the index of the tape entry of this mdf
+void
+mdf_computer_exec(turingcell_computer_t* cp, uint64_t tape_idx, uint64_t inst_amount){
+    uint64_t t0, t1, t2;
+    cp->applied_tape_idx = tape_idx;
+    if_likely(cp->metricsp == NULL){
+        turingcell_computer_pre_cpu_exec_phase(cp);
+        turingcell_computer_cpu_exec_phase(cp, inst_amount);
+        turingcell_computer_post_cpu_exec_phase(cp);
+        return;
+    }
+    t0 = latency_histogram_ticks();
+    turingcell_computer_pre_cpu_exec_phase(cp);
+    t1 = latency_histogram_ticks();
+    turingcell_computer_cpu_exec_phase(cp, inst_amount);
+    t2 = latency_histogram_ticks();
+    turingcell_computer_post_cpu_exec_phase(cp);
+    latency_histogram_record(&cp->metricsp->hists[TURINGCELL_COMPUTER_METRIC_MDF_PRE], t1 - t0);
+    latency_histogram_record(&cp->metricsp->hists[TURINGCELL_COMPUTER_METRIC_MDF_CPU_EXEC],
+        t2 - t1);
+    latency_histogram_record(&cp->metricsp->hists[TURINGCELL_COMPUTER_METRIC_MDF_POST],
+        latency_histogram_ticks() - t2);
+}
+
+// ret u8: 0 if success | 1 if the device does not accept input
+uint8_t
+mdf_computer_io_input(turingcell_computer_t* cp, uint64_t tape_idx, uint8_t dev_id,
+    const uint8_t* data, uint32_t len){
+
+    io_device_t* devp;
+    uint64_t t0;
+    if(dev_id >= TURINGCELL_COMPUTER_IO_DEVICE_CT){
+        return 1;
+    }
+    devp = cp->io_devices[dev_id];
+    if(devp->ops->io_input_write_buffer == 0){
+        return 1;
+    }
+    cp->applied_tape_idx = tape_idx;
+    t0 = latency_histogram_probe_begin(devp->histp);
+    devp->ops->io_input_write_buffer(devp, turingcell_computer_now(cp), data, len);
+    latency_histogram_probe_end(devp->histp, t0);
+    return 0;
+}
+
+// ret u8: 0 if success | 1 if the device has no output
+uint8_t
+mdf_computer_io_output(turingcell_computer_t* cp, uint64_t tape_idx, uint8_t dev_id,
+    uint64_t offset, uint32_t len){
+
+    io_device_t* devp;
+    uint64_t t0;
+    if(dev_id >= TURINGCELL_COMPUTER_IO_DEVICE_CT){
+        return 1;
+    }
+    devp = cp->io_devices[dev_id];
+    if(devp->ops->io_output_consume_buffer == 0){
+        return 1;
+    }
+    cp->applied_tape_idx = tape_idx;
+    t0 = latency_histogram_probe_begin(devp->histp);
+    devp->ops->io_output_consume_buffer(devp, turingcell_computer_now(cp), offset, len);
+    latency_histogram_probe_end(devp->histp, t0);
+    return 0;
+}
+
+// ** persistent state **
+// the state of a computer is the persistent part (above `temp bellow`) of the computer, of
+// every vCPU, of the event queue and of every device, plus what lives in host memory: the
+// guest RAM, the uart tx ring and the disk block map. The configuration (vcpu_ct, ram_size,
+// uart_tx_size, disk_block_ct) and the io_device_t headers are not part of it, they are rebuilt
+// by `turingcell_computer_init`.
+//
+// `turingcell_computer_state_visit` hands the state to fn member by member, so no padding is
+// ever visited, and always in the same order. A snapshot is this byte stream (host byte order),
+// the state hash is its sha256.
+
+// name is the member as written below, e.g. "cpup->R", for diagnostics only
+typedef void (*turingcell_computer_state_visit_fn_t)(void* arg, const char* name, void* p,
+    uint64_t len);
+
+#define TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, member) \
+    (fn)((arg), #member, &(member), sizeof(member))
+
+// always_inline
+inline void
+turingcell_computer_state_visit_pv(io_device_pv_t* pvp,
+    turingcell_computer_state_visit_fn_t fn, void* arg){
+
+    io_device_pv_queue_t* qp;
+    uint32_t i;
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, pvp->device_id);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, pvp->queue_ct);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, pvp->queue_sel);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, pvp->int_status);
+    for(i = 0; i < IO_DEVICE_PV_QUEUE_CT_MAX; i++){
+        qp = &pvp->queues[i];
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, qp->paddr);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, qp->size);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, qp->ready);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, qp->last_avail_idx);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, qp->used_idx);
+    }
+}
+
+void
+turingcell_computer_state_visit(turingcell_computer_t* cp,
+    turingcell_computer_state_visit_fn_t fn, void* arg){
+
+    io_device_uart_tx_ring_t* txp = cp->uart.txp;
+    armv4cpu_md_t* cpup;
+    uint8_t i;
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->applied_tape_idx);
+    for(i = 0; i < cp->vcpu_ct; i++){
+        cpup = turingcell_computer_vcpu(cp, i);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cpup->R);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cpup->cpsr);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cpup->spsr);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cpup->inst_executed_ct_total);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cpup->wait_for_interrupt_flag);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cpup->vfp_S);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cpup->vfp_fpscr);
+        TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cpup->vfp_fpexc);
+    }
+
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->event_queue.deadline);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->event_queue.pos);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->event_queue.heap);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->event_queue.len);
+
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->timer.load);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->timer.ctrl);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->timer.frozen_value);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->timer.raw_irq);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->timer.start_ct);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->timer.deadline);
+
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->intc.pending);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->intc.enable);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->intc.fiq_select);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->intc.irq_out);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->intc.fiq_out);
+
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->uart.ctrl);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->uart.rx_fifo);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->uart.rx_head);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->uart.rx_ct);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->uart.rx_dropped_ct);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->uart.tx_ct);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->uart.tx_seg_ct);
+
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->disk.block);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->disk.count);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->disk.paddr);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->disk.ctrl);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->disk.cmd);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->disk.done);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->disk.error);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->disk.seq_next_block);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->disk.seq_read_ahead_ct);
+
+    turingcell_computer_state_visit_pv(&cp->pv_blk.pv, fn, arg);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->pv_blk.batch_ct);
+    turingcell_computer_state_visit_pv(&cp->pv_console.pv, fn, arg);
+
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, cp->smp.ipi_pending);
+
+    fn(arg, "ram", cp->ram_hostp, cp->ram_size);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, txp->published_ct);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, txp->acked_ct);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, txp->seg_published_ct);
+    TURINGCELL_COMPUTER_STATE_VISIT(fn, arg, txp->segs);
+    fn(arg, "txp->data", txp->data, txp->data_size);
+    fn(arg, "cp->disk.block_map", cp->disk.block_map,
+        (uint64_t)cp->disk.block_ct * sizeof(io_device_disk_hash_t));
+}
+
+// the state has just been overwritten through `turingcell_computer_state_visit`, right after
+// `turingcell_computer_init`: rederive what the state drives
+void
+turingcell_computer_state_loaded(turingcell_computer_t* cp){
+    uint8_t i;
+    turingcell_computer_cpu_lines_update(cp);
+    for(i = 0; i < cp->vcpu_ct; i++){
+        armv4cpu_code_cache_flush(turingcell_computer_vcpu(cp, i));
+    }
+}
+
+void
+turingcell_computer_state_hash_visit_fn(void* arg, const char* name, void* p, uint64_t len){
+    sha256_update((sha256_ctx_t*)arg, (const uint8_t*)p, len);
+}
+
+void
+turingcell_computer_state_hash(turingcell_computer_t* cp, uint8_t digest[SHA256_DIGEST_SIZE]){
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    turingcell_computer_state_visit(cp, turingcell_computer_state_hash_visit_fn, &ctx);
+    sha256_final(&ctx, digest);
+}
+
+// ** paged and small state **
+// the state as the host side observers (follower_read.h, state_transfer.h) split it:
+//  - paged: the RAM and the disk block map, state page p is the RAM page p below
+//    `turingcell_computer_state_ram_page_ct`, then TURINGCELL_COMPUTER_BLOCK_MAP_PAGE_HASH_CT
+//    hashes of the block map per page, the last one shorter if block_ct is not a multiple
+//  - small: every other member, in the order of `turingcell_computer_state_visit`, copied as
+//    a whole. The data of the uart tx ring is in it only with TURINGCELL_COMPUTER_SMALL_TX_DATA,
+//    a reader on the host can take it from the ring itself.
+// members are told apart by where they are, not by their names
+
+#define TURINGCELL_COMPUTER_BLOCK_MAP_PAGE_HASH_CT \
+    ((uint32_t)(PHYS_MEM_PAGE_SIZE / sizeof(io_device_disk_hash_t)))
+
+#define TURINGCELL_COMPUTER_SMALL_TX_DATA   0x01
+
+// always_inline
+inline uint32_t
+turingcell_computer_state_ram_page_ct(turingcell_computer_t* cp){
+    return cp->ram_size >> PHYS_MEM_PAGE_SHIFT;
+}
+
+// ret u32: the state page holding the hash of block_no
+// always_inline
+inline uint32_t
+turingcell_computer_state_block_map_page(turingcell_computer_t* cp, uint32_t block_no){
+    return turingcell_computer_state_ram_page_ct(cp) +
+        block_no / TURINGCELL_COMPUTER_BLOCK_MAP_PAGE_HASH_CT;
+}
+
+// always_inline
+inline uint32_t
+turingcell_computer_state_page_ct(turingcell_computer_t* cp){
+    return turingcell_computer_state_block_map_page(cp,
+        cp->disk.block_ct + TURINGCELL_COMPUTER_BLOCK_MAP_PAGE_HASH_CT - 1);
+}
+
+// page below `turingcell_computer_state_page_ct`
+// ret uint8_t*: the live content of the state page, of *lenp bytes
+// always_inline
+inline uint8_t*
+turingcell_computer_state_page(turingcell_computer_t* cp, uint32_t page, uint32_t* lenp){
+    uint32_t ram_page_ct = turingcell_computer_state_ram_page_ct(cp);
+    uint32_t first, ct;
+    if(page < ram_page_ct){
+        *lenp = PHYS_MEM_PAGE_SIZE;
+        return cp->ram_hostp + ((uint64_t)page << PHYS_MEM_PAGE_SHIFT);
+    }
+    first = (page - ram_page_ct) * TURINGCELL_COMPUTER_BLOCK_MAP_PAGE_HASH_CT;
+    ct = cp->disk.block_ct - first;
+    if(ct > TURINGCELL_COMPUTER_BLOCK_MAP_PAGE_HASH_CT){
+        ct = TURINGCELL_COMPUTER_BLOCK_MAP_PAGE_HASH_CT;
+    }
+    *lenp = ct * (uint32_t)sizeof(io_device_disk_hash_t);
+    return (uint8_t*)&cp->disk.block_map[first];
+}
+
+typedef struct {
+    turingcell_computer_t* cp;
+    uint8_t flags;
+    turingcell_computer_state_visit_fn_t fn;
+    void* arg;
+} turingcell_computer_small_state_visit_t;
+
+void
+turingcell_computer_small_state_visit_fn(void* arg, const char* name, void* p, uint64_t len){
+    turingcell_computer_small_state_visit_t* vp = (turingcell_computer_small_state_visit_t*)arg;
+    turingcell_computer_t* cp = vp->cp;
+    if(p == cp->ram_hostp || p == cp->disk.block_map ||
+        (p == cp->uart.txp->data && !(vp->flags & TURINGCELL_COMPUTER_SMALL_TX_DATA))){
+        return;
+    }
+    vp->fn(vp->arg, name, p, len);
+}
+
+// `turingcell_computer_state_visit` of the small state only, flags TURINGCELL_COMPUTER_SMALL_*
+void
+turingcell_computer_small_state_visit(turingcell_computer_t* cp, uint8_t flags,
+    turingcell_computer_state_visit_fn_t fn, void* arg){
+
+    turingcell_computer_small_state_visit_t v;
+    v.cp = cp;
+    v.flags = flags;
+    v.fn = fn;
+    v.arg = arg;
+    turingcell_computer_state_visit(cp, turingcell_computer_small_state_visit_fn, &v);
+}
+
+void
+turingcell_computer_small_state_len_visit_fn(void* arg, const char* name, void* p,
+    uint64_t len){
+
+    *(uint32_t*)arg += (uint32_t)len;
+}
+
+void
+turingcell_computer_small_state_save_visit_fn(void* arg, const char* name, void* p,
+    uint64_t len){
+
+    uint8_t** dstp = (uint8_t**)arg;
+    memcpy(*dstp, p, len);
+    *dstp += len;
+}
+
+void
+turingcell_computer_small_state_load_visit_fn(void* arg, const char* name, void* p,
+    uint64_t len){
+
+    const uint8_t** srcp = (const uint8_t**)arg;
+    memcpy(p, *srcp, len);
+    *srcp += len;
+}
+
+// ret u32: length of the small state
+uint32_t
+turingcell_computer_small_state_len(turingcell_computer_t* cp, uint8_t flags){
+    uint32_t len = 0;
+    turingcell_computer_small_state_visit(cp, flags,
+        turingcell_computer_small_state_len_visit_fn, &len);
+    return len;
+}
+
+// dst of `turingcell_computer_small_state_len` bytes
+void
+turingcell_computer_small_state_save(turingcell_computer_t* cp, uint8_t flags, uint8_t* dst){
+    turingcell_computer_small_state_visit(cp, flags,
+        turingcell_computer_small_state_save_visit_fn, &dst);
+}
+
+// like `turingcell_computer_state_visit` overwriting the state, `turingcell_computer_state_loaded`
+// follows once the paged state is loaded too
+void
+turingcell_computer_small_state_load(turingcell_computer_t* cp, uint8_t flags,
+    const uint8_t* src){
+
+    turingcell_computer_small_state_visit(cp, flags,
+        turingcell_computer_small_state_load_visit_fn, &src);
+}
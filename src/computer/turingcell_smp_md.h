@@ -0,0 +1,196 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** deterministic SMP **
+// N vCPUs share the guest RAM. The cpu exec phase is cut into quanta, a quantum ends at the
+// next multiple of TURINGCELL_SMP_QUANTUM_INST_CT of the inst counter or earlier at the
+// event deadline. Inside a quantum every vCPU runs alone, possibly on its own host thread,
+// against its private view of the physical memory:
+//  - loads see the guest RAM as it was at the start of the quantum plus its own stores
+//  - the first store to a RAM page copies the page into a shadow of this vCPU
+//  - an access to a device register, a SWP/SWPB, or a store which finds the shadow pool
+//    exhausted is deferred: the vCPU stops in front of that inst (`armv4cpu_inst_defer`)
+// and nothing it does could be seen by another vCPU. At the quantum barrier:
+//  1. the shadows are merged into the guest RAM in vCPU order. Stores are not tracked, a
+//     byte is taken from a shadow only if it differs from the guest RAM of the start of the
+//     quantum: a byte changed by several vCPUs ends up with the value of the highest vCPU id
+//     which changed it, a vCPU which stored back the original value does not count
+//  2. the deferred insts are executed against the guest RAM and the devices, in vCPU order
+//  3. every vCPU which stopped early is stalled to the end of the quantum, so all the inst
+//     counters are equal again and `now` stays the one of vCPU 0
+// so the result only depends on the guest and the tape, never on the host scheduling.
+//
+// must be included after armv4cpu_md.c
+
+#ifndef TURINGCELL_SMP_MD_H
+#define TURINGCELL_SMP_MD_H
+
+#include<stdint.h>
+#include<string.h>
+#include "phys_mem_map_md.h"
+
+#define TURINGCELL_SMP_VCPU_CT_MAX          8
+#define TURINGCELL_SMP_QUANTUM_INST_CT      ((uint64_t)16384)
+#define TURINGCELL_SMP_SHADOW_PAGE_CT       256     // per vCPU per quantum
+
+// private view of one vCPU, all temp
+typedef struct {
+    armv4cpu_md_t* cpup;
+    phys_mem_map_t* pmmp;           // RAM write protected, no device
+    phys_mem_map_t* shared_pmmp;    // page table of the computer
+    uint8_t* shadow_hostp;          // TURINGCELL_SMP_SHADOW_PAGE_CT pages
+    uint32_t shadow_ct;
+    uint32_t dirty_pfns[TURINGCELL_SMP_SHADOW_PAGE_CT];    // indexed by shadow idx
+} turingcell_smp_vcpu_t;
+
+// a code page of the private view has been written by its own vCPU
+void
+turingcell_smp_vcpu_code_write_cb(void* cb_arg, uint32_t paddr, uint32_t len){
+    turingcell_smp_vcpu_t* vp = (turingcell_smp_vcpu_t*)cb_arg;
+    armv4cpu_code_cache_invalidate(vp->cpup, paddr, len);
+}
+
+// copy on write of the RAM, everything else which is not served by the private view is
+// either a device register (deferred) or unmapped (aborts as usual)
+uint8_t
+turingcell_smp_vcpu_fault_cb(void* cb_arg, phys_mem_page_t* pagep, uint32_t paddr){
+    turingcell_smp_vcpu_t* vp = (turingcell_smp_vcpu_t*)cb_arg;
+    uint8_t* shadowp;
+    if(pagep->ram_hostp){
+        if(vp->shadow_ct == TURINGCELL_SMP_SHADOW_PAGE_CT){
+            armv4cpu_inst_defer(vp->cpup);
+            return 0;
+        }
+        shadowp = vp->shadow_hostp + (vp->shadow_ct << PHYS_MEM_PAGE_SHIFT);
+        memcpy(shadowp, pagep->ram_hostp, PHYS_MEM_PAGE_SIZE);
+        pagep->ram_hostp = shadowp;
+        pagep->ram_write_hostp = shadowp;
+        vp->dirty_pfns[vp->shadow_ct] = paddr >> PHYS_MEM_PAGE_SHIFT;
+        vp->shadow_ct++;
+        return 1;
+    }
+    if(phys_mem_map_page(vp->shared_pmmp, paddr)->mmiop){
+        armv4cpu_inst_defer(vp->cpup);
+    }
+    return 0;
+}
+
+// the private view maps the same RAM as the computer, read only
+// ram_size must be page aligned
+// always_inline
+inline void
+turingcell_smp_vcpu_init(turingcell_smp_vcpu_t* vp, armv4cpu_md_t* cpup, phys_mem_map_t* pmmp,
+    uint8_t* shadow_hostp, uint32_t ram_paddr, uint8_t* ram_hostp, uint32_t ram_size){
+
+    uint32_t pfn;
+    vp->cpup = cpup;
+    vp->pmmp = pmmp;
+    vp->shadow_hostp = shadow_hostp;
+    vp->shadow_ct = 0;
+    phys_mem_map_init(pmmp);
+    phys_mem_map_add_ram(pmmp, ram_paddr, ram_size, ram_hostp);
+    for(pfn = ram_paddr >> PHYS_MEM_PAGE_SHIFT;
+        pfn < (ram_paddr + ram_size) >> PHYS_MEM_PAGE_SHIFT; pfn++){
+        pmmp->pages[pfn].ram_write_hostp = 0;
+    }
+    pmmp->fault_cb = turingcell_smp_vcpu_fault_cb;
+    pmmp->fault_cb_arg = vp;
+    pmmp->code_write_cb = turingcell_smp_vcpu_code_write_cb;
+    pmmp->code_write_cb_arg = vp;
+}
+
+// dst = every byte of shadow which differs from orig
+// a byte stored with its original value is not seen, it is left as in dst
+// always_inline
+inline void
+turingcell_smp_page_apply_diff(uint8_t* dst, const uint8_t* shadow, const uint8_t* orig){
+    uint64_t s, o;
+    uint32_t i, j;
+    for(i = 0; i < PHYS_MEM_PAGE_SIZE; i += 8){
+        memcpy(&s, shadow + i, 8);
+        memcpy(&o, orig + i, 8);
+        if_likely(s == o){
+            continue;
+        }
+        for(j = i; j < i + 8; j++){
+            if(shadow[j] != orig[j]){
+                dst[j] = shadow[j];
+            }
+        }
+    }
+}
+
+// back to the guest RAM, write protected
+// always_inline
+inline void
+turingcell_smp_page_reset(phys_mem_page_t* pagep, uint8_t* ram_hostp){
+    pagep->ram_hostp = ram_hostp;
+    pagep->ram_write_hostp = 0;
+}
+
+// step 1 of the barrier, every private view is clean afterwards
+// a page dirty in a single vCPU is copied as a whole, a page dirty in several vCPUs is
+// rebuilt from the diffs of every shadow against the guest RAM, in vCPU order
+// merge_buf is one page of scratch
+// always_inline
+inline void
+turingcell_smp_merge(turingcell_smp_vcpu_t* vcpus, uint8_t vcpu_ct, uint8_t* merge_buf){
+    turingcell_smp_vcpu_t* vp;
+    phys_mem_page_t* pagep;
+    phys_mem_page_t* other_pagep;
+    uint8_t* ram_hostp;
+    uint32_t pfn, k;
+    uint8_t i, j, shared_flag;
+    for(i = 0; i < vcpu_ct; i++){
+        vp = &vcpus[i];
+        for(k = 0; k < vp->shadow_ct; k++){
+            pfn = vp->dirty_pfns[k];
+            pagep = &vp->pmmp->pages[pfn];
+            if(pagep->ram_write_hostp == 0){ // merged along with a lower vCPU
+                continue;
+            }
+            ram_hostp = vp->shared_pmmp->pages[pfn].ram_hostp;
+            // a write protected page of the computer is shown to its fault_cb (RAM watch)
+            if_unlikely(vp->shared_pmmp->pages[pfn].ram_write_hostp == 0){
+                phys_mem_map_fault(vp->shared_pmmp, &vp->shared_pmmp->pages[pfn],
+                    pfn << PHYS_MEM_PAGE_SHIFT);
+            }
+            shared_flag = 0;
+            for(j = i + 1; j < vcpu_ct; j++){
+                if(vcpus[j].pmmp->pages[pfn].ram_write_hostp){
+                    shared_flag = 1;
+                    break;
+                }
+            }
+            if_likely(!shared_flag){
+                memcpy(ram_hostp, pagep->ram_hostp, PHYS_MEM_PAGE_SIZE);
+            }else{
+                memcpy(merge_buf, ram_hostp, PHYS_MEM_PAGE_SIZE);
+                turingcell_smp_page_apply_diff(merge_buf, pagep->ram_hostp, ram_hostp);
+                for(j = i + 1; j < vcpu_ct; j++){
+                    other_pagep = &vcpus[j].pmmp->pages[pfn];
+                    if(other_pagep->ram_write_hostp){
+                        turingcell_smp_page_apply_diff(merge_buf, other_pagep->ram_hostp, ram_hostp);
+                        turingcell_smp_page_reset(other_pagep, ram_hostp);
+                    }
+                }
+                memcpy(ram_hostp, merge_buf, PHYS_MEM_PAGE_SIZE);
+            }
+            turingcell_smp_page_reset(pagep, ram_hostp);
+        }
+        vp->shadow_ct = 0;
+    }
+}
+
+#endif
@@ -20,8 +20,49 @@
 //  1. ARM DDI 0100I page A4-6: add rd is r15 (but only work in usr and sys mode)
 //  2. In all variants of ARMv4 and ARMv5, bits[1:0] of a value written to R15 in ARM state
 //      must be 0b00. If they are not, the results are UNPREDICTABLE.
+//      Here R15 keeps them and the fetch ignores them.
 
 #include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include "../common/crc32_md.h"
+#include "../common/softfloat_md.h"
+#include "../common/latency_histogram.h"
+
+#define ARMV4CPU_CODE_CACHE_ENTRY_CT    1024            // must be a power of 2
+#define ARMV4CPU_CODE_CACHE_TAG_NONE    ((uint32_t)1)   // never a 4 bytes aligned paddr
+#define ARMV4CPU_CODE_CACHE_BUCKET_CT   256             // must be a power of 2
+#define ARMV4CPU_CODE_PAGE_SHIFT        12              // the code pages of the memory map
+
+// the rows of ARM DDI 0100I Figure A3-1 (Page A3-2), ARMV4CPU_ROW_UNCOND for the cond 0b1111
+// space, see `armv4cpu_inst_predecode`
+#define ARMV4CPU_ROW_UNCOND             0
+#define ARMV4CPU_ROW_DP_IMM_SHIFT       1
+#define ARMV4CPU_ROW_MISC_2             2
+#define ARMV4CPU_ROW_DP_REG_SHIFT       3
+#define ARMV4CPU_ROW_MISC_4             4
+#define ARMV4CPU_ROW_MUL_EXTRA_LDR_STR  5
+#define ARMV4CPU_ROW_DP_IMM             6
+#define ARMV4CPU_ROW_UNDEF_7            7
+#define ARMV4CPU_ROW_MSR_IMM            8
+#define ARMV4CPU_ROW_LDR_STR_IMM        9
+#define ARMV4CPU_ROW_LDR_STR_REG        10
+#define ARMV4CPU_ROW_UNDEF_11           11
+#define ARMV4CPU_ROW_UNDEF_12           12
+#define ARMV4CPU_ROW_LDM_STM            13
+#define ARMV4CPU_ROW_B_BL               14
+#define ARMV4CPU_ROW_COPROC_LDC_STC     15
+#define ARMV4CPU_ROW_COPROC_CDP         16
+#define ARMV4CPU_ROW_COPROC_MCR_MRC     17
+#define ARMV4CPU_ROW_SWI                18
+
+// an inst with what its decode gives, see `armv4cpu_inst_predecode`
+typedef struct {
+    uint32_t paddr;     // in the predecode cache: the tag, ARMV4CPU_CODE_CACHE_TAG_NONE if free
+    uint32_t inst;
+    uint32_t operand;   // rows 6 and 8: the rotated immediate | row 14: the offset from PC + 8
+    uint8_t row;        // ARMV4CPU_ROW_*
+} armv4cpu_predecoded_inst_t;
 
 typedef struct {
     uint32_t R[31];     // register
@@ -34,6 +75,15 @@ typedef struct {
     uint64_t inst_executed_ct_in_this_execute;   // cleared after cpu reset and at the entry point
                                                  //   of function call `armv4cpu_execute`
 
+    // set by the CP15 wait-for-interrupt operation and cleared by `armv4cpu_wakeup`
+    // while it is set the cpu only burns its inst budget (see `armv4cpu_execute`)
+    uint8_t wait_for_interrupt_flag;
+
+    // VFP coprocessor, see `** VFP **`
+    uint32_t vfp_S[32];     // single precision registers, D[n] is S[2n + 1]:S[2n]
+    uint32_t vfp_fpscr;
+    uint32_t vfp_fpexc;     // disabled (0) after cpu reset
+
     // temp bellow
     // all members below are **temporary** and does not need to be serialized
     uint64_t inst_ct_limit_in_this_execute;
@@ -44,7 +94,7 @@ typedef struct {
     uint8_t inst_enter_cpsr_carryout_flag_ro;       // inst enter cpsr C state, readonly
     uint8_t inst_enter_cpsr_v_overflow_flag_ro;     // inst enter cpsr V state, readonly
     uint8_t inst_enter_cpumodn_ro;                  // inst enter cpumodn state, readonly
-    uint8_t inst_enter_real_PC_ro;                  // inst enter real PC value, readonly
+    uint32_t inst_enter_real_PC_ro;                 // inst enter real PC value, readonly
     uint8_t dp_do_not_write_result_to_rd_flag;      // do not need to write result to rd
 
     uint8_t dp_next_negative_flag;      // could only be used inside dp inst
@@ -63,8 +113,44 @@ typedef struct {
     // actually under privileged mode
     uint8_t mmu_inst_is_ldrxt_strxt_flag;
     uint8_t mmu_data_access_need_abort_flag;
+    uint8_t mmu_inst_fetch_need_abort_flag;
+    // set by any data access through the mmu and by any VFP inst (the idle loop snapshot does
+    // not cover the VFP registers), used by the idle loop detection
+    uint8_t mmu_data_access_happened_flag;
+
+    // derived from the interrupt controller state and the cpsr I/F bits
+    //  see `armv4cpu_set_interrupt_lines`
+    uint8_t irq_line;
+    uint8_t fiq_line;
+    uint8_t interrupt_possible_flag;    // an unmasked irq or fiq is pending
+
+    // physical memory of the computer this cpu belongs to, only used by the dependent api
+    void* phys_mem_ctx;
+
+    // SMP, see `armv4cpu_inst_defer`
+    uint8_t inst_deferred_flag;             // the last inst of this execute has been deferred
+    uint8_t atomic_inst_need_defer_flag;    // SWP/SWPB have to be deferred
+
+    // idle loop detection, see `armv4cpu_idle_loop_on_backward_branch`
+    uint8_t idle_loop_snapshot_valid_flag;
+    uint32_t idle_loop_head_PC;
+    uint64_t idle_loop_head_inst_ct;            // inst_executed_ct_in_this_execute at loop head
+    uint32_t idle_loop_snapshot[31 + 1 + 6];    // R[31] + cpsr + spsr[6] at loop head
+
+    // predecode cache, see `armv4cpu_code_cache_fetch`
+    armv4cpu_predecoded_inst_t code_cache[ARMV4CPU_CODE_CACHE_ENTRY_CT];
+    uint16_t code_cache_bucket_cts[ARMV4CPU_CODE_CACHE_BUCKET_CT];  // cached insts per bucket
+    armv4cpu_predecoded_inst_t code_cache_bypass;   // the latest inst fetched around the cache
+
+    // run the same inst handlers without the shortcuts around them: no predecode cache, no
+    // idle loop fast forward and the generic dp, see cpu_lockstep.h
+    uint8_t reference_flag;
+
+    // host time of every exception entry, NULL if not measured (see latency_histogram.h)
+    latency_histogram_t* exception_histp;
 
     uint32_t this_inst;
+    uint32_t this_operand;  // of the predecoded this_inst
 } armv4cpu_md_t;
 
 const uint8_t gl_armv4_reg_const_lookup_array_mod_to_regtidx[16] =
@@ -101,12 +187,6 @@ const uint8_t gl_armv4_reg_const_lookup_array_regtidx_to_realr_idx[6][16] = {
 #define CPUMODEN_UND 0x1b
 #define CPUMODEN_SYS 0x1f
 
-#define EXCEPTION_CPUMODEN_FIQ CPUMODEN_FIQ
-#define EXCEPTION_CPUMODEN_IRQ CPUMODEN_IRQ
-#define EXCEPTION_CPUMODEN_SVC CPUMODEN_SVC
-#define EXCEPTION_CPUMODEN_ABT CPUMODEN_ABT
-#define EXCEPTION_CPUMODEN_UND CPUMODEN_UND
-
 #define EXCEPTION_VECTOR_ADDR_UND           ((uint32_t)0x04)
 #define EXCEPTION_VECTOR_ADDR_SWI           ((uint32_t)0x08)
 #define EXCEPTION_VECTOR_ADDR_INST_ABT      ((uint32_t)0x0c)
@@ -114,6 +194,36 @@ const uint8_t gl_armv4_reg_const_lookup_array_regtidx_to_realr_idx[6][16] = {
 #define EXCEPTION_VECTOR_ADDR_IRQ           ((uint32_t)0x18)
 #define EXCEPTION_VECTOR_ADDR_FIQ           ((uint32_t)0x1c)
 
+#define EXCEPTION_KIND_UND                  0
+#define EXCEPTION_KIND_SWI                  1
+#define EXCEPTION_KIND_INST_ABT             2
+#define EXCEPTION_KIND_DATA_ABT             3
+#define EXCEPTION_KIND_IRQ                  4
+#define EXCEPTION_KIND_FIQ                  5
+
+// everything an exception entry writes, precomputed per kind. The new cpsr keeps the bits of
+// the current one outside cpsr_clear (flags, and F unless fiq, ARM DDI 0100I page A2-13) and
+// ors cpsr_set in, so none of it depends on the mode the exception is taken from and the
+// entry is a few stores
+typedef struct {
+    uint32_t cpsr_clear;    // mode | T | I (| F for fiq)
+    uint32_t cpsr_set;      // mode | I (| F for fiq)
+    uint8_t r14_idx;        // armv4cpu_md_t.R slot of the banked r14 of the mode
+    uint8_t spsr_idx;       // armv4cpu_md_t.spsr slot of the mode
+    uint32_t vector_addr;
+} armv4cpu_exception_entry_t;
+
+// slots as in gl_armv4_reg_const_lookup_array_mod_to_regtidx and
+// gl_armv4_reg_const_lookup_array_regtidx_to_realr_idx
+const armv4cpu_exception_entry_t gl_armv4cpu_exception_entries[6] = {
+    {0xbf, CPUMODEN_UND | 0x80, 21, 3, EXCEPTION_VECTOR_ADDR_UND},          // UND
+    {0xbf, CPUMODEN_SVC | 0x80, 17, 1, EXCEPTION_VECTOR_ADDR_SWI},          // SWI
+    {0xbf, CPUMODEN_ABT | 0x80, 19, 2, EXCEPTION_VECTOR_ADDR_INST_ABT},     // INST_ABT
+    {0xbf, CPUMODEN_ABT | 0x80, 19, 2, EXCEPTION_VECTOR_ADDR_DATA_ABT},     // DATA_ABT
+    {0xbf, CPUMODEN_IRQ | 0x80, 23, 4, EXCEPTION_VECTOR_ADDR_IRQ},          // IRQ
+    {0xff, CPUMODEN_FIQ | 0xc0, 30, 5, EXCEPTION_VECTOR_ADDR_FIQ},          // FIQ
+};
+
 
 // helpers
 // get_cur_cpumod() // usr sys svc abrt undef irq fiq
@@ -215,77 +325,53 @@ armv4cpu_hwreset
 armv4cpu_load_persistent_cpu_state
 armv4cpu_save_persistent_cpu_state
 armv4cpu_execute(inst_amount_limit) -> inst_amount_executed
+armv4cpu_execute_limit_to_deadline
+armv4cpu_code_cache_flush
+armv4cpu_code_cache_invalidate
+armv4cpu_set_interrupt_lines
+armv4cpu_wakeup
 armv4cpu_destroy
 
 // dependent api
-armv4cpu_inst_fetch_mem()
-armv4cpu_data_read_mem()
-armv4cpu_data_write_mem()
+armv4cpu_phys_mem_fetch_4bytes()
+armv4cpu_phys_mem_read_4bytes()
+armv4cpu_phys_mem_read_2bytes()
+armv4cpu_phys_mem_read_1byte()
+armv4cpu_phys_mem_write_4bytes()
+armv4cpu_phys_mem_write_2bytes()
+armv4cpu_phys_mem_write_1byte()
+armv4cpu_phys_mem_ram_hostp()
+armv4cpu_phys_mem_code_page_mark()
+armv4cpu_phys_mem_code_page_unmark()
 */
 
+// ARM DDI 0100I: Page A3-4
+// bit NZCV (N << 3 | Z << 2 | C << 1 | V) of row cond is 1 if the cond passes with those flags
+const uint16_t gl_armv4cpu_cond_truth_table[16] = {
+    0xf0f0, // 0b'0000 EQ
+    0x0f0f, // 0b'0001 NE
+    0xcccc, // 0b'0010 CS/HS
+    0x3333, // 0b'0011 CC/LO
+    0xff00, // 0b'0100 MI
+    0x00ff, // 0b'0101 PL
+    0xaaaa, // 0b'0110 VS
+    0x5555, // 0b'0111 VC
+    0x0c0c, // 0b'1000 HI
+    0xf3f3, // 0b'1001 LS
+    0xaa55, // 0b'1010 GE
+    0x55aa, // 0b'1011 LT
+    0x0a05, // 0b'1100 GT
+    0xf5fa, // 0b'1101 LE
+    0xffff, // 0b'1110 AL
+    0x0000, // 0b'1111 (unpredictable, never tested)
+};
+
 // return 0 for fail or non-0 for success
 // Note: unpredictable if inst_cond == 0b'1111
-// TODO: use lookup table directly instead of the switch-case
+// always_inline
 inline uint32_t
 armv4cpu_inst_cond_test_is_ok(uint32_t inst, uint32_t psr) {
-    // ARM DDI 0100I: Page A3-4
-    uint32_t cond = bits_span_drop_to_floor_u32(inst, 31, 28);
-    if_likely(cond == 14){ // 0b'1110 AL
-        return 1;
-    }
-    switch(cond){
-        case 0: // 0b'0000 EQ
-            return get_psr_Z(psr);
-            break;
-        case 1: // 0b'0001 NE
-            return !get_psr_Z(psr);
-            break;
-        case 2: // 0b'0010 CS/HS
-            return get_psr_C(psr);
-            break;
-        case 3: // 0b'0011 CC/LO
-            return !get_psr_C(psr);
-            break;
-        case 4: // 0b'0100 MI
-            return get_psr_N(psr);
-            break;
-        case 5: // 0b'0101 PL
-            return !get_psr_N(psr);
-            break;
-        case 6: // 0b'0110 VS
-            return get_psr_V(psr);
-            break;
-        case 7: // 0b'0111 VC
-            return !get_psr_V(psr);
-            break;
-        case 8: // 0b'1000 HI
-            return (get_psr_C(psr) && (!get_psr_Z(psr)));
-            break;
-        case 9: // 0b'1001 LS
-            return ((!get_psr_C(psr)) || get_psr_Z(psr));
-            break;
-        case 10: // 0b'1010 GE
-            return (get_psr_N(psr) == get_psr_V(psr));
-            break;
-        case 11: // 0b'1011 LT
-            return (get_psr_N(psr) != get_psr_V(psr));
-            break;
-        case 12: // 0b'1100 GT
-            return ((!get_psr_Z(psr)) && (get_psr_N(psr) == get_psr_V(psr)));
-            break;
-        case 13: // 0b'1101 LE
-            return (get_psr_Z(psr) || (get_psr_N(psr) != get_psr_V(psr)));
-            break;
-        case 14: // 0b'1110 AL
-            assert(0);
-            break;
-        case 15: // 0b'1111
-            assert(0);
-            break;
-        default:
-            assert(0);
-    }
-    assert(0);
+    return (gl_armv4cpu_cond_truth_table[inst >> 28] >> (psr >> 28)) & 1;
 }
 
 // always_inline
@@ -297,6 +383,35 @@ armv4cpu_update_cpsr_NZCV_part(armv4cpu_md_t* cpup  , uint8_t n, uint8_t z, uint
     set_cpsr(cpup, psr);
 }
 
+// ** interrupt **
+// the interrupt controller drives the irq/fiq lines, and `interrupt_possible_flag` caches
+// whether any of them is unmasked by the cpsr. The flag is only recomputed when the lines or
+// the cpsr I/F bits change, and only tested at the deterministic delivery points:
+//  1. the entry of `armv4cpu_execute`
+//  2. basic block boundaries: after an inst writes PC non-sequentially (B BL BX, dp with rd
+//     is PC) and after an exception entry
+//  3. after an inst writes the cpsr I/F bits (MSR, dp with S bit and rd is PC)
+// so the common no-interrupt path never pays for it
+
+// always_inline
+inline void
+armv4cpu_update_interrupt_possible_flag(armv4cpu_md_t* cpup){
+    uint32_t cpsr = get_cpsr(cpup);
+    cpup->interrupt_possible_flag =
+        (cpup->fiq_line && !(cpsr & (uint32_t)0x40)) ||
+        (cpup->irq_line && !(cpsr & (uint32_t)0x80));
+}
+
+inline void armv4cpu_deliver_interrupt(armv4cpu_md_t* cpup);
+
+// always_inline
+inline void
+armv4cpu_on_block_boundary(armv4cpu_md_t* cpup){
+    if_unlikely(cpup->interrupt_possible_flag){
+        armv4cpu_deliver_interrupt(cpup);
+    }
+}
+
 // always_inline
 inline void
 armv4cpu_inst_nop(armv4cpu_md_t* cpup  , uint8_t cpumodn){
@@ -307,7 +422,17 @@ armv4cpu_inst_nop(armv4cpu_md_t* cpup  , uint8_t cpumodn){
 // always_inline
 inline void
 armv4cpu_inst_enter_init_tmp(armv4cpu_md_t* cpup){
-    /* others NEEND to be implemented!!! */
+    uint32_t cpsr = get_cpsr(cpup);
+    cpup->inst_enter_cpsr_negative_flag_ro = get_psr_N(cpsr);
+    cpup->inst_enter_cpsr_zero_flag_ro = get_psr_Z(cpsr);
+    cpup->inst_enter_cpsr_carryout_flag_ro = get_psr_C(cpsr);
+    cpup->inst_enter_cpsr_v_overflow_flag_ro = get_psr_V(cpsr);
+    cpup->inst_enter_cpumodn_ro = get_cur_cpumodn(cpup);
+    cpup->inst_enter_real_PC_ro = get_PC(cpup, cpup->inst_enter_cpumodn_ro);
+
+    cpup->mmu_inst_is_ldrxt_strxt_flag = 0;
+    cpup->mmu_data_access_need_abort_flag = 0;
+    cpup->mmu_inst_fetch_need_abort_flag = 0;
 
     cpup->dp_next_negative_flag = 0;
     cpup->dp_next_zero_flag = 0;
@@ -353,7 +478,7 @@ armv4cpu_ror(uint32_t u32, uint8_t n){
 }
 
 // always_inline
-inline void
+static inline void
 armv4cpu_inst_dp_calc_op2_op2reg_immshift(armv4cpu_md_t* cpup){
     uint32_t shift_type = bits_span_drop_to_floor_u32(cpup->this_inst, 6, 5);       // [0, 3]
     uint8_t shift_amt = bits_span_drop_to_floor_u32(cpup->this_inst, 11, 7);        // [0, 31]
@@ -405,7 +530,7 @@ armv4cpu_inst_dp_calc_op2_op2reg_immshift(armv4cpu_md_t* cpup){
 }
 
 // always_inline
-inline void
+static inline void
 armv4cpu_inst_dp_calc_op2_op2reg_regshift(armv4cpu_md_t* cpup){
     uint32_t shift_type = bits_span_drop_to_floor_u32(cpup->this_inst, 6, 5);
     uint8_t shift_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 11, 8);
@@ -499,16 +624,12 @@ armv4cpu_inst_dp_calc_op2_op2reg_regshift(armv4cpu_md_t* cpup){
 }
 
 // always_inline
-inline void
+static inline void
 armv4cpu_inst_dp_calc_op2_op2imm(armv4cpu_md_t* cpup){
-    uint8_t rotate_imm = bits_span_drop_to_floor_u32(cpup->this_inst, 11, 8);   // [0, 15]
-    uint32_t imm32 = bits_span_drop_to_floor_u32(cpup->this_inst, 7, 0);
-
-    if(rotate_imm == 0){
+    cpup->dp_op2 = cpup->this_operand; // rotated by `armv4cpu_inst_predecode`
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 11, 8) == 0){ // rotate_imm
         cpup->dp_next_carry_out_flag = cpup->inst_enter_cpsr_carryout_flag_ro;
-        cpup->dp_op2 = imm32;
-    }else{ // rotate_imm belong to [1, 15]
-        cpup->dp_op2 = armv4cpu_ror(imm32, rotate_imm + rotate_imm); // n belong to [2, 30]
+    }else{
         cpup->dp_next_carry_out_flag = bits_span_drop_to_floor_u32(cpup->dp_op2, 31, 31);
     }
 }
@@ -602,15 +723,44 @@ armv4cpu_inst_sbc_signed_is_overflow(uint32_t op1, uint32_t op2, uint32_t c){
     }
 }
 
+// the S form of a dp inst writing PC, the return from an exception: cpsr = spsr of the mode
 // always_inline
 inline void
-armv4cpu_inst_dp_exec(armv4cpu_md_t* cpup){
-    uint32_t opcode = bits_span_drop_to_floor_u32(cpup->this_inst, 24, 21);
+armv4cpu_inst_dp_spsr_restore(armv4cpu_md_t* cpup){
+    uint8_t cpumodn = cpup->inst_enter_cpumodn_ro;
+    // unpredictable behaviour in usr and sys, we just leave the cpsr as it is
+    if_likely(cpumodn != CPUMODEN_USR && cpumodn != CPUMODEN_SYS){
+        cpup->cpsr = cpup->spsr[gl_armv4_reg_const_lookup_array_mod_to_regtidx[cpumodn & 0x0f]];
+        armv4cpu_update_interrupt_possible_flag(cpup);
+    }
+    armv4cpu_on_block_boundary(cpup);
+}
+
+// ** data processing **
+// one template for all the data processing insts: opcode and s_flag are compile time constants
+// at every call site below, so each handler is specialized down to its own ALU operation and
+// flags update, and the only branch left on the data is rd == PC. The template and the op2
+// helpers are static: the handlers are called through tables and are not inline themselves,
+// so a plain C99 `inline` would leave the helpers without any external definition
+// always_inline
+static inline void
+armv4cpu_inst_dp_exec_specialized(armv4cpu_md_t* cpup, const uint8_t opcode, const uint8_t s_flag){
     uint8_t op1_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 19, 16);
     uint8_t rd_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 15, 12);
     uint32_t op1 = get_R(cpup, cpup->inst_enter_cpumodn_ro, op1_regidx); // Rn
     uint32_t op2 = cpup->dp_op2;
     uint32_t result = 0;
+    if_unlikely(op1_regidx == REGIDX_PC){
+        op1 = op1 + 8;
+    }
+    // `MOVS pc, lr` and `SUBS pc, lr, #4`, the exception returns of a guest kernel: no flags
+    if(s_flag && (opcode == 13 || opcode == 2)){
+        if_unlikely(rd_regidx == REGIDX_PC){
+            cpup->R[REGIDX_PC] = opcode == 13 ? op2 : op1 - op2;
+            armv4cpu_inst_dp_spsr_restore(cpup);
+            return;
+        }
+    }
     cpup->dp_do_not_write_result_to_rd_flag = 0;
     switch(opcode){
         case 0:  // AND : logical
@@ -708,18 +858,9 @@ armv4cpu_inst_dp_exec(armv4cpu_md_t* cpup){
     }else{
         set_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx, result);
     }
-    if(bits_span_drop_to_floor_u32(cpup->this_inst, 20, 20)){ // S bit: set condition code
+    if(s_flag){ // S bit: set condition code
         if_unlikely(rd_regidx == REGIDX_PC){
-            if_unlikely(cpup->inst_enter_cpumodn_ro == CPUMODEN_USR ||
-                cpup->inst_enter_cpumodn_ro == CPUMODEN_SYS){
-
-                // unpredictable behaviour, do what you like ;-p
-                // we just leave it here now
-                return;
-            }else{
-                set_cpsr(cpup, get_spsr(cpup, cpup->inst_enter_cpumodn_ro));
-                return;
-            }
+            armv4cpu_inst_dp_spsr_restore(cpup);
             return;
         }else{
             armv4cpu_update_cpsr_NZCV_part(cpup,
@@ -728,50 +869,133 @@ armv4cpu_inst_dp_exec(armv4cpu_md_t* cpup){
         }
     }else{
         if_unlikely(rd_regidx == REGIDX_PC){
+            armv4cpu_on_block_boundary(cpup);
             return;
         }
     }
     set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
 }
 
+#define ARMV4CPU_DP_HANDLER_DEFINE(op2_form, opcode, s_flag)                                \
+    void                                                                                    \
+    armv4cpu_inst_dp_##op2_form##_##opcode##_##s_flag(armv4cpu_md_t* cpup){                 \
+        armv4cpu_inst_dp_calc_op2_##op2_form(cpup);                                         \
+        armv4cpu_inst_dp_exec_specialized(cpup, opcode, s_flag);                            \
+    }
+
+#define ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, opcode)                                      \
+    ARMV4CPU_DP_HANDLER_DEFINE(op2_form, opcode, 0)                                         \
+    ARMV4CPU_DP_HANDLER_DEFINE(op2_form, opcode, 1)
+
+#define ARMV4CPU_DP_HANDLERS_DEFINE(op2_form)                                               \
+    ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 0)  ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 1)    \
+    ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 2)  ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 3)    \
+    ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 4)  ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 5)    \
+    ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 6)  ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 7)    \
+    ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 8)  ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 9)    \
+    ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 10) ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 11)   \
+    ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 12) ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 13)   \
+    ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 14) ARMV4CPU_DP_HANDLER_DEFINE_S(op2_form, 15)
+
+#define ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, opcode)                                     \
+    armv4cpu_inst_dp_##op2_form##_##opcode##_0, armv4cpu_inst_dp_##op2_form##_##opcode##_1
+
+#define ARMV4CPU_DP_HANDLER_ENTRIES(op2_form)                                               \
+    ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 0),  ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 1),  \
+    ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 2),  ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 3),  \
+    ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 4),  ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 5),  \
+    ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 6),  ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 7),  \
+    ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 8),  ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 9),  \
+    ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 10), ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 11), \
+    ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 12), ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 13), \
+    ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 14), ARMV4CPU_DP_HANDLER_ENTRIES_S(op2_form, 15)
+
+ARMV4CPU_DP_HANDLERS_DEFINE(op2imm)
+ARMV4CPU_DP_HANDLERS_DEFINE(op2reg_immshift)
+ARMV4CPU_DP_HANDLERS_DEFINE(op2reg_regshift)
+
+typedef void (*armv4cpu_inst_dp_handler_t)(armv4cpu_md_t* cpup);
+
+// indexed by inst[24:20], i.e. opcode << 1 | S
+const armv4cpu_inst_dp_handler_t gl_armv4cpu_inst_dp_op2imm_handlers[32] = {
+    ARMV4CPU_DP_HANDLER_ENTRIES(op2imm)
+};
+const armv4cpu_inst_dp_handler_t gl_armv4cpu_inst_dp_op2reg_immshift_handlers[32] = {
+    ARMV4CPU_DP_HANDLER_ENTRIES(op2reg_immshift)
+};
+const armv4cpu_inst_dp_handler_t gl_armv4cpu_inst_dp_op2reg_regshift_handlers[32] = {
+    ARMV4CPU_DP_HANDLER_ENTRIES(op2reg_regshift)
+};
+
+// the same template with the opcode and the S bit only known at run time
+void
+armv4cpu_inst_dp_reference_exec(armv4cpu_md_t* cpup){
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 25, 25)){
+        armv4cpu_inst_dp_calc_op2_op2imm(cpup);
+    }else if(bits_span_drop_to_floor_u32(cpup->this_inst, 4, 4)){
+        armv4cpu_inst_dp_calc_op2_op2reg_regshift(cpup);
+    }else{
+        armv4cpu_inst_dp_calc_op2_op2reg_immshift(cpup);
+    }
+    armv4cpu_inst_dp_exec_specialized(cpup, bits_span_drop_to_floor_u32(cpup->this_inst, 24, 21),
+        bits_span_drop_to_floor_u32(cpup->this_inst, 20, 20));
+}
+
 // always_inline
 inline void
-armv4cpu_inst_raise_exception(
-    armv4cpu_md_t* cpup, uint8_t exception_cpumodn,
-    uint32_t return_link_addr, uint32_t exception_vector_addr){
+armv4cpu_inst_raise_exception(armv4cpu_md_t* cpup, uint8_t exception_kind,
+    uint32_t return_link_addr){
 
-    if_unlikely(exception_cpumodn == CPUMODEN_USR || exception_cpumodn == CPUMODEN_SYS){
-        assert(0);
+    const armv4cpu_exception_entry_t* ep = &gl_armv4cpu_exception_entries[exception_kind];
+    uint32_t cpsr = cpup->cpsr;
+    uint64_t t0;
+    if_unlikely(cpup->inst_deferred_flag){ // the data abort of a deferred inst is not real
+        return;
     }
+    t0 = latency_histogram_probe_begin(cpup->exception_histp);
+    cpup->R[ep->r14_idx] = return_link_addr;
+    cpup->spsr[ep->spsr_idx] = cpsr;
+    cpup->cpsr = (cpsr & ~ep->cpsr_clear) | ep->cpsr_set;
+    cpup->R[REGIDX_PC] = ep->vector_addr;
+    armv4cpu_update_interrupt_possible_flag(cpup);
+    armv4cpu_on_block_boundary(cpup);
+    latency_histogram_probe_end(cpup->exception_histp, t0);
+}
 
-    set_R(cpup, exception_cpumodn, REGIDX_R14, return_link_addr);
-    uint32_t cpsr = get_cpsr(cpup);
-    set_spsr(cpup, exception_cpumodn, cpsr);
-    cpsr = (cpsr >> 8) << 8;
-    cpsr = cpsr + ((uint32_t)exception_cpumodn) + ((uint32_t)0x80);
-    if(exception_cpumodn == CPUMODEN_FIQ){
-        cpsr = cpsr + ((uint32_t)0x40);
+// fiq has the higher priority
+// the next inst to execute is pointed by PC, the handler returns by `SUBS pc, lr, #4`
+inline void
+armv4cpu_deliver_interrupt(armv4cpu_md_t* cpup){
+    uint32_t next_pc = get_PC(cpup, get_cur_cpumodn(cpup));
+    if(cpup->fiq_line && !(get_cpsr(cpup) & (uint32_t)0x40)){
+        armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_FIQ, next_pc + 4);
+    }else{
+        armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_IRQ, next_pc + 4);
+    }
+}
+
+// called by the interrupt controller whenever its output lines change
+// always_inline
+inline void
+armv4cpu_set_interrupt_lines(armv4cpu_md_t* cpup, uint8_t irq_line, uint8_t fiq_line){
+    cpup->irq_line = irq_line;
+    cpup->fiq_line = fiq_line;
+    if(irq_line || fiq_line){
+        cpup->wait_for_interrupt_flag = 0;
     }
-    set_cpsr(cpup, cpsr);
-    set_PC(cpup, cpup->inst_enter_cpumodn_ro, exception_vector_addr);
+    armv4cpu_update_interrupt_possible_flag(cpup);
 }
 
 // always_inline
 inline void
 armv4cpu_inst_undefined_exec(armv4cpu_md_t* cpup){
-    armv4cpu_inst_raise_exception(cpup,
-        EXCEPTION_CPUMODEN_UND,
-        cpup->inst_enter_real_PC_ro + 4,
-        EXCEPTION_VECTOR_ADDR_UND);
+    armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_UND, cpup->inst_enter_real_PC_ro + 4);
 }
 
 // always_inline
 inline void
 armv4cpu_inst_swi_exec(armv4cpu_md_t* cpup){
-    armv4cpu_inst_raise_exception(cpup,
-        EXCEPTION_CPUMODEN_SVC,
-        cpup->inst_enter_real_PC_ro + 4,
-        EXCEPTION_VECTOR_ADDR_SWI);
+    armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_SWI, cpup->inst_enter_real_PC_ro + 4);
 }
 
 // always_inline
@@ -785,20 +1009,18 @@ armv4cpu_inst_bx_exec(armv4cpu_md_t* cpup){
         return;
     }
     set_PC(cpup, cpup->inst_enter_cpumodn_ro, rn);
+    armv4cpu_on_block_boundary(cpup);
 }
 
 // always_inline
 inline void
 armv4cpu_inst_b_bl_exec(armv4cpu_md_t* cpup){
-    uint32_t offset = bits_span_drop_to_floor_u32(cpup->this_inst, 23, 0);
-    uint8_t neg_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 23, 23);
-    offset = offset << 2;
-    if(neg_flag){
-        offset = offset | (uint32_t)0xfc000000;
+    uint32_t pc = get_R(cpup, cpup->inst_enter_cpumodn_ro, REGIDX_PC);
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 24, 24)){ // L
+        set_R(cpup, cpup->inst_enter_cpumodn_ro, REGIDX_R14, pc + 4);
     }
-    uint32_t pc = get_R(cpup, cpup->inst_enter_cpumodn_ro, REGIDX_PC) + 8;
-    set_R(cpup, cpup->inst_enter_cpumodn_ro, REGIDX_R14, pc);
-    set_R(cpup, cpup->inst_enter_cpumodn_ro, REGIDX_PC, pc + offset);
+    // this_operand: the sign extended offset + 8, see `armv4cpu_inst_predecode`
+    set_R(cpup, cpup->inst_enter_cpumodn_ro, REGIDX_PC, pc + cpup->this_operand);
 }
 
 // always_inline
@@ -858,25 +1080,14 @@ armv4cpu_inst_mull_mlal_exec(armv4cpu_md_t* cpup){
             u64 = ((uint64_t)rm) * ((uint64_t)rs);
         }
     }else{ // signed
-        int64_t i64, i64rm, i64rs;
+        int64_t i64rm, i64rs;
+        i64rm = (int32_t)rm;
+        i64rs = (int32_t)rs;
+        // |rm * rs| <= 2^62 never overflows, the accumulate wraps modulo 2^64 like the hardware
+        u64 = (uint64_t)(i64rm * i64rs);
         if(acmul_flag){
-            u64 = get_R(cpup, cpup->inst_enter_cpumodn_ro, rdhi_regidx);
-            u64 = u64 << 32;
-            u64 = get_R(cpup, cpup->inst_enter_cpumodn_ro, rdlo_regidx) + u64;
-            i64 = *((int64_t*)&u64);
-            u64 = (uint64_t)rm;
-            i64rm = *((int64_t*)&u64);
-            u64 = (uint64_t)rs;
-            i64rs = *((int64_t*)&u64);
-            i64 = i64rm * i64rs + i64;
-            u64 = *((uint64_t*)&i64);
-        }else{
-            u64 = (uint64_t)rm;
-            i64rm = *((int64_t*)&u64);
-            u64 = (uint64_t)rs;
-            i64rs = *((int64_t*)&u64);
-            i64 = i64rm * i64rs + i64;
-            u64 = *((uint64_t*)&i64);
+            u64 = (((uint64_t)get_R(cpup, cpup->inst_enter_cpumodn_ro, rdhi_regidx)) << 32) +
+                get_R(cpup, cpup->inst_enter_cpumodn_ro, rdlo_regidx) + u64;
         }
     }
     rdhi = (uint32_t)(u64 >> 32);
@@ -898,6 +1109,164 @@ armv4cpu_inst_mull_mlal_exec(armv4cpu_md_t* cpup){
     set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
 }
 
+// ** ARMv5TE **
+// the DSP extension of ARM DDI 0100I chapter A10: the saturating arithmetic and the signed
+// 16 bit multiplies. The sticky Q flag is bit 27 of the cpsr, it is only ever set here and
+// cleared by MSR.
+
+#define ARMV4CPU_CPSR_Q_BIT         ((uint32_t)0x08000000)
+
+// always_inline
+inline void
+armv4cpu_set_cpsr_Q(armv4cpu_md_t* cpup){
+    set_cpsr(cpup, get_cpsr(cpup) | ARMV4CPU_CPSR_Q_BIT);
+}
+
+// ret u32: i64 saturated to the signed 32 bit range, Q set if it had to
+// always_inline
+inline uint32_t
+armv4cpu_signed_sat32(armv4cpu_md_t* cpup, int64_t i64){
+    int32_t i32;
+    if_unlikely(i64 > (int64_t)0x7fffffff){
+        armv4cpu_set_cpsr_Q(cpup);
+        i32 = 0x7fffffff;
+    }else if(i64 < -(int64_t)0x80000000){
+        armv4cpu_set_cpsr_Q(cpup);
+        i32 = -0x7fffffff - 1;
+    }else{
+        i32 = (int32_t)i64;
+    }
+    return *((uint32_t*)&i32);
+}
+
+// always_inline
+inline int64_t
+armv4cpu_u32_to_i64(uint32_t u32){
+    int32_t i32 = *((int32_t*)&u32);
+    return (int64_t)i32;
+}
+
+// ret: the signed bottom (top if top_flag) half of u32
+// always_inline
+inline int32_t
+armv4cpu_half_to_i32(uint32_t u32, uint8_t top_flag){
+    uint16_t u16 = (uint16_t)(top_flag ? (u32 >> 16) : u32);
+    int16_t i16 = *((int16_t*)&u16);
+    return (int32_t)i16;
+}
+
+// CLZ
+// always_inline
+inline void
+armv4cpu_inst_clz_exec(armv4cpu_md_t* cpup){
+    uint32_t rm = get_R(cpup, cpup->inst_enter_cpumodn_ro,
+        bits_span_drop_to_floor_u32(cpup->this_inst, 3, 0));
+    uint32_t rd = 32;
+    if(rm){
+        rd = (uint32_t)__builtin_clz(rm);
+    }
+    set_R(cpup, cpup->inst_enter_cpumodn_ro,
+        bits_span_drop_to_floor_u32(cpup->this_inst, 15, 12), rd);
+    set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
+}
+
+// BLX Rm
+// always_inline
+inline void
+armv4cpu_inst_blx_reg_exec(armv4cpu_md_t* cpup){
+    uint32_t rm = get_R(cpup, cpup->inst_enter_cpumodn_ro,
+        bits_span_drop_to_floor_u32(cpup->this_inst, 3, 0));
+    uint32_t pc = get_R(cpup, cpup->inst_enter_cpumodn_ro, REGIDX_PC);
+    if_unlikely(bits_span_drop_to_floor_u32(rm, 0, 0)){ // thumb
+        // do not support thumb mode yet
+        armv4cpu_inst_undefined_exec(cpup);
+        return;
+    }
+    set_R(cpup, cpup->inst_enter_cpumodn_ro, REGIDX_R14, pc + 4);
+    set_PC(cpup, cpup->inst_enter_cpumodn_ro, rm);
+    armv4cpu_on_block_boundary(cpup);
+}
+
+// QADD QSUB QDADD QDSUB
+// always_inline
+inline void
+armv4cpu_inst_qadd_qsub_exec(armv4cpu_md_t* cpup){
+    int64_t rm = armv4cpu_u32_to_i64(get_R(cpup, cpup->inst_enter_cpumodn_ro,
+        bits_span_drop_to_floor_u32(cpup->this_inst, 3, 0)));
+    int64_t rn = armv4cpu_u32_to_i64(get_R(cpup, cpup->inst_enter_cpumodn_ro,
+        bits_span_drop_to_floor_u32(cpup->this_inst, 19, 16)));
+    uint32_t rd;
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 22, 22)){ // doubling
+        rn = armv4cpu_u32_to_i64(armv4cpu_signed_sat32(cpup, rn * 2));
+    }
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 21, 21)){ // sub
+        rd = armv4cpu_signed_sat32(cpup, rm - rn);
+    }else{
+        rd = armv4cpu_signed_sat32(cpup, rm + rn);
+    }
+    set_R(cpup, cpup->inst_enter_cpumodn_ro,
+        bits_span_drop_to_floor_u32(cpup->this_inst, 15, 12), rd);
+    set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
+}
+
+// SMLAxy SMLAWy SMULWy SMLALxy SMULxy
+// x (bit 5) selects the half of Rm, y (bit 6) the half of Rs, SMLAWy/SMULWy take the whole Rm
+// and keep bits [47:16] of the 48 bit product. Only the 32 bit accumulates set Q, SMLALxy
+// wraps around like SMLAL.
+// always_inline
+inline void
+armv4cpu_inst_smul_smla_16bits_exec(armv4cpu_md_t* cpup){
+    uint8_t x_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 5, 5);
+    uint8_t y_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 6, 6);
+    uint8_t rd_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 19, 16);
+    uint8_t rn_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 15, 12);
+    uint32_t rm = get_R(cpup, cpup->inst_enter_cpumodn_ro,
+        bits_span_drop_to_floor_u32(cpup->this_inst, 3, 0));
+    uint32_t rs = get_R(cpup, cpup->inst_enter_cpumodn_ro,
+        bits_span_drop_to_floor_u32(cpup->this_inst, 11, 8));
+    int64_t i64;
+    uint64_t u64;
+    uint32_t rd;
+    switch(bits_span_drop_to_floor_u32(cpup->this_inst, 22, 21)){
+        case 0: // SMLAxy
+            i64 = (int64_t)(armv4cpu_half_to_i32(rm, x_flag) * armv4cpu_half_to_i32(rs, y_flag));
+            i64 = i64 + armv4cpu_u32_to_i64(get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx));
+            if_unlikely(i64 > (int64_t)0x7fffffff || i64 < -(int64_t)0x80000000){
+                armv4cpu_set_cpsr_Q(cpup);
+            }
+            rd = (uint32_t)i64;
+            break;
+        case 1: // SMLAWy SMULWy
+            i64 = armv4cpu_u32_to_i64(rm) * armv4cpu_half_to_i32(rs, y_flag);
+            u64 = *((uint64_t*)&i64);
+            rd = (uint32_t)(u64 >> 16);
+            if(x_flag == 0){ // SMLAWy
+                i64 = armv4cpu_u32_to_i64(rd) +
+                    armv4cpu_u32_to_i64(get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx));
+                if_unlikely(i64 > (int64_t)0x7fffffff || i64 < -(int64_t)0x80000000){
+                    armv4cpu_set_cpsr_Q(cpup);
+                }
+                rd = (uint32_t)i64;
+            }
+            break;
+        case 2: // SMLALxy, RdHi is Rd and RdLo is Rn
+            i64 = (int64_t)(armv4cpu_half_to_i32(rm, x_flag) * armv4cpu_half_to_i32(rs, y_flag));
+            u64 = get_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx);
+            u64 = u64 << 32;
+            u64 = get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx) + u64;
+            u64 = u64 + *((uint64_t*)&i64);
+            set_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx, (uint32_t)u64);
+            rd = (uint32_t)(u64 >> 32);
+            break;
+        default: // SMULxy
+            i64 = (int64_t)(armv4cpu_half_to_i32(rm, x_flag) * armv4cpu_half_to_i32(rs, y_flag));
+            rd = (uint32_t)i64;
+            break;
+    }
+    set_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx, rd);
+    set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
+}
+
 // always_inline
 inline void
 armv4cpu_inst_msr_mrs_exec(armv4cpu_md_t* cpup){
@@ -919,16 +1288,16 @@ armv4cpu_inst_msr_mrs_exec(armv4cpu_md_t* cpup){
         }
         if(bits_span_drop_to_floor_u32(cpup->this_inst, 16, 16)){ // whole psr
             psr = r;
-        }else{ // psr flag bits only
-            psr = bits_span_drop_to_floor_u32(psr, 27, 0);
-            psr = psr | (bits_span_drop_to_floor_u32(r, 31, 28) << 28);
+        }else{ // psr flag bits only, NZCV and the ARMv5TE Q
+            psr = bits_span_drop_to_floor_u32(psr, 26, 0);
+            psr = psr | (bits_span_drop_to_floor_u32(r, 31, 27) << 27);
         }
         if(cpup->inst_enter_cpumodn_ro == CPUMODEN_USR){
             if(spsr_flag){
             }else{
                 uint32_t cpsr = get_cpsr(cpup);
-                cpsr = bits_span_drop_to_floor_u32(cpsr, 27, 0);
-                cpsr = cpsr | (bits_span_drop_to_floor_u32(psr, 31, 28) << 28);
+                cpsr = bits_span_drop_to_floor_u32(cpsr, 26, 0);
+                cpsr = cpsr | (bits_span_drop_to_floor_u32(psr, 31, 27) << 27);
                 set_cpsr(cpup, cpsr);
             }
         }else{
@@ -936,6 +1305,7 @@ armv4cpu_inst_msr_mrs_exec(armv4cpu_md_t* cpup){
                 set_spsr(cpup, cpup->inst_enter_cpumodn_ro, psr);
             }else{
                 set_cpsr(cpup, psr);
+                armv4cpu_update_interrupt_possible_flag(cpup);
             }
         }
     }else{ // MRS - r <= s
@@ -944,37 +1314,340 @@ armv4cpu_inst_msr_mrs_exec(armv4cpu_md_t* cpup){
     }
 
     set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
+    armv4cpu_on_block_boundary(cpup);
 }
 
 
+// dependent api, implemented by the computer which owns the physical memory map
+// paddr is the physical address, *abort_flagp is set to 1 if the access aborts
+// the 4 (2) bytes variants require paddr to be 4 (2) bytes aligned
+uint32_t armv4cpu_phys_mem_fetch_4bytes(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp);
+uint32_t armv4cpu_phys_mem_read_4bytes(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp);
+uint16_t armv4cpu_phys_mem_read_2bytes(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp);
+uint8_t armv4cpu_phys_mem_read_1byte(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp);
+void armv4cpu_phys_mem_write_4bytes(
+    armv4cpu_md_t* cpup, uint32_t paddr, uint32_t u32, uint8_t* abort_flagp);
+void armv4cpu_phys_mem_write_2bytes(
+    armv4cpu_md_t* cpup, uint32_t paddr, uint16_t u16, uint8_t* abort_flagp);
+void armv4cpu_phys_mem_write_1byte(
+    armv4cpu_md_t* cpup, uint32_t paddr, uint8_t u8, uint8_t* abort_flagp);
+// ret: host address of paddr for a direct access inside its page, or NULL if paddr is not
+//  plain RAM (or the write could not be granted)
+uint8_t* armv4cpu_phys_mem_ram_hostp(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t write_flag);
+// the inst at paddr is going to be cached, every later write to its page has to be reported
+//  back through `armv4cpu_code_cache_invalidate`
+// the pages are 1 << ARMV4CPU_CODE_PAGE_SHIFT bytes
+void armv4cpu_phys_mem_code_page_mark(armv4cpu_md_t* cpup, uint32_t paddr);
+// the last inst of the page at paddr has left the cache, the writes to it need not be reported
+//  any more, as far as this cpu is concerned
+void armv4cpu_phys_mem_code_page_unmark(armv4cpu_md_t* cpup, uint32_t paddr);
+
+// the smallest page of the ARMv4 mmu (tiny page), an access inside one never needs a second
+// translation
+#define ARMV4CPU_MMU_PAGE_SIZE_MIN  ((uint32_t)1024)
+
+// there is no mmu: the cpu has no CP15 control register (every MCR/MRC p15 but the wait for
+// interrupt is undefined), so the guest can never turn a translation on and every virtual
+// address is its physical address. The predecode cache and the paddr keyed callers rely on it
 // always_inline
 inline uint32_t
-armv4cpu_mmu_fetch_inst_4bytes(armv4cpu_md_t* cpup, uint32_t addr){
+armv4cpu_mmu_translate(armv4cpu_md_t* cpup, uint32_t addr){
+    return addr;
+}
+
+// ** predecode cache **
+// the fetched insts are kept decoded in a direct mapped cache indexed by the physical address:
+// a hit never walks the physical memory map nor the decode table, it hands the row of the inst
+// and its operand straight to the dispatch. The cpu marks the page of every inst it caches as
+// a code page of the map, and the map reports any write to a code page (stores of the cpu, DMA
+// of the devices) back, which drops exactly the entries of the written range. The cached insts
+// are counted per bucket of pages, and once a bucket is empty the page of the last inst which
+// left it is unmarked, so the stores to a page which is not code any more (overwritten code,
+// or code evicted by other code) are not reported any more.
+// The cache never changes the result: the cached inst always equals to the one in the memory.
+// The cache is temp and its pages are marked in the map the cpu is bound to, whoever binds the
+// cpu to another memory map flushes it first, or marks the pages of the cached insts in the
+// new map if the memory has not changed meanwhile
+
+// ARM DDI 0100I: Page A3-2 Figure A3-1
+// always_inline
+inline void
+armv4cpu_inst_predecode(uint32_t inst, armv4cpu_predecoded_inst_t* dst){
+    uint32_t rotate_imm;
+    dst->inst = inst;
+    dst->operand = 0;
+    if_unlikely(bits_span_drop_to_floor_u32(inst, 31, 28) == 15){
+        dst->row = ARMV4CPU_ROW_UNCOND;
+        return;
+    }
+    switch(bits_span_drop_to_floor_u32(inst, 27, 25)){
+        case 0: // 0b'000
+            if(bits_span_drop_to_floor_u32(inst, 4, 4) == 0){
+                if(bits_span_drop_to_floor_u32(inst, 24, 23) == 2 &&
+                    bits_span_drop_to_floor_u32(inst, 20, 20) == 0){
+                    dst->row = ARMV4CPU_ROW_MISC_2;
+                }else{
+                    dst->row = ARMV4CPU_ROW_DP_IMM_SHIFT;
+                }
+            }else if(bits_span_drop_to_floor_u32(inst, 7, 7) == 0){
+                if(bits_span_drop_to_floor_u32(inst, 24, 23) == 2 &&
+                    bits_span_drop_to_floor_u32(inst, 20, 20) == 0){
+                    dst->row = ARMV4CPU_ROW_MISC_4;
+                }else{
+                    dst->row = ARMV4CPU_ROW_DP_REG_SHIFT;
+                }
+            }else{
+                dst->row = ARMV4CPU_ROW_MUL_EXTRA_LDR_STR;
+            }
+            return;
+        case 1: // 0b'001
+            if(bits_span_drop_to_floor_u32(inst, 24, 23) == 2 &&
+                bits_span_drop_to_floor_u32(inst, 20, 20) == 0){
+                dst->row = bits_span_drop_to_floor_u32(inst, 21, 21) ?
+                    ARMV4CPU_ROW_MSR_IMM : ARMV4CPU_ROW_UNDEF_7;
+            }else{
+                dst->row = ARMV4CPU_ROW_DP_IMM;
+            }
+            rotate_imm = bits_span_drop_to_floor_u32(inst, 11, 8);
+            dst->operand = bits_span_drop_to_floor_u32(inst, 7, 0);
+            if(rotate_imm){
+                dst->operand = armv4cpu_ror(dst->operand, (uint8_t)(rotate_imm + rotate_imm));
+            }
+            return;
+        case 2: // 0b'010
+            dst->row = ARMV4CPU_ROW_LDR_STR_IMM;
+            return;
+        case 3: // 0b'011
+            if(bits_span_drop_to_floor_u32(inst, 4, 4) == 0){
+                dst->row = ARMV4CPU_ROW_LDR_STR_REG;
+            }else if(bits_span_drop_to_floor_u32(inst, 24, 20) == 0x1f &&
+                bits_span_drop_to_floor_u32(inst, 7, 5) == 7){
+                dst->row = ARMV4CPU_ROW_UNDEF_12;
+            }else{
+                dst->row = ARMV4CPU_ROW_UNDEF_11;
+            }
+            return;
+        case 4: // 0b'100
+            dst->row = ARMV4CPU_ROW_LDM_STM;
+            return;
+        case 5: // 0b'101
+            dst->row = ARMV4CPU_ROW_B_BL;
+            dst->operand = bits_span_drop_to_floor_u32(inst, 23, 0) << 2;
+            if(bits_span_drop_to_floor_u32(inst, 23, 23)){
+                dst->operand = dst->operand | (uint32_t)0xfc000000;
+            }
+            dst->operand = dst->operand + 8;
+            return;
+        case 6: // 0b'110
+            dst->row = ARMV4CPU_ROW_COPROC_LDC_STC;
+            return;
+        default: // 0b'111
+            if(bits_span_drop_to_floor_u32(inst, 24, 24)){
+                dst->row = ARMV4CPU_ROW_SWI;
+            }else if(bits_span_drop_to_floor_u32(inst, 4, 4) == 0){
+                dst->row = ARMV4CPU_ROW_COPROC_CDP;
+            }else{
+                dst->row = ARMV4CPU_ROW_COPROC_MCR_MRC;
+            }
+            return;
+    }
+}
+
+// always_inline
+inline uint16_t*
+armv4cpu_code_cache_bucket_ctp(armv4cpu_md_t* cpup, uint32_t paddr){
+    return &cpup->code_cache_bucket_cts[
+        (paddr >> ARMV4CPU_CODE_PAGE_SHIFT) & (ARMV4CPU_CODE_CACHE_BUCKET_CT - 1)];
+}
+
+// ret u8: 0 if no inst of the page at paddr is cached | 1 if one may be
+// always_inline
+inline uint8_t
+armv4cpu_code_cache_page_maybe_cached(armv4cpu_md_t* cpup, uint32_t paddr){
+    return *armv4cpu_code_cache_bucket_ctp(cpup, paddr) != 0;
+}
+
+// entryp must be in use
+// always_inline
+inline void
+armv4cpu_code_cache_drop(armv4cpu_md_t* cpup, armv4cpu_predecoded_inst_t* entryp){
+    uint32_t paddr = entryp->paddr;
+    entryp->paddr = ARMV4CPU_CODE_CACHE_TAG_NONE;
+    if(--*armv4cpu_code_cache_bucket_ctp(cpup, paddr) == 0){
+        armv4cpu_phys_mem_code_page_unmark(cpup, paddr);
+    }
+}
+
+// always_inline
+inline void
+armv4cpu_code_cache_flush(armv4cpu_md_t* cpup){
+    uint32_t i, paddr, pfn = 0xffffffff;    // of the latest page unmarked
+    memset(cpup->code_cache_bucket_cts, 0, sizeof(cpup->code_cache_bucket_cts));
+    for(i = 0; i < ARMV4CPU_CODE_CACHE_ENTRY_CT; i++){
+        paddr = cpup->code_cache[i].paddr;
+        if(paddr == ARMV4CPU_CODE_CACHE_TAG_NONE){
+            continue;
+        }
+        cpup->code_cache[i].paddr = ARMV4CPU_CODE_CACHE_TAG_NONE;
+        if((paddr >> ARMV4CPU_CODE_PAGE_SHIFT) != pfn){
+            pfn = paddr >> ARMV4CPU_CODE_PAGE_SHIFT;
+            armv4cpu_phys_mem_code_page_unmark(cpup, paddr);
+        }
+    }
+}
+
+// [paddr, paddr + len) has been written
+void
+armv4cpu_code_cache_invalidate(armv4cpu_md_t* cpup, uint32_t paddr, uint32_t len){
+    armv4cpu_predecoded_inst_t* entryp;
+    uint32_t a, end = paddr + len;
+    if(len >= (ARMV4CPU_CODE_CACHE_ENTRY_CT << 2)){
+        armv4cpu_code_cache_flush(cpup);
+        return;
+    }
+    for(a = paddr & (~(uint32_t)3); a < end; a += 4){
+        entryp = &cpup->code_cache[(a >> 2) & (ARMV4CPU_CODE_CACHE_ENTRY_CT - 1)];
+        if(entryp->paddr == a){
+            armv4cpu_code_cache_drop(cpup, entryp);
+        }
+    }
+}
+
+// the miss path of `armv4cpu_code_cache_fetch`, kept out of the execute loop
+// ret: the predecoded inst at paddr, only valid until the next fetch
+const armv4cpu_predecoded_inst_t*
+armv4cpu_code_cache_fill(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp){
+    armv4cpu_predecoded_inst_t* entryp =
+        &cpup->code_cache[(paddr >> 2) & (ARMV4CPU_CODE_CACHE_ENTRY_CT - 1)];
+    uint32_t inst = armv4cpu_phys_mem_fetch_4bytes(cpup, paddr, abort_flagp);
+    if_unlikely(*abort_flagp){
+        return &cpup->code_cache_bypass;
+    }
+    if(entryp->paddr != ARMV4CPU_CODE_CACHE_TAG_NONE){
+        armv4cpu_code_cache_drop(cpup, entryp);
+    }
+    armv4cpu_phys_mem_code_page_mark(cpup, paddr);
+    (*armv4cpu_code_cache_bucket_ctp(cpup, paddr))++;
+    entryp->paddr = paddr;
+    armv4cpu_inst_predecode(inst, entryp);
+    return entryp;
+}
+
+// paddr must be 4 bytes aligned
+// A return (BX LR, MOV pc, lr, LDM with pc) fetches its target through here like any other
+// inst. The hit is one index and one tag compare, which is all a return stack predicting the
+// slot could skip, less than its push on every BL
+// ret: the predecoded inst at paddr, only valid until the next fetch
+// always_inline
+inline const armv4cpu_predecoded_inst_t*
+armv4cpu_code_cache_fetch(armv4cpu_md_t* cpup, uint32_t paddr, uint8_t* abort_flagp){
+    const armv4cpu_predecoded_inst_t* entryp =
+        &cpup->code_cache[(paddr >> 2) & (ARMV4CPU_CODE_CACHE_ENTRY_CT - 1)];
+    if_likely(entryp->paddr == paddr){
+        return entryp;
+    }
+    return armv4cpu_code_cache_fill(cpup, paddr, abort_flagp);
+}
 
+// bits[1:0] of PC are ignored (unpredictable behaviour 2 at the top)
+// ret: the predecoded inst at addr, only valid until the next fetch
+// always_inline
+inline const armv4cpu_predecoded_inst_t*
+armv4cpu_mmu_fetch_inst(armv4cpu_md_t* cpup, uint32_t addr){
+    uint32_t inst;
+    addr = addr & (~(uint32_t)3);
+    if_unlikely(cpup->reference_flag){
+        inst = armv4cpu_phys_mem_fetch_4bytes(cpup,
+            armv4cpu_mmu_translate(cpup, addr), &cpup->mmu_inst_fetch_need_abort_flag);
+        armv4cpu_inst_predecode(inst, &cpup->code_cache_bypass);
+        return &cpup->code_cache_bypass;
+    }
+    return armv4cpu_code_cache_fetch(cpup,
+        armv4cpu_mmu_translate(cpup, addr), &cpup->mmu_inst_fetch_need_abort_flag);
 }
 
+// ARM DDI 0100I page A4-44: a word load from an unaligned address rotates the aligned word
 // always_inline
 inline uint32_t
 armv4cpu_mmu_data_access_read_4bytes(armv4cpu_md_t* cpup, uint32_t addr){
-
+    uint32_t u32;
+    cpup->mmu_data_access_happened_flag = 1;
+    u32 = armv4cpu_phys_mem_read_4bytes(cpup,
+        armv4cpu_mmu_translate(cpup, addr & (~(uint32_t)3)), &cpup->mmu_data_access_need_abort_flag);
+    if_unlikely(addr & 3){
+        u32 = armv4cpu_ror(u32, (uint8_t)((addr & 3) << 3));
+    }
+    return u32;
 }
 
 // always_inline
 inline uint8_t
 armv4cpu_mmu_data_access_read_1byte(armv4cpu_md_t* cpup, uint32_t addr){
+    cpup->mmu_data_access_happened_flag = 1;
+    return armv4cpu_phys_mem_read_1byte(cpup,
+        armv4cpu_mmu_translate(cpup, addr), &cpup->mmu_data_access_need_abort_flag);
+}
 
+// the low bit of an unaligned halfword address is ignored (UNPREDICTABLE in ARMv5TE)
+// always_inline
+inline uint16_t
+armv4cpu_mmu_data_access_read_2bytes(armv4cpu_md_t* cpup, uint32_t addr){
+    cpup->mmu_data_access_happened_flag = 1;
+    return armv4cpu_phys_mem_read_2bytes(cpup,
+        armv4cpu_mmu_translate(cpup, addr & (~(uint32_t)1)), &cpup->mmu_data_access_need_abort_flag);
 }
 
+// the low 2 bits of an unaligned word store address are ignored
 // always_inline
 inline void
 armv4cpu_mmu_data_access_write_4bytes(armv4cpu_md_t* cpup, uint32_t addr, uint32_t u32){
+    cpup->mmu_data_access_happened_flag = 1;
+    armv4cpu_phys_mem_write_4bytes(cpup,
+        armv4cpu_mmu_translate(cpup, addr & (~(uint32_t)3)), u32,
+        &cpup->mmu_data_access_need_abort_flag);
+}
 
+// always_inline
+inline void
+armv4cpu_mmu_data_access_write_2bytes(armv4cpu_md_t* cpup, uint32_t addr, uint16_t u16){
+    cpup->mmu_data_access_happened_flag = 1;
+    armv4cpu_phys_mem_write_2bytes(cpup,
+        armv4cpu_mmu_translate(cpup, addr & (~(uint32_t)1)), u16,
+        &cpup->mmu_data_access_need_abort_flag);
 }
 
 // always_inline
 inline void
 armv4cpu_mmu_data_access_write_1byte(armv4cpu_md_t* cpup, uint32_t addr, uint8_t u8){
+    cpup->mmu_data_access_happened_flag = 1;
+    armv4cpu_phys_mem_write_1byte(cpup,
+        armv4cpu_mmu_translate(cpup, addr), u8, &cpup->mmu_data_access_need_abort_flag);
+}
+
+// ret: host address of addr, valid up to the end of its ARMV4CPU_MMU_PAGE_SIZE_MIN page,
+//  or NULL and the data access aborts
+// always_inline
+inline uint8_t*
+armv4cpu_mmu_data_access_ram_hostp(armv4cpu_md_t* cpup, uint32_t addr, uint8_t write_flag){
+    uint8_t* hostp;
+    cpup->mmu_data_access_happened_flag = 1;
+    hostp = armv4cpu_phys_mem_ram_hostp(cpup, armv4cpu_mmu_translate(cpup, addr), write_flag);
+    if_unlikely(hostp == 0){
+        cpup->mmu_data_access_need_abort_flag = 1;
+    }
+    return hostp;
+}
 
+// SMP: give up the current inst without any side effect, the caller of `armv4cpu_execute`
+// replays it later (see `inst_deferred_flag`). Called by the inst itself or by the dependent
+// api from inside a data access, in the latter case the access aborts and the abort is
+// dropped by `armv4cpu_inst_raise_exception`. The execute ends right after this inst, which
+// is not counted.
+// always_inline
+inline void
+armv4cpu_inst_defer(armv4cpu_md_t* cpup){
+    cpup->inst_deferred_flag = 1;
+    cpup->inst_ct_limit_in_this_execute = 0;
 }
 
 // SWP SWPB
@@ -984,10 +1657,14 @@ armv4cpu_inst_swp_exec(armv4cpu_md_t* cpup){
     uint8_t rn_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 19, 16);
     uint32_t rn = get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx);
     uint8_t rd_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 15, 12);
-    uint32_t rd = get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx);
+    uint32_t rd;
     uint8_t rm_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 3, 0);
-    uint32_t rm = get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx);
+    uint32_t rm = get_R(cpup, cpup->inst_enter_cpumodn_ro, rm_regidx);
 
+    if_unlikely(cpup->atomic_inst_need_defer_flag){ // the read-modify-write must be atomic
+        armv4cpu_inst_defer(cpup);
+        return;
+    }
     if_unlikely(bits_span_drop_to_floor_u32(cpup->this_inst, 22, 22)){ // byte mode - SWPB
         uint8_t m8 = armv4cpu_mmu_data_access_read_1byte(cpup, rn);
         if_unlikely(cpup->mmu_data_access_need_abort_flag){
@@ -998,7 +1675,6 @@ armv4cpu_inst_swp_exec(armv4cpu_md_t* cpup){
             goto DATA_ACCESS_ABORT;
         }
         rd = (uint32_t)m8;
-        return;
     }else{ // word mode - SWP
         uint32_t m = armv4cpu_mmu_data_access_read_4bytes(cpup, rn);
         if_unlikely(cpup->mmu_data_access_need_abort_flag){
@@ -1015,8 +1691,7 @@ armv4cpu_inst_swp_exec(armv4cpu_md_t* cpup){
     return;
 
     DATA_ACCESS_ABORT:;
-    armv4cpu_inst_raise_exception(cpup,
-        EXCEPTION_CPUMODEN_ABT, cpup->inst_enter_real_PC_ro + 4, EXCEPTION_VECTOR_ADDR_DATA_ABT);
+    armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_DATA_ABT, cpup->inst_enter_real_PC_ro + 4);
     return;
 }
 
@@ -1027,13 +1702,16 @@ armv4cpu_inst_ldr_str_exec(armv4cpu_md_t* cpup){
     uint8_t rn_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 19, 16);
     uint32_t rn = get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx);
     uint8_t rd_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 15, 12);
-    uint32_t rd = get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx);
+    uint32_t rd;
     uint8_t write_back_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 21, 21);
     uint8_t byte_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 22, 22);
     uint8_t add_offset_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 23, 23);
     uint8_t pre_calc_offset_flag =
         bits_span_drop_to_floor_u32(cpup->this_inst, 24, 24);
     uint32_t offset, new_rn, addr;
+    if_unlikely(rn_regidx == REGIDX_PC){
+        rn = rn + 8;
+    }
     if(bits_span_drop_to_floor_u32(cpup->this_inst, 25, 25)){ // Rm + imm_shift
         armv4cpu_inst_dp_calc_op2_op2reg_immshift(cpup);
         offset = cpup->dp_op2;
@@ -1047,11 +1725,12 @@ armv4cpu_inst_ldr_str_exec(armv4cpu_md_t* cpup){
     }
     if(pre_calc_offset_flag){
         addr = new_rn;
-        if(write_back_flag){
+    }else{ // post-indexed always writes back, W bit means LDRT/LDRBT/STRT/STRBT
+        addr = rn;
+        write_back_flag = 1;
+        if(bits_span_drop_to_floor_u32(cpup->this_inst, 21, 21)){
             cpup->mmu_inst_is_ldrxt_strxt_flag = 1;
         }
-    }else{
-        addr = rd;
     }
     if(bits_span_drop_to_floor_u32(cpup->this_inst, 20, 20)){ // LDR
         if_unlikely(byte_flag){
@@ -1059,56 +1738,76 @@ armv4cpu_inst_ldr_str_exec(armv4cpu_md_t* cpup){
         }else{
             rd = armv4cpu_mmu_data_access_read_4bytes(cpup, addr);
         }
+        if_unlikely(cpup->mmu_data_access_need_abort_flag){
+            goto DATA_ACCESS_ABORT;
+        }
+        if(write_back_flag){
+            set_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx, new_rn);
+        }
+        if_unlikely(rd_regidx == REGIDX_PC){
+            set_PC(cpup, cpup->inst_enter_cpumodn_ro, rd & (~(uint32_t)3));
+            armv4cpu_on_block_boundary(cpup);
+            return;
+        }
+        set_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx, rd);
     }else{ // STR
+        rd = get_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx);
+        if_unlikely(rd_regidx == REGIDX_PC){
+            rd = rd + 8;
+        }
         if_unlikely(byte_flag){
             armv4cpu_mmu_data_access_write_1byte(cpup, addr, (uint8_t)rd);
         }else{
             armv4cpu_mmu_data_access_write_4bytes(cpup, addr, rd);
         }
-    }
-    if_unlikely(cpup->mmu_data_access_need_abort_flag){
-        goto DATA_ACCESS_ABORT;
-    }
-    if(pre_calc_offset_flag){
+        if_unlikely(cpup->mmu_data_access_need_abort_flag){
+            goto DATA_ACCESS_ABORT;
+        }
         if(write_back_flag){
-        }else{
-        }
-    }else{
-        if(write_back_flag){
-            rn = new_rn;
             set_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx, new_rn);
-        }else{
         }
     }
-    set_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx, rd);
     set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
     return;
 
     DATA_ACCESS_ABORT:;
-    armv4cpu_inst_raise_exception(cpup,
-        EXCEPTION_CPUMODEN_ABT, cpup->inst_enter_real_PC_ro + 4, EXCEPTION_VECTOR_ADDR_DATA_ABT);
+    armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_DATA_ABT, cpup->inst_enter_real_PC_ro + 8);
     return;
 }
 
-// STRH LDRH LDRSB LDRSH
+// STRH LDRH LDRSB LDRSH, and ARMv5TE LDRD STRD
+// unpredictable cases of ARM DDI 0100I page A5-34 A5-36 resolved as:
+//  1. the low bit of a halfword address is ignored, the low 2 bits of a LDRD/STRD address too
+//  2. LDRD/STRD with an odd Rd or with Rd being R14 is undefined
+//  3. with write back and Rn being (one of) the loaded Rd, the loaded value wins
+//  4. a load into PC is handled like LDR, STRH of PC stores PC + 8
+// a data abort leaves all the registers unchanged
 // always_inline
 inline void
 armv4cpu_inst_extra_ldr_str_exec(armv4cpu_md_t* cpup){
     uint8_t rn_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 19, 16);
     uint32_t rn = get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx);
     uint8_t rd_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 15, 12);
-    uint32_t rd = get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx);
+    uint32_t rd, rd2;
     uint8_t write_back_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 21, 21);
-    uint8_t byte_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 22, 22);
     uint8_t add_offset_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 23, 23);
     uint8_t pre_calc_offset_flag =
         bits_span_drop_to_floor_u32(cpup->this_inst, 24, 24);
+    uint8_t sh = bits_span_drop_to_floor_u32(cpup->this_inst, 6, 5);
+    uint8_t rm_regidx;
     uint32_t offset, new_rn, addr;
-    if(bits_span_drop_to_floor_u32(cpup->this_inst, 25, 25)){ // Rm + imm_shift
-        armv4cpu_inst_dp_calc_op2_op2reg_immshift(cpup);
-        offset = cpup->dp_op2;
-    }else{
-        offset = bits_span_drop_to_floor_u32(cpup->this_inst, 11, 0);
+    if_unlikely(rn_regidx == REGIDX_PC){
+        rn = rn + 8;
+    }
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 22, 22)){ // imm
+        offset = (bits_span_drop_to_floor_u32(cpup->this_inst, 11, 8) << 4) |
+            bits_span_drop_to_floor_u32(cpup->this_inst, 3, 0);
+    }else{ // Rm
+        rm_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 3, 0);
+        offset = get_R(cpup, cpup->inst_enter_cpumodn_ro, rm_regidx);
+        if_unlikely(rm_regidx == REGIDX_PC){
+            offset = offset + 8;
+        }
     }
     if(add_offset_flag){
         new_rn = rn + offset;
@@ -1117,159 +1816,1212 @@ armv4cpu_inst_extra_ldr_str_exec(armv4cpu_md_t* cpup){
     }
     if(pre_calc_offset_flag){
         addr = new_rn;
-        if(write_back_flag){
-            cpup->mmu_inst_is_ldrxt_strxt_flag = 1;
-        }
-    }else{
-        addr = rd;
+    }else{ // post-indexed always writes back
+        addr = rn;
+        write_back_flag = 1;
     }
-    if(bits_span_drop_to_floor_u32(cpup->this_inst, 20, 20)){ // LDR
-        if_unlikely(byte_flag){
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 20, 20)){ // LDRH LDRSB LDRSH
+        if(sh == 2){ // LDRSB
             rd = (uint32_t)(armv4cpu_mmu_data_access_read_1byte(cpup, addr));
+            if(rd & 0x80){
+                rd = rd | (uint32_t)0xffffff00;
+            }
         }else{
-            rd = armv4cpu_mmu_data_access_read_4bytes(cpup, addr);
+            rd = (uint32_t)(armv4cpu_mmu_data_access_read_2bytes(cpup, addr));
+            if(sh == 3 && (rd & 0x8000)){ // LDRSH
+                rd = rd | (uint32_t)0xffff0000;
+            }
         }
-    }else{ // STR
-        if_unlikely(byte_flag){
-            armv4cpu_mmu_data_access_write_1byte(cpup, addr, (uint8_t)rd);
-        }else{
+        if_unlikely(cpup->mmu_data_access_need_abort_flag){
+            goto DATA_ACCESS_ABORT;
+        }
+        if(write_back_flag){
+            set_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx, new_rn);
+        }
+        if_unlikely(rd_regidx == REGIDX_PC){
+            set_PC(cpup, cpup->inst_enter_cpumodn_ro, rd & (~(uint32_t)3));
+            armv4cpu_on_block_boundary(cpup);
+            return;
+        }
+        set_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx, rd);
+    }else if(sh == 1){ // STRH
+        rd = get_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx);
+        if_unlikely(rd_regidx == REGIDX_PC){
+            rd = rd + 8;
+        }
+        armv4cpu_mmu_data_access_write_2bytes(cpup, addr, (uint16_t)rd);
+        if_unlikely(cpup->mmu_data_access_need_abort_flag){
+            goto DATA_ACCESS_ABORT;
+        }
+        if(write_back_flag){
+            set_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx, new_rn);
+        }
+    }else{ // LDRD STRD
+        if_unlikely((rd_regidx & 1) || rd_regidx == REGIDX_R14){
+            armv4cpu_inst_undefined_exec(cpup);
+            return;
+        }
+        addr = addr & (~(uint32_t)3);
+        if(sh == 2){ // LDRD, both words are loaded before any register is written
+            rd = armv4cpu_mmu_data_access_read_4bytes(cpup, addr);
+            if_unlikely(cpup->mmu_data_access_need_abort_flag){
+                goto DATA_ACCESS_ABORT;
+            }
+            rd2 = armv4cpu_mmu_data_access_read_4bytes(cpup, addr + 4);
+            if_unlikely(cpup->mmu_data_access_need_abort_flag){
+                goto DATA_ACCESS_ABORT;
+            }
+            if(write_back_flag){
+                set_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx, new_rn);
+            }
+            set_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx, rd);
+            set_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx + 1, rd2);
+        }else{ // STRD
+            rd = get_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx);
+            rd2 = get_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx + 1);
             armv4cpu_mmu_data_access_write_4bytes(cpup, addr, rd);
+            if_unlikely(cpup->mmu_data_access_need_abort_flag){
+                goto DATA_ACCESS_ABORT;
+            }
+            armv4cpu_mmu_data_access_write_4bytes(cpup, addr + 4, rd2);
+            if_unlikely(cpup->mmu_data_access_need_abort_flag){
+                goto DATA_ACCESS_ABORT;
+            }
+            if(write_back_flag){
+                set_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx, new_rn);
+            }
         }
     }
-    if_unlikely(cpup->mmu_data_access_need_abort_flag){
-        goto DATA_ACCESS_ABORT;
+    set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
+    return;
+
+    DATA_ACCESS_ABORT:;
+    armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_DATA_ABT, cpup->inst_enter_real_PC_ro + 8);
+    return;
+}
+
+// LDM STM
+// unpredictable cases of ARM DDI 0100I page A4-37 A4-85, resolved as:
+//  1. an empty register list is undefined
+//  2. STM stores the value of Rn before the write back, PC is stored as PC + 8
+//  3. LDM with Rn in the list: the loaded value wins over the write back
+//  4. LDM/STM with S bit but without PC (user bank) still writes back Rn of the current mode
+//  5. LDM with S bit and PC from usr|sys mode leaves the cpsr unchanged
+// the bits [1:0] of the address are ignored (ARM DDI 0100I page A5-41), a word is never rotated
+// a data abort leaves all the registers unchanged. The words of STM before the abort have been
+// stored (ARM DDI 0100I page A2-21: they are UNPREDICTABLE after it anyway)
+// always_inline
+inline void
+armv4cpu_inst_ldm_stm_exec(armv4cpu_md_t* cpup){
+    uint8_t rn_regidx = bits_span_drop_to_floor_u32(cpup->this_inst, 19, 16);
+    uint32_t rn = get_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx);
+    uint32_t reg_list = bits_span_drop_to_floor_u32(cpup->this_inst, 15, 0);
+    uint8_t s_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 22, 22);
+    uint8_t write_back_flag = bits_span_drop_to_floor_u32(cpup->this_inst, 21, 21);
+    uint8_t pc_in_list_flag = bits_span_drop_to_floor_u32(reg_list, 15, 15);
+    uint8_t reg_cpumodn = cpup->inst_enter_cpumodn_ro;
+    uint32_t ct = (uint32_t)__builtin_popcount(reg_list);
+    uint32_t loaded[16];
+    uint32_t addr, new_rn, u32, psr;
+    uint8_t i;
+    if_unlikely(ct == 0){
+        armv4cpu_inst_undefined_exec(cpup);
+        return;
     }
-    if(pre_calc_offset_flag){
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 23, 23)){ // U: increment
+        addr = rn;
+        new_rn = rn + (ct << 2);
+    }else{ // decrement
+        addr = rn - (ct << 2);
+        new_rn = addr;
+    }
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 24, 24) ==
+        bits_span_drop_to_floor_u32(cpup->this_inst, 23, 23)){ // IB DA
+        addr = addr + 4;
+    }
+    addr = addr & (~(uint32_t)3);
+    if_unlikely(s_flag && !(bits_span_drop_to_floor_u32(cpup->this_inst, 20, 20) && pc_in_list_flag)){
+        reg_cpumodn = CPUMODEN_USR;
+    }
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 20, 20)){ // LDM
+        for(i = 0; i < 16; i++){
+            if(reg_list & (((uint32_t)1) << i)){
+                loaded[i] = armv4cpu_mmu_data_access_read_4bytes(cpup, addr);
+                if_unlikely(cpup->mmu_data_access_need_abort_flag){
+                    goto DATA_ACCESS_ABORT;
+                }
+                addr += 4;
+            }
+        }
         if(write_back_flag){
-        }else{
+            set_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx, new_rn);
+        }
+        for(i = 0; i < 15; i++){
+            if(reg_list & (((uint32_t)1) << i)){
+                set_R(cpup, reg_cpumodn, i, loaded[i]);
+            }
+        }
+        if(pc_in_list_flag){
+            if_unlikely(s_flag && cpup->inst_enter_cpumodn_ro != CPUMODEN_USR &&
+                cpup->inst_enter_cpumodn_ro != CPUMODEN_SYS){
+                psr = get_spsr(cpup, cpup->inst_enter_cpumodn_ro);
+                set_cpsr(cpup, psr);
+                armv4cpu_update_interrupt_possible_flag(cpup);
+            }
+            set_PC(cpup, cpup->inst_enter_cpumodn_ro, loaded[REGIDX_PC] & (~(uint32_t)3));
+            armv4cpu_on_block_boundary(cpup);
+            return;
+        }
+    }else{ // STM
+        for(i = 0; i < 16; i++){
+            if(reg_list & (((uint32_t)1) << i)){
+                u32 = get_R(cpup, reg_cpumodn, i);
+                if_unlikely(i == REGIDX_PC){
+                    u32 = u32 + 8;
+                }
+                armv4cpu_mmu_data_access_write_4bytes(cpup, addr, u32);
+                if_unlikely(cpup->mmu_data_access_need_abort_flag){
+                    goto DATA_ACCESS_ABORT;
+                }
+                addr += 4;
+            }
         }
-    }else{
         if(write_back_flag){
-            rn = new_rn;
             set_R(cpup, cpup->inst_enter_cpumodn_ro, rn_regidx, new_rn);
-        }else{
         }
     }
-    set_R(cpup, cpup->inst_enter_cpumodn_ro, rd_regidx, rd);
     set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
     return;
 
     DATA_ACCESS_ABORT:;
-    armv4cpu_inst_raise_exception(cpup,
-        EXCEPTION_CPUMODEN_ABT, cpup->inst_enter_real_PC_ro + 4, EXCEPTION_VECTOR_ADDR_DATA_ABT);
+    armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_DATA_ABT, cpup->inst_enter_real_PC_ro + 8);
     return;
 }
 
-/*
-armv4cpu_execute(inst_amount_limit) -> inst_amount_executed
-    // data-access-mem-abort that instructon would be totally atomic in any case,
-    // for example data abort occur in inst[R0-R15 <-load-or-store-> mem-span]
-    //    such inst would be totally atomic operation
-
-    loop{
-        inst = inst_fetch()
-        handle_exception_if_inst_fetch_mem_abort()
-        // inst decode and execute start
-        if_unlikely(inst cond_field is 0b1111){ // ARM DDI 0100I: Page A3-4 Line 2
-            goto UNPREDICTABLE_INST_HANDLE;
-        }
-        if(!armv4cpu_inst_cond_test_is_ok()){
-            armv4cpu_inst_nop(cpup, inst);
-            goto POST_INST_HANDLE;
+// ** hypercalls **
+// CDP p7, #op, c0, c0, c0, #0 runs a string operation natively on the guest memory
+//  op 0 memcpy   r0 dst, r1 src, r2 len    the result is the one of a forward bytewise copy
+//  op 1 memset   r0 dst, r1 byte value in bits[7:0], r2 len
+//  op 2 crc32    r0 crc, r1 buf, r2 len    r0 = crc32(r0, buf, len), the crc32 of zlib
+// any other op, or any other CRn, CRd, CRm or opcode2 than c0, c0, c0, #0, is undefined, so a
+// guest could fall back to its own routine.
+//
+// a hypercall is restartable: one execution of it is a step over n bytes, which moves r0
+// (except op 2) and r1 (except op 1) forward by n and r2 backward by n, and leaves the PC on
+// the inst until r2 reaches 0. So it is interruptible and never runs over the inst budget.
+// A step never crosses a page of dst or src, and a data abort keeps the progress of the
+// steps before it (LR = PC + 8 as usual).
+//
+// cost: a step of n bytes counts max(1, ceil(n / ARMV4CPU_HYPERCALL_BYTES_PER_INST)) insts,
+// thus a hypercall within one page costs ceil(len / 16) insts (1 if len is 0) and at most
+// 2 more per page boundary of dst or src. Where the budget cuts the steps never changes it.
+
+#define ARMV4CPU_HYPERCALL_CP_NUM           7
+#define ARMV4CPU_HYPERCALL_OP_MEMCPY        0
+#define ARMV4CPU_HYPERCALL_OP_MEMSET        1
+#define ARMV4CPU_HYPERCALL_OP_CRC32         2
+#define ARMV4CPU_HYPERCALL_BYTES_PER_INST   16
+#define ARMV4CPU_HYPERCALL_ZERO_MASK        ((uint32_t)0x000ff0ef)  // CRn CRd opcode2 CRm
+
+// ret: n limited so that [addr, addr + n) stays inside one page
+// always_inline
+inline uint32_t
+armv4cpu_hypercall_page_limit(uint32_t addr, uint32_t n){
+    uint32_t page_remain = ARMV4CPU_MMU_PAGE_SIZE_MIN - (addr & (ARMV4CPU_MMU_PAGE_SIZE_MIN - 1));
+    return n < page_remain ? n : page_remain;
+}
+
+// always_inline
+inline void
+armv4cpu_inst_hypercall_exec(armv4cpu_md_t* cpup){
+    uint8_t op = bits_span_drop_to_floor_u32(cpup->this_inst, 23, 20);
+    uint8_t cpumodn = cpup->inst_enter_cpumodn_ro;
+    uint32_t r0 = get_R(cpup, cpumodn, 0);
+    uint32_t r1 = get_R(cpup, cpumodn, 1);
+    uint32_t r2 = get_R(cpup, cpumodn, 2);
+    uint64_t budget_byte_ct = (cpup->inst_ct_limit_in_this_execute -
+        cpup->inst_executed_ct_in_this_execute) * ARMV4CPU_HYPERCALL_BYTES_PER_INST;
+    uint64_t inst_ct;
+    uint32_t n = r2, i;
+    uint8_t* dstp = 0;
+    uint8_t* srcp = 0;
+    if_unlikely(op > ARMV4CPU_HYPERCALL_OP_CRC32 ||
+        (cpup->this_inst & ARMV4CPU_HYPERCALL_ZERO_MASK) != 0){
+        armv4cpu_inst_undefined_exec(cpup);
+        return;
+    }
+    if(n > budget_byte_ct){
+        n = (uint32_t)budget_byte_ct;
+    }
+    if(op != ARMV4CPU_HYPERCALL_OP_CRC32){
+        n = armv4cpu_hypercall_page_limit(r0, n);
+    }
+    if(op != ARMV4CPU_HYPERCALL_OP_MEMSET){
+        n = armv4cpu_hypercall_page_limit(r1, n);
+    }
+    if(n){
+        // dst at first, so that src sees the page dst is about to write if they share it
+        if(op != ARMV4CPU_HYPERCALL_OP_CRC32){
+            dstp = armv4cpu_mmu_data_access_ram_hostp(cpup, r0, 1);
+            if_unlikely(dstp == 0){
+                goto DATA_ACCESS_ABORT;
+            }
         }
-        switch(inst[27:25]){ // ARM DDI 0100I: Page A3-2 Figure A3-1
-            case 0b'000:
-                if(inst[4] == 0'b0){
-                    if_unlikely(inst[24:23] == 0'b10 && inst[20] == 0'b0){
-                        goto MISCELLANEOUS_INSTRUCTIONS_HANDLE_ROW2 // Row 2 in Figure A3-1 of A3-2
-                    }else{
-                        goto DATA_PROCESSING_IMM_SHIFT_HANDLE_ROW1; // Row 1
-                    }
-                }else{
-                    if_likely(inst[7] == 0){
-                        if_unlikely(inst[24:23] == 0'b10 && inst[20] == 0'b0){
-                            goto MISCELLANEOUS_INSTRUCTIONS_HANDLE_ROW4 // Row 4
-                        }else{
-                            goto DATA_PROCESSING_REG_SHIFT_HANDLE_ROW3 // Row 3
-                        }
-                    }else{
-                        goto MUTIPLIES_AND_EXTRA_LOAD_STORE_HANDLE_ROW5 // Row 5
-                    }
+        if(op != ARMV4CPU_HYPERCALL_OP_MEMSET){
+            srcp = armv4cpu_mmu_data_access_ram_hostp(cpup, r1, 0);
+            if_unlikely(srcp == 0){
+                goto DATA_ACCESS_ABORT;
+            }
+        }
+    }
+    switch(op){
+        case ARMV4CPU_HYPERCALL_OP_MEMCPY:
+            if_unlikely(r0 > r1 && r0 - r1 < n){ // the forward copy reads what it wrote
+                for(i = 0; i < n; i++){
+                    dstp[i] = srcp[i];
                 }
-                break;
-            case 0b'001:
-                if_unlikely(inst[24:23] == 0'b10 && inst[20] == 0'b0){
-                    if_likely(inst[21] == 1){
-                        goto MOV_IMM_TO_STATUS_REG_HANDLE_ROW8 // Row 8
-                    }else{
-                        goto UNDEF_HANDLE_ROW7 // Row 7
-                    }
-                }else{
-                    goto DATA_PROCESSING_IMM_HANDLE_ROW6 // Row 6
+            }else if(n){
+                memmove(dstp, srcp, n);
+            }
+            r0 = r0 + n;
+            r1 = r1 + n;
+            break;
+        case ARMV4CPU_HYPERCALL_OP_MEMSET:
+            if(n){
+                memset(dstp, (int)(r1 & 0xff), n);
+            }
+            r0 = r0 + n;
+            break;
+        default: // ARMV4CPU_HYPERCALL_OP_CRC32
+            r0 = crc32_update(r0, srcp, n);
+            r1 = r1 + n;
+            break;
+    }
+    r2 = r2 - n;
+    set_R(cpup, cpumodn, 0, r0);
+    set_R(cpup, cpumodn, 1, r1);
+    set_R(cpup, cpumodn, 2, r2);
+    // the last one is counted by the execute loop
+    inst_ct = (n + ARMV4CPU_HYPERCALL_BYTES_PER_INST - 1) / ARMV4CPU_HYPERCALL_BYTES_PER_INST;
+    if(inst_ct > 1){
+        cpup->inst_executed_ct_total += inst_ct - 1;
+        cpup->inst_executed_ct_in_this_execute += inst_ct - 1;
+    }
+    if(r2 == 0){
+        set_PC(cpup, cpumodn, cpup->inst_enter_real_PC_ro + 4);
+    }
+    return;
+
+    DATA_ACCESS_ABORT:;
+    armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_DATA_ABT, cpup->inst_enter_real_PC_ro + 8);
+    return;
+}
+
+// ** VFP **
+// a VFPv2 coprocessor, cp10 for single and cp11 for double precision (ARM DDI 0100I part C),
+// computed by softfloat_md.h so that every replica gets the same bits whatever the host FPU.
+//  - it is off after cpu reset (FPEXC.EN 0): every VFP inst is undefined, except FMXR/FMRX of
+//    FPSID and FPEXC in a privileged mode, until the guest enables it as on the silicon, so a
+//    guest of soft-float never sees it
+//  - it never traps, the exception enable bits of FPSCR read as zero and only the cumulative
+//    flags are set, FPEXC.EX is always 0
+//  - FMAC, FNMAC, FMSC and FNMSC round the product before the accumulation, there is no fused
+//    multiply-add
+//  - short vectors of FPSCR.LEN and STRIDE are supported, compares and conversions are scalar
+//  - every VFP inst counts as 1 inst, the load/store multiple ones included
+
+#define ARMV4CPU_VFP_FPSID              ((uint32_t)0x410120b4)  // ARM, VFPv2, VFP11 rev 4
+#define ARMV4CPU_VFP_FPEXC_EN           ((uint32_t)0x40000000)
+#define ARMV4CPU_VFP_FPSCR_WRITE_MASK   ((uint32_t)0xf3f7009f)  // no trap enable bit
+#define ARMV4CPU_VFP_SYSREG_FPSID       0
+#define ARMV4CPU_VFP_SYSREG_FPSCR       1
+#define ARMV4CPU_VFP_SYSREG_FPEXC       8
+
+// opcode of the data processing, p:q:r:s (bits 23, 21, 20, 6)
+#define ARMV4CPU_VFP_OP_FMAC            0x0
+#define ARMV4CPU_VFP_OP_FNMAC           0x1
+#define ARMV4CPU_VFP_OP_FMSC            0x2
+#define ARMV4CPU_VFP_OP_FNMSC           0x3
+#define ARMV4CPU_VFP_OP_FMUL            0x4
+#define ARMV4CPU_VFP_OP_FNMUL           0x5
+#define ARMV4CPU_VFP_OP_FADD            0x6
+#define ARMV4CPU_VFP_OP_FSUB            0x7
+#define ARMV4CPU_VFP_OP_FDIV            0x8
+#define ARMV4CPU_VFP_OP_EXTENSION       0xf
+
+// extension opcode, Fn:N (bits 19:16, 7)
+#define ARMV4CPU_VFP_EXT_FCPY           0x00
+#define ARMV4CPU_VFP_EXT_FABS           0x01
+#define ARMV4CPU_VFP_EXT_FNEG           0x02
+#define ARMV4CPU_VFP_EXT_FSQRT          0x03
+#define ARMV4CPU_VFP_EXT_FCMP           0x08
+#define ARMV4CPU_VFP_EXT_FCMPE          0x09
+#define ARMV4CPU_VFP_EXT_FCMPZ          0x0a
+#define ARMV4CPU_VFP_EXT_FCMPEZ         0x0b
+#define ARMV4CPU_VFP_EXT_FCVT           0x0f    // FCVTDS in cp10, FCVTSD in cp11
+#define ARMV4CPU_VFP_EXT_FUITO          0x10
+#define ARMV4CPU_VFP_EXT_FSITO          0x11
+#define ARMV4CPU_VFP_EXT_FTOUI          0x18
+#define ARMV4CPU_VFP_EXT_FTOUIZ         0x19
+#define ARMV4CPU_VFP_EXT_FTOSI          0x1a
+#define ARMV4CPU_VFP_EXT_FTOSIZ         0x1b
+
+// always_inline
+inline uint8_t
+armv4cpu_vfp_enabled(armv4cpu_md_t* cpup){
+    return (cpup->vfp_fpexc & ARMV4CPU_VFP_FPEXC_EN) != 0;
+}
+
+// the value of S[regidx], or of D[regidx] if dp_flag is set
+// always_inline
+inline uint64_t
+armv4cpu_vfp_get(armv4cpu_md_t* cpup, uint8_t dp_flag, uint8_t regidx){
+    if(dp_flag){
+        return ((uint64_t)cpup->vfp_S[2 * regidx + 1] << 32) | cpup->vfp_S[2 * regidx];
+    }
+    return cpup->vfp_S[regidx];
+}
+
+// always_inline
+inline void
+armv4cpu_vfp_set(armv4cpu_md_t* cpup, uint8_t dp_flag, uint8_t regidx, uint64_t v){
+    if(dp_flag){
+        cpup->vfp_S[2 * regidx] = (uint32_t)v;
+        cpup->vfp_S[2 * regidx + 1] = (uint32_t)(v >> 32);
+    }else{
+        cpup->vfp_S[regidx] = (uint32_t)v;
+    }
+}
+
+// always_inline
+inline void
+armv4cpu_vfp_ctx_init(armv4cpu_md_t* cpup, softfloat_ctx_t* ctxp){
+    ctxp->round_mode = bits_span_drop_to_floor_u32(cpup->vfp_fpscr, 23, 22);
+    ctxp->flush_to_zero_flag = bits_span_drop_to_floor_u32(cpup->vfp_fpscr, 24, 24);
+    ctxp->default_nan_flag = bits_span_drop_to_floor_u32(cpup->vfp_fpscr, 25, 25);
+    ctxp->flags = 0;
+}
+
+// always_inline
+inline uint64_t
+armv4cpu_vfp_neg(uint8_t dp_flag, uint64_t v){
+    return v ^ (dp_flag ? (uint64_t)1 << 63 : (uint64_t)1 << 31);
+}
+
+// the next register of a short vector, it wraps around inside the bank of regidx (8 single or
+// 4 double registers)
+// always_inline
+inline uint8_t
+armv4cpu_vfp_vector_step(uint8_t dp_flag, uint8_t regidx, uint8_t stride){
+    uint8_t bank_mask = dp_flag ? 3 : 7;
+    return (regidx & ~bank_mask) | ((regidx + stride) & bank_mask);
+}
+
+// one element of a data processing inst which is not an extension one, or FSQRT
+// always_inline
+inline uint64_t
+armv4cpu_vfp_dp_calc(softfloat_ctx_t* ctxp, uint8_t dp_flag, uint8_t op,
+    uint64_t d, uint64_t n, uint64_t m){
+
+    uint64_t product;
+    if(op == ARMV4CPU_VFP_OP_FADD){
+        return dp_flag ? softfloat_f64_add(ctxp, n, m) :
+            softfloat_f32_add(ctxp, (uint32_t)n, (uint32_t)m);
+    }
+    if(op == ARMV4CPU_VFP_OP_FSUB){
+        return dp_flag ? softfloat_f64_sub(ctxp, n, m) :
+            softfloat_f32_sub(ctxp, (uint32_t)n, (uint32_t)m);
+    }
+    if(op == ARMV4CPU_VFP_OP_FDIV){
+        return dp_flag ? softfloat_f64_div(ctxp, n, m) :
+            softfloat_f32_div(ctxp, (uint32_t)n, (uint32_t)m);
+    }
+    if(op == ARMV4CPU_VFP_OP_EXTENSION){ // FSQRT
+        return dp_flag ? softfloat_f64_sqrt(ctxp, m) : softfloat_f32_sqrt(ctxp, (uint32_t)m);
+    }
+    product = dp_flag ? softfloat_f64_mul(ctxp, n, m) :
+        softfloat_f32_mul(ctxp, (uint32_t)n, (uint32_t)m);
+    switch(op){
+        case ARMV4CPU_VFP_OP_FMUL:
+            return product;
+        case ARMV4CPU_VFP_OP_FNMUL:
+            return armv4cpu_vfp_neg(dp_flag, product);
+        case ARMV4CPU_VFP_OP_FNMAC:
+        case ARMV4CPU_VFP_OP_FNMSC:
+            product = armv4cpu_vfp_neg(dp_flag, product);
+            break;
+        default:
+            break;
+    }
+    if(op == ARMV4CPU_VFP_OP_FMSC || op == ARMV4CPU_VFP_OP_FNMSC){
+        d = armv4cpu_vfp_neg(dp_flag, d);
+    }
+    return dp_flag ? softfloat_f64_add(ctxp, d, product) :
+        softfloat_f32_add(ctxp, (uint32_t)d, (uint32_t)product);
+}
+
+// the extension insts which are always scalar: compares and conversions
+// ret u8: 1 if done | 0 if undefined
+// always_inline
+inline uint8_t
+armv4cpu_vfp_dp_scalar_exec(armv4cpu_md_t* cpup, softfloat_ctx_t* ctxp, uint8_t dp_flag,
+    uint8_t ext_op){
+
+    uint32_t inst = cpup->this_inst;
+    uint8_t fd = bits_span_drop_to_floor_u32(inst, 15, 12);
+    uint8_t fm = bits_span_drop_to_floor_u32(inst, 3, 0);
+    uint8_t sd = (fd << 1) | bits_span_drop_to_floor_u32(inst, 22, 22);
+    uint8_t sm = (fm << 1) | bits_span_drop_to_floor_u32(inst, 5, 5);
+    uint8_t round_mode = ctxp->round_mode, nzcv;
+    uint64_t m;
+    switch(ext_op){
+        case ARMV4CPU_VFP_EXT_FCMP:
+        case ARMV4CPU_VFP_EXT_FCMPE:
+        case ARMV4CPU_VFP_EXT_FCMPZ:
+        case ARMV4CPU_VFP_EXT_FCMPEZ:
+            if(dp_flag && (sd & 1 || (ext_op < ARMV4CPU_VFP_EXT_FCMPZ && sm & 1))){
+                return 0;
+            }
+            if(ext_op >= ARMV4CPU_VFP_EXT_FCMPZ){
+                m = 0;
+            }else{
+                m = armv4cpu_vfp_get(cpup, dp_flag, dp_flag ? fm : sm);
+            }
+            if(dp_flag){
+                nzcv = softfloat_f64_compare(ctxp, armv4cpu_vfp_get(cpup, 1, fd), m, ext_op & 1);
+            }else{
+                nzcv = softfloat_f32_compare(ctxp, cpup->vfp_S[sd], (uint32_t)m, ext_op & 1);
+            }
+            cpup->vfp_fpscr = (cpup->vfp_fpscr & (uint32_t)0x0fffffff) | ((uint32_t)nzcv << 28);
+            return 1;
+        case ARMV4CPU_VFP_EXT_FCVT:
+            if(dp_flag){ // FCVTSD Sd, Dm
+                if(sm & 1){
+                    return 0;
                 }
-                break;
-            case 0b'010:
-                goto LOAD_STORE_IMM_OFFSET_HANDLE_ROW9 // Row 9
-                break;
-            case 0b'011:
-                if_likely(inst[4] == 0){
-                    goto LOAD_STORE_REG_OFFSET_HANDLE_ROW10 // Row 10
-                }else{
-                    if(inst[24:20] == 0b11111 && inst[7:5] == 0b111){
-                        goto UNDEF_ARCHITECHTURALLY_HANDLE_ROW12 // Row 12
-                    }else{
-                        goto UNDEF_HANDLE_ROW11 // Row 11
-                    }
+                cpup->vfp_S[sd] = softfloat_f64_to_f32(ctxp, armv4cpu_vfp_get(cpup, 1, fm));
+            }else{ // FCVTDS Dd, Sm
+                if(sd & 1){
+                    return 0;
                 }
-                break;
-            case 0b'100:
-                goto LOAD_STORE_MULTI_HANDLE_ROW13 // Row 13
-                break;
-            case 0b'101:
-                goto BRANCH_AND_BRANCH_WITH_LINK_HANDLE_ROW14 // Row 14
-                break;
-            case 0b'110:
-                goto COPROCESSOR_LOAD_STORE_AND_DOUBLE_REG_TRANSFER_HANDLE_ROW15 // Row 15
-                break;
-            case 0b'111:
-                if_likely(inst[24] == 0b1){
-                    goto SWI_HANDLE_ROW18 // Row 18
-                }else{
-                    if(inst[4] == 0b0){
-                        goto COPROCESSOR_DATA_PROCESSING_HANDLE_ROW16 // Row 16
-                    }else{
-                        goto COPROCESSOR_REG_TRANSFER_HANDLE_ROW17 // Row 17
-                    }
+                armv4cpu_vfp_set(cpup, 1, fd, softfloat_f32_to_f64(ctxp, cpup->vfp_S[sm]));
+            }
+            return 1;
+        case ARMV4CPU_VFP_EXT_FUITO:
+        case ARMV4CPU_VFP_EXT_FSITO:
+            if(dp_flag){ // Dd, Sm
+                if(sd & 1){
+                    return 0;
+                }
+                armv4cpu_vfp_set(cpup, 1, fd, ext_op == ARMV4CPU_VFP_EXT_FSITO ?
+                    softfloat_f64_from_i32(cpup->vfp_S[sm]) :
+                    softfloat_f64_from_u32(cpup->vfp_S[sm]));
+            }else{
+                cpup->vfp_S[sd] = ext_op == ARMV4CPU_VFP_EXT_FSITO ?
+                    softfloat_f32_from_i32(ctxp, cpup->vfp_S[sm]) :
+                    softfloat_f32_from_u32(ctxp, cpup->vfp_S[sm]);
+            }
+            return 1;
+        case ARMV4CPU_VFP_EXT_FTOUI:
+        case ARMV4CPU_VFP_EXT_FTOUIZ:
+        case ARMV4CPU_VFP_EXT_FTOSI:
+        case ARMV4CPU_VFP_EXT_FTOSIZ:
+            if(ext_op & 1){
+                round_mode = SOFTFLOAT_ROUND_ZERO;
+            }
+            if(dp_flag){ // Sd, Dm
+                if(sm & 1){
+                    return 0;
                 }
-                break;
-            default: abort()
+                cpup->vfp_S[sd] = softfloat_f64_to_int32(ctxp, armv4cpu_vfp_get(cpup, 1, fm),
+                    round_mode, ext_op >= ARMV4CPU_VFP_EXT_FTOSI);
+            }else{
+                cpup->vfp_S[sd] = softfloat_f32_to_int32(ctxp, cpup->vfp_S[sm],
+                    round_mode, ext_op >= ARMV4CPU_VFP_EXT_FTOSI);
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// CDP p10/p11
+void
+armv4cpu_inst_vfp_data_processing_exec(armv4cpu_md_t* cpup){
+    uint32_t inst = cpup->this_inst;
+    uint8_t dp_flag = bits_span_drop_to_floor_u32(inst, 8, 8);
+    uint8_t op = (bits_span_drop_to_floor_u32(inst, 23, 23) << 3) |
+        (bits_span_drop_to_floor_u32(inst, 21, 20) << 1) | bits_span_drop_to_floor_u32(inst, 6, 6);
+    uint8_t ext_op = (bits_span_drop_to_floor_u32(inst, 19, 16) << 1) |
+        bits_span_drop_to_floor_u32(inst, 7, 7);
+    uint8_t fd = bits_span_drop_to_floor_u32(inst, 15, 12);
+    uint8_t fn = bits_span_drop_to_floor_u32(inst, 19, 16);
+    uint8_t fm = bits_span_drop_to_floor_u32(inst, 3, 0);
+    uint8_t bank_mask = dp_flag ? 3 : 7;
+    uint8_t len = bits_span_drop_to_floor_u32(cpup->vfp_fpscr, 18, 16) + 1;
+    uint8_t stride = bits_span_drop_to_floor_u32(cpup->vfp_fpscr, 21, 20) == 3 ? 2 : 1;
+    uint8_t m_vector_flag, i;
+    softfloat_ctx_t ctx;
+    uint64_t z;
+    cpup->mmu_data_access_happened_flag = 1;
+    if_unlikely(!armv4cpu_vfp_enabled(cpup) || (op > ARMV4CPU_VFP_OP_FDIV &&
+        op != ARMV4CPU_VFP_OP_EXTENSION)){
+
+        goto UNDEF;
+    }
+    armv4cpu_vfp_ctx_init(cpup, &ctx);
+    if(op == ARMV4CPU_VFP_OP_EXTENSION && ext_op > ARMV4CPU_VFP_EXT_FSQRT){
+        if(!armv4cpu_vfp_dp_scalar_exec(cpup, &ctx, dp_flag, ext_op)){
+            goto UNDEF;
+        }
+        goto DONE;
+    }
+    if(dp_flag){
+        if(bits_span_drop_to_floor_u32(inst, 22, 22) || bits_span_drop_to_floor_u32(inst, 5, 5) ||
+            (op != ARMV4CPU_VFP_OP_EXTENSION && bits_span_drop_to_floor_u32(inst, 7, 7))){
+
+            goto UNDEF;
         }
+    }else{
+        fd = (fd << 1) | bits_span_drop_to_floor_u32(inst, 22, 22);
+        fn = (fn << 1) | bits_span_drop_to_floor_u32(inst, 7, 7);
+        fm = (fm << 1) | bits_span_drop_to_floor_u32(inst, 5, 5);
+    }
+    // a destination in the first bank is always scalar, a vector of any other reads a scalar
+    // Fm from the first bank
+    if((fd & ~bank_mask) == 0){
+        len = 1;
+    }
+    m_vector_flag = (fm & ~bank_mask) != 0;
+    for(i = 0; i < len; i++){
+        if(op != ARMV4CPU_VFP_OP_EXTENSION){
+            z = armv4cpu_vfp_dp_calc(&ctx, dp_flag, op, armv4cpu_vfp_get(cpup, dp_flag, fd),
+                armv4cpu_vfp_get(cpup, dp_flag, fn), armv4cpu_vfp_get(cpup, dp_flag, fm));
+        }else{
+            z = armv4cpu_vfp_get(cpup, dp_flag, fm);
+            switch(ext_op){
+                case ARMV4CPU_VFP_EXT_FABS:
+                    z = z & ~armv4cpu_vfp_neg(dp_flag, 0);
+                    break;
+                case ARMV4CPU_VFP_EXT_FNEG:
+                    z = armv4cpu_vfp_neg(dp_flag, z);
+                    break;
+                case ARMV4CPU_VFP_EXT_FSQRT:
+                    z = armv4cpu_vfp_dp_calc(&ctx, dp_flag, op, 0, 0, z);
+                    break;
+                default: // FCPY
+                    break;
+            }
+        }
+        armv4cpu_vfp_set(cpup, dp_flag, fd, z);
+        fd = armv4cpu_vfp_vector_step(dp_flag, fd, stride);
+        fn = armv4cpu_vfp_vector_step(dp_flag, fn, stride);
+        if(m_vector_flag){
+            fm = armv4cpu_vfp_vector_step(dp_flag, fm, stride);
+        }
+    }
+
+    DONE:;
+    cpup->vfp_fpscr |= ctx.flags;
+    set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
+    return;
+
+    UNDEF:;
+    armv4cpu_inst_undefined_exec(cpup);
+}
+
+// MCR/MRC p10/p11: FMSR FMRS FMDLR FMRDL FMDHR FMRDH FMXR FMRX FMSTAT
+void
+armv4cpu_inst_vfp_reg_transfer_exec(armv4cpu_md_t* cpup){
+    uint32_t inst = cpup->this_inst;
+    uint8_t cpumodn = cpup->inst_enter_cpumodn_ro;
+    uint8_t dp_flag = bits_span_drop_to_floor_u32(inst, 8, 8);
+    uint8_t opc1 = bits_span_drop_to_floor_u32(inst, 23, 21);
+    uint8_t load_flag = bits_span_drop_to_floor_u32(inst, 20, 20);
+    uint8_t rd_regidx = bits_span_drop_to_floor_u32(inst, 15, 12);
+    uint8_t fn = bits_span_drop_to_floor_u32(inst, 19, 16);
+    uint8_t n_bit = bits_span_drop_to_floor_u32(inst, 7, 7);
+    uint32_t* u32p;
+    uint32_t u32;
+    cpup->mmu_data_access_happened_flag = 1;
+    if(!dp_flag && opc1 == 7){ // FMXR FMRX
+        if(n_bit){
+            goto UNDEF;
+        }
+        if(fn == ARMV4CPU_VFP_SYSREG_FPSID || fn == ARMV4CPU_VFP_SYSREG_FPEXC){
+            if(cpumodn == CPUMODEN_USR){
+                goto UNDEF;
+            }
+        }else if(fn != ARMV4CPU_VFP_SYSREG_FPSCR || !armv4cpu_vfp_enabled(cpup)){
+            goto UNDEF;
+        }
+        if(load_flag){
+            if(fn == ARMV4CPU_VFP_SYSREG_FPSID){
+                u32 = ARMV4CPU_VFP_FPSID;
+            }else if(fn == ARMV4CPU_VFP_SYSREG_FPEXC){
+                u32 = cpup->vfp_fpexc;
+            }else{
+                u32 = cpup->vfp_fpscr;
+            }
+            if(rd_regidx == REGIDX_PC){ // FMSTAT
+                if(fn != ARMV4CPU_VFP_SYSREG_FPSCR){
+                    goto UNDEF;
+                }
+                set_cpsr(cpup, (get_cpsr(cpup) & (uint32_t)0x0fffffff) |
+                    (u32 & (uint32_t)0xf0000000));
+            }else{
+                set_R(cpup, cpumodn, rd_regidx, u32);
+            }
+        }else{
+            if(rd_regidx == REGIDX_PC){
+                goto UNDEF;
+            }
+            u32 = get_R(cpup, cpumodn, rd_regidx);
+            if(fn == ARMV4CPU_VFP_SYSREG_FPEXC){
+                cpup->vfp_fpexc = u32 & ARMV4CPU_VFP_FPEXC_EN;
+            }else if(fn == ARMV4CPU_VFP_SYSREG_FPSCR){
+                cpup->vfp_fpscr = u32 & ARMV4CPU_VFP_FPSCR_WRITE_MASK;
+            } // FPSID ignores writes
+        }
+        goto DONE;
+    }
+    if(!armv4cpu_vfp_enabled(cpup) || rd_regidx == REGIDX_PC){
+        goto UNDEF;
+    }
+    if(!dp_flag && opc1 == 0){ // FMSR FMRS
+        u32p = &cpup->vfp_S[(fn << 1) | n_bit];
+    }else if(dp_flag && opc1 <= 1 && !n_bit){ // FMDLR FMRDL (opc1 0) FMDHR FMRDH (opc1 1)
+        u32p = &cpup->vfp_S[2 * fn + opc1];
+    }else{
+        goto UNDEF;
+    }
+    if(load_flag){
+        set_R(cpup, cpumodn, rd_regidx, *u32p);
+    }else{
+        *u32p = get_R(cpup, cpumodn, rd_regidx);
+    }
+
+    DONE:;
+    set_PC(cpup, cpumodn, cpup->inst_enter_real_PC_ro + 4);
+    return;
+
+    UNDEF:;
+    armv4cpu_inst_undefined_exec(cpup);
+}
+
+// MCRR/MRRC p10/p11: FMSRR FMRRS FMDRR FMRRD
+// always_inline
+inline void
+armv4cpu_inst_vfp_double_reg_transfer_exec(armv4cpu_md_t* cpup){
+    uint32_t inst = cpup->this_inst;
+    uint8_t cpumodn = cpup->inst_enter_cpumodn_ro;
+    uint8_t dp_flag = bits_span_drop_to_floor_u32(inst, 8, 8);
+    uint8_t load_flag = bits_span_drop_to_floor_u32(inst, 20, 20);
+    uint8_t rn_regidx = bits_span_drop_to_floor_u32(inst, 19, 16);
+    uint8_t rd_regidx = bits_span_drop_to_floor_u32(inst, 15, 12);
+    uint8_t sm = (bits_span_drop_to_floor_u32(inst, 3, 0) << 1) |
+        bits_span_drop_to_floor_u32(inst, 5, 5);
+    if(bits_span_drop_to_floor_u32(inst, 7, 6) || !bits_span_drop_to_floor_u32(inst, 4, 4) ||
+        rd_regidx == REGIDX_PC || rn_regidx == REGIDX_PC ||
+        (load_flag && rd_regidx == rn_regidx) || (dp_flag ? sm & 1 : sm == 31)){
+
+        armv4cpu_inst_undefined_exec(cpup);
+        return;
+    }
+    if(dp_flag){ // the low word goes with Rd
+        sm = sm & ~(uint8_t)1;
+    }
+    if(load_flag){
+        set_R(cpup, cpumodn, rd_regidx, cpup->vfp_S[sm]);
+        set_R(cpup, cpumodn, rn_regidx, cpup->vfp_S[sm + 1]);
+    }else{
+        cpup->vfp_S[sm] = get_R(cpup, cpumodn, rd_regidx);
+        cpup->vfp_S[sm + 1] = get_R(cpup, cpumodn, rn_regidx);
+    }
+    set_PC(cpup, cpumodn, cpup->inst_enter_real_PC_ro + 4);
+}
+
+// LDC/STC p10/p11: FLDS FSTS FLDD FSTD FLDM FSTM (S, D and X, IA and DB), and MCRR/MRRC
+// a load commits the registers and the base write back only if no word aborted
+void
+armv4cpu_inst_vfp_load_store_exec(armv4cpu_md_t* cpup){
+    uint32_t inst = cpup->this_inst;
+    uint8_t cpumodn = cpup->inst_enter_cpumodn_ro;
+    uint8_t dp_flag = bits_span_drop_to_floor_u32(inst, 8, 8);
+    uint8_t p = bits_span_drop_to_floor_u32(inst, 24, 24);
+    uint8_t u = bits_span_drop_to_floor_u32(inst, 23, 23);
+    uint8_t w = bits_span_drop_to_floor_u32(inst, 21, 21);
+    uint8_t load_flag = bits_span_drop_to_floor_u32(inst, 20, 20);
+    uint8_t rn_regidx = bits_span_drop_to_floor_u32(inst, 19, 16);
+    uint8_t offset8 = bits_span_drop_to_floor_u32(inst, 7, 0);
+    uint8_t first = bits_span_drop_to_floor_u32(inst, 15, 12);
+    uint8_t word_ct, reg_word_ct, i;
+    uint32_t words[33]; // FLDMX of 16 double registers
+    uint32_t rn, addr, wb_addr;
+    cpup->mmu_data_access_happened_flag = 1;
+    if_unlikely(!armv4cpu_vfp_enabled(cpup)){
+        goto UNDEF;
+    }
+    if(!p && !u){
+        if(bits_span_drop_to_floor_u32(inst, 22, 21) == 2){
+            armv4cpu_inst_vfp_double_reg_transfer_exec(cpup);
+            return;
+        }
+        goto UNDEF;
+    }
+    if(dp_flag){
+        if(bits_span_drop_to_floor_u32(inst, 22, 22)){
+            goto UNDEF;
+        }
+        first = first << 1; // S index of the low half
+    }else{
+        first = (first << 1) | bits_span_drop_to_floor_u32(inst, 22, 22);
+    }
+    rn = get_R(cpup, cpumodn, rn_regidx);
+    if(rn_regidx == REGIDX_PC){
+        if(w){
+            goto UNDEF;
+        }
+        rn += 8;
+    }
+    if(p && !w){ // FLDS FSTS FLDD FSTD
+        word_ct = dp_flag ? 2 : 1;
+        reg_word_ct = word_ct;
+        addr = u ? rn + ((uint32_t)offset8 << 2) : rn - ((uint32_t)offset8 << 2);
+        wb_addr = rn;
+    }else{
+        if(p && u){
+            goto UNDEF;
+        }
+        // FLDMX/FSTMX (cp11, odd offset) move one more word, stored as 0 and ignored by a load
+        word_ct = offset8;
+        reg_word_ct = dp_flag ? offset8 & ~(uint8_t)1 : offset8;
+        if(reg_word_ct == 0 || reg_word_ct > 32 || first + reg_word_ct > 32){
+            goto UNDEF;
+        }
+        if(u){ // IA
+            addr = rn;
+            wb_addr = rn + ((uint32_t)word_ct << 2);
+        }else{ // DB
+            addr = rn - ((uint32_t)word_ct << 2);
+            wb_addr = addr;
+        }
+    }
+    if(load_flag){
+        for(i = 0; i < word_ct; i++){
+            words[i] = armv4cpu_mmu_data_access_read_4bytes(cpup, (addr & ~(uint32_t)3) + 4 * i);
+            if_unlikely(cpup->mmu_data_access_need_abort_flag){
+                goto DATA_ACCESS_ABORT;
+            }
+        }
+        for(i = 0; i < reg_word_ct; i++){
+            cpup->vfp_S[first + i] = words[i];
+        }
+    }else{
+        for(i = 0; i < word_ct; i++){
+            armv4cpu_mmu_data_access_write_4bytes(cpup, (addr & ~(uint32_t)3) + 4 * i,
+                i < reg_word_ct ? cpup->vfp_S[first + i] : 0);
+            if_unlikely(cpup->mmu_data_access_need_abort_flag){
+                goto DATA_ACCESS_ABORT;
+            }
+        }
+    }
+    if(w){
+        set_R(cpup, cpumodn, rn_regidx, wb_addr);
+    }
+    set_PC(cpup, cpumodn, cpup->inst_enter_real_PC_ro + 4);
+    return;
+
+    UNDEF:;
+    armv4cpu_inst_undefined_exec(cpup);
+    return;
+
+    DATA_ACCESS_ABORT:;
+    armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_DATA_ABT, cpup->inst_enter_real_PC_ro + 8);
+    return;
+}
+
+// CDP
+// always_inline
+inline void
+armv4cpu_inst_coprocessor_data_processing_exec(armv4cpu_md_t* cpup){
+    uint8_t cp_num = bits_span_drop_to_floor_u32(cpup->this_inst, 11, 8);
+    if_likely(cp_num == ARMV4CPU_HYPERCALL_CP_NUM){
+        armv4cpu_inst_hypercall_exec(cpup);
+        return;
+    }
+    if(cp_num == 10 || cp_num == 11){
+        armv4cpu_inst_vfp_data_processing_exec(cpup);
+        return;
+    }
+    armv4cpu_inst_undefined_exec(cpup);
+}
+
+// MCR p15, 0, rd, c7, c0, 4 - wait for interrupt
+#define ARMV4CPU_INST_CP15_WFI_MASK     ((uint32_t)0x0fff0fff)
+#define ARMV4CPU_INST_CP15_WFI_VALUE    ((uint32_t)0x0e070f90)
+
+// MCR MRC
+// always_inline
+inline void
+armv4cpu_inst_coprocessor_reg_transfer_exec(armv4cpu_md_t* cpup){
+    if_likely((cpup->this_inst & ARMV4CPU_INST_CP15_WFI_MASK) == ARMV4CPU_INST_CP15_WFI_VALUE &&
+        cpup->inst_enter_cpumodn_ro != CPUMODEN_USR){
+        cpup->wait_for_interrupt_flag = 1;
+        set_PC(cpup, cpup->inst_enter_cpumodn_ro, cpup->inst_enter_real_PC_ro + 4);
+        return;
+    }
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 11, 9) == 5){ // p10 p11
+        armv4cpu_inst_vfp_reg_transfer_exec(cpup);
+        return;
+    }
+    armv4cpu_inst_undefined_exec(cpup);
+}
+
+// LDC STC MCRR MRRC
+// always_inline
+inline void
+armv4cpu_inst_coprocessor_load_store_exec(armv4cpu_md_t* cpup){
+    if(bits_span_drop_to_floor_u32(cpup->this_inst, 11, 9) == 5){ // p10 p11
+        armv4cpu_inst_vfp_load_store_exec(cpup);
+        return;
+    }
+    armv4cpu_inst_undefined_exec(cpup);
+}
+
+// called when an interrupt is asserted to the cpu
+// the waiting for interrupt ends even if the interrupt is masked by the cpsr I/F bits
+// always_inline
+inline void
+armv4cpu_wakeup(armv4cpu_md_t* cpup){
+    cpup->wait_for_interrupt_flag = 0;
+}
+
+// cut the inst budget of the running `armv4cpu_execute` so that it ends when the inst counter
+// reaches `deadline`, called by the io devices when they arm an earlier event from inside
+// an inst (mmio write for example), the current inst always completes
+// always_inline
+inline void
+armv4cpu_execute_limit_to_deadline(armv4cpu_md_t* cpup, uint64_t deadline){
+    uint64_t start_ct = cpup->inst_executed_ct_total - cpup->inst_executed_ct_in_this_execute;
+    uint64_t limit = cpup->inst_executed_ct_in_this_execute + 1;
+    if(deadline > start_ct + limit){
+        limit = deadline - start_ct;
+    }
+    if(limit < cpup->inst_ct_limit_in_this_execute){
+        cpup->inst_ct_limit_in_this_execute = limit;
+    }
+}
+
+// ** idle detection **
+// time inside the turingcell computer is the inst counter, so an idle cpu could jump its
+// counters forward instead of emulating the spinning. The caller of `armv4cpu_execute` ends
+// the inst budget at the next timer or interrupt deadline, thus nothing observable by the
+// guest could happen inside the skipped span. The skip decision only depends on the guest
+// state and the inst budget, so every replica makes the same one.
+//
+// idle states:
+//  1. CP15 wait for interrupt: the rest of the budget is consumed at once
+//  2. tight backward loop which has no data access and whose one iteration leaves all the
+//     cpu state unchanged (`B .` for example): as many whole iterations as the budget allows
+//     are skipped and the tail is interpreted as usual, so the result is exactly the same
+//     as running it inst by inst
+
+#define ARMV4CPU_IDLE_LOOP_MAX_SPAN_BYTES       ((uint32_t)64)  // at most 16 insts
+#define ARMV4CPU_IDLE_LOOP_MAX_ITER_INST_CT     ((uint64_t)64)
+
+// always_inline
+inline void
+armv4cpu_idle_fast_forward(armv4cpu_md_t* cpup, uint64_t inst_ct){
+    cpup->inst_executed_ct_total += inst_ct;
+    cpup->inst_executed_ct_in_this_execute += inst_ct;
+}
+
+// always_inline
+inline void
+armv4cpu_idle_loop_forget(armv4cpu_md_t* cpup){
+    cpup->idle_loop_snapshot_valid_flag = 0;
+    cpup->idle_loop_head_PC = 0xffffffff; // never equals to a branch target
+}
+
+// always_inline
+inline void
+armv4cpu_idle_loop_take_snapshot(armv4cpu_md_t* cpup){
+    uint8_t i;
+    for(i = 0; i < 31; i++){
+        cpup->idle_loop_snapshot[i] = cpup->R[i];
+    }
+    cpup->idle_loop_snapshot[31] = cpup->cpsr;
+    for(i = 0; i < 6; i++){
+        cpup->idle_loop_snapshot[32 + i] = cpup->spsr[i];
+    }
+    cpup->idle_loop_snapshot_valid_flag = 1;
+}
+
+// ret u8: 1 if the cpu state equals to the snapshot | 0 if not
+// always_inline
+inline uint8_t
+armv4cpu_idle_loop_state_is_unchanged(armv4cpu_md_t* cpup){
+    uint8_t i;
+    if(cpup->idle_loop_snapshot[31] != cpup->cpsr){
+        return 0;
+    }
+    for(i = 0; i < 31; i++){
+        if(cpup->idle_loop_snapshot[i] != cpup->R[i]){
+            return 0;
+        }
+    }
+    for(i = 0; i < 6; i++){
+        if(cpup->idle_loop_snapshot[32 + i] != cpup->spsr[i]){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// called after a taken short backward branch without link, the branch inst already counted
+// always_inline
+inline void
+armv4cpu_idle_loop_on_backward_branch(armv4cpu_md_t* cpup, uint32_t target){
+    uint64_t iter_ct = cpup->inst_executed_ct_in_this_execute - cpup->idle_loop_head_inst_ct;
+    if(target != cpup->idle_loop_head_PC){ // a new loop
+        cpup->idle_loop_head_PC = target;
+        armv4cpu_idle_loop_take_snapshot(cpup);
+    }else if(cpup->mmu_data_access_happened_flag || iter_ct > ARMV4CPU_IDLE_LOOP_MAX_ITER_INST_CT){
+        cpup->idle_loop_snapshot_valid_flag = 0;
+    }else if(cpup->idle_loop_snapshot_valid_flag && armv4cpu_idle_loop_state_is_unchanged(cpup)){
+        uint64_t remain_ct =
+            cpup->inst_ct_limit_in_this_execute - cpup->inst_executed_ct_in_this_execute;
+        armv4cpu_idle_fast_forward(cpup, (remain_ct / iter_ct) * iter_ct);
+    }else{
+        armv4cpu_idle_loop_take_snapshot(cpup);
+    }
+    cpup->idle_loop_head_inst_ct = cpup->inst_executed_ct_in_this_execute;
+    cpup->mmu_data_access_happened_flag = 0;
+}
+
+// ret: amount of inst executed in this call, always equals to inst_amount_limit unless the
+//  last inst is deferred (SMP only, see `armv4cpu_inst_defer`)
+// data-access-mem-abort that instructon would be totally atomic in any case,
+// for example data abort occur in inst[R0-R15 <-load-or-store-> mem-span]
+//    such inst would be totally atomic operation
+uint64_t
+armv4cpu_execute(armv4cpu_md_t* cpup, uint64_t inst_amount_limit){
+    const armv4cpu_predecoded_inst_t* instp;
+    cpup->inst_executed_ct_in_this_execute = 0;
+    cpup->inst_ct_limit_in_this_execute = inst_amount_limit;
+    cpup->inst_deferred_flag = 0;
+    // devices may have changed the ram since the last call
+    armv4cpu_idle_loop_forget(cpup);
+    armv4cpu_on_block_boundary(cpup);
+    if_unlikely(cpup->wait_for_interrupt_flag){
+        armv4cpu_idle_fast_forward(cpup, inst_amount_limit);
+        return cpup->inst_executed_ct_in_this_execute;
+    }
+
+    while(cpup->inst_executed_ct_in_this_execute < cpup->inst_ct_limit_in_this_execute){
+        armv4cpu_inst_enter_init_tmp(cpup);
+        instp = armv4cpu_mmu_fetch_inst(cpup, cpup->inst_enter_real_PC_ro);
+        if_unlikely(cpup->mmu_inst_fetch_need_abort_flag){
+            armv4cpu_inst_raise_exception(cpup, EXCEPTION_KIND_INST_ABT,
+                cpup->inst_enter_real_PC_ro + 4);
+            goto POST_INST_HANDLE;
+        }
+        cpup->this_inst = instp->inst;
+        // inst execute start, decoded by `armv4cpu_inst_predecode`
+        if_unlikely(instp->row == ARMV4CPU_ROW_UNCOND){
+            if((cpup->this_inst & (uint32_t)0xfd70f000) == (uint32_t)0xf550f000){ // PLD
+                armv4cpu_inst_nop(cpup, cpup->inst_enter_cpumodn_ro);
+                goto POST_INST_HANDLE;
+            }
+            goto UNPREDICTABLE_INST_HANDLE; // ARM DDI 0100I: Page A3-4 Line 2
+        }
+        if(!armv4cpu_inst_cond_test_is_ok(cpup->this_inst, get_cpsr(cpup))){
+            armv4cpu_inst_nop(cpup, cpup->inst_enter_cpumodn_ro);
+            goto POST_INST_HANDLE;
+        }
+        cpup->this_operand = instp->operand;
+        switch(instp->row){
+            case ARMV4CPU_ROW_DP_IMM_SHIFT:
+                goto DATA_PROCESSING_IMM_SHIFT_HANDLE_ROW1;
+            case ARMV4CPU_ROW_MISC_2:
+                goto MISCELLANEOUS_INSTRUCTIONS_HANDLE_ROW2;
+            case ARMV4CPU_ROW_DP_REG_SHIFT:
+                goto DATA_PROCESSING_REG_SHIFT_HANDLE_ROW3;
+            case ARMV4CPU_ROW_MISC_4:
+                goto MISCELLANEOUS_INSTRUCTIONS_HANDLE_ROW4;
+            case ARMV4CPU_ROW_MUL_EXTRA_LDR_STR:
+                goto MUTIPLIES_AND_EXTRA_LOAD_STORE_HANDLE_ROW5;
+            case ARMV4CPU_ROW_DP_IMM:
+                goto DATA_PROCESSING_IMM_HANDLE_ROW6;
+            case ARMV4CPU_ROW_UNDEF_7:
+                goto UNDEF_HANDLE_ROW7;
+            case ARMV4CPU_ROW_MSR_IMM:
+                goto MOV_IMM_TO_STATUS_REG_HANDLE_ROW8;
+            case ARMV4CPU_ROW_LDR_STR_IMM:
+                goto LOAD_STORE_IMM_OFFSET_HANDLE_ROW9;
+            case ARMV4CPU_ROW_LDR_STR_REG:
+                goto LOAD_STORE_REG_OFFSET_HANDLE_ROW10;
+            case ARMV4CPU_ROW_UNDEF_11:
+                goto UNDEF_HANDLE_ROW11;
+            case ARMV4CPU_ROW_UNDEF_12:
+                goto UNDEF_ARCHITECHTURALLY_HANDLE_ROW12;
+            case ARMV4CPU_ROW_LDM_STM:
+                goto LOAD_STORE_MULTI_HANDLE_ROW13;
+            case ARMV4CPU_ROW_B_BL:
+                goto BRANCH_AND_BRANCH_WITH_LINK_HANDLE_ROW14;
+            case ARMV4CPU_ROW_COPROC_LDC_STC:
+                goto COPROCESSOR_LOAD_STORE_AND_DOUBLE_REG_TRANSFER_HANDLE_ROW15;
+            case ARMV4CPU_ROW_COPROC_CDP:
+                goto COPROCESSOR_DATA_PROCESSING_HANDLE_ROW16;
+            case ARMV4CPU_ROW_COPROC_MCR_MRC:
+                goto COPROCESSOR_REG_TRANSFER_HANDLE_ROW17;
+            case ARMV4CPU_ROW_SWI:
+                goto SWI_HANDLE_ROW18;
+            default:
+                assert(0);
+        }
+
         DATA_PROCESSING_IMM_SHIFT_HANDLE_ROW1:;
+        if_unlikely(cpup->reference_flag){
+            goto DATA_PROCESSING_REFERENCE_HANDLE;
+        }
+        gl_armv4cpu_inst_dp_op2reg_immshift_handlers[
+            bits_span_drop_to_floor_u32(cpup->this_inst, 24, 20)](cpup);
+        goto POST_INST_HANDLE;
+
         DATA_PROCESSING_REG_SHIFT_HANDLE_ROW3:;
+        if_unlikely(cpup->reference_flag){
+            goto DATA_PROCESSING_REFERENCE_HANDLE;
+        }
+        gl_armv4cpu_inst_dp_op2reg_regshift_handlers[
+            bits_span_drop_to_floor_u32(cpup->this_inst, 24, 20)](cpup);
+        goto POST_INST_HANDLE;
+
         DATA_PROCESSING_IMM_HANDLE_ROW6:;
+        if_unlikely(cpup->reference_flag){
+            goto DATA_PROCESSING_REFERENCE_HANDLE;
+        }
+        gl_armv4cpu_inst_dp_op2imm_handlers[
+            bits_span_drop_to_floor_u32(cpup->this_inst, 24, 20)](cpup);
+        goto POST_INST_HANDLE;
+
+        DATA_PROCESSING_REFERENCE_HANDLE:;
+        armv4cpu_inst_dp_reference_exec(cpup);
+        goto POST_INST_HANDLE;
+
         BRANCH_AND_BRANCH_WITH_LINK_HANDLE_ROW14:;
+        armv4cpu_inst_b_bl_exec(cpup);
+        cpup->inst_executed_ct_total++;
+        cpup->inst_executed_ct_in_this_execute++;
+        if_unlikely(cpup->interrupt_possible_flag){
+            armv4cpu_deliver_interrupt(cpup);
+            continue;
+        }
+        // B with negative offset
+        if_unlikely((cpup->this_inst & (uint32_t)0x01800000) == (uint32_t)0x00800000 &&
+            !cpup->reference_flag && cpup->inst_enter_real_PC_ro - get_PC(cpup, cpup->inst_enter_cpumodn_ro) <
+                ARMV4CPU_IDLE_LOOP_MAX_SPAN_BYTES){
+            armv4cpu_idle_loop_on_backward_branch(cpup,
+                get_PC(cpup, cpup->inst_enter_cpumodn_ro));
+        }
+        continue;
+
         MUTIPLIES_AND_EXTRA_LOAD_STORE_HANDLE_ROW5:;
+        if(bits_span_drop_to_floor_u32(cpup->this_inst, 7, 4) == 9){ // 0b'1001
+            if(bits_span_drop_to_floor_u32(cpup->this_inst, 27, 24) == 0){
+                if(bits_span_drop_to_floor_u32(cpup->this_inst, 23, 23)){
+                    armv4cpu_inst_mull_mlal_exec(cpup);
+                }else{
+                    armv4cpu_inst_mul_mla_exec(cpup);
+                }
+            }else if(bits_span_drop_to_floor_u32(cpup->this_inst, 27, 23) == 2 &&
+                bits_span_drop_to_floor_u32(cpup->this_inst, 21, 20) == 0){
+                armv4cpu_inst_swp_exec(cpup);
+            }else{
+                armv4cpu_inst_undefined_exec(cpup);
+            }
+        }else{
+            armv4cpu_inst_extra_ldr_str_exec(cpup);
+        }
+        goto POST_INST_HANDLE;
+
         LOAD_STORE_IMM_OFFSET_HANDLE_ROW9:;
         LOAD_STORE_REG_OFFSET_HANDLE_ROW10:;
-        LOAD_STORE_MULTI_HANDLE_ROW13:;
+        armv4cpu_inst_ldr_str_exec(cpup);
+        goto POST_INST_HANDLE;
+
         SWI_HANDLE_ROW18:;
+        armv4cpu_inst_swi_exec(cpup);
+        goto POST_INST_HANDLE;
+
         MISCELLANEOUS_INSTRUCTIONS_HANDLE_ROW2:;
+        if(bits_span_drop_to_floor_u32(cpup->this_inst, 7, 4) == 0){ // MRS MSR
+            armv4cpu_inst_msr_mrs_exec(cpup);
+        }else if(bits_span_drop_to_floor_u32(cpup->this_inst, 7, 7) == 1){ // SMLAxy ...
+            armv4cpu_inst_smul_smla_16bits_exec(cpup);
+        }else{
+            armv4cpu_inst_undefined_exec(cpup);
+        }
+        goto POST_INST_HANDLE;
+
         MISCELLANEOUS_INSTRUCTIONS_HANDLE_ROW4:;
+        if(bits_span_drop_to_floor_u32(cpup->this_inst, 7, 4) == 1 &&
+            bits_span_drop_to_floor_u32(cpup->this_inst, 22, 21) == 1){ // BX
+            armv4cpu_inst_bx_exec(cpup);
+        }else if(bits_span_drop_to_floor_u32(cpup->this_inst, 7, 4) == 1 &&
+            bits_span_drop_to_floor_u32(cpup->this_inst, 22, 21) == 3){ // CLZ
+            armv4cpu_inst_clz_exec(cpup);
+        }else if(bits_span_drop_to_floor_u32(cpup->this_inst, 7, 4) == 3 &&
+            bits_span_drop_to_floor_u32(cpup->this_inst, 22, 21) == 1){ // BLX Rm
+            armv4cpu_inst_blx_reg_exec(cpup);
+        }else if(bits_span_drop_to_floor_u32(cpup->this_inst, 7, 4) == 5){ // QADD QSUB ...
+            armv4cpu_inst_qadd_qsub_exec(cpup);
+        }else{
+            armv4cpu_inst_undefined_exec(cpup);
+        }
+        goto POST_INST_HANDLE;
+
         MOV_IMM_TO_STATUS_REG_HANDLE_ROW8:;
-        COPROCESSOR_LOAD_STORE_AND_DOUBLE_REG_TRANSFER_HANDLE_ROW15:;
-        COPROCESSOR_DATA_PROCESSING_HANDLE_ROW16:;
+        armv4cpu_inst_msr_mrs_exec(cpup);
+        goto POST_INST_HANDLE;
+
         COPROCESSOR_REG_TRANSFER_HANDLE_ROW17:;
+        armv4cpu_inst_coprocessor_reg_transfer_exec(cpup);
+        if_unlikely(cpup->wait_for_interrupt_flag){
+            cpup->inst_executed_ct_total++;
+            cpup->inst_executed_ct_in_this_execute++;
+            armv4cpu_idle_fast_forward(cpup,
+                cpup->inst_ct_limit_in_this_execute - cpup->inst_executed_ct_in_this_execute);
+            break;
+        }
+        goto POST_INST_HANDLE;
+
+        COPROCESSOR_DATA_PROCESSING_HANDLE_ROW16:;
+        armv4cpu_inst_coprocessor_data_processing_exec(cpup);
+        goto POST_INST_HANDLE;
+
+        LOAD_STORE_MULTI_HANDLE_ROW13:;
+        armv4cpu_inst_ldm_stm_exec(cpup);
+        goto POST_INST_HANDLE;
+
+        COPROCESSOR_LOAD_STORE_AND_DOUBLE_REG_TRANSFER_HANDLE_ROW15:;
+        armv4cpu_inst_coprocessor_load_store_exec(cpup);
+        goto POST_INST_HANDLE;
+
         UNPREDICTABLE_INST_HANDLE:;
         UNDEF_ARCHITECHTURALLY_HANDLE_ROW12:;
         UNDEF_HANDLE_ROW11:;
         UNDEF_HANDLE_ROW7:;
+        armv4cpu_inst_undefined_exec(cpup);
 
-        POST_INST_HANDLE:
-        cpup->inst_executed_amount_total++;
-        cpup->inst_executed_amount_in_one_execute++;
-        if_unlikely(cpu->inst_executed_ct_in_this_execute >= cpup->inst_ct_limit_in_this_execute){
-            break; // return from this func call
-        }
+        POST_INST_HANDLE:;
+        cpup->inst_executed_ct_total++;
+        cpup->inst_executed_ct_in_this_execute++;
     }
-
-*/
+    if_unlikely(cpup->inst_deferred_flag){
+        cpup->inst_executed_ct_total--;
+        cpup->inst_executed_ct_in_this_execute--;
+    }
+    return cpup->inst_executed_ct_in_this_execute;
+}
@@ -0,0 +1,390 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** disk device **
+// the disk is an array of 4KB blocks. Its content is NOT stored as one blob: the state of
+// the disk is the block map (block no -> sha256 of the block content), and the contents live
+// in a content-addressed chunk store on the host (see src/runtime/chunk_store.h), shared by
+// every cell of the host, so identical blocks are stored once.
+// The all-zero hash stands for the all-zero block, which is never stored.
+//
+// a guest write is deterministic, so every replica computes the same chunk and the same
+// block map delta by itself. Only the delta (block no, hash) is reported to the backend, it
+// is what a checkpoint or a state transfer has to carry besides the chunks it lacks.
+//
+// timing: a command completes `IO_DEVICE_DISK_CMD_BASE_INST_CT + count *
+// IO_DEVICE_DISK_CMD_PER_BLOCK_INST_CT` insts after it is issued, through the io event
+// queue, no matter how fast the host is. Meanwhile the backend is told which chunks will be
+// read (and, for a sequential stream, the following ones) so it could load them into its
+// cache asynchronously. The data is transferred at completion; a chunk not cached by then is
+// simply loaded synchronously, the host speed changes the wall time only.
+//
+// registers:
+//  0x00 BLOCK      rw  first block no of the command, write ignored while busy
+//  0x04 COUNT      rw  amount of blocks, [1, IO_DEVICE_DISK_CMD_MAX_BLOCK_CT], write ignored
+//                      while busy
+//  0x08 PADDR      rw  guest RAM buffer, 4KB aligned, write ignored while busy
+// the completion of a command uses BLOCK, COUNT and PADDR as checked when it was issued
+//  0x0c CMD        wo  1 read | 2 write, ignored while busy
+//  0x10 STATUS     ro  [0] busy | [1] done | [2] error, an invalid command or, along with done,
+//                      a block the backend failed (see io_device_disk_backend_t)
+//  0x14 INTACK     wo  clear done and error
+//  0x18 CAPACITY   ro  amount of blocks of the disk
+//  0x1c CTRL       rw  [0] irq enable
+
+#ifndef IO_DEVICE_DISK_MD_H
+#define IO_DEVICE_DISK_MD_H
+
+#include<stdint.h>
+#include "io_device_md.h"
+#include "../common/sha256_md.h"
+#include "../computer/phys_mem_map_md.h"
+
+#define IO_DEVICE_DISK_REG_BLOCK        0x00
+#define IO_DEVICE_DISK_REG_COUNT        0x04
+#define IO_DEVICE_DISK_REG_PADDR        0x08
+#define IO_DEVICE_DISK_REG_CMD          0x0c
+#define IO_DEVICE_DISK_REG_STATUS       0x10
+#define IO_DEVICE_DISK_REG_INTACK       0x14
+#define IO_DEVICE_DISK_REG_CAPACITY     0x18
+#define IO_DEVICE_DISK_REG_CTRL         0x1c
+
+#define IO_DEVICE_DISK_CMD_NONE         0
+#define IO_DEVICE_DISK_CMD_READ         1
+#define IO_DEVICE_DISK_CMD_WRITE        2
+
+#define IO_DEVICE_DISK_STATUS_BUSY      ((uint32_t)0x01)
+#define IO_DEVICE_DISK_STATUS_DONE      ((uint32_t)0x02)
+#define IO_DEVICE_DISK_STATUS_ERROR     ((uint32_t)0x04)
+
+#define IO_DEVICE_DISK_CTRL_IRQ_ENABLE  ((uint32_t)0x01)
+
+#define IO_DEVICE_DISK_BLOCK_SIZE       PHYS_MEM_PAGE_SIZE
+#define IO_DEVICE_DISK_CMD_MAX_BLOCK_CT 64
+#define IO_DEVICE_DISK_CMD_BASE_INST_CT         ((uint64_t)4096)
+#define IO_DEVICE_DISK_CMD_PER_BLOCK_INST_CT    ((uint64_t)1024)
+#define IO_DEVICE_DISK_READ_AHEAD_MAX_BLOCK_CT  256
+
+typedef struct {
+    uint8_t u8[SHA256_DIGEST_SIZE];
+} io_device_disk_hash_t;
+
+// host side. A backend lacking a chunk has to get it (from a peer replica for example) before
+// returning, a failure is left for what the host could not do at all (no replica has the
+// chunk, the store is not writable): the command fails with the error status instead of taking
+// down the host. Such an error is local to this replica, so its guest is no longer identical
+// to the others and `backend_error_ct` tells the runtime the cell has to be repaired
+typedef struct {
+    // ret int: 0 if success | -1 if failed
+    int (*chunk_get)(void* ctx, const io_device_disk_hash_t* hashp, uint8_t* dst);
+    // ret int: 0 if success | -1 if failed
+    int (*chunk_put)(void* ctx, const io_device_disk_hash_t* hashp, const uint8_t* src);
+    // a hint only, the chunk is going to be got soon
+    void (*chunk_prefetch)(void* ctx, const io_device_disk_hash_t* hashp);
+    // block_no is about to map to hashp, the block map still holds the previous hash
+    void (*block_map_delta)(void* ctx, uint32_t block_no, const io_device_disk_hash_t* hashp);
+    void* ctx;
+} io_device_disk_backend_t;
+
+typedef struct {
+    io_device_t dev;    // must be the first member
+
+    uint32_t block;
+    uint32_t count;
+    uint32_t paddr;
+    uint32_t ctrl;
+    uint8_t cmd;                // command in flight
+    uint8_t done;
+    uint8_t error;
+    uint32_t seq_next_block;    // block right after the latest read
+    uint32_t seq_read_ahead_ct; // read-ahead window, doubled on every sequential read
+    uint32_t block_ct;
+
+    // temp bellow
+    io_device_disk_hash_t* block_map;   // host memory, its content is part of the state
+    const io_device_disk_backend_t* backendp;
+    phys_mem_map_t* pmmp;
+    uint64_t backend_error_ct;          // failed chunk_get / chunk_put, see the backend
+} io_device_disk_t;
+
+// always_inline
+inline uint8_t
+io_device_disk_hash_is_zero(const io_device_disk_hash_t* hashp){
+    uint8_t i;
+    for(i = 0; i < SHA256_DIGEST_SIZE; i++){
+        if(hashp->u8[i]){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// always_inline
+inline void
+io_device_disk_update_irq_line(io_device_disk_t* dp){
+    io_device_irq_line_set(&dp->dev,
+        (dp->done || dp->error) && (dp->ctrl & IO_DEVICE_DISK_CTRL_IRQ_ENABLE));
+}
+
+// always_inline
+inline void
+io_device_disk_prefetch_blocks(io_device_disk_hash_t* block_map, uint32_t block_ct,
+    const io_device_disk_backend_t* backendp, uint32_t block, uint32_t count){
+
+    uint32_t i;
+    if(backendp->chunk_prefetch == 0){
+        return;
+    }
+    for(i = 0; i < count && block + i < block_ct; i++){
+        if(!io_device_disk_hash_is_zero(&block_map[block + i])){
+            backendp->chunk_prefetch(backendp->ctx, &block_map[block + i]);
+        }
+    }
+}
+
+// always_inline
+inline void
+io_device_disk_prefetch(io_device_disk_t* dp, uint32_t block, uint32_t count){
+    io_device_disk_prefetch_blocks(dp->block_map, dp->block_ct, dp->backendp, block, count);
+}
+
+// ret u8: 0 if the command is valid | 1 if not
+// always_inline
+inline uint8_t
+io_device_disk_cmd_check(io_device_disk_t* dp){
+    uint32_t i;
+    phys_mem_page_t* pagep;
+    if(dp->count == 0 || dp->count > IO_DEVICE_DISK_CMD_MAX_BLOCK_CT ||
+        dp->block >= dp->block_ct || dp->count > dp->block_ct - dp->block ||
+        (dp->paddr & PHYS_MEM_PAGE_MASK)){
+        return 1;
+    }
+    for(i = 0; i < dp->count; i++){
+        pagep = phys_mem_map_page(dp->pmmp, dp->paddr + i * IO_DEVICE_DISK_BLOCK_SIZE);
+        if(pagep == 0 || pagep->ram_hostp == 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// always_inline
+inline void
+io_device_disk_cmd_issue(io_device_disk_t* dp, uint64_t now, uint8_t cmd){
+    if(dp->cmd != IO_DEVICE_DISK_CMD_NONE){
+        return;
+    }
+    if(io_device_disk_cmd_check(dp)){
+        dp->error = 1;
+        io_device_disk_update_irq_line(dp);
+        return;
+    }
+    dp->cmd = cmd;
+    if(cmd == IO_DEVICE_DISK_CMD_READ){
+        io_device_disk_prefetch(dp, dp->block, dp->count);
+        if(dp->block == dp->seq_next_block){
+            dp->seq_read_ahead_ct = dp->seq_read_ahead_ct == 0 ? dp->count :
+                dp->seq_read_ahead_ct << 1;
+            if(dp->seq_read_ahead_ct > IO_DEVICE_DISK_READ_AHEAD_MAX_BLOCK_CT){
+                dp->seq_read_ahead_ct = IO_DEVICE_DISK_READ_AHEAD_MAX_BLOCK_CT;
+            }
+            io_device_disk_prefetch(dp, dp->block + dp->count, dp->seq_read_ahead_ct);
+        }else{
+            dp->seq_read_ahead_ct = 0;
+        }
+        dp->seq_next_block = dp->block + dp->count;
+    }
+    io_event_queue_set(dp->dev.eqp, dp->dev.id, now + IO_DEVICE_DISK_CMD_BASE_INST_CT +
+        dp->count * IO_DEVICE_DISK_CMD_PER_BLOCK_INST_CT);
+}
+
+uint32_t
+io_device_disk_registers_read_handler(io_device_t* devp, uint64_t now, uint32_t offset){
+    io_device_disk_t* dp = (io_device_disk_t*)devp;
+    switch(offset){
+        case IO_DEVICE_DISK_REG_BLOCK:
+            return dp->block;
+        case IO_DEVICE_DISK_REG_COUNT:
+            return dp->count;
+        case IO_DEVICE_DISK_REG_PADDR:
+            return dp->paddr;
+        case IO_DEVICE_DISK_REG_STATUS:
+            return (dp->cmd != IO_DEVICE_DISK_CMD_NONE ? IO_DEVICE_DISK_STATUS_BUSY : 0) |
+                (dp->done ? IO_DEVICE_DISK_STATUS_DONE : 0) |
+                (dp->error ? IO_DEVICE_DISK_STATUS_ERROR : 0);
+        case IO_DEVICE_DISK_REG_CAPACITY:
+            return dp->block_ct;
+        case IO_DEVICE_DISK_REG_CTRL:
+            return dp->ctrl;
+        default:
+            return 0;
+    }
+}
+
+void
+io_device_disk_registers_write_handler(
+    io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v){
+
+    io_device_disk_t* dp = (io_device_disk_t*)devp;
+    if(dp->cmd != IO_DEVICE_DISK_CMD_NONE && offset <= IO_DEVICE_DISK_REG_PADDR){
+        return; // the command in flight has been checked against them
+    }
+    switch(offset){
+        case IO_DEVICE_DISK_REG_BLOCK:
+            dp->block = v;
+            break;
+        case IO_DEVICE_DISK_REG_COUNT:
+            dp->count = v;
+            break;
+        case IO_DEVICE_DISK_REG_PADDR:
+            dp->paddr = v;
+            break;
+        case IO_DEVICE_DISK_REG_CMD:
+            if(v == IO_DEVICE_DISK_CMD_READ || v == IO_DEVICE_DISK_CMD_WRITE){
+                io_device_disk_cmd_issue(dp, now, (uint8_t)v);
+            }
+            break;
+        case IO_DEVICE_DISK_REG_INTACK:
+            dp->done = 0;
+            dp->error = 0;
+            io_device_disk_update_irq_line(dp);
+            break;
+        case IO_DEVICE_DISK_REG_CTRL:
+            dp->ctrl = v;
+            io_device_disk_update_irq_line(dp);
+            break;
+        default:
+            break;
+    }
+}
+
+// also used by the paravirtual block device, which shares the block map of the disk
+// ret int: 0 if success | -1 if the backend failed
+// always_inline
+inline int
+io_device_disk_read_block(io_device_disk_hash_t* block_map,
+    const io_device_disk_backend_t* backendp, uint32_t block_no, uint8_t* dst){
+
+    uint32_t i;
+    if(io_device_disk_hash_is_zero(&block_map[block_no])){
+        for(i = 0; i < IO_DEVICE_DISK_BLOCK_SIZE; i++){
+            dst[i] = 0;
+        }
+        return 0;
+    }
+    return backendp->chunk_get(backendp->ctx, &block_map[block_no], dst);
+}
+
+// the block keeps its previous content if the backend failed
+// ret int: 0 if success | -1 if the backend failed
+// always_inline
+inline int
+io_device_disk_write_block(io_device_disk_hash_t* block_map,
+    const io_device_disk_backend_t* backendp, uint32_t block_no, const uint8_t* src){
+
+    io_device_disk_hash_t hash;
+    uint32_t i;
+    for(i = 0; i < IO_DEVICE_DISK_BLOCK_SIZE; i++){
+        if(src[i]){
+            break;
+        }
+    }
+    if(i == IO_DEVICE_DISK_BLOCK_SIZE){
+        for(i = 0; i < SHA256_DIGEST_SIZE; i++){
+            hash.u8[i] = 0;
+        }
+    }else{
+        sha256(src, IO_DEVICE_DISK_BLOCK_SIZE, hash.u8);
+        if(backendp->chunk_put(backendp->ctx, &hash, src) != 0){
+            return -1;
+        }
+    }
+    if(backendp->block_map_delta){
+        backendp->block_map_delta(backendp->ctx, block_no, &hash);
+    }
+    block_map[block_no] = hash;
+    return 0;
+}
+
+// the command in flight completes
+void
+io_device_disk_cpuclk_timer_routine(io_device_t* devp, uint64_t now){
+    io_device_disk_t* dp = (io_device_disk_t*)devp;
+    uint32_t i, paddr;
+    uint8_t* hostp;
+    int ret;
+    for(i = 0; i < dp->count; i++){
+        paddr = dp->paddr + i * IO_DEVICE_DISK_BLOCK_SIZE;
+        if(dp->cmd == IO_DEVICE_DISK_CMD_READ){
+            hostp = phys_mem_map_ram_write_hostp(dp->pmmp, paddr);
+            ret = io_device_disk_read_block(dp->block_map, dp->backendp, dp->block + i, hostp);
+            phys_mem_map_code_write(dp->pmmp, paddr, IO_DEVICE_DISK_BLOCK_SIZE);
+        }else{
+            hostp = phys_mem_map_page(dp->pmmp, paddr)->ram_hostp;
+            ret = io_device_disk_write_block(dp->block_map, dp->backendp, dp->block + i, hostp);
+        }
+        if(ret != 0){
+            dp->backend_error_ct++;
+            dp->error = 1;
+        }
+    }
+    dp->cmd = IO_DEVICE_DISK_CMD_NONE;
+    dp->done = 1;
+    io_device_disk_update_irq_line(dp);
+}
+
+// polled by a guest driver waiting for the completion
+uint32_t
+io_device_disk_read_status(io_device_t* devp, uint64_t now, uint32_t offset){
+    return io_device_disk_registers_read_handler(devp, now, IO_DEVICE_DISK_REG_STATUS);
+}
+
+const io_device_ops_t gl_io_device_disk_ops = {
+    .pre_cpu_exec_phase_handler = 0,
+    .registers_read_handler = io_device_disk_registers_read_handler,
+    .registers_write_handler = io_device_disk_registers_write_handler,
+    .cpuclk_timer_routine = io_device_disk_cpuclk_timer_routine,
+    .post_cpu_exec_phase_handler = 0,
+    .io_input_write_buffer = 0,
+    .io_output_consume_buffer = 0,
+};
+
+// the block map of block_ct hashes belongs to the cell and keeps the content of the disk
+// always_inline
+inline void
+io_device_disk_hwreset(io_device_disk_t* dp, io_device_disk_hash_t* block_map, uint32_t block_ct,
+    const io_device_disk_backend_t* backendp, phys_mem_map_t* pmmp){
+
+    dp->dev.ops = &gl_io_device_disk_ops;
+    io_device_mmio_table_init(&dp->dev);
+    dp->dev.mmio_table.read[IO_DEVICE_MMIO_REG_IDX(IO_DEVICE_DISK_REG_STATUS)] =
+        io_device_disk_read_status;
+    dp->block = 0;
+    dp->count = 0;
+    dp->paddr = 0;
+    dp->ctrl = 0;
+    dp->cmd = IO_DEVICE_DISK_CMD_NONE;
+    dp->done = 0;
+    dp->error = 0;
+    dp->seq_next_block = 0xffffffff;
+    dp->seq_read_ahead_ct = 0;
+    dp->block_ct = block_ct;
+    dp->block_map = block_map;
+    dp->backendp = backendp;
+    dp->pmmp = pmmp;
+    dp->backend_error_ct = 0;
+    io_event_queue_cancel(dp->dev.eqp, dp->dev.id);
+}
+
+#endif
@@ -0,0 +1,160 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** interrupt controller **
+// up to 32 interrupt lines, the pending, enabled and fiq-selected state are all bitmasks.
+// Devices push their line level into the controller, the controller never queries any
+// device. The cpu is only told when one of the two output lines (irq, fiq) changes.
+//
+// registers:
+//  0x00 IRQ_STATUS     ro  pending & enable & ~fiq_select
+//  0x04 FIQ_STATUS     ro  pending & enable & fiq_select
+//  0x08 RAW            ro  pending
+//  0x0c ENABLE         ro  enable
+//  0x10 ENABLE_SET     wo  enable |= v
+//  0x14 ENABLE_CLEAR   wo  enable &= ~v
+//  0x18 FIQ_SELECT     rw  lines routed to fiq instead of irq
+
+#ifndef IO_DEVICE_INTC_MD_H
+#define IO_DEVICE_INTC_MD_H
+
+#include<stdint.h>
+#include "io_device_md.h"
+
+#define IO_DEVICE_INTC_REG_IRQ_STATUS   0x00
+#define IO_DEVICE_INTC_REG_FIQ_STATUS   0x04
+#define IO_DEVICE_INTC_REG_RAW          0x08
+#define IO_DEVICE_INTC_REG_ENABLE       0x0c
+#define IO_DEVICE_INTC_REG_ENABLE_SET   0x10
+#define IO_DEVICE_INTC_REG_ENABLE_CLEAR 0x14
+#define IO_DEVICE_INTC_REG_FIQ_SELECT   0x18
+
+typedef struct {
+    io_device_t dev;    // must be the first member
+
+    uint32_t pending;   // level of every line
+    uint32_t enable;
+    uint32_t fiq_select;
+    uint8_t irq_out;
+    uint8_t fiq_out;
+
+    // temp bellow
+    void (*cpu_lines_set_cb)(void* cb_arg, uint8_t irq_line, uint8_t fiq_line);
+    void* cpu_cb_arg;
+} io_device_intc_t;
+
+// always_inline
+inline void
+io_device_intc_update_output(io_device_intc_t* icp){
+    uint32_t active = icp->pending & icp->enable;
+    uint8_t irq_out = !!(active & (~icp->fiq_select));
+    uint8_t fiq_out = !!(active & icp->fiq_select);
+    if(irq_out == icp->irq_out && fiq_out == icp->fiq_out){
+        return;
+    }
+    icp->irq_out = irq_out;
+    icp->fiq_out = fiq_out;
+    if(icp->cpu_lines_set_cb){
+        icp->cpu_lines_set_cb(icp->cpu_cb_arg, irq_out, fiq_out);
+    }
+}
+
+// drive line irq_no of the controller, level: 0 for low | 1 for high
+// always_inline
+inline void
+io_device_intc_line_set(io_device_intc_t* icp, uint8_t irq_no, uint8_t level){
+    uint32_t bit = ((uint32_t)1) << (irq_no & 0x1f);
+    if(level){
+        icp->pending = icp->pending | bit;
+    }else{
+        icp->pending = icp->pending & (~bit);
+    }
+    io_device_intc_update_output(icp);
+}
+
+uint32_t
+io_device_intc_registers_read_handler(io_device_t* devp, uint64_t now, uint32_t offset){
+    io_device_intc_t* icp = (io_device_intc_t*)devp;
+    switch(offset){
+        case IO_DEVICE_INTC_REG_IRQ_STATUS:
+            return icp->pending & icp->enable & (~icp->fiq_select);
+        case IO_DEVICE_INTC_REG_FIQ_STATUS:
+            return icp->pending & icp->enable & icp->fiq_select;
+        case IO_DEVICE_INTC_REG_RAW:
+            return icp->pending;
+        case IO_DEVICE_INTC_REG_ENABLE:
+            return icp->enable;
+        case IO_DEVICE_INTC_REG_FIQ_SELECT:
+            return icp->fiq_select;
+        default:
+            return 0;
+    }
+}
+
+void
+io_device_intc_registers_write_handler(
+    io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v){
+
+    io_device_intc_t* icp = (io_device_intc_t*)devp;
+    switch(offset){
+        case IO_DEVICE_INTC_REG_ENABLE_SET:
+            icp->enable = icp->enable | v;
+            break;
+        case IO_DEVICE_INTC_REG_ENABLE_CLEAR:
+            icp->enable = icp->enable & (~v);
+            break;
+        case IO_DEVICE_INTC_REG_FIQ_SELECT:
+            icp->fiq_select = v;
+            break;
+        default:
+            return;
+    }
+    io_device_intc_update_output(icp);
+}
+
+// read by the guest interrupt handler on every interrupt
+uint32_t
+io_device_intc_read_irq_status(io_device_t* devp, uint64_t now, uint32_t offset){
+    io_device_intc_t* icp = (io_device_intc_t*)devp;
+    return icp->pending & icp->enable & (~icp->fiq_select);
+}
+
+const io_device_ops_t gl_io_device_intc_ops = {
+    .pre_cpu_exec_phase_handler = 0,
+    .registers_read_handler = io_device_intc_registers_read_handler,
+    .registers_write_handler = io_device_intc_registers_write_handler,
+    .cpuclk_timer_routine = 0,
+    .post_cpu_exec_phase_handler = 0,
+    .io_input_write_buffer = 0,
+    .io_output_consume_buffer = 0,
+};
+
+// the line levels are kept, they belong to the devices
+// always_inline
+inline void
+io_device_intc_hwreset(io_device_intc_t* icp){
+    icp->dev.ops = &gl_io_device_intc_ops;
+    io_device_mmio_table_init(&icp->dev);
+    icp->dev.mmio_table.read[IO_DEVICE_MMIO_REG_IDX(IO_DEVICE_INTC_REG_IRQ_STATUS)] =
+        io_device_intc_read_irq_status;
+    icp->enable = 0;
+    icp->fiq_select = 0;
+    icp->irq_out = 0;
+    icp->fiq_out = 0;
+    if(icp->cpu_lines_set_cb){
+        icp->cpu_lines_set_cb(icp->cpu_cb_arg, 0, 0);
+    }
+}
+
+#endif
@@ -0,0 +1,115 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** io device framework **
+// every handler is a md function, the only notion of time inside a device is `now`, which
+// is the cpu inst counter `inst_executed_ct_total` at the moment of the call
+//
+// mdf
+//     pre_cpu_exec_phase          -> pre_cpu_exec_phase_handler
+//     cpu_exec_phase
+//         cpu_exec_batch          -> registers_read/write_handler
+//         event deadline reached  -> cpuclk_timer_routine
+//     post_cpu_exec_phase         -> post_cpu_exec_phase_handler
+// mdf_computer_io_input               -> io_input_write_buffer
+// mdf_computer_io_output              -> io_output_consume_buffer
+
+#ifndef IO_DEVICE_MD_H
+#define IO_DEVICE_MD_H
+
+#include<stdint.h>
+#include "../computer/io_event_queue_md.h"
+#include "../common/latency_histogram.h"
+
+typedef struct io_device_s io_device_t;
+
+typedef uint32_t (*io_device_mmio_read_fn_t)(io_device_t* devp, uint64_t now, uint32_t offset);
+typedef void (*io_device_mmio_write_fn_t)(
+    io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v);
+
+// registers are decoded by offset[7:2] only, i.e. they mirror every 256 bytes in the page
+#define IO_DEVICE_MMIO_REG_CT           64
+#define IO_DEVICE_MMIO_REG_IDX(offset)  (((offset) >> 2) & (IO_DEVICE_MMIO_REG_CT - 1))
+
+// an mmio page of the physical memory map points directly to this table, so one register
+// access costs two loads and an indirect call, plus the test of `histp` of the device
+typedef struct {
+    io_device_t* devp;
+    io_device_mmio_read_fn_t read[IO_DEVICE_MMIO_REG_CT];       // indexed by register idx
+    io_device_mmio_write_fn_t write[IO_DEVICE_MMIO_REG_CT];
+} io_device_mmio_table_t;
+
+// any handler could be NULL if the device does not care about it
+typedef struct {
+    void (*pre_cpu_exec_phase_handler)(io_device_t* devp, uint64_t now);
+    uint32_t (*registers_read_handler)(io_device_t* devp, uint64_t now, uint32_t offset);
+    void (*registers_write_handler)(io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v);
+    void (*cpuclk_timer_routine)(io_device_t* devp, uint64_t now);
+    void (*post_cpu_exec_phase_handler)(io_device_t* devp, uint64_t now);
+    // data chosen by the tape for this device
+    void (*io_input_write_buffer)(io_device_t* devp, uint64_t now, const uint8_t* data, uint32_t len);
+    // the output span [offset, offset + len) has been delivered to the outside
+    void (*io_output_consume_buffer)(io_device_t* devp, uint64_t now, uint64_t offset, uint32_t len);
+} io_device_ops_t;
+
+struct io_device_s {
+    const io_device_ops_t* ops;
+    uint8_t id;                     // also the owner id of its event in the io event queue
+    uint8_t irq_no;                 // interrupt line of this device
+
+    // temp bellow
+    io_event_queue_t* eqp;
+    const uint64_t* tape_idxp;      // index of the tape entry being applied
+    // drive the interrupt line of this device, level: 0 for low | 1 for high
+    void (*irq_line_set_cb)(void* cb_arg, uint8_t irq_no, uint8_t level);
+    void* irq_cb_arg;
+    io_device_mmio_table_t mmio_table;
+    // host time of every handler invocation, NULL if not measured (see latency_histogram.h)
+    latency_histogram_t* histp;
+};
+
+uint32_t
+io_device_mmio_read_nothing(io_device_t* devp, uint64_t now, uint32_t offset){
+    return 0;
+}
+
+void
+io_device_mmio_write_nothing(io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v){
+}
+
+// every register goes to the generic handlers of `ops` at first, then the device could
+// override its hot registers with dedicated handlers
+// always_inline
+inline void
+io_device_mmio_table_init(io_device_t* devp){
+    uint8_t i;
+    io_device_mmio_table_t* tp = &devp->mmio_table;
+    tp->devp = devp;
+    for(i = 0; i < IO_DEVICE_MMIO_REG_CT; i++){
+        tp->read[i] = devp->ops->registers_read_handler ?
+            devp->ops->registers_read_handler : io_device_mmio_read_nothing;
+        tp->write[i] = devp->ops->registers_write_handler ?
+            devp->ops->registers_write_handler : io_device_mmio_write_nothing;
+    }
+}
+
+// always_inline
+inline void
+io_device_irq_line_set(io_device_t* devp, uint8_t level){
+    if(devp->irq_line_set_cb){
+        devp->irq_line_set_cb(devp->irq_cb_arg, devp->irq_no, level);
+    }
+}
+
+#endif
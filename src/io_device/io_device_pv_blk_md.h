@@ -0,0 +1,284 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** paravirtual block device **
+// the paravirtual front end of the disk of the cell: it shares the block map and the chunk
+// store backend with io_device_disk_md.h, a guest is expected to drive only one of them.
+//
+// one queue (0). A request is a descriptor chain:
+//  header  readable, 16 bytes: u32 type, u32 reserved, u32 block no, u32 reserved
+//  data    0 or more, len a multiple of the block size, writable for IN and readable for OUT
+//  status  writable, 1 byte: IO_DEVICE_PV_BLK_S_*
+//
+// timing: a NOTIFY takes every request available as one batch, which completes
+// `IO_DEVICE_DISK_CMD_BASE_INST_CT + blocks * IO_DEVICE_DISK_CMD_PER_BLOCK_INST_CT` insts
+// later with one interrupt, the base cost is paid once per batch. Requests made available
+// while a batch is in flight go into the next batch.
+//
+// config:
+//  CONFIG0     capacity in blocks
+//  CONFIG1     block size in bytes
+
+#ifndef IO_DEVICE_PV_BLK_MD_H
+#define IO_DEVICE_PV_BLK_MD_H
+
+#include<stdint.h>
+#include "io_device_md.h"
+#include "io_device_pv_md.h"
+#include "io_device_disk_md.h"
+
+#define IO_DEVICE_PV_BLK_T_IN       0   // read
+#define IO_DEVICE_PV_BLK_T_OUT      1   // write
+
+#define IO_DEVICE_PV_BLK_S_OK       0
+#define IO_DEVICE_PV_BLK_S_IOERR    1
+#define IO_DEVICE_PV_BLK_S_UNSUPP   2
+
+#define IO_DEVICE_PV_BLK_HEADER_SIZE    16
+
+typedef struct {
+    io_device_t dev;    // must be the first member
+    io_device_pv_t pv;
+
+    uint32_t batch_ct;  // amount of requests in flight, taken from last_avail_idx
+    uint32_t block_ct;
+
+    // temp bellow
+    io_device_disk_hash_t* block_map;   // shared with the disk device
+    const io_device_disk_backend_t* backendp;
+    uint64_t backend_error_ct;          // like io_device_disk_t.backend_error_ct
+    uint8_t block_buf[IO_DEVICE_DISK_BLOCK_SIZE];
+} io_device_pv_blk_t;
+
+// a request, decoded from its chain
+typedef struct {
+    uint32_t head;
+    uint32_t type;
+    uint32_t block;
+    uint32_t block_ct;
+    uint32_t data_desc_ct;
+    io_device_pv_desc_t data_descs[IO_DEVICE_PV_QUEUE_SIZE_MAX];
+    io_device_pv_desc_t status_desc;
+    uint8_t status_valid_flag;
+} io_device_pv_blk_req_t;
+
+// ret u8: IO_DEVICE_PV_BLK_S_OK if the request could be served
+// always_inline
+inline uint8_t
+io_device_pv_blk_req_decode(io_device_pv_blk_t* bp, io_device_pv_queue_t* qp, uint32_t head,
+    io_device_pv_blk_req_t* reqp){
+
+    io_device_pv_desc_t desc;
+    uint32_t i, idx = head;
+    uint8_t ret = IO_DEVICE_PV_BLK_S_OK;
+    reqp->head = head;
+    reqp->block_ct = 0;
+    reqp->data_desc_ct = 0;
+    reqp->status_valid_flag = 0;
+    for(i = 0; i < qp->size; i++){ // a looping chain ends at the ring size
+        io_device_pv_desc_read(&bp->pv, qp, idx, &desc);
+        if(i == 0){
+            if((desc.flags & IO_DEVICE_PV_DESC_F_WRITE) || desc.len < IO_DEVICE_PV_BLK_HEADER_SIZE ||
+                !phys_mem_map_ram_range_check(bp->pv.pmmp, desc.paddr, IO_DEVICE_PV_BLK_HEADER_SIZE) ||
+                (desc.paddr & 3)){
+                ret = IO_DEVICE_PV_BLK_S_IOERR;
+            }else{
+                reqp->type = io_device_pv_load(&bp->pv, desc.paddr);
+                reqp->block = io_device_pv_load(&bp->pv, desc.paddr + 8);
+            }
+        }else if(!(desc.flags & IO_DEVICE_PV_DESC_F_NEXT)){
+            if((desc.flags & IO_DEVICE_PV_DESC_F_WRITE) && desc.len >= 1 &&
+                phys_mem_map_ram_range_check(bp->pv.pmmp, desc.paddr, 1)){
+                reqp->status_desc = desc;
+                reqp->status_valid_flag = 1;
+            }
+        }else{
+            if(desc.len % IO_DEVICE_DISK_BLOCK_SIZE ||
+                !phys_mem_map_ram_range_check(bp->pv.pmmp, desc.paddr, desc.len)){
+                ret = IO_DEVICE_PV_BLK_S_IOERR;
+            }
+            reqp->data_descs[reqp->data_desc_ct++] = desc;
+            reqp->block_ct += desc.len / IO_DEVICE_DISK_BLOCK_SIZE;
+        }
+        if(!(desc.flags & IO_DEVICE_PV_DESC_F_NEXT)){
+            break;
+        }
+        idx = desc.next;
+    }
+    if(!reqp->status_valid_flag){
+        return IO_DEVICE_PV_BLK_S_IOERR;
+    }
+    if(ret != IO_DEVICE_PV_BLK_S_OK){
+        return ret;
+    }
+    if(reqp->type != IO_DEVICE_PV_BLK_T_IN && reqp->type != IO_DEVICE_PV_BLK_T_OUT){
+        return IO_DEVICE_PV_BLK_S_UNSUPP;
+    }
+    if(reqp->block > bp->block_ct || reqp->block_ct > bp->block_ct - reqp->block){
+        return IO_DEVICE_PV_BLK_S_IOERR;
+    }
+    for(i = 0; i < reqp->data_desc_ct; i++){
+        if(((reqp->type == IO_DEVICE_PV_BLK_T_IN) != !!(reqp->data_descs[i].flags & IO_DEVICE_PV_DESC_F_WRITE))){
+            return IO_DEVICE_PV_BLK_S_IOERR;
+        }
+    }
+    return IO_DEVICE_PV_BLK_S_OK;
+}
+
+// take the available requests as a new batch and time it
+// always_inline
+inline void
+io_device_pv_blk_batch_start(io_device_pv_blk_t* bp, uint64_t now){
+    io_device_pv_queue_t* qp = &bp->pv.queues[0];
+    io_device_pv_blk_req_t req;
+    uint64_t block_ct = 0;
+    uint32_t i;
+    bp->batch_ct = io_device_pv_avail_ct(&bp->pv, qp);
+    if(bp->batch_ct == 0){
+        return;
+    }
+    for(i = 0; i < bp->batch_ct; i++){
+        if(io_device_pv_blk_req_decode(bp, qp, io_device_pv_avail_head(&bp->pv, qp, i), &req) ==
+            IO_DEVICE_PV_BLK_S_OK){
+            block_ct += req.block_ct;
+            if(req.type == IO_DEVICE_PV_BLK_T_IN){
+                io_device_disk_prefetch_blocks(bp->block_map, bp->block_ct, bp->backendp,
+                    req.block, req.block_ct);
+            }
+        }
+    }
+    io_event_queue_set(bp->dev.eqp, bp->dev.id, now + IO_DEVICE_DISK_CMD_BASE_INST_CT +
+        block_ct * IO_DEVICE_DISK_CMD_PER_BLOCK_INST_CT);
+}
+
+// *statusp becomes IO_DEVICE_PV_BLK_S_IOERR if the backend failed a block, the other blocks
+// are still served
+// ret u32: amount of bytes written into the guest RAM
+// always_inline
+inline uint32_t
+io_device_pv_blk_req_exec(io_device_pv_blk_t* bp, io_device_pv_blk_req_t* reqp, uint8_t* statusp){
+    uint32_t i, j, paddr, block = reqp->block, written_ct = 0;
+    io_device_pv_desc_t* descp;
+    int ret;
+    for(i = 0; i < reqp->data_desc_ct; i++){
+        descp = &reqp->data_descs[i];
+        for(j = 0; j < descp->len; j += IO_DEVICE_DISK_BLOCK_SIZE){
+            paddr = descp->paddr + j;
+            // a page aligned block is one RAM page, the chunk goes straight from or into it
+            // like with the disk, block_buf is only for a block straddling two pages
+            if(reqp->type == IO_DEVICE_PV_BLK_T_IN){
+                if((paddr & PHYS_MEM_PAGE_MASK) == 0){
+                    ret = io_device_disk_read_block(bp->block_map, bp->backendp, block,
+                        phys_mem_map_ram_write_hostp(bp->pv.pmmp, paddr));
+                    phys_mem_map_code_write(bp->pv.pmmp, paddr, IO_DEVICE_DISK_BLOCK_SIZE);
+                }else{
+                    ret = io_device_disk_read_block(bp->block_map, bp->backendp, block,
+                        bp->block_buf);
+                    phys_mem_map_ram_copy_in(bp->pv.pmmp, paddr, bp->block_buf,
+                        IO_DEVICE_DISK_BLOCK_SIZE);
+                }
+                written_ct += IO_DEVICE_DISK_BLOCK_SIZE;
+            }else if((paddr & PHYS_MEM_PAGE_MASK) == 0){
+                ret = io_device_disk_write_block(bp->block_map, bp->backendp, block,
+                    phys_mem_map_ram_hostp(bp->pv.pmmp, paddr));
+            }else{
+                phys_mem_map_ram_copy_out(bp->pv.pmmp, paddr, bp->block_buf,
+                    IO_DEVICE_DISK_BLOCK_SIZE);
+                ret = io_device_disk_write_block(bp->block_map, bp->backendp, block,
+                    bp->block_buf);
+            }
+            if(ret != 0){
+                bp->backend_error_ct++;
+                *statusp = IO_DEVICE_PV_BLK_S_IOERR;
+            }
+            block++;
+        }
+    }
+    return written_ct;
+}
+
+// the batch in flight completes
+void
+io_device_pv_blk_cpuclk_timer_routine(io_device_t* devp, uint64_t now){
+    io_device_pv_blk_t* bp = (io_device_pv_blk_t*)devp;
+    io_device_pv_queue_t* qp = &bp->pv.queues[0];
+    io_device_pv_blk_req_t req;
+    uint32_t i, len;
+    uint8_t status;
+    if(!qp->ready){ // reset by the guest meanwhile
+        bp->batch_ct = 0;
+        return;
+    }
+    for(i = 0; i < bp->batch_ct; i++){
+        status = io_device_pv_blk_req_decode(bp, qp, io_device_pv_avail_head(&bp->pv, qp, 0), &req);
+        len = 0;
+        if(status == IO_DEVICE_PV_BLK_S_OK){
+            len = io_device_pv_blk_req_exec(bp, &req, &status);
+        }
+        if(req.status_valid_flag){
+            phys_mem_map_ram_write_hostp(bp->pv.pmmp, req.status_desc.paddr)[0] = status;
+            phys_mem_map_code_write(bp->pv.pmmp, req.status_desc.paddr, 1);
+            len++;
+        }
+        qp->last_avail_idx++;
+        io_device_pv_used_push(&bp->pv, qp, req.head, len);
+    }
+    bp->batch_ct = 0;
+    io_device_pv_raise_used(&bp->dev, &bp->pv);
+    io_device_pv_blk_batch_start(bp, now);
+}
+
+uint32_t
+io_device_pv_blk_registers_read_handler(io_device_t* devp, uint64_t now, uint32_t offset){
+    io_device_pv_blk_t* bp = (io_device_pv_blk_t*)devp;
+    return io_device_pv_registers_read(&bp->pv, offset, bp->block_ct, IO_DEVICE_DISK_BLOCK_SIZE);
+}
+
+void
+io_device_pv_blk_registers_write_handler(
+    io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v){
+
+    io_device_pv_blk_t* bp = (io_device_pv_blk_t*)devp;
+    if(io_device_pv_registers_write(devp, &bp->pv, offset, v) == 0 && bp->batch_ct == 0){
+        io_device_pv_blk_batch_start(bp, now);
+    }
+}
+
+const io_device_ops_t gl_io_device_pv_blk_ops = {
+    .pre_cpu_exec_phase_handler = 0,
+    .registers_read_handler = io_device_pv_blk_registers_read_handler,
+    .registers_write_handler = io_device_pv_blk_registers_write_handler,
+    .cpuclk_timer_routine = io_device_pv_blk_cpuclk_timer_routine,
+    .post_cpu_exec_phase_handler = 0,
+    .io_input_write_buffer = 0,
+    .io_output_consume_buffer = 0,
+};
+
+// always_inline
+inline void
+io_device_pv_blk_hwreset(io_device_pv_blk_t* bp, io_device_disk_hash_t* block_map,
+    uint32_t block_ct, const io_device_disk_backend_t* backendp, phys_mem_map_t* pmmp){
+
+    bp->dev.ops = &gl_io_device_pv_blk_ops;
+    io_device_mmio_table_init(&bp->dev);
+    io_device_pv_hwreset(&bp->pv, IO_DEVICE_PV_DEVICE_ID_BLK, 1, pmmp);
+    bp->batch_ct = 0;
+    bp->block_ct = block_ct;
+    bp->block_map = block_map;
+    bp->backendp = backendp;
+    bp->backend_error_ct = 0;
+    io_event_queue_cancel(bp->dev.eqp, bp->dev.id);
+}
+
+#endif
@@ -0,0 +1,216 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** paravirtual console device **
+// the paravirtual front end of the uart: the byte streams are the ones of the uart, so the
+// tape entries (`mdf_computer_io_input/output` on the uart) and the replicated tx ring with
+// its exactly-once delivery stay the same. A guest is expected to drive only one of them.
+//
+// queue 0 rx: writable buffers, filled with the received bytes in pre_cpu_exec_phase, i.e.
+//             right after the input entries of the tape are applied
+// queue 1 tx: readable buffers, a NOTIFY moves every available chain into the uart tx ring at
+//             once. A chain which does not fit the free space of the tx ring waits until
+//             the acknowledgement frees enough, it is retried in every pre_cpu_exec_phase.
+// used buffers of both queues are reported by one interrupt.
+
+#ifndef IO_DEVICE_PV_CONSOLE_MD_H
+#define IO_DEVICE_PV_CONSOLE_MD_H
+
+#include<stdint.h>
+#include "io_device_md.h"
+#include "io_device_pv_md.h"
+#include "io_device_uart_md.h"
+
+#define IO_DEVICE_PV_CONSOLE_QUEUE_RX   0
+#define IO_DEVICE_PV_CONSOLE_QUEUE_TX   1
+
+#define IO_DEVICE_PV_CONSOLE_BUF_SIZE   256
+
+typedef struct {
+    io_device_t dev;    // must be the first member
+    io_device_pv_t pv;
+
+    // temp bellow
+    io_device_uart_t* uartp;
+    uint8_t buf[IO_DEVICE_PV_CONSOLE_BUF_SIZE];
+} io_device_pv_console_t;
+
+// ret: total len of the readable descs of the chain | 0xffffffff if the chain is invalid
+// always_inline
+inline uint32_t
+io_device_pv_console_tx_chain_len(io_device_pv_console_t* cp, io_device_pv_queue_t* qp,
+    uint32_t head){
+
+    io_device_pv_desc_t desc;
+    uint32_t i, idx = head, total = 0;
+    for(i = 0; i < qp->size; i++){
+        io_device_pv_desc_read(&cp->pv, qp, idx, &desc);
+        if((desc.flags & IO_DEVICE_PV_DESC_F_WRITE) || total + desc.len < total ||
+            !phys_mem_map_ram_range_check(cp->pv.pmmp, desc.paddr, desc.len)){
+            return 0xffffffff;
+        }
+        total += desc.len;
+        if(!(desc.flags & IO_DEVICE_PV_DESC_F_NEXT)){
+            return total;
+        }
+        idx = desc.next;
+    }
+    return 0xffffffff;
+}
+
+// always_inline
+inline void
+io_device_pv_console_tx_chain_send(io_device_pv_console_t* cp, io_device_pv_queue_t* qp,
+    uint32_t head){
+
+    io_device_pv_desc_t desc;
+    uint32_t i, idx = head, off, n;
+    for(i = 0; i < qp->size; i++){
+        io_device_pv_desc_read(&cp->pv, qp, idx, &desc);
+        for(off = 0; off < desc.len; off += n){
+            n = desc.len - off;
+            if(n > IO_DEVICE_PV_CONSOLE_BUF_SIZE){
+                n = IO_DEVICE_PV_CONSOLE_BUF_SIZE;
+            }
+            phys_mem_map_ram_copy_out(cp->pv.pmmp, desc.paddr + off, cp->buf, n);
+            io_device_uart_tx_bytes(cp->uartp, cp->buf, n);
+        }
+        if(!(desc.flags & IO_DEVICE_PV_DESC_F_NEXT)){
+            return;
+        }
+        idx = desc.next;
+    }
+}
+
+// always_inline
+inline void
+io_device_pv_console_tx_process(io_device_pv_console_t* cp){
+    io_device_pv_queue_t* qp = &cp->pv.queues[IO_DEVICE_PV_CONSOLE_QUEUE_TX];
+    uint32_t ct = io_device_pv_avail_ct(&cp->pv, qp);
+    uint32_t i, head, len;
+    uint8_t used_flag = 0;
+    for(i = 0; i < ct; i++){
+        head = io_device_pv_avail_head(&cp->pv, qp, 0);
+        len = io_device_pv_console_tx_chain_len(cp, qp, head);
+        if(len != 0xffffffff){
+            if(len > cp->uartp->txp->data_size){ // could never fit, drop it
+                len = 0xffffffff;
+            }else if(len > io_device_uart_tx_free(cp->uartp)){
+                break;
+            }else{
+                io_device_pv_console_tx_chain_send(cp, qp, head);
+            }
+        }
+        qp->last_avail_idx++;
+        io_device_pv_used_push(&cp->pv, qp, head, 0);
+        used_flag = 1;
+    }
+    if(used_flag){
+        io_device_pv_raise_used(&cp->dev, &cp->pv);
+    }
+}
+
+// always_inline
+inline void
+io_device_pv_console_rx_process(io_device_pv_console_t* cp){
+    io_device_pv_queue_t* qp = &cp->pv.queues[IO_DEVICE_PV_CONSOLE_QUEUE_RX];
+    io_device_pv_desc_t desc;
+    uint32_t ct, head, idx, i, total, n;
+    uint8_t used_flag = 0;
+    ct = io_device_pv_avail_ct(&cp->pv, qp);
+    while(ct && cp->uartp->rx_ct){
+        head = io_device_pv_avail_head(&cp->pv, qp, 0);
+        idx = head;
+        total = 0;
+        for(i = 0; i < qp->size; i++){
+            io_device_pv_desc_read(&cp->pv, qp, idx, &desc);
+            if(!(desc.flags & IO_DEVICE_PV_DESC_F_WRITE) ||
+                !phys_mem_map_ram_range_check(cp->pv.pmmp, desc.paddr, desc.len)){
+                break;
+            }
+            while(desc.len && cp->uartp->rx_ct){
+                n = desc.len > IO_DEVICE_PV_CONSOLE_BUF_SIZE ? IO_DEVICE_PV_CONSOLE_BUF_SIZE : desc.len;
+                n = io_device_uart_rx_pop(cp->uartp, cp->buf, n);
+                phys_mem_map_ram_copy_in(cp->pv.pmmp, desc.paddr, cp->buf, n);
+                desc.paddr += n;
+                desc.len -= n;
+                total += n;
+            }
+            if(!(desc.flags & IO_DEVICE_PV_DESC_F_NEXT) || cp->uartp->rx_ct == 0){
+                break;
+            }
+            idx = desc.next;
+        }
+        qp->last_avail_idx++;
+        io_device_pv_used_push(&cp->pv, qp, head, total);
+        used_flag = 1;
+        ct--;
+    }
+    if(used_flag){
+        io_device_pv_raise_used(&cp->dev, &cp->pv);
+    }
+}
+
+void
+io_device_pv_console_pre_cpu_exec_phase_handler(io_device_t* devp, uint64_t now){
+    io_device_pv_console_t* cp = (io_device_pv_console_t*)devp;
+    io_device_pv_console_rx_process(cp);
+    io_device_pv_console_tx_process(cp);
+}
+
+uint32_t
+io_device_pv_console_registers_read_handler(io_device_t* devp, uint64_t now, uint32_t offset){
+    io_device_pv_console_t* cp = (io_device_pv_console_t*)devp;
+    return io_device_pv_registers_read(&cp->pv, offset, 0, 0);
+}
+
+void
+io_device_pv_console_registers_write_handler(
+    io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v){
+
+    io_device_pv_console_t* cp = (io_device_pv_console_t*)devp;
+    switch(io_device_pv_registers_write(devp, &cp->pv, offset, v)){
+        case IO_DEVICE_PV_CONSOLE_QUEUE_RX:
+            io_device_pv_console_rx_process(cp);
+            break;
+        case IO_DEVICE_PV_CONSOLE_QUEUE_TX:
+            io_device_pv_console_tx_process(cp);
+            break;
+        default:
+            break;
+    }
+}
+
+const io_device_ops_t gl_io_device_pv_console_ops = {
+    .pre_cpu_exec_phase_handler = io_device_pv_console_pre_cpu_exec_phase_handler,
+    .registers_read_handler = io_device_pv_console_registers_read_handler,
+    .registers_write_handler = io_device_pv_console_registers_write_handler,
+    .cpuclk_timer_routine = 0,
+    .post_cpu_exec_phase_handler = 0,
+    .io_input_write_buffer = 0,
+    .io_output_consume_buffer = 0,
+};
+
+// always_inline
+inline void
+io_device_pv_console_hwreset(io_device_pv_console_t* cp, io_device_uart_t* uartp,
+    phys_mem_map_t* pmmp){
+
+    cp->dev.ops = &gl_io_device_pv_console_ops;
+    io_device_mmio_table_init(&cp->dev);
+    io_device_pv_hwreset(&cp->pv, IO_DEVICE_PV_DEVICE_ID_CONSOLE, 2, pmmp);
+    cp->uartp = uartp;
+}
+
+#endif
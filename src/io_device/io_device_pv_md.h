@@ -0,0 +1,304 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** paravirtual device framework **
+// a virtio-mmio-like transport: the requests are descriptor chains in rings in the guest RAM.
+// One doorbell (NOTIFY) write submits every request the guest has put into the avail ring so
+// far, and one interrupt reports every request the device has put into the used ring since
+// the last INT_ACK, so the amount of mmio accesses no longer grows with the data size.
+//
+// it is a simplified split virtqueue with 32-bit fields only, because the guest is a 32-bit
+// little-endian cpu. The ring of size n (power of 2) lives at QUEUE_PADDR:
+//  desc table  +0              n * { u32 paddr, u32 len, u32 flags, u32 next }
+//  avail ring  +16n            u32 flags (unused), u32 idx, u32 ring[n]
+//  used ring   +16n + 8 + 4n   u32 flags (unused), u32 idx, n * { u32 id, u32 len }
+// the idx fields are free-running, entry i is at ring[i % n]
+//
+// registers:
+//  0x00 MAGIC          ro  IO_DEVICE_PV_MAGIC
+//  0x04 DEVICE_ID      ro  IO_DEVICE_PV_DEVICE_ID_*
+//  0x08 QUEUE_SEL      rw  queue the QUEUE_* registers refer to
+//  0x0c QUEUE_SIZE     rw  power of 2, [1, IO_DEVICE_PV_QUEUE_SIZE_MAX]
+//  0x10 QUEUE_PADDR    rw  4 bytes aligned, the whole ring must be in RAM
+//  0x14 QUEUE_READY    rw  write 1 to enable the queue, the ring is checked then
+//  0x18 NOTIFY         wo  doorbell, the value is the queue idx
+//  0x1c INT_STATUS     ro  [0] used ring updated | [1] ring config error
+//  0x20 INT_ACK        wo  clear the bits of INT_STATUS written as 1
+//  0x24 CONFIG0        ro  device specific
+//  0x28 CONFIG1        ro  device specific
+
+#ifndef IO_DEVICE_PV_MD_H
+#define IO_DEVICE_PV_MD_H
+
+#include<stdint.h>
+#include "io_device_md.h"
+#include "../computer/phys_mem_map_md.h"
+
+#define IO_DEVICE_PV_REG_MAGIC          0x00
+#define IO_DEVICE_PV_REG_DEVICE_ID      0x04
+#define IO_DEVICE_PV_REG_QUEUE_SEL      0x08
+#define IO_DEVICE_PV_REG_QUEUE_SIZE     0x0c
+#define IO_DEVICE_PV_REG_QUEUE_PADDR    0x10
+#define IO_DEVICE_PV_REG_QUEUE_READY    0x14
+#define IO_DEVICE_PV_REG_NOTIFY         0x18
+#define IO_DEVICE_PV_REG_INT_STATUS     0x1c
+#define IO_DEVICE_PV_REG_INT_ACK        0x20
+#define IO_DEVICE_PV_REG_CONFIG0        0x24
+#define IO_DEVICE_PV_REG_CONFIG1        0x28
+
+#define IO_DEVICE_PV_MAGIC              ((uint32_t)0x76706374)  // "tcpv"
+#define IO_DEVICE_PV_DEVICE_ID_BLK      1
+#define IO_DEVICE_PV_DEVICE_ID_CONSOLE  2
+
+#define IO_DEVICE_PV_INT_USED           ((uint32_t)0x01)
+#define IO_DEVICE_PV_INT_CONFIG_ERROR   ((uint32_t)0x02)
+
+#define IO_DEVICE_PV_QUEUE_CT_MAX       2
+#define IO_DEVICE_PV_QUEUE_SIZE_MAX     256
+
+#define IO_DEVICE_PV_DESC_F_NEXT        ((uint32_t)0x01)
+#define IO_DEVICE_PV_DESC_F_WRITE       ((uint32_t)0x02)    // device writes, guest reads
+
+typedef struct {
+    uint32_t paddr;
+    uint32_t size;
+    uint8_t ready;
+    uint32_t last_avail_idx;    // next avail entry the device takes
+    uint32_t used_idx;
+} io_device_pv_queue_t;
+
+typedef struct {
+    uint32_t paddr;
+    uint32_t len;
+    uint32_t flags;
+    uint32_t next;
+} io_device_pv_desc_t;
+
+// embedded by every paravirtual device right after its `io_device_t dev`
+typedef struct {
+    uint32_t device_id;
+    uint32_t queue_ct;
+    uint32_t queue_sel;
+    uint32_t int_status;
+    io_device_pv_queue_t queues[IO_DEVICE_PV_QUEUE_CT_MAX];
+
+    // temp bellow
+    phys_mem_map_t* pmmp;
+} io_device_pv_t;
+
+// always_inline
+inline uint32_t
+io_device_pv_ring_bytes(uint32_t size){
+    return 16 * size + 8 + 4 * size + 8 + 8 * size;
+}
+
+// the ring has passed the check of QUEUE_READY, so every access below hits RAM
+// always_inline
+inline uint32_t
+io_device_pv_load(io_device_pv_t* pvp, uint32_t paddr){
+    return phys_mem_load_le32(phys_mem_map_ram_hostp(pvp->pmmp, paddr));
+}
+
+// always_inline
+inline void
+io_device_pv_store(io_device_pv_t* pvp, uint32_t paddr, uint32_t u32){
+    phys_mem_store_le32(phys_mem_map_ram_write_hostp(pvp->pmmp, paddr), u32);
+    phys_mem_map_code_write(pvp->pmmp, paddr, 4);
+}
+
+// always_inline
+inline uint32_t
+io_device_pv_avail_paddr(io_device_pv_queue_t* qp){
+    return qp->paddr + 16 * qp->size;
+}
+
+// always_inline
+inline uint32_t
+io_device_pv_used_paddr(io_device_pv_queue_t* qp){
+    return qp->paddr + 16 * qp->size + 8 + 4 * qp->size;
+}
+
+// ret: amount of avail entries not taken yet
+// a guest which claims more than the ring size is clamped, it could only hurt itself
+// always_inline
+inline uint32_t
+io_device_pv_avail_ct(io_device_pv_t* pvp, io_device_pv_queue_t* qp){
+    uint32_t ct;
+    if(!qp->ready){
+        return 0;
+    }
+    ct = io_device_pv_load(pvp, io_device_pv_avail_paddr(qp) + 4) - qp->last_avail_idx;
+    return ct > qp->size ? qp->size : ct;
+}
+
+// ret: head desc idx of avail entry `last_avail_idx + i`
+// always_inline
+inline uint32_t
+io_device_pv_avail_head(io_device_pv_t* pvp, io_device_pv_queue_t* qp, uint32_t i){
+    return io_device_pv_load(pvp, io_device_pv_avail_paddr(qp) + 8 +
+        4 * ((qp->last_avail_idx + i) & (qp->size - 1))) & (qp->size - 1);
+}
+
+// always_inline
+inline void
+io_device_pv_desc_read(io_device_pv_t* pvp, io_device_pv_queue_t* qp, uint32_t idx,
+    io_device_pv_desc_t* descp){
+
+    uint32_t paddr = qp->paddr + 16 * (idx & (qp->size - 1));
+    descp->paddr = io_device_pv_load(pvp, paddr);
+    descp->len = io_device_pv_load(pvp, paddr + 4);
+    descp->flags = io_device_pv_load(pvp, paddr + 8);
+    descp->next = io_device_pv_load(pvp, paddr + 12) & (qp->size - 1);
+}
+
+// complete the chain of head desc `head` with `len` bytes written by the device
+// the interrupt is raised by the caller once per batch, see `io_device_pv_raise_used`
+// always_inline
+inline void
+io_device_pv_used_push(io_device_pv_t* pvp, io_device_pv_queue_t* qp, uint32_t head, uint32_t len){
+    uint32_t paddr = io_device_pv_used_paddr(qp) + 8 + 8 * (qp->used_idx & (qp->size - 1));
+    io_device_pv_store(pvp, paddr, head);
+    io_device_pv_store(pvp, paddr + 4, len);
+    qp->used_idx++;
+    io_device_pv_store(pvp, io_device_pv_used_paddr(qp) + 4, qp->used_idx);
+}
+
+// always_inline
+inline void
+io_device_pv_update_irq_line(io_device_t* devp, io_device_pv_t* pvp){
+    io_device_irq_line_set(devp, pvp->int_status != 0);
+}
+
+// always_inline
+inline void
+io_device_pv_raise_used(io_device_t* devp, io_device_pv_t* pvp){
+    if(!(pvp->int_status & IO_DEVICE_PV_INT_USED)){
+        pvp->int_status = pvp->int_status | IO_DEVICE_PV_INT_USED;
+        io_device_pv_update_irq_line(devp, pvp);
+    }
+}
+
+// always_inline
+inline void
+io_device_pv_queue_set_ready(io_device_t* devp, io_device_pv_t* pvp, io_device_pv_queue_t* qp,
+    uint32_t v){
+
+    if(v == 0){
+        qp->ready = 0;
+        return;
+    }
+    if(qp->size == 0 || qp->size > IO_DEVICE_PV_QUEUE_SIZE_MAX || (qp->size & (qp->size - 1)) ||
+        (qp->paddr & 3) ||
+        !phys_mem_map_ram_range_check(pvp->pmmp, qp->paddr, io_device_pv_ring_bytes(qp->size))){
+        pvp->int_status = pvp->int_status | IO_DEVICE_PV_INT_CONFIG_ERROR;
+        io_device_pv_update_irq_line(devp, pvp);
+        return;
+    }
+    qp->ready = 1;
+    qp->last_avail_idx = io_device_pv_load(pvp, io_device_pv_avail_paddr(qp) + 4);
+    qp->used_idx = io_device_pv_load(pvp, io_device_pv_used_paddr(qp) + 4);
+}
+
+// the registers common to all paravirtual devices
+// config0/1 are the device specific values
+// always_inline
+inline uint32_t
+io_device_pv_registers_read(io_device_pv_t* pvp, uint32_t offset, uint32_t config0,
+    uint32_t config1){
+
+    io_device_pv_queue_t* qp = &pvp->queues[pvp->queue_sel];
+    switch(offset){
+        case IO_DEVICE_PV_REG_MAGIC:
+            return IO_DEVICE_PV_MAGIC;
+        case IO_DEVICE_PV_REG_DEVICE_ID:
+            return pvp->device_id;
+        case IO_DEVICE_PV_REG_QUEUE_SEL:
+            return pvp->queue_sel;
+        case IO_DEVICE_PV_REG_QUEUE_SIZE:
+            return qp->size;
+        case IO_DEVICE_PV_REG_QUEUE_PADDR:
+            return qp->paddr;
+        case IO_DEVICE_PV_REG_QUEUE_READY:
+            return qp->ready;
+        case IO_DEVICE_PV_REG_INT_STATUS:
+            return pvp->int_status;
+        case IO_DEVICE_PV_REG_CONFIG0:
+            return config0;
+        case IO_DEVICE_PV_REG_CONFIG1:
+            return config1;
+        default:
+            return 0;
+    }
+}
+
+// ret: queue idx rung by a NOTIFY write | IO_DEVICE_PV_QUEUE_CT_MAX if none
+// always_inline
+inline uint32_t
+io_device_pv_registers_write(io_device_t* devp, io_device_pv_t* pvp, uint32_t offset, uint32_t v){
+    io_device_pv_queue_t* qp = &pvp->queues[pvp->queue_sel];
+    switch(offset){
+        case IO_DEVICE_PV_REG_QUEUE_SEL:
+            if(v < pvp->queue_ct){
+                pvp->queue_sel = v;
+            }
+            break;
+        case IO_DEVICE_PV_REG_QUEUE_SIZE:
+            if(!qp->ready){
+                qp->size = v;
+            }
+            break;
+        case IO_DEVICE_PV_REG_QUEUE_PADDR:
+            if(!qp->ready){
+                qp->paddr = v;
+            }
+            break;
+        case IO_DEVICE_PV_REG_QUEUE_READY:
+            io_device_pv_queue_set_ready(devp, pvp, qp, v);
+            break;
+        case IO_DEVICE_PV_REG_NOTIFY:
+            if(v < pvp->queue_ct && pvp->queues[v].ready){
+                return v;
+            }
+            break;
+        case IO_DEVICE_PV_REG_INT_ACK:
+            pvp->int_status = pvp->int_status & (~v);
+            io_device_pv_update_irq_line(devp, pvp);
+            break;
+        default:
+            break;
+    }
+    return IO_DEVICE_PV_QUEUE_CT_MAX;
+}
+
+// always_inline
+inline void
+io_device_pv_hwreset(io_device_pv_t* pvp, uint32_t device_id, uint32_t queue_ct,
+    phys_mem_map_t* pmmp){
+
+    uint32_t i;
+    pvp->device_id = device_id;
+    pvp->queue_ct = queue_ct;
+    pvp->queue_sel = 0;
+    pvp->int_status = 0;
+    for(i = 0; i < IO_DEVICE_PV_QUEUE_CT_MAX; i++){
+        pvp->queues[i].paddr = 0;
+        pvp->queues[i].size = 0;
+        pvp->queues[i].ready = 0;
+        pvp->queues[i].last_avail_idx = 0;
+        pvp->queues[i].used_idx = 0;
+    }
+    pvp->pmmp = pmmp;
+}
+
+#endif
@@ -0,0 +1,121 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** SMP control device **
+// the vCPU id and the inter-processor interrupts. Every vCPU has one IPI line, it is OR-ed
+// with the irq output of the interrupt controller for vCPU 0. In SMP mode a register access
+// is deferred to the quantum barrier (see turingcell_smp_md.h), so an IPI is raised at the
+// barrier and taken by its target at the start of the next quantum.
+//
+// registers:
+//  0x00 CPU_ID     ro  id of the vCPU which accesses the register
+//  0x04 CPU_CT     ro  amount of vCPUs
+//  0x08 IPI_SEND   wo  raise the IPI of every vCPU whose bit is set in v
+//  0x0c IPI_STATUS ro  1 if the IPI of the accessing vCPU is pending | 0 if not
+//  0x10 IPI_ACK    wo  clear the IPI of the accessing vCPU
+
+#ifndef IO_DEVICE_SMP_MD_H
+#define IO_DEVICE_SMP_MD_H
+
+#include<stdint.h>
+#include "io_device_md.h"
+
+#define IO_DEVICE_SMP_REG_CPU_ID        0x00
+#define IO_DEVICE_SMP_REG_CPU_CT        0x04
+#define IO_DEVICE_SMP_REG_IPI_SEND      0x08
+#define IO_DEVICE_SMP_REG_IPI_STATUS    0x0c
+#define IO_DEVICE_SMP_REG_IPI_ACK       0x10
+
+typedef struct {
+    io_device_t dev;    // must be the first member
+
+    uint8_t cpu_ct;
+    uint32_t ipi_pending;   // bit i for vCPU i
+
+    // temp bellow
+    uint8_t cur_cpu_id;     // vCPU doing the register access, set by the computer
+    void (*ipi_lines_set_cb)(void* cb_arg, uint32_t ipi_pending);
+    void* ipi_cb_arg;
+} io_device_smp_t;
+
+// always_inline
+inline void
+io_device_smp_ipi_update(io_device_smp_t* sp, uint32_t ipi_pending){
+    ipi_pending = ipi_pending & (uint32_t)((((uint64_t)1) << sp->cpu_ct) - 1);
+    if(ipi_pending == sp->ipi_pending){
+        return;
+    }
+    sp->ipi_pending = ipi_pending;
+    if(sp->ipi_lines_set_cb){
+        sp->ipi_lines_set_cb(sp->ipi_cb_arg, ipi_pending);
+    }
+}
+
+uint32_t
+io_device_smp_registers_read_handler(io_device_t* devp, uint64_t now, uint32_t offset){
+    io_device_smp_t* sp = (io_device_smp_t*)devp;
+    switch(offset){
+        case IO_DEVICE_SMP_REG_CPU_ID:
+            return sp->cur_cpu_id;
+        case IO_DEVICE_SMP_REG_CPU_CT:
+            return sp->cpu_ct;
+        case IO_DEVICE_SMP_REG_IPI_STATUS:
+            return (sp->ipi_pending >> sp->cur_cpu_id) & 1;
+        default:
+            return 0;
+    }
+}
+
+void
+io_device_smp_registers_write_handler(
+    io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v){
+
+    io_device_smp_t* sp = (io_device_smp_t*)devp;
+    switch(offset){
+        case IO_DEVICE_SMP_REG_IPI_SEND:
+            io_device_smp_ipi_update(sp, sp->ipi_pending | v);
+            break;
+        case IO_DEVICE_SMP_REG_IPI_ACK:
+            io_device_smp_ipi_update(sp, sp->ipi_pending & (~(((uint32_t)1) << sp->cur_cpu_id)));
+            break;
+        default:
+            break;
+    }
+}
+
+const io_device_ops_t gl_io_device_smp_ops = {
+    .pre_cpu_exec_phase_handler = 0,
+    .registers_read_handler = io_device_smp_registers_read_handler,
+    .registers_write_handler = io_device_smp_registers_write_handler,
+    .cpuclk_timer_routine = 0,
+    .post_cpu_exec_phase_handler = 0,
+    .io_input_write_buffer = 0,
+    .io_output_consume_buffer = 0,
+};
+
+// cpu_ct must belong to [1, 32]
+// always_inline
+inline void
+io_device_smp_hwreset(io_device_smp_t* sp, uint8_t cpu_ct){
+    sp->dev.ops = &gl_io_device_smp_ops;
+    io_device_mmio_table_init(&sp->dev);
+    sp->cpu_ct = cpu_ct;
+    sp->cur_cpu_id = 0;
+    sp->ipi_pending = 0;
+    if(sp->ipi_lines_set_cb){
+        sp->ipi_lines_set_cb(sp->ipi_cb_arg, 0);
+    }
+}
+
+#endif
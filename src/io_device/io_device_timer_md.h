@@ -0,0 +1,196 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** timer device **
+// the time base is the cpu inst counter: the counter decrements once every
+// 2^prescale_shift insts. The timer never polls, it arms one deadline in the io event queue
+// and the cpu runs unbroken until that deadline.
+//
+// registers:
+//  0x00 LOAD   rw  reload value, writing it restarts the counting
+//  0x04 VALUE  ro  current counter value
+//  0x08 CTRL   rw  [0] enable | [1] periodic | [2] irq enable | [7:4] prescale_shift
+//  0x0c INTCLR wo  clear the interrupt
+//  0x10 RIS    ro  raw interrupt status
+//  0x14 MIS    ro  masked interrupt status
+
+#ifndef IO_DEVICE_TIMER_MD_H
+#define IO_DEVICE_TIMER_MD_H
+
+#include<stdint.h>
+#include "io_device_md.h"
+
+#define IO_DEVICE_TIMER_REG_LOAD        0x00
+#define IO_DEVICE_TIMER_REG_VALUE       0x04
+#define IO_DEVICE_TIMER_REG_CTRL        0x08
+#define IO_DEVICE_TIMER_REG_INTCLR      0x0c
+#define IO_DEVICE_TIMER_REG_RIS         0x10
+#define IO_DEVICE_TIMER_REG_MIS         0x14
+
+#define IO_DEVICE_TIMER_CTRL_ENABLE     ((uint32_t)0x01)
+#define IO_DEVICE_TIMER_CTRL_PERIODIC   ((uint32_t)0x02)
+#define IO_DEVICE_TIMER_CTRL_IRQ_ENABLE ((uint32_t)0x04)
+
+typedef struct {
+    io_device_t dev;    // must be the first member
+
+    uint32_t load;
+    uint32_t ctrl;
+    uint32_t frozen_value;  // counter value while disabled
+    uint8_t raw_irq;
+    uint64_t start_ct;      // inst counter when the current period started
+    uint64_t deadline;      // inst counter when the current period ends
+} io_device_timer_t;
+
+// always_inline
+inline uint8_t
+io_device_timer_prescale_shift(io_device_timer_t* tp){
+    return (uint8_t)((tp->ctrl >> 4) & 0x0f);
+}
+
+// a period is at least 1 tick, otherwise a periodic timer loaded with 0 would never let
+// the cpu run
+// always_inline
+inline uint64_t
+io_device_timer_period_inst_ct(io_device_timer_t* tp){
+    uint64_t ticks = tp->load == 0 ? 1 : tp->load;
+    return ticks << io_device_timer_prescale_shift(tp);
+}
+
+// always_inline
+inline void
+io_device_timer_update_irq_line(io_device_timer_t* tp){
+    io_device_irq_line_set(&tp->dev,
+        tp->raw_irq && (tp->ctrl & IO_DEVICE_TIMER_CTRL_IRQ_ENABLE));
+}
+
+// always_inline
+inline void
+io_device_timer_start_period(io_device_timer_t* tp, uint64_t start_ct){
+    tp->start_ct = start_ct;
+    tp->deadline = start_ct + io_device_timer_period_inst_ct(tp);
+    io_event_queue_set(tp->dev.eqp, tp->dev.id, tp->deadline);
+}
+
+// always_inline
+inline uint32_t
+io_device_timer_value(io_device_timer_t* tp, uint64_t now){
+    if(!(tp->ctrl & IO_DEVICE_TIMER_CTRL_ENABLE)){
+        return tp->frozen_value;
+    }
+    return (uint32_t)((tp->deadline - now) >> io_device_timer_prescale_shift(tp));
+}
+
+uint32_t
+io_device_timer_registers_read_handler(io_device_t* devp, uint64_t now, uint32_t offset){
+    io_device_timer_t* tp = (io_device_timer_t*)devp;
+    switch(offset){
+        case IO_DEVICE_TIMER_REG_LOAD:
+            return tp->load;
+        case IO_DEVICE_TIMER_REG_VALUE:
+            return io_device_timer_value(tp, now);
+        case IO_DEVICE_TIMER_REG_CTRL:
+            return tp->ctrl;
+        case IO_DEVICE_TIMER_REG_RIS:
+            return tp->raw_irq;
+        case IO_DEVICE_TIMER_REG_MIS:
+            return tp->raw_irq && (tp->ctrl & IO_DEVICE_TIMER_CTRL_IRQ_ENABLE);
+        default:
+            return 0;
+    }
+}
+
+void
+io_device_timer_registers_write_handler(
+    io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v){
+
+    io_device_timer_t* tp = (io_device_timer_t*)devp;
+    switch(offset){
+        case IO_DEVICE_TIMER_REG_LOAD:
+            tp->load = v;
+            tp->frozen_value = v;
+            if(tp->ctrl & IO_DEVICE_TIMER_CTRL_ENABLE){
+                io_device_timer_start_period(tp, now);
+            }
+            break;
+        case IO_DEVICE_TIMER_REG_CTRL:
+            if((tp->ctrl & IO_DEVICE_TIMER_CTRL_ENABLE) && !(v & IO_DEVICE_TIMER_CTRL_ENABLE)){
+                tp->frozen_value = io_device_timer_value(tp, now);
+                io_event_queue_cancel(tp->dev.eqp, tp->dev.id);
+                tp->ctrl = v;
+            }else if(!(tp->ctrl & IO_DEVICE_TIMER_CTRL_ENABLE) && (v & IO_DEVICE_TIMER_CTRL_ENABLE)){
+                tp->ctrl = v;
+                io_device_timer_start_period(tp, now);
+            }else{
+                tp->ctrl = v;
+            }
+            io_device_timer_update_irq_line(tp);
+            break;
+        case IO_DEVICE_TIMER_REG_INTCLR:
+            tp->raw_irq = 0;
+            io_device_timer_update_irq_line(tp);
+            break;
+        default:
+            break;
+    }
+}
+
+// the deadline of the current period is reached
+void
+io_device_timer_cpuclk_timer_routine(io_device_t* devp, uint64_t now){
+    io_device_timer_t* tp = (io_device_timer_t*)devp;
+    tp->raw_irq = 1;
+    if(tp->ctrl & IO_DEVICE_TIMER_CTRL_PERIODIC){
+        // restart from the deadline instead of `now` so the period never drifts
+        io_device_timer_start_period(tp, tp->deadline);
+    }else{
+        tp->frozen_value = 0;
+        tp->ctrl = tp->ctrl & (~IO_DEVICE_TIMER_CTRL_ENABLE);
+    }
+    io_device_timer_update_irq_line(tp);
+}
+
+// polled by the guest for its clock source
+uint32_t
+io_device_timer_read_value(io_device_t* devp, uint64_t now, uint32_t offset){
+    return io_device_timer_value((io_device_timer_t*)devp, now);
+}
+
+const io_device_ops_t gl_io_device_timer_ops = {
+    .pre_cpu_exec_phase_handler = 0,
+    .registers_read_handler = io_device_timer_registers_read_handler,
+    .registers_write_handler = io_device_timer_registers_write_handler,
+    .cpuclk_timer_routine = io_device_timer_cpuclk_timer_routine,
+    .post_cpu_exec_phase_handler = 0,
+    .io_input_write_buffer = 0,
+    .io_output_consume_buffer = 0,
+};
+
+// always_inline
+inline void
+io_device_timer_hwreset(io_device_timer_t* tp){
+    tp->dev.ops = &gl_io_device_timer_ops;
+    io_device_mmio_table_init(&tp->dev);
+    tp->dev.mmio_table.read[IO_DEVICE_MMIO_REG_IDX(IO_DEVICE_TIMER_REG_VALUE)] =
+        io_device_timer_read_value;
+    tp->load = 0;
+    tp->ctrl = 0;
+    tp->frozen_value = 0;
+    tp->raw_irq = 0;
+    tp->start_ct = 0;
+    tp->deadline = 0;
+    io_event_queue_cancel(tp->dev.eqp, tp->dev.id);
+}
+
+#endif
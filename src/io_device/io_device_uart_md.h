@@ -0,0 +1,337 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** uart device **
+// rx: bytes chosen by the tape (`mdf_computer_io_input`) are queued in the rx fifo
+// tx: bytes written by the guest go straight into the tx ring, which lives in a shared memory
+//     segment provided by the host, so the external forwarder reads them in place without
+//     any copy (see src/runtime/uart_output_forwarder.h)
+//
+// every tx byte has a global offset (the amount of bytes ever sent before it). At the end of
+// each mdf the newly sent span is tagged with the index of its tape entry and published.
+// A span is freed only by `mdf_computer_io_output(offset, len)` on the tape, i.e. the
+// acknowledgement of its delivery is replicated too. Every replica has the same tx ring
+// content, exactly one designated replica forwards it, and a new designated replica resumes
+// from the last acknowledged offset. The consumer drops any span below its offset high-water
+// mark, so the bytes take effect exactly once.
+// A full tx ring is reported in STATUS, the guest has to wait for the acknowledgement.
+//
+// registers:
+//  0x00 DATA       rw  write: send 1 byte | read: pop 1 received byte (0 if none)
+//  0x04 STATUS     ro  [0] rx available | [1] tx full | [2] tx all acknowledged
+//  0x08 CTRL       rw  [0] rx irq enable | [1] tx space irq enable
+//  0x0c TXWORD     wo  send 4 bytes at once, little-endian, for the data link usage
+//  0x10 RXCOUNT    ro  amount of received bytes available
+//  0x14 TXFREE     ro  amount of free bytes in the tx ring
+
+#ifndef IO_DEVICE_UART_MD_H
+#define IO_DEVICE_UART_MD_H
+
+#include<stdint.h>
+#include<string.h>
+#include "io_device_md.h"
+
+#define IO_DEVICE_UART_REG_DATA         0x00
+#define IO_DEVICE_UART_REG_STATUS       0x04
+#define IO_DEVICE_UART_REG_CTRL         0x08
+#define IO_DEVICE_UART_REG_TXWORD       0x0c
+#define IO_DEVICE_UART_REG_RXCOUNT      0x10
+#define IO_DEVICE_UART_REG_TXFREE       0x14
+
+#define IO_DEVICE_UART_STATUS_RX_AVAIL  ((uint32_t)0x01)
+#define IO_DEVICE_UART_STATUS_TX_FULL   ((uint32_t)0x02)
+#define IO_DEVICE_UART_STATUS_TX_ACKED  ((uint32_t)0x04)
+
+#define IO_DEVICE_UART_CTRL_RX_IRQ      ((uint32_t)0x01)
+#define IO_DEVICE_UART_CTRL_TX_IRQ      ((uint32_t)0x02)
+
+#define IO_DEVICE_UART_RX_FIFO_SIZE     4096    // power of 2
+#define IO_DEVICE_UART_TX_SEG_CT        1024    // power of 2
+
+// a span of tx bytes sent during the mdf of tape entry tape_idx
+typedef struct {
+    uint64_t tape_idx;
+    uint64_t start_offset;
+    uint64_t end_offset;
+} io_device_uart_tx_seg_t;
+
+// layout of the shared memory segment, written only by the executor
+// published_ct and seg_published_ct are stored with release semantics after the bytes and
+// the seg they cover, the forwarder loads them with acquire semantics
+typedef struct {
+    uint64_t published_ct;          // bytes [0, published_ct) are readable
+    uint64_t acked_ct;              // bytes [0, acked_ct) are delivered and freed
+    uint64_t seg_published_ct;      // segs [0, seg_published_ct) are readable
+    uint32_t data_size;             // power of 2
+    uint32_t reserved;
+    io_device_uart_tx_seg_t segs[IO_DEVICE_UART_TX_SEG_CT]; // seg i at segs[i % SEG_CT]
+    uint8_t data[];                 // byte at offset o is at data[o % data_size]
+} io_device_uart_tx_ring_t;
+
+typedef struct {
+    io_device_t dev;    // must be the first member
+
+    uint32_t ctrl;
+    uint8_t rx_fifo[IO_DEVICE_UART_RX_FIFO_SIZE];
+    uint32_t rx_head;               // pop at rx_head, push at rx_head + rx_ct
+    uint32_t rx_ct;
+    uint64_t rx_dropped_ct;         // input beyond the fifo capacity
+    uint64_t tx_ct;                 // amount of bytes ever sent
+    uint64_t tx_seg_ct;             // amount of tx segs ever tagged
+
+    // temp bellow
+    io_device_uart_tx_ring_t* txp;  // shared memory, its content is part of the state
+} io_device_uart_t;
+
+// always_inline
+inline uint32_t
+io_device_uart_tx_free(io_device_uart_t* up){
+    return up->txp->data_size - (uint32_t)(up->tx_ct - up->txp->acked_ct);
+}
+
+// always_inline
+inline void
+io_device_uart_update_irq_line(io_device_uart_t* up){
+    io_device_irq_line_set(&up->dev,
+        ((up->ctrl & IO_DEVICE_UART_CTRL_RX_IRQ) && up->rx_ct) ||
+        ((up->ctrl & IO_DEVICE_UART_CTRL_TX_IRQ) && io_device_uart_tx_free(up)));
+}
+
+// ret u8: 1 if sent | 0 if the tx ring is full
+// always_inline
+inline uint8_t
+io_device_uart_tx_byte(io_device_uart_t* up, uint8_t u8){
+    if(io_device_uart_tx_free(up) == 0){
+        return 0;
+    }
+    up->txp->data[up->tx_ct & (up->txp->data_size - 1)] = u8;
+    up->tx_ct++;
+    return 1;
+}
+
+// send all of the len bytes, the caller has checked `io_device_uart_tx_free`
+// always_inline
+inline void
+io_device_uart_tx_bytes(io_device_uart_t* up, const uint8_t* src, uint32_t len){
+    uint32_t mask = up->txp->data_size - 1;
+    uint32_t n;
+    while(len){
+        n = up->txp->data_size - (uint32_t)(up->tx_ct & mask);
+        if(n > len){
+            n = len;
+        }
+        memcpy(&up->txp->data[up->tx_ct & mask], src, n);
+        up->tx_ct += n;
+        src += n;
+        len -= n;
+    }
+}
+
+// ret: amount of received bytes popped into dst, at most len
+// always_inline
+inline uint32_t
+io_device_uart_rx_pop(io_device_uart_t* up, uint8_t* dst, uint32_t len){
+    uint32_t i;
+    for(i = 0; i < len && up->rx_ct; i++){
+        dst[i] = up->rx_fifo[up->rx_head];
+        up->rx_head = (up->rx_head + 1) & (IO_DEVICE_UART_RX_FIFO_SIZE - 1);
+        up->rx_ct--;
+    }
+    if(up->rx_ct == 0){
+        io_device_uart_update_irq_line(up);
+    }
+    return i;
+}
+
+// always_inline
+inline uint32_t
+io_device_uart_status(io_device_uart_t* up){
+    uint32_t status = 0;
+    if(up->rx_ct){
+        status = status | IO_DEVICE_UART_STATUS_RX_AVAIL;
+    }
+    if(io_device_uart_tx_free(up) == 0){
+        status = status | IO_DEVICE_UART_STATUS_TX_FULL;
+    }
+    if(up->tx_ct == up->txp->acked_ct){
+        status = status | IO_DEVICE_UART_STATUS_TX_ACKED;
+    }
+    return status;
+}
+
+uint32_t
+io_device_uart_registers_read_handler(io_device_t* devp, uint64_t now, uint32_t offset){
+    io_device_uart_t* up = (io_device_uart_t*)devp;
+    uint32_t v;
+    switch(offset){
+        case IO_DEVICE_UART_REG_DATA:
+            if(up->rx_ct == 0){
+                return 0;
+            }
+            v = up->rx_fifo[up->rx_head];
+            up->rx_head = (up->rx_head + 1) & (IO_DEVICE_UART_RX_FIFO_SIZE - 1);
+            up->rx_ct--;
+            if(up->rx_ct == 0){
+                io_device_uart_update_irq_line(up);
+            }
+            return v;
+        case IO_DEVICE_UART_REG_STATUS:
+            return io_device_uart_status(up);
+        case IO_DEVICE_UART_REG_CTRL:
+            return up->ctrl;
+        case IO_DEVICE_UART_REG_RXCOUNT:
+            return up->rx_ct;
+        case IO_DEVICE_UART_REG_TXFREE:
+            return io_device_uart_tx_free(up);
+        default:
+            return 0;
+    }
+}
+
+void
+io_device_uart_registers_write_handler(
+    io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v){
+
+    io_device_uart_t* up = (io_device_uart_t*)devp;
+    switch(offset){
+        case IO_DEVICE_UART_REG_DATA:
+            io_device_uart_tx_byte(up, (uint8_t)v);
+            break;
+        case IO_DEVICE_UART_REG_TXWORD:
+            // all or nothing, so the guest could simply retry the whole word
+            if(io_device_uart_tx_free(up) >= 4){
+                io_device_uart_tx_byte(up, (uint8_t)v);
+                io_device_uart_tx_byte(up, (uint8_t)(v >> 8));
+                io_device_uart_tx_byte(up, (uint8_t)(v >> 16));
+                io_device_uart_tx_byte(up, (uint8_t)(v >> 24));
+            }
+            break;
+        case IO_DEVICE_UART_REG_CTRL:
+            up->ctrl = v;
+            break;
+        default:
+            return;
+    }
+    io_device_uart_update_irq_line(up);
+}
+
+// the polling loop of a guest console driver
+uint32_t
+io_device_uart_read_status(io_device_t* devp, uint64_t now, uint32_t offset){
+    return io_device_uart_status((io_device_uart_t*)devp);
+}
+
+void
+io_device_uart_write_data(io_device_t* devp, uint64_t now, uint32_t offset, uint32_t v){
+    io_device_uart_t* up = (io_device_uart_t*)devp;
+    io_device_uart_tx_byte(up, (uint8_t)v);
+    if(up->ctrl & IO_DEVICE_UART_CTRL_TX_IRQ){
+        io_device_uart_update_irq_line(up);
+    }
+}
+
+// tag and publish the span sent during this mdf
+// if the seg ring is full of unacknowledged segs, the span is merged into the latest seg
+void
+io_device_uart_post_cpu_exec_phase_handler(io_device_t* devp, uint64_t now){
+    io_device_uart_t* up = (io_device_uart_t*)devp;
+    io_device_uart_tx_ring_t* txp = up->txp;
+    io_device_uart_tx_seg_t* segp;
+    if(up->tx_ct == txp->published_ct){
+        return;
+    }
+    segp = &txp->segs[up->tx_seg_ct & (IO_DEVICE_UART_TX_SEG_CT - 1)];
+    if(up->tx_seg_ct >= IO_DEVICE_UART_TX_SEG_CT && segp->end_offset > txp->acked_ct){
+        segp = &txp->segs[(up->tx_seg_ct - 1) & (IO_DEVICE_UART_TX_SEG_CT - 1)];
+        __atomic_store_n(&segp->end_offset, up->tx_ct, __ATOMIC_RELEASE);
+        __atomic_store_n(&txp->published_ct, up->tx_ct, __ATOMIC_RELEASE);
+        return;
+    }
+    segp->tape_idx = *up->dev.tape_idxp;
+    segp->start_offset = txp->published_ct;
+    segp->end_offset = up->tx_ct;
+    up->tx_seg_ct++;
+    __atomic_store_n(&txp->seg_published_ct, up->tx_seg_ct, __ATOMIC_RELEASE);
+    __atomic_store_n(&txp->published_ct, up->tx_ct, __ATOMIC_RELEASE);
+}
+
+// io_device_io_input_write_buffer
+void
+io_device_uart_io_input_write_buffer(
+    io_device_t* devp, uint64_t now, const uint8_t* data, uint32_t len){
+
+    io_device_uart_t* up = (io_device_uart_t*)devp;
+    uint32_t i;
+    for(i = 0; i < len; i++){
+        if(up->rx_ct == IO_DEVICE_UART_RX_FIFO_SIZE){
+            up->rx_dropped_ct += len - i;
+            break;
+        }
+        up->rx_fifo[(up->rx_head + up->rx_ct) & (IO_DEVICE_UART_RX_FIFO_SIZE - 1)] = data[i];
+        up->rx_ct++;
+    }
+    io_device_uart_update_irq_line(up);
+}
+
+// io_device_io_output_consume_buffer
+// only the span continuing exactly from acked_ct takes effect, a stale or duplicated
+// acknowledgement from a former designated replica is ignored
+void
+io_device_uart_io_output_consume_buffer(
+    io_device_t* devp, uint64_t now, uint64_t offset, uint32_t len){
+
+    io_device_uart_t* up = (io_device_uart_t*)devp;
+    uint64_t end = offset + len;
+    if(offset > up->txp->acked_ct || end <= up->txp->acked_ct || end > up->txp->published_ct){
+        return;
+    }
+    __atomic_store_n(&up->txp->acked_ct, end, __ATOMIC_RELEASE);
+    io_device_uart_update_irq_line(up);
+}
+
+const io_device_ops_t gl_io_device_uart_ops = {
+    .pre_cpu_exec_phase_handler = 0,
+    .registers_read_handler = io_device_uart_registers_read_handler,
+    .registers_write_handler = io_device_uart_registers_write_handler,
+    .cpuclk_timer_routine = 0,
+    .post_cpu_exec_phase_handler = io_device_uart_post_cpu_exec_phase_handler,
+    .io_input_write_buffer = io_device_uart_io_input_write_buffer,
+    .io_output_consume_buffer = io_device_uart_io_output_consume_buffer,
+};
+
+// txp points to the shared memory segment, data_size must be a power of 2
+// always_inline
+inline void
+io_device_uart_hwreset(io_device_uart_t* up, io_device_uart_tx_ring_t* txp, uint32_t data_size){
+    up->dev.ops = &gl_io_device_uart_ops;
+    io_device_mmio_table_init(&up->dev);
+    up->dev.mmio_table.read[IO_DEVICE_MMIO_REG_IDX(IO_DEVICE_UART_REG_STATUS)] =
+        io_device_uart_read_status;
+    up->dev.mmio_table.write[IO_DEVICE_MMIO_REG_IDX(IO_DEVICE_UART_REG_DATA)] =
+        io_device_uart_write_data;
+    up->ctrl = 0;
+    up->rx_head = 0;
+    up->rx_ct = 0;
+    up->rx_dropped_ct = 0;
+    up->tx_ct = 0;
+    up->tx_seg_ct = 0;
+    up->txp = txp;
+    txp->published_ct = 0;
+    txp->acked_ct = 0;
+    txp->seg_published_ct = 0;
+    txp->data_size = data_size;
+    txp->reserved = 0;
+}
+
+#endif
@@ -0,0 +1,259 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** cell metrics segment **
+// host side, NOT a md part: the latency histograms of every cell of a host (see "metrics" in
+// turingcell_computer_md.c) in one POSIX shared memory segment, so that a scraper in another
+// process reads them in place. The executor only ever stores into the segment, the scraper
+// only loads, neither ever waits for the other (see latency_histogram.h).
+//
+// segment: cell_metrics_segment_t, then cell_ct turingcell_computer_metrics_t. The header
+// carries the layout, so a scraper refuses a segment of another build, and the tick rate of
+// the host, so that it could print ns.
+//
+// the scraper prints one JSON object per line and per non empty histogram:
+//  {"cell":N,"metric":"mdf_cpu_exec","ct":N,"mean_ns":F,"p50_ns":F,"p90_ns":F,"p99_ns":F,
+//   "p999_ns":F,"max_ns":F}
+// Build it with CELL_METRICS_MAIN defined after including turingcell_computer_md.c, `make`
+// does so into build/:
+//     cell_metrics segment_name [cell_id]
+
+#ifndef CELL_METRICS_H
+#define CELL_METRICS_H
+
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include "../common/latency_histogram.h"
+
+#define CELL_METRICS_MAGIC              ((uint64_t)0x314d4d5254434754)     // "TGCTRMM1"
+#define CELL_METRICS_VERSION            1
+#define CELL_METRICS_CALIBRATE_NS       ((uint64_t)20000000)
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t cell_ct;
+    uint32_t metric_ct;                 // TURINGCELL_COMPUTER_METRIC_CT
+    uint32_t bucket_ct;                 // LATENCY_HISTOGRAM_BUCKET_CT
+    uint64_t ticks_per_sec;
+    uint64_t segment_size;
+} cell_metrics_segment_t;
+
+typedef struct {
+    cell_metrics_segment_t* segp;
+    uint64_t segment_size;
+    char name[256];
+} cell_metrics_t;
+
+// always_inline
+inline turingcell_computer_metrics_t*
+cell_metrics_cell(cell_metrics_segment_t* segp, uint32_t cell_id){
+    return (turingcell_computer_metrics_t*)(segp + 1) + cell_id;
+}
+
+// always_inline
+inline uint64_t
+cell_metrics_host_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// rate of latency_histogram_ticks against the monotonic clock
+uint64_t
+cell_metrics_calibrate_ticks_per_sec(void){
+    struct timespec ts = {0, (long)CELL_METRICS_CALIBRATE_NS};
+    uint64_t ns0, ns1, t0, t1;
+    ns0 = cell_metrics_host_ns();
+    t0 = latency_histogram_ticks();
+    nanosleep(&ts, NULL);
+    ns1 = cell_metrics_host_ns();
+    t1 = latency_histogram_ticks();
+    if(ns1 == ns0){
+        return 1000000000ull;
+    }
+    return (uint64_t)((double)(t1 - t0) * 1e9 / (double)(ns1 - ns0));
+}
+
+// name is a POSIX shm name such as "/turingcell_metrics", an existing segment is replaced
+// ret int: 0 if success | -1 if failed
+int
+cell_metrics_create(cell_metrics_t* mp, const char* name, uint32_t cell_ct){
+    uint64_t size = sizeof(cell_metrics_segment_t) +
+        (uint64_t)cell_ct * sizeof(turingcell_computer_metrics_t);
+    void* p;
+    int fd;
+    memset(mp, 0, sizeof(*mp));
+    if(strlen(name) >= sizeof(mp->name)){
+        return -1;
+    }
+    strcpy(mp->name, name);
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0){
+        return -1;
+    }
+    if(ftruncate(fd, (off_t)size) != 0){ // zero filled, every histogram starts empty
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED){
+        shm_unlink(name);
+        return -1;
+    }
+    mp->segp = (cell_metrics_segment_t*)p;
+    mp->segment_size = size;
+    mp->segp->version = CELL_METRICS_VERSION;
+    mp->segp->cell_ct = cell_ct;
+    mp->segp->metric_ct = TURINGCELL_COMPUTER_METRIC_CT;
+    mp->segp->bucket_ct = LATENCY_HISTOGRAM_BUCKET_CT;
+    mp->segp->ticks_per_sec = cell_metrics_calibrate_ticks_per_sec();
+    mp->segp->segment_size = size;
+    __atomic_store_n(&mp->segp->magic, CELL_METRICS_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// measure the computer of cell_id from now on, before it runs
+void
+cell_metrics_attach(cell_metrics_t* mp, turingcell_computer_t* cp, uint32_t cell_id){
+    turingcell_computer_metrics_attach(cp, cell_metrics_cell(mp->segp, cell_id));
+}
+
+// the computers must have been detached (or destroyed) before
+void
+cell_metrics_destroy(cell_metrics_t* mp){
+    munmap(mp->segp, mp->segment_size);
+    shm_unlink(mp->name);
+}
+
+// read only mapping of the segment of another process
+// ret int: 0 if success | -1 if there is no such segment or it has another layout
+int
+cell_metrics_open(cell_metrics_t* mp, const char* name){
+    cell_metrics_segment_t head;
+    void* p;
+    int fd;
+    memset(mp, 0, sizeof(*mp));
+    fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0){
+        return -1;
+    }
+    if(pread(fd, &head, sizeof(head), 0) != (ssize_t)sizeof(head) ||
+        head.magic != CELL_METRICS_MAGIC || head.version != CELL_METRICS_VERSION ||
+        head.metric_ct != TURINGCELL_COMPUTER_METRIC_CT ||
+        head.bucket_ct != LATENCY_HISTOGRAM_BUCKET_CT){
+
+        close(fd);
+        return -1;
+    }
+    p = mmap(NULL, head.segment_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED){
+        return -1;
+    }
+    mp->segp = (cell_metrics_segment_t*)p;
+    mp->segment_size = head.segment_size;
+    return 0;
+}
+
+void
+cell_metrics_close(cell_metrics_t* mp){
+    munmap(mp->segp, mp->segment_size);
+}
+
+// buf holds at least 32 bytes
+void
+cell_metrics_name(uint32_t metric_id, char* buf){
+    if(metric_id == TURINGCELL_COMPUTER_METRIC_MDF_PRE){
+        strcpy(buf, "mdf_pre_cpu_exec");
+    }else if(metric_id == TURINGCELL_COMPUTER_METRIC_MDF_CPU_EXEC){
+        strcpy(buf, "mdf_cpu_exec");
+    }else if(metric_id == TURINGCELL_COMPUTER_METRIC_MDF_POST){
+        strcpy(buf, "mdf_post_cpu_exec");
+    }else if(metric_id < TURINGCELL_COMPUTER_METRIC_EXCEPTION(0)){
+        sprintf(buf, "device_%u", metric_id - TURINGCELL_COMPUTER_METRIC_DEVICE(0));
+    }else if(metric_id < TURINGCELL_COMPUTER_METRIC_MEM_FAULT(0)){
+        sprintf(buf, "exception_vcpu_%u", metric_id - TURINGCELL_COMPUTER_METRIC_EXCEPTION(0));
+    }else if(metric_id < TURINGCELL_COMPUTER_METRIC_CHECKPOINT){
+        sprintf(buf, "mem_fault_vcpu_%u", metric_id - TURINGCELL_COMPUTER_METRIC_MEM_FAULT(0));
+    }else{
+        strcpy(buf, "checkpoint");
+    }
+}
+
+// a copy first, the executor keeps writing meanwhile
+void
+cell_metrics_print(FILE* fp, cell_metrics_t* mp, uint32_t cell_id){
+    latency_histogram_t h;
+    double ns_per_tick = 1e9 / (double)(mp->segp->ticks_per_sec ? mp->segp->ticks_per_sec : 1);
+    char name[32];
+    uint32_t i, j;
+    turingcell_computer_metrics_t* cmp = cell_metrics_cell(mp->segp, cell_id);
+    for(i = 0; i < TURINGCELL_COMPUTER_METRIC_CT; i++){
+        h.ct = __atomic_load_n(&cmp->hists[i].ct, __ATOMIC_ACQUIRE);
+        if(h.ct == 0){
+            continue;
+        }
+        h.sum = __atomic_load_n(&cmp->hists[i].sum, __ATOMIC_RELAXED);
+        h.max = __atomic_load_n(&cmp->hists[i].max, __ATOMIC_RELAXED);
+        for(j = 0; j < LATENCY_HISTOGRAM_BUCKET_CT; j++){
+            h.buckets[j] = __atomic_load_n(&cmp->hists[i].buckets[j], __ATOMIC_RELAXED);
+        }
+        cell_metrics_name(i, name);
+        fprintf(fp, "{\"cell\":%u,\"metric\":\"%s\",\"ct\":%llu,\"mean_ns\":%.1f,"
+            "\"p50_ns\":%.1f,\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"p999_ns\":%.1f,\"max_ns\":%.1f}\n",
+            cell_id, name, (unsigned long long)h.ct,
+            (double)h.sum / (double)h.ct * ns_per_tick,
+            (double)latency_histogram_quantile(&h, 0.5) * ns_per_tick,
+            (double)latency_histogram_quantile(&h, 0.9) * ns_per_tick,
+            (double)latency_histogram_quantile(&h, 0.99) * ns_per_tick,
+            (double)latency_histogram_quantile(&h, 0.999) * ns_per_tick,
+            (double)h.max * ns_per_tick);
+    }
+}
+
+#ifdef CELL_METRICS_MAIN
+int
+main(int argc, char** argv){
+    cell_metrics_t m;
+    uint32_t i;
+    if(argc < 2){
+        fprintf(stderr, "usage: cell_metrics segment_name [cell_id]\n");
+        return 1;
+    }
+    if(cell_metrics_open(&m, argv[1]) != 0){
+        fprintf(stderr, "cell_metrics: no segment %s of this build\n", argv[1]);
+        return 1;
+    }
+    for(i = 0; i < m.segp->cell_ct; i++){
+        if(argc > 2 && i != (uint32_t)strtoul(argv[2], 0, 0)){
+            continue;
+        }
+        cell_metrics_print(stdout, &m, i);
+    }
+    cell_metrics_close(&m);
+    return 0;
+}
+#endif
+
+#endif
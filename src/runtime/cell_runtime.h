@@ -0,0 +1,538 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** multi-cell host runtime **
+// host side, NOT a md part: runs the cells `turingcell_computer_0 ... turingcell_computer_n`
+// of one host in one process over a fixed pool of worker threads.
+//
+// the consensus layer hands the committed tape entries of a cell to `cell_runtime_submit`.
+// A cell with pending entries is runnable; it sits in the deque of exactly one worker.
+// A worker pops its own deque from the bottom (LIFO, the cell it ran last is still warm in
+// its caches) and, once empty, steals from the top of the others (FIFO, the coldest cell).
+//
+// a cell runs on at most one thread at a time, its `state` moves
+//     IDLE --submit--> QUEUED --pop/steal--> RUNNING --drained--> IDLE
+//                                                    --budget---> QUEUED
+// and only the thread which wins the transition to QUEUED pushes the cell into a deque.
+//
+// the page table (phys_mem_map_t, 3MB) is the per-thread scratch: it depends on the
+// configuration only, so a worker keeps one and switches it to the cell it runs next. The
+// switch rewrites the RAM and mmio entries only and keeps the predecode caches of the cell.
+//
+// which worker executes a tape entry never changes its result, the scheduling is free to be
+// nondeterministic.
+
+#ifndef CELL_RUNTIME_H
+#define CELL_RUNTIME_H
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<sched.h>
+#include<unistd.h>
+
+#define CELL_RUNTIME_WORKER_CT_MAX      256
+#define CELL_RUNTIME_DEQUE_LEN          4096    // power of 2, >= amount of cells
+#define CELL_RUNTIME_CELL_TAPE_Q_LEN    1024    // power of 2
+#define CELL_RUNTIME_RUN_ENTRY_CT_MAX   64      // entries applied per turn, then yield
+
+#define CELL_RUNTIME_TAPE_ENTRY_EXEC        1   // mdf_computer_exec
+#define CELL_RUNTIME_TAPE_ENTRY_IO_INPUT    2   // mdf_computer_io_input
+#define CELL_RUNTIME_TAPE_ENTRY_IO_OUTPUT   3   // mdf_computer_io_output
+
+#define CELL_RUNTIME_CELL_STATE_IDLE    0
+#define CELL_RUNTIME_CELL_STATE_QUEUED  1
+#define CELL_RUNTIME_CELL_STATE_RUNNING 2
+
+// the fixed binary layout of a tape entry, e.g. in a write-ahead log segment (tape_segment.h),
+// every integer in host byte order: this header, then the len bytes of data of an IO_INPUT,
+// then zeros up to the next multiple of CELL_RUNTIME_TAPE_RECORD_ALIGN. In a mapping aligned
+// to it the data of every record is aligned too, and handed to the device as it is.
+#define CELL_RUNTIME_TAPE_RECORD_ALIGN  32
+
+typedef struct {
+    uint8_t type;                       // CELL_RUNTIME_TAPE_ENTRY_* | 0 past the last record
+    uint8_t dev_id;
+    uint16_t reserved0;                 // 0
+    uint32_t len;
+    uint32_t cell_id;                   // the computer the entry is for
+    uint32_t crc;                       // crc32 of the whole record with this field 0
+    uint64_t tape_idx;
+    uint64_t inst_amount_or_offset;     // inst amount of EXEC | offset of IO_OUTPUT
+} cell_runtime_tape_record_t;           // 32 bytes
+
+// a mapped run of records (see tape_segment.h) the data of entries in flight point into
+typedef struct cell_runtime_tape_segment_s cell_runtime_tape_segment_t;
+
+struct cell_runtime_tape_segment_s {
+    uint64_t ref_ct;                    // atomic, the owner and every entry pointing into it
+    void (*release_fn)(cell_runtime_tape_segment_t* segp);     // at the last reference
+};
+
+typedef struct {
+    uint8_t type;
+    uint8_t dev_id;
+    uint32_t len;
+    uint64_t tape_idx;
+    uint64_t inst_amount_or_offset;     // inst amount of EXEC | offset of IO_OUTPUT
+    uint8_t* data;                      // IO_INPUT only, owned by the runtime after submit
+    cell_runtime_tape_segment_t* segp;  // NULL if data is a heap buffer | data is a slice of it
+} cell_runtime_tape_entry_t;
+
+// observer of the tape of one cell, e.g. the recorder of tape_replay.h
+// fn is called on the worker running the cell, before every entry is applied and, with entryp
+// NULL, at the end of every turn; the computer is not touched by anybody else meanwhile
+typedef struct {
+    void (*fn)(void* ctx, turingcell_computer_t* cp, const cell_runtime_tape_entry_t* entryp);
+    void* ctx;
+} cell_runtime_tape_hook_t;
+
+typedef struct {
+    turingcell_computer_t* cp;
+    uint32_t cell_id;
+    uint8_t state;                      // CELL_RUNTIME_CELL_STATE_*, atomic
+
+    pthread_mutex_t tape_q_lock;
+    cell_runtime_tape_entry_t tape_q[CELL_RUNTIME_CELL_TAPE_Q_LEN];
+    uint32_t tape_q_head;
+    uint32_t tape_q_ct;
+
+    uint64_t applied_ct;                // read by the consensus layer, atomic
+    cell_runtime_tape_hook_t* tape_hookp;   // NULL if none, atomic
+} cell_runtime_cell_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    cell_runtime_cell_t* cells[CELL_RUNTIME_DEQUE_LEN];
+    uint32_t top;                       // steal end
+    uint32_t bottom;                    // owner end
+} cell_runtime_deque_t;
+
+typedef struct cell_runtime_s cell_runtime_t;
+
+typedef struct {
+    cell_runtime_t* rtp;
+    uint32_t worker_id;
+    pthread_t thread;
+    cell_runtime_deque_t deque;
+    phys_mem_map_t* pmmp;               // scratch, bound to bound_cp
+    turingcell_computer_t* bound_cp;
+    uint32_t rand_state;
+    uint64_t run_ct;
+    uint64_t steal_ct;
+} cell_runtime_worker_t;
+
+struct cell_runtime_s {
+    cell_runtime_worker_t* workers;
+    uint32_t worker_ct;
+    uint32_t submit_rr;                 // round-robin of the deque for newly runnable cells
+    uint32_t queued_ct;                 // amount of runnable cells, protected by idle_lock
+    uint8_t stop_flag;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+};
+
+// ret int: 0 if success | -1 if the deque is full
+int
+cell_runtime_deque_push_bottom(cell_runtime_deque_t* dqp, cell_runtime_cell_t* cellp){
+    pthread_mutex_lock(&dqp->lock);
+    if(dqp->bottom - dqp->top == CELL_RUNTIME_DEQUE_LEN){
+        pthread_mutex_unlock(&dqp->lock);
+        return -1;
+    }
+    dqp->cells[dqp->bottom & (CELL_RUNTIME_DEQUE_LEN - 1)] = cellp;
+    dqp->bottom++;
+    pthread_mutex_unlock(&dqp->lock);
+    return 0;
+}
+
+cell_runtime_cell_t*
+cell_runtime_deque_pop_bottom(cell_runtime_deque_t* dqp){
+    cell_runtime_cell_t* cellp = NULL;
+    pthread_mutex_lock(&dqp->lock);
+    if(dqp->bottom != dqp->top){
+        dqp->bottom--;
+        cellp = dqp->cells[dqp->bottom & (CELL_RUNTIME_DEQUE_LEN - 1)];
+    }
+    pthread_mutex_unlock(&dqp->lock);
+    return cellp;
+}
+
+cell_runtime_cell_t*
+cell_runtime_deque_steal_top(cell_runtime_deque_t* dqp){
+    cell_runtime_cell_t* cellp = NULL;
+    if(pthread_mutex_trylock(&dqp->lock) != 0){ // busy, try another victim
+        return NULL;
+    }
+    if(dqp->bottom != dqp->top){
+        cellp = dqp->cells[dqp->top & (CELL_RUNTIME_DEQUE_LEN - 1)];
+        dqp->top++;
+    }
+    pthread_mutex_unlock(&dqp->lock);
+    return cellp;
+}
+
+void
+cell_runtime_wake_one(cell_runtime_t* rtp){
+    pthread_mutex_lock(&rtp->idle_lock);
+    rtp->queued_ct++;
+    pthread_cond_signal(&rtp->idle_cond);
+    pthread_mutex_unlock(&rtp->idle_lock);
+}
+
+// the caller has just moved cellp into QUEUED
+void
+cell_runtime_enqueue(cell_runtime_t* rtp, cell_runtime_worker_t* wp, cell_runtime_cell_t* cellp){
+    uint32_t i;
+    if(wp == NULL){
+        wp = &rtp->workers[__atomic_fetch_add(&rtp->submit_rr, 1, __ATOMIC_RELAXED) % rtp->worker_ct];
+    }
+    for(i = 0; cell_runtime_deque_push_bottom(&wp->deque, cellp) != 0; i++){
+        wp = &rtp->workers[(wp->worker_id + 1) % rtp->worker_ct];
+        if(i == rtp->worker_ct){
+            abort(); // more runnable cells than all the deques could hold
+        }
+    }
+    cell_runtime_wake_one(rtp);
+}
+
+// ret u8: 1 if this thread moved the cell from IDLE to QUEUED
+// always_inline
+inline uint8_t
+cell_runtime_cell_try_queue(cell_runtime_cell_t* cellp){
+    uint8_t expected = CELL_RUNTIME_CELL_STATE_IDLE;
+    return __atomic_compare_exchange_n(&cellp->state, &expected, CELL_RUNTIME_CELL_STATE_QUEUED,
+        0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// called by the consensus layer in tape order, entryp->data (or the reference to entryp->segp)
+// is taken over by the runtime
+// ret int: 0 if success | -1 if the tape queue of the cell is full, retry later
+int
+cell_runtime_submit(cell_runtime_t* rtp, cell_runtime_cell_t* cellp,
+    const cell_runtime_tape_entry_t* entryp){
+
+    pthread_mutex_lock(&cellp->tape_q_lock);
+    if(cellp->tape_q_ct == CELL_RUNTIME_CELL_TAPE_Q_LEN){
+        pthread_mutex_unlock(&cellp->tape_q_lock);
+        return -1;
+    }
+    cellp->tape_q[(cellp->tape_q_head + cellp->tape_q_ct) & (CELL_RUNTIME_CELL_TAPE_Q_LEN - 1)] =
+        *entryp;
+    cellp->tape_q_ct++;
+    pthread_mutex_unlock(&cellp->tape_q_lock);
+    if(cell_runtime_cell_try_queue(cellp)){
+        cell_runtime_enqueue(rtp, NULL, cellp);
+    }
+    return 0;
+}
+
+// always_inline
+inline void
+cell_runtime_tape_segment_get(cell_runtime_tape_segment_t* segp){
+    __atomic_add_fetch(&segp->ref_ct, 1, __ATOMIC_RELAXED);
+}
+
+// always_inline
+inline void
+cell_runtime_tape_segment_put(cell_runtime_tape_segment_t* segp){
+    if(__atomic_sub_fetch(&segp->ref_ct, 1, __ATOMIC_ACQ_REL) == 0){
+        segp->release_fn(segp);
+    }
+}
+
+// size of the record of an entry of this type and len, padding included
+// always_inline
+inline uint64_t
+cell_runtime_tape_record_size(uint8_t type, uint32_t len){
+    uint64_t size = sizeof(cell_runtime_tape_record_t) +
+        (type == CELL_RUNTIME_TAPE_ENTRY_IO_INPUT ? len : 0);
+    return (size + CELL_RUNTIME_TAPE_RECORD_ALIGN - 1) &
+        ~(uint64_t)(CELL_RUNTIME_TAPE_RECORD_ALIGN - 1);
+}
+
+// the entry of a record whose data follows it, without copying the data: it points into the
+// record, which must stay valid until the entry is applied (segp, if any, is given a reference)
+// always_inline
+inline void
+cell_runtime_tape_record_entry(const cell_runtime_tape_record_t* recp,
+    cell_runtime_tape_segment_t* segp, cell_runtime_tape_entry_t* entryp){
+
+    entryp->type = recp->type;
+    entryp->dev_id = recp->dev_id;
+    entryp->len = recp->len;
+    entryp->tape_idx = recp->tape_idx;
+    entryp->inst_amount_or_offset = recp->inst_amount_or_offset;
+    entryp->data = NULL;
+    entryp->segp = NULL;
+    if(recp->type == CELL_RUNTIME_TAPE_ENTRY_IO_INPUT){
+        entryp->data = (uint8_t*)(recp + 1);
+        entryp->segp = segp;
+        if(segp){
+            cell_runtime_tape_segment_get(segp);
+        }
+    }
+}
+
+// the data of an IO_INPUT entry taken over by the runtime goes, applied or not
+// always_inline
+inline void
+cell_runtime_tape_entry_release(cell_runtime_tape_entry_t* entryp){
+    if(entryp->type != CELL_RUNTIME_TAPE_ENTRY_IO_INPUT){
+        return;
+    }
+    if(entryp->segp){
+        cell_runtime_tape_segment_put(entryp->segp);
+    }else{
+        free(entryp->data);
+    }
+}
+
+// always_inline
+inline void
+cell_runtime_apply_tape_entry(turingcell_computer_t* cp, cell_runtime_tape_entry_t* entryp){
+    switch(entryp->type){
+        case CELL_RUNTIME_TAPE_ENTRY_EXEC:
+            mdf_computer_exec(cp, entryp->tape_idx, entryp->inst_amount_or_offset);
+            break;
+        case CELL_RUNTIME_TAPE_ENTRY_IO_INPUT:
+            mdf_computer_io_input(cp, entryp->tape_idx, entryp->dev_id, entryp->data, entryp->len);
+            cell_runtime_tape_entry_release(entryp);
+            break;
+        case CELL_RUNTIME_TAPE_ENTRY_IO_OUTPUT:
+            mdf_computer_io_output(cp, entryp->tape_idx, entryp->dev_id,
+                entryp->inst_amount_or_offset, entryp->len);
+            break;
+        default:
+            break;
+    }
+}
+
+// run one turn of a cell which this worker has moved into RUNNING
+void
+cell_runtime_worker_run_cell(cell_runtime_worker_t* wp, cell_runtime_cell_t* cellp){
+    cell_runtime_tape_hook_t* hookp = __atomic_load_n(&cellp->tape_hookp, __ATOMIC_ACQUIRE);
+    cell_runtime_tape_entry_t entry;
+    uint32_t i;
+    if(wp->bound_cp != cellp->cp || cellp->cp->pmmp != wp->pmmp){
+        turingcell_computer_rebind_phys_mem_map(cellp->cp, wp->pmmp);
+        wp->bound_cp = cellp->cp;
+    }
+    for(i = 0; i < CELL_RUNTIME_RUN_ENTRY_CT_MAX; i++){
+        pthread_mutex_lock(&cellp->tape_q_lock);
+        if(cellp->tape_q_ct == 0){
+            pthread_mutex_unlock(&cellp->tape_q_lock);
+            break;
+        }
+        entry = cellp->tape_q[cellp->tape_q_head];
+        cellp->tape_q_head = (cellp->tape_q_head + 1) & (CELL_RUNTIME_CELL_TAPE_Q_LEN - 1);
+        cellp->tape_q_ct--;
+        pthread_mutex_unlock(&cellp->tape_q_lock);
+        if_unlikely(hookp){
+            hookp->fn(hookp->ctx, cellp->cp, &entry);
+        }
+        cell_runtime_apply_tape_entry(cellp->cp, &entry);
+        __atomic_add_fetch(&cellp->applied_ct, 1, __ATOMIC_RELEASE);
+    }
+    if_unlikely(hookp){
+        hookp->fn(hookp->ctx, cellp->cp, NULL);
+    }
+    wp->run_ct++;
+    if(i == CELL_RUNTIME_RUN_ENTRY_CT_MAX){ // budget used up, let the others run
+        __atomic_store_n(&cellp->state, CELL_RUNTIME_CELL_STATE_QUEUED, __ATOMIC_RELEASE);
+        cell_runtime_enqueue(wp->rtp, wp, cellp);
+        return;
+    }
+    __atomic_store_n(&cellp->state, CELL_RUNTIME_CELL_STATE_IDLE, __ATOMIC_SEQ_CST);
+    // an entry submitted after the queue was seen empty but before IDLE was stored would
+    // otherwise be left behind
+    pthread_mutex_lock(&cellp->tape_q_lock);
+    i = cellp->tape_q_ct;
+    pthread_mutex_unlock(&cellp->tape_q_lock);
+    if(i && cell_runtime_cell_try_queue(cellp)){
+        cell_runtime_enqueue(wp->rtp, wp, cellp);
+    }
+}
+
+// always_inline
+inline cell_runtime_cell_t*
+cell_runtime_worker_find(cell_runtime_worker_t* wp){
+    cell_runtime_t* rtp = wp->rtp;
+    cell_runtime_cell_t* cellp = cell_runtime_deque_pop_bottom(&wp->deque);
+    uint32_t i, victim;
+    if(cellp){
+        return cellp;
+    }
+    // xorshift, only to spread the thieves over the victims
+    wp->rand_state ^= wp->rand_state << 13;
+    wp->rand_state ^= wp->rand_state >> 17;
+    wp->rand_state ^= wp->rand_state << 5;
+    victim = wp->rand_state % rtp->worker_ct;
+    for(i = 0; i < rtp->worker_ct; i++){
+        if((victim + i) % rtp->worker_ct == wp->worker_id){
+            continue;
+        }
+        cellp = cell_runtime_deque_steal_top(&rtp->workers[(victim + i) % rtp->worker_ct].deque);
+        if(cellp){
+            wp->steal_ct++;
+            return cellp;
+        }
+    }
+    return NULL;
+}
+
+void*
+cell_runtime_worker_main(void* arg){
+    cell_runtime_worker_t* wp = (cell_runtime_worker_t*)arg;
+    cell_runtime_t* rtp = wp->rtp;
+    cell_runtime_cell_t* cellp;
+    for(;;){
+        pthread_mutex_lock(&rtp->idle_lock);
+        while(rtp->queued_ct == 0 && !rtp->stop_flag){
+            pthread_cond_wait(&rtp->idle_cond, &rtp->idle_lock);
+        }
+        if(rtp->stop_flag){
+            pthread_mutex_unlock(&rtp->idle_lock);
+            break;
+        }
+        rtp->queued_ct--; // this worker is going to take one
+        pthread_mutex_unlock(&rtp->idle_lock);
+        // the cell counted above is in some deque, or already taken by a worker which
+        // passed here before; keep looking until one is found
+        while((cellp = cell_runtime_worker_find(wp)) == NULL){
+            sched_yield();
+        }
+        __atomic_store_n(&cellp->state, CELL_RUNTIME_CELL_STATE_RUNNING, __ATOMIC_RELEASE);
+        cell_runtime_worker_run_cell(wp, cellp);
+    }
+    return NULL;
+}
+
+// ret int: 0 if success | -1 if failed
+int
+cell_runtime_cell_init(cell_runtime_cell_t* cellp, turingcell_computer_t* cp, uint32_t cell_id){
+    cellp->cp = cp;
+    cellp->cell_id = cell_id;
+    cellp->state = CELL_RUNTIME_CELL_STATE_IDLE;
+    cellp->tape_q_head = 0;
+    cellp->tape_q_ct = 0;
+    cellp->applied_ct = 0;
+    cellp->tape_hookp = NULL;
+    return pthread_mutex_init(&cellp->tape_q_lock, NULL) == 0 ? 0 : -1;
+}
+
+// the workers from created_ct on have no thread, the stop_flag is set already
+void
+cell_runtime_workers_destroy(cell_runtime_t* rtp, uint32_t created_ct){
+    uint32_t i;
+    pthread_mutex_lock(&rtp->idle_lock);
+    rtp->stop_flag = 1;
+    pthread_cond_broadcast(&rtp->idle_cond);
+    pthread_mutex_unlock(&rtp->idle_lock);
+    for(i = 0; i < created_ct; i++){
+        pthread_join(rtp->workers[i].thread, NULL);
+    }
+    for(i = 0; i < rtp->worker_ct; i++){
+        free(rtp->workers[i].pmmp);
+        pthread_mutex_destroy(&rtp->workers[i].deque.lock);
+    }
+    free(rtp->workers);
+    rtp->workers = NULL;
+    rtp->worker_ct = 0;
+    pthread_mutex_destroy(&rtp->idle_lock);
+    pthread_cond_destroy(&rtp->idle_cond);
+}
+
+// worker_ct of 0 means one per online cpu
+// ret int: 0 if success | -1 if failed, nothing is left running nor allocated then and
+//  `cell_runtime_stop` is a no-op
+int
+cell_runtime_start(cell_runtime_t* rtp, uint32_t worker_ct){
+    uint32_t i;
+    long online_ct;
+    if(worker_ct == 0){
+        online_ct = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_ct = online_ct > 0 ? (uint32_t)online_ct : 1;
+    }
+    if(worker_ct > CELL_RUNTIME_WORKER_CT_MAX){
+        worker_ct = CELL_RUNTIME_WORKER_CT_MAX;
+    }
+    memset(rtp, 0, sizeof(*rtp));
+    rtp->workers = calloc(worker_ct, sizeof(cell_runtime_worker_t));
+    if(rtp->workers == NULL){
+        return -1;
+    }
+    rtp->worker_ct = worker_ct;
+    pthread_mutex_init(&rtp->idle_lock, NULL);
+    pthread_cond_init(&rtp->idle_cond, NULL);
+    for(i = 0; i < worker_ct; i++){
+        rtp->workers[i].rtp = rtp;
+        rtp->workers[i].worker_id = i;
+        rtp->workers[i].rand_state = 2463534242u + i;
+        pthread_mutex_init(&rtp->workers[i].deque.lock, NULL);
+        rtp->workers[i].pmmp = malloc(sizeof(phys_mem_map_t));
+        if(rtp->workers[i].pmmp == NULL){
+            rtp->worker_ct = i + 1; // the deques initialized so far
+            cell_runtime_workers_destroy(rtp, 0);
+            return -1;
+        }
+        phys_mem_map_init(rtp->workers[i].pmmp);
+    }
+    for(i = 0; i < worker_ct; i++){
+        if(pthread_create(&rtp->workers[i].thread, NULL, cell_runtime_worker_main,
+            &rtp->workers[i]) != 0){
+
+            cell_runtime_workers_destroy(rtp, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// the entries submitted but not applied yet are dropped, their data released; every cell is
+// IDLE afterwards
+void
+cell_runtime_stop(cell_runtime_t* rtp){
+    cell_runtime_worker_t* wp;
+    cell_runtime_cell_t* cellp;
+    uint32_t i, worker_ct = rtp->worker_ct;
+    if(rtp->workers == NULL){
+        return;
+    }
+    pthread_mutex_lock(&rtp->idle_lock);
+    rtp->stop_flag = 1;
+    pthread_cond_broadcast(&rtp->idle_cond);
+    pthread_mutex_unlock(&rtp->idle_lock);
+    for(i = 0; i < worker_ct; i++){
+        pthread_join(rtp->workers[i].thread, NULL);
+    }
+    // no worker left: a cell with entries pending is QUEUED, in one of the deques
+    for(i = 0; i < worker_ct; i++){
+        wp = &rtp->workers[i];
+        while((cellp = cell_runtime_deque_pop_bottom(&wp->deque)) != NULL){
+            pthread_mutex_lock(&cellp->tape_q_lock);
+            while(cellp->tape_q_ct){
+                cell_runtime_tape_entry_release(&cellp->tape_q[cellp->tape_q_head]);
+                cellp->tape_q_head = (cellp->tape_q_head + 1) & (CELL_RUNTIME_CELL_TAPE_Q_LEN - 1);
+                cellp->tape_q_ct--;
+            }
+            pthread_mutex_unlock(&cellp->tape_q_lock);
+            __atomic_store_n(&cellp->state, CELL_RUNTIME_CELL_STATE_IDLE, __ATOMIC_RELEASE);
+        }
+    }
+    cell_runtime_workers_destroy(rtp, 0);
+}
+
+#endif
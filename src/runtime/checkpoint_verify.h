@@ -0,0 +1,872 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** parallel checkpoint segment verification **
+// host side, NOT a md part: the audit of a tape recorded with checkpoints (tape_replay.h).
+// The checkpoints cut the tape into segments, every segment starts from the state of the
+// checkpoint in front of it (the head state for the first one) and has to end in the state
+// of the checkpoint behind it (the recorded final hash for the last one). The segments do
+// not depend on each other, a pool of threads re-executes them all at once, each thread on
+// a computer of its own, so an audit takes about the time of the longest segment instead of
+// the whole tape.
+//
+// a tape recorded with a trace (see "trace" in tape_replay.h) is checked at every trace
+// record on the way too, so a segment which goes wrong is narrowed down to the window of
+// trace_inst_ct insts in front of the first record it does not reproduce.
+//
+// the first segment which ends in another state is where the execution diverged, it is
+// then taken apart on the calling thread:
+//  - `checkpoint_verify_diff` runs it once more and compares the state at the first trace
+//    record it does not reproduce, or else at its end, with the recording member by member:
+//    which registers of which vCPU, which device fields, which RAM pages differ
+//  - `checkpoint_verify_locate` runs it on a fast and a reference computer in lockstep
+//    (cpu_lockstep.h), which checks the shortcuts of the cpu (predecode cache, idle loop fast
+//    forward) against its plain dispatch, to the inst. One vCPU only.
+//
+// when two replicas of a cell end in different states, each records the same entries (see
+// `tape_record_set_first_tape_idx`) with the same intervals, and `checkpoint_verify_replicas`
+// compares the two recordings record by record: the first checkpoint or trace record where
+// they differ bounds the divergence to the window behind the record in front of it, and is
+// compared member by member, the cpus and the RAM pages written in the window. Each recording
+// is also re-executed by this build, which tells the replica that went its own way.
+//
+// Build the tool with CHECKPOINT_VERIFY_MAIN defined after including turingcell_computer_md.c,
+// `make` does so into build/:
+//     checkpoint_verify [-d chunk_store_dir] [-j thread_ct] [-r other_replica_file] file
+
+#ifndef CHECKPOINT_VERIFY_H
+#define CHECKPOINT_VERIFY_H
+
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<unistd.h>
+#include "tape_replay.h"
+#include "cpu_lockstep.h"
+
+#define CHECKPOINT_VERIFY_THREAD_CT_MAX     256
+#define CHECKPOINT_VERIFY_DIFF_PAGE_CT      16      // RAM pages listed by the diff at most
+#define CHECKPOINT_VERIFY_DIFF_WORD_LEN     256     // members printed word by word up to
+#define CHECKPOINT_VERIFY_ENTRY_NONE        ((uint64_t)0xffffffffffffffff)
+
+typedef struct {
+    uint64_t first_entry;           // index in the entries of the tape
+    uint64_t entry_ct;              // up to the next checkpoint or the end
+    uint8_t* start_state;
+    uint8_t* end_state;             // of the checkpoint behind it | NULL for the last one
+
+    // result
+    uint8_t expected_hash[SHA256_DIGEST_SIZE];
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    uint64_t trace_ct;              // trace records reproduced
+    uint64_t trace_mismatch_entry;  // first trace record not reproduced | ENTRY_NONE
+    uint64_t inst_ct;
+    uint64_t ns;
+    uint8_t done_flag;
+    uint8_t match_flag;
+} checkpoint_verify_segment_t;
+
+typedef struct {
+    tape_replay_tape_t tape;
+    chunk_store_t chunk_store;
+    uint8_t chunk_store_flag;
+    checkpoint_verify_segment_t* segments;
+    uint64_t segment_ct;
+    uint64_t next_segment;          // atomic, the next one a worker takes
+    uint8_t error_flag;             // atomic, a worker could not set up its computer
+    uint32_t thread_ct;             // of the latest run
+    uint64_t total_ns;
+} checkpoint_verify_t;
+
+// ret int: 0 if success | -1 if the tape could not be loaded
+int
+checkpoint_verify_init(checkpoint_verify_t* vp, const char* path, const char* chunk_dir){
+    tape_replay_tape_t* tp = &vp->tape;
+    checkpoint_verify_segment_t* sp;
+    uint64_t i;
+    memset(vp, 0, sizeof(*vp));
+    if(tape_replay_load_file(tp, path) != 0){
+        return -1;
+    }
+    if(chunk_store_init(&vp->chunk_store, chunk_dir, TAPE_REPLAY_CHUNK_CACHE_SLOT_CT, NULL) != 0){
+        return -1;
+    }
+    vp->chunk_store_flag = 1;
+    vp->segments = calloc(tp->checkpoint_ct + 1, sizeof(checkpoint_verify_segment_t));
+    if(vp->segments == NULL){
+        return -1;
+    }
+    sp = &vp->segments[0];
+    sp->start_state = tp->state;
+    for(i = 0; i < tp->entry_ct; i++){
+        if(tp->entries[i].type != TAPE_REPLAY_ENTRY_CHECKPOINT){
+            continue;
+        }
+        sp->entry_ct = i - sp->first_entry;
+        sp->end_state = tp->entries[i].data;
+        sp++;
+        sp->first_entry = i + 1;
+        sp->start_state = tp->entries[i].data;
+    }
+    sp->entry_ct = tp->entry_ct - sp->first_entry;
+    vp->segment_ct = tp->checkpoint_ct + 1;
+    return 0;
+}
+
+// safe after a failed checkpoint_verify_init too
+void
+checkpoint_verify_destroy(checkpoint_verify_t* vp){
+    free(vp->segments);
+    if(vp->chunk_store_flag){
+        chunk_store_destroy(&vp->chunk_store);
+    }
+    tape_replay_tape_free(&vp->tape);
+}
+
+typedef struct {
+    FILE* fp;
+    uint8_t* expected;              // cursor in the expected state stream
+    const char* expected_name;      // what the expected state is, for the print
+    int vcpu_idx;                   // of the members visited right now
+    uint64_t diff_ct;               // members which differ
+} checkpoint_verify_diff_t;
+
+void
+checkpoint_verify_diff_visit_fn(void* arg, const char* name, void* p, uint64_t len){
+    checkpoint_verify_diff_t* dp = (checkpoint_verify_diff_t*)arg;
+    uint8_t* a = (uint8_t*)p;
+    uint8_t* b = dp->expected;
+    uint64_t off, page_ct = 0;
+    uint32_t wa, wb;
+    dp->expected += len;
+    if(strcmp(name, "cpup->R") == 0){
+        dp->vcpu_idx++;
+    }
+    if(memcmp(a, b, len) == 0){
+        return;
+    }
+    dp->diff_ct++;
+    if(strcmp(name, "ram") == 0){
+        for(off = 0; off < len; off += PHYS_MEM_PAGE_SIZE){
+            if(memcmp(a + off, b + off, PHYS_MEM_PAGE_SIZE) == 0){
+                continue;
+            }
+            if(page_ct < CHECKPOINT_VERIFY_DIFF_PAGE_CT){
+                for(wa = 0; a[off + wa] == b[off + wa]; wa++){
+                }
+                fprintf(dp->fp, "  RAM page %08llx differs first at paddr %08llx\n",
+                    (unsigned long long)(TURINGCELL_COMPUTER_PADDR_RAM + off),
+                    (unsigned long long)(TURINGCELL_COMPUTER_PADDR_RAM + off + wa));
+            }
+            page_ct++;
+        }
+        fprintf(dp->fp, "  RAM: %llu pages differ\n", (unsigned long long)page_ct);
+        return;
+    }
+    if(len % 4 == 0 && len <= CHECKPOINT_VERIFY_DIFF_WORD_LEN){
+        for(off = 0; off < len; off += 4){
+            memcpy(&wa, a + off, 4);
+            memcpy(&wb, b + off, 4);
+            if(wa == wb){
+                continue;
+            }
+            fprintf(dp->fp, "  %s", name);
+            if(len > 4){
+                fprintf(dp->fp, "[%llu]", (unsigned long long)(off / 4));
+            }
+            if(strncmp(name, "cpup->", 6) == 0){
+                fprintf(dp->fp, " of vCPU %d", dp->vcpu_idx);
+            }
+            fprintf(dp->fp, ": %08x, %s %08x\n", wa, dp->expected_name, wb);
+        }
+        return;
+    }
+    for(off = 0; a[off] == b[off]; off++){
+    }
+    fprintf(dp->fp, "  %s differs first at byte %llu of %llu\n", name,
+        (unsigned long long)off, (unsigned long long)len);
+}
+
+// print how the state of cp differs from expected, the whole state | the small state of a
+// trace record if small_flag
+// ret u64: amount of members which differ
+uint64_t
+checkpoint_verify_state_diff(FILE* fp, turingcell_computer_t* cp, uint8_t small_flag,
+    const uint8_t* expected, const char* expected_name){
+
+    checkpoint_verify_diff_t diff;
+    diff.fp = fp;
+    diff.expected = (uint8_t*)expected;
+    diff.expected_name = expected_name;
+    diff.vcpu_idx = -1;
+    diff.diff_ct = 0;
+    if(small_flag){
+        turingcell_computer_small_state_visit(cp, 0, checkpoint_verify_diff_visit_fn, &diff);
+    }else{
+        turingcell_computer_state_visit(cp, checkpoint_verify_diff_visit_fn, &diff);
+    }
+    return diff.diff_ct;
+}
+
+// ret u8: 1 if rec of len bytes is a well formed trace record | 0 if not
+// always_inline
+inline uint8_t
+checkpoint_verify_trace_check_len(const uint8_t* rec, uint32_t len, uint32_t small_len){
+    uint32_t dirty_ct;
+    if(len < small_len + 4){
+        return 0;
+    }
+    memcpy(&dirty_ct, rec + small_len, 4);
+    return (uint64_t)len == small_len + 4 + (uint64_t)dirty_ct * TAPE_REPLAY_TRACE_PAGE_LEN;
+}
+
+// print how the RAM pages written in the window of trace record a differ from the ones of b
+// ret u64: amount of pages which differ
+uint64_t
+checkpoint_verify_trace_pages_diff(FILE* fp, const uint8_t* a, uint32_t a_len,
+    const char* a_name, const uint8_t* b, uint32_t b_len, const char* b_name,
+    uint32_t small_len){
+
+    uint32_t a_ct, b_ct, i = 0, j = 0, a_pfn, b_pfn;
+    uint64_t page_ct = 0;
+    const char* only_name;
+    if(!checkpoint_verify_trace_check_len(a, a_len, small_len) ||
+        !checkpoint_verify_trace_check_len(b, b_len, small_len)){
+
+        fprintf(fp, "  malformed trace record\n");
+        return 1;
+    }
+    memcpy(&a_ct, a + small_len, 4);
+    memcpy(&b_ct, b + small_len, 4);
+    a += small_len + 4;
+    b += small_len + 4;
+    while(i < a_ct || j < b_ct){
+        a_pfn = b_pfn = 0xffffffff;
+        if(i < a_ct){
+            memcpy(&a_pfn, a + i * TAPE_REPLAY_TRACE_PAGE_LEN, 4);
+        }
+        if(j < b_ct){
+            memcpy(&b_pfn, b + j * TAPE_REPLAY_TRACE_PAGE_LEN, 4);
+        }
+        if(a_pfn == b_pfn){
+            if(memcmp(a + i * TAPE_REPLAY_TRACE_PAGE_LEN + 4,
+                b + j * TAPE_REPLAY_TRACE_PAGE_LEN + 4, SHA256_DIGEST_SIZE) != 0){
+
+                if(page_ct < CHECKPOINT_VERIFY_DIFF_PAGE_CT){
+                    fprintf(fp, "  RAM page %08llx written by both, the contents differ\n",
+                        (unsigned long long)(TURINGCELL_COMPUTER_PADDR_RAM +
+                            ((uint64_t)a_pfn << PHYS_MEM_PAGE_SHIFT)));
+                }
+                page_ct++;
+            }
+            i++;
+            j++;
+            continue;
+        }
+        only_name = a_pfn < b_pfn ? a_name : b_name;
+        if(page_ct < CHECKPOINT_VERIFY_DIFF_PAGE_CT){
+            fprintf(fp, "  RAM page %08llx written by %s only\n",
+                (unsigned long long)(TURINGCELL_COMPUTER_PADDR_RAM +
+                    ((uint64_t)(a_pfn < b_pfn ? a_pfn : b_pfn) << PHYS_MEM_PAGE_SHIFT)),
+                only_name);
+        }
+        page_ct++;
+        if(a_pfn < b_pfn){
+            i++;
+        }else{
+            j++;
+        }
+    }
+    fprintf(fp, "  RAM: %llu pages written in the window differ\n", (unsigned long long)page_ct);
+    return page_ct;
+}
+
+// the trace records of a segment, checked while it is re-executed
+typedef struct {
+    const tape_replay_tape_t* tp;
+    uint64_t next_entry;            // where the next trace record is looked for
+    uint64_t end_entry;             // of the segment
+    uint64_t ct;                    // records reproduced
+    uint64_t mismatch_entry;        // first one not reproduced | ENTRY_NONE
+    uint64_t prev_inst_ct;          // inst counter of the latest one reproduced
+    FILE* diff_fp;                  // print how the first one not reproduced differs | NULL
+} checkpoint_verify_trace_check_t;
+
+// tape_replay_trace_emit_fn_t
+void
+checkpoint_verify_trace_emit_fn(void* ctx, turingcell_computer_t* cp, const uint8_t* rec,
+    uint32_t len){
+
+    checkpoint_verify_trace_check_t* tcp = (checkpoint_verify_trace_check_t*)ctx;
+    const cell_runtime_tape_entry_t* entryp;
+    uint64_t i = tcp->next_entry;
+    uint32_t small_len;
+    if(tcp->mismatch_entry != CHECKPOINT_VERIFY_ENTRY_NONE){
+        return;
+    }
+    while(i < tcp->end_entry && tcp->tp->entries[i].type != TAPE_REPLAY_ENTRY_TRACE){
+        i++;
+    }
+    tcp->next_entry = i + 1;
+    if(i == tcp->end_entry){
+        tcp->mismatch_entry = i;    // one more than recorded
+        if(tcp->diff_fp){
+            fprintf(tcp->diff_fp, "  a trace record at inst %llu which the recording does not "
+                "have\n", (unsigned long long)turingcell_computer_now(cp));
+        }
+        return;
+    }
+    entryp = &tcp->tp->entries[i];
+    if(entryp->tape_idx == cp->applied_tape_idx &&
+        entryp->inst_amount_or_offset == turingcell_computer_now(cp) &&
+        entryp->len == len && memcmp(entryp->data, rec, len) == 0){
+
+        tcp->ct++;
+        tcp->prev_inst_ct = entryp->inst_amount_or_offset;
+        return;
+    }
+    tcp->mismatch_entry = i;
+    if(tcp->diff_fp == NULL){
+        return;
+    }
+    fprintf(tcp->diff_fp, "  re-executed: tape_idx %llu inst %llu, recorded: tape_idx %llu inst "
+        "%llu, the window: insts [%llu, %llu)\n", (unsigned long long)cp->applied_tape_idx,
+        (unsigned long long)turingcell_computer_now(cp), (unsigned long long)entryp->tape_idx,
+        (unsigned long long)entryp->inst_amount_or_offset,
+        (unsigned long long)tcp->prev_inst_ct, (unsigned long long)turingcell_computer_now(cp));
+    small_len = turingcell_computer_small_state_len(cp, 0);
+    if(!checkpoint_verify_trace_check_len(entryp->data, entryp->len, small_len)){
+        fprintf(tcp->diff_fp, "  malformed trace record\n");
+        return;
+    }
+    fprintf(tcp->diff_fp, "  %llu members differ\n", (unsigned long long)
+        checkpoint_verify_state_diff(tcp->diff_fp, cp, 1, entryp->data, "recorded"));
+    checkpoint_verify_trace_pages_diff(tcp->diff_fp, rec, len, "this build", entryp->data,
+        entryp->len, "the recording", small_len);
+}
+
+// load the start state of the segment into the computer of hp and apply its entries, the
+// trace records are checked into tcp if it is not NULL and the tape has a trace
+// ret int: 0 if success | -1 if the state does not fit this build
+int
+checkpoint_verify_segment_exec(checkpoint_verify_t* vp, uint64_t seg_idx,
+    tape_replay_host_t* hp, checkpoint_verify_trace_check_t* tcp){
+
+    checkpoint_verify_segment_t* sp = &vp->segments[seg_idx];
+    cell_runtime_tape_entry_t* entryp;
+    tape_replay_trace_t trace;
+    uint64_t i;
+    int ret = 0;
+    memset(&trace, 0, sizeof(trace));
+    if(tape_replay_host_load(hp, &vp->tape, sp->start_state) != 0){
+        return -1;
+    }
+    if(tcp){
+        tcp->tp = &vp->tape;
+        tcp->next_entry = sp->first_entry;
+        tcp->end_entry = sp->first_entry + sp->entry_ct;
+        tcp->ct = 0;
+        tcp->mismatch_entry = CHECKPOINT_VERIFY_ENTRY_NONE;
+        tcp->prev_inst_ct = turingcell_computer_now(hp->cp);
+        if(vp->tape.trace_inst_ct && tape_replay_trace_start(&trace, hp->cp,
+            vp->tape.trace_inst_ct, checkpoint_verify_trace_emit_fn, tcp) != 0){
+
+            ret = -1;
+        }
+    }
+    sp->inst_ct = 0;
+    for(i = 0; i < sp->entry_ct && ret == 0; i++){
+        entryp = &vp->tape.entries[sp->first_entry + i];
+        tape_replay_apply_entry(hp->cp, entryp);
+        if(entryp->type == CELL_RUNTIME_TAPE_ENTRY_EXEC){
+            sp->inst_ct += entryp->inst_amount_or_offset;
+        }
+    }
+    tape_replay_trace_stop(&trace);
+    if(tcp && vp->tape.trace_inst_ct && tcp->mismatch_entry == CHECKPOINT_VERIFY_ENTRY_NONE){
+        for(i = tcp->next_entry; i < tcp->end_entry; i++){
+            if(vp->tape.entries[i].type == TAPE_REPLAY_ENTRY_TRACE){
+                tcp->mismatch_entry = i;    // recorded, but not reached
+                if(tcp->diff_fp){
+                    fprintf(tcp->diff_fp, "  the recording has a trace record at inst %llu "
+                        "which this build does not reach\n",
+                        (unsigned long long)vp->tape.entries[i].inst_amount_or_offset);
+                }
+                break;
+            }
+        }
+    }
+    return ret;
+}
+
+void*
+checkpoint_verify_worker(void* arg){
+    checkpoint_verify_t* vp = (checkpoint_verify_t*)arg;
+    checkpoint_verify_segment_t* sp;
+    checkpoint_verify_trace_check_t check;
+    tape_replay_host_t host;
+    uint64_t seg_idx, t0;
+    memset(&check, 0, sizeof(check));
+    if(tape_replay_host_init(&host, &vp->tape, &vp->chunk_store.backend, 0) != 0){
+        __atomic_store_n(&vp->error_flag, 1, __ATOMIC_RELAXED);
+        tape_replay_host_destroy(&host);
+        return NULL;
+    }
+    for(;;){
+        seg_idx = __atomic_fetch_add(&vp->next_segment, 1, __ATOMIC_RELAXED);
+        if(seg_idx >= vp->segment_ct){
+            break;
+        }
+        sp = &vp->segments[seg_idx];
+        t0 = tape_replay_host_ns();
+        if(checkpoint_verify_segment_exec(vp, seg_idx, &host, &check) != 0){
+            __atomic_store_n(&vp->error_flag, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        turingcell_computer_state_hash(host.cp, sp->hash);
+        if(sp->end_state){
+            tape_replay_state_hash(sp->end_state, vp->tape.state_len, sp->expected_hash);
+        }else{
+            memcpy(sp->expected_hash, vp->tape.recorded_hash, SHA256_DIGEST_SIZE);
+        }
+        sp->trace_ct = check.ct;
+        sp->trace_mismatch_entry = check.mismatch_entry;
+        sp->match_flag = memcmp(sp->hash, sp->expected_hash, SHA256_DIGEST_SIZE) == 0 &&
+            sp->trace_mismatch_entry == CHECKPOINT_VERIFY_ENTRY_NONE;
+        sp->ns = tape_replay_host_ns() - t0;
+        sp->done_flag = 1;
+    }
+    tape_replay_host_destroy(&host);
+    return NULL;
+}
+
+// every segment on thread_ct threads, the results are in the segments
+// ret int: 0 if every segment has been executed | -1 if failed
+int
+checkpoint_verify_run(checkpoint_verify_t* vp, uint32_t thread_ct){
+    pthread_t threads[CHECKPOINT_VERIFY_THREAD_CT_MAX];
+    uint64_t t0 = tape_replay_host_ns();
+    uint32_t i, started_ct = 0;
+    if(thread_ct == 0){
+        thread_ct = 1;
+    }
+    if(thread_ct > CHECKPOINT_VERIFY_THREAD_CT_MAX){
+        thread_ct = CHECKPOINT_VERIFY_THREAD_CT_MAX;
+    }
+    if(thread_ct > vp->segment_ct){
+        thread_ct = (uint32_t)vp->segment_ct;
+    }
+    vp->next_segment = 0;
+    vp->error_flag = 0;
+    for(i = 0; i < thread_ct; i++){
+        if(pthread_create(&threads[i], NULL, checkpoint_verify_worker, vp) != 0){
+            break;
+        }
+        started_ct++;
+    }
+    if(started_ct == 0){
+        return -1;
+    }
+    for(i = 0; i < started_ct; i++){
+        pthread_join(threads[i], NULL);
+    }
+    vp->thread_ct = started_ct;
+    vp->total_ns = tape_replay_host_ns() - t0;
+    return vp->error_flag ? -1 : 0;
+}
+
+// ret u64: index of the first segment which did not end in the expected state
+//          | segment_ct if they all did
+uint64_t
+checkpoint_verify_first_mismatch(const checkpoint_verify_t* vp){
+    uint64_t i;
+    for(i = 0; i < vp->segment_ct; i++){
+        if(!vp->segments[i].match_flag){
+            break;
+        }
+    }
+    return i;
+}
+
+// re-execute the segment and print how the state at its first trace record not reproduced,
+// or else at its end, differs from the recording
+// ret int: 0 if success | -1 if failed or it only differs from the final hash of the tape
+int
+checkpoint_verify_diff(checkpoint_verify_t* vp, uint64_t seg_idx, FILE* fp){
+    checkpoint_verify_segment_t* sp = &vp->segments[seg_idx];
+    checkpoint_verify_trace_check_t check;
+    tape_replay_host_t host;
+    const cell_runtime_tape_entry_t* entryp;
+    int ret = -1;
+    memset(&check, 0, sizeof(check));
+    if(sp->trace_mismatch_entry == CHECKPOINT_VERIFY_ENTRY_NONE && sp->end_state == NULL){
+        return -1;
+    }
+    if(sp->trace_mismatch_entry != CHECKPOINT_VERIFY_ENTRY_NONE){
+        if(sp->trace_mismatch_entry < vp->tape.entry_ct){
+            entryp = &vp->tape.entries[sp->trace_mismatch_entry];
+            fprintf(fp, "first trace record not reproduced: entry %llu, tape_idx %llu, inst %llu "
+                "(%llu records of the segment reproduced)\n",
+                (unsigned long long)sp->trace_mismatch_entry,
+                (unsigned long long)entryp->tape_idx,
+                (unsigned long long)entryp->inst_amount_or_offset,
+                (unsigned long long)sp->trace_ct);
+        }
+        check.diff_fp = fp;
+    }
+    if(tape_replay_host_init(&host, &vp->tape, &vp->chunk_store.backend, 0) == 0 &&
+        checkpoint_verify_segment_exec(vp, seg_idx, &host, &check) == 0){
+
+        if(sp->trace_mismatch_entry == CHECKPOINT_VERIFY_ENTRY_NONE){
+            fprintf(fp, "  %llu members differ\n", (unsigned long long)
+                checkpoint_verify_state_diff(fp, host.cp, 0, sp->end_state, "checkpoint"));
+        }
+        ret = 0;
+    }
+    tape_replay_host_destroy(&host);
+    return ret;
+}
+
+// re-execute the segment on a fast and a reference computer in lockstep
+// ret int: 0 if they agree over the whole segment | 1 if not, see the report
+//          | -1 if they could not run in lockstep
+int
+checkpoint_verify_locate(checkpoint_verify_t* vp, uint64_t seg_idx,
+    cpu_lockstep_report_t* rp){
+
+    checkpoint_verify_segment_t* sp = &vp->segments[seg_idx];
+    tape_replay_host_t fast, ref;
+    cell_runtime_tape_entry_t* entryp;
+    cpu_lockstep_t ls;
+    uint64_t i;
+    uint8_t io_ret, differ_flag = 0;
+    int ret = -1;
+    memset(&ls, 0, sizeof(ls));
+    memset(&fast, 0, sizeof(fast));
+    memset(&ref, 0, sizeof(ref));
+    if(vp->tape.vcpu_ct == 1 &&
+        tape_replay_host_init(&fast, &vp->tape, &vp->chunk_store.backend, 0) == 0 &&
+        tape_replay_host_init(&ref, &vp->tape, &vp->chunk_store.backend, 0) == 0 &&
+        tape_replay_host_load(&fast, &vp->tape, sp->start_state) == 0 &&
+        tape_replay_host_load(&ref, &vp->tape, sp->start_state) == 0 &&
+        cpu_lockstep_init(&ls, vp->tape.ram_size, vp->tape.uart_tx_size) == 0 &&
+        cpu_lockstep_attach(&ls, fast.cp, ref.cp) == 0){
+
+        for(i = 0; i < sp->entry_ct && !differ_flag; i++){
+            entryp = &vp->tape.entries[sp->first_entry + i];
+            switch(entryp->type){
+                case CELL_RUNTIME_TAPE_ENTRY_EXEC:
+                    differ_flag = cpu_lockstep_mdf_exec(&ls, entryp->tape_idx,
+                        entryp->inst_amount_or_offset, rp);
+                    break;
+                case CELL_RUNTIME_TAPE_ENTRY_IO_INPUT:
+                    differ_flag = cpu_lockstep_io_input(&ls, entryp->tape_idx, entryp->dev_id,
+                        entryp->data, entryp->len, &io_ret, rp);
+                    break;
+                case CELL_RUNTIME_TAPE_ENTRY_IO_OUTPUT:
+                    differ_flag = cpu_lockstep_io_output(&ls, entryp->tape_idx, entryp->dev_id,
+                        entryp->inst_amount_or_offset, entryp->len, &io_ret, rp);
+                    break;
+                default:
+                    break;
+            }
+        }
+        ret = differ_flag;
+    }
+    cpu_lockstep_destroy(&ls);
+    tape_replay_host_destroy(&ref);
+    tape_replay_host_destroy(&fast);
+    return ret;
+}
+
+// ret u8: 1 if the two entries of tapes of state_len are the same | 0 if not
+// always_inline
+inline uint8_t
+checkpoint_verify_entry_same(const cell_runtime_tape_entry_t* a,
+    const cell_runtime_tape_entry_t* b, uint64_t state_len){
+
+    uint64_t len = a->type == TAPE_REPLAY_ENTRY_CHECKPOINT ? state_len : a->len;
+    return a->type == b->type && a->dev_id == b->dev_id && a->len == b->len &&
+        a->tape_idx == b->tape_idx && a->inst_amount_or_offset == b->inst_amount_or_offset &&
+        (len == 0 || memcmp(a->data, b->data, len) == 0);
+}
+
+// always_inline
+inline void
+checkpoint_verify_record_print(FILE* fp, const cell_runtime_tape_entry_t* entryp){
+    if(entryp->type == TAPE_REPLAY_ENTRY_CHECKPOINT){
+        fprintf(fp, "checkpoint after tape_idx %llu", (unsigned long long)entryp->tape_idx);
+    }else{
+        fprintf(fp, "trace record at tape_idx %llu inst %llu",
+            (unsigned long long)entryp->tape_idx,
+            (unsigned long long)entryp->inst_amount_or_offset);
+    }
+}
+
+// ret u64: index of the segment of vp which is checked against entry entry_idx
+// always_inline
+inline uint64_t
+checkpoint_verify_entry_segment(const checkpoint_verify_t* vp, uint64_t entry_idx){
+    uint64_t i;
+    for(i = 0; i + 1 < vp->segment_ct; i++){
+        if(entry_idx <= vp->segments[i].first_entry + vp->segments[i].entry_ct){
+            break;  // a checkpoint entry ends the segment in front of it
+        }
+    }
+    return i;
+}
+
+// print how the state a of replica A differs from the state b of replica B, the whole state
+// of a head or checkpoint | a trace record if trace_flag
+// ret int: 0 if success | -1 if the scratch computer could not be set up
+int
+checkpoint_verify_replicas_diff(checkpoint_verify_t* vp, FILE* fp, uint8_t trace_flag,
+    uint8_t* a, uint32_t a_len, uint8_t* b, uint32_t b_len){
+
+    tape_replay_host_t host;
+    uint32_t small_len;
+    int ret = -1;
+    if(tape_replay_host_init(&host, &vp->tape, &vp->chunk_store.backend, 0) == 0 &&
+        tape_replay_host_load(&host, &vp->tape, trace_flag ? vp->tape.state : a) == 0){
+
+        if(!trace_flag){
+            fprintf(fp, "  %llu members differ\n", (unsigned long long)
+                checkpoint_verify_state_diff(fp, host.cp, 0, b, "B"));
+        }else{
+            small_len = turingcell_computer_small_state_len(host.cp, 0);
+            if(checkpoint_verify_trace_check_len(a, a_len, small_len) &&
+                checkpoint_verify_trace_check_len(b, b_len, small_len)){
+
+                turingcell_computer_small_state_load(host.cp, 0, a);
+                fprintf(fp, "  %llu members differ\n", (unsigned long long)
+                    checkpoint_verify_state_diff(fp, host.cp, 1, b, "B"));
+            }
+            checkpoint_verify_trace_pages_diff(fp, a, a_len, "A", b, b_len, "B", small_len);
+        }
+        ret = 0;
+    }
+    tape_replay_host_destroy(&host);
+    return ret;
+}
+
+// compare the recording of replica A, vp, with the one of replica B, op, of the same cell and
+// bound where they diverged, both run by checkpoint_verify_run before
+// ret int: 0 if they agree | 1 if not, see fp | -1 if they could not be compared
+int
+checkpoint_verify_replicas(checkpoint_verify_t* vp, checkpoint_verify_t* op, FILE* fp){
+    const tape_replay_tape_t* ap = &vp->tape;
+    const tape_replay_tape_t* bp = &op->tape;
+    const cell_runtime_tape_entry_t* ep;
+    const cell_runtime_tape_entry_t* prevp = NULL;
+    uint64_t i, entry_ct, seg_idx;
+    if(ap->ram_size != bp->ram_size || ap->uart_tx_size != bp->uart_tx_size ||
+        ap->disk_block_ct != bp->disk_block_ct || ap->vcpu_ct != bp->vcpu_ct ||
+        ap->state_len != bp->state_len || ap->trace_inst_ct != bp->trace_inst_ct){
+
+        fprintf(fp, "replicas: not the same configuration or trace interval\n");
+        return -1;
+    }
+    if(memcmp(ap->state, bp->state, ap->state_len) != 0){
+        fprintf(fp, "replicas: the head states differ, record from the same tape_idx\n");
+        if(checkpoint_verify_replicas_diff(vp, fp, 0, ap->state, 0, bp->state, 0) != 0){
+            return -1;
+        }
+        return 1;
+    }
+    entry_ct = ap->entry_ct < bp->entry_ct ? ap->entry_ct : bp->entry_ct;
+    for(i = 0; i < entry_ct; i++){
+        ep = &ap->entries[i];
+        if(!checkpoint_verify_entry_same(ep, &bp->entries[i], ap->state_len)){
+            break;
+        }
+        if(ep->type == TAPE_REPLAY_ENTRY_CHECKPOINT || ep->type == TAPE_REPLAY_ENTRY_TRACE){
+            prevp = ep;
+        }
+    }
+    if(i == entry_ct && ap->entry_ct == bp->entry_ct &&
+        memcmp(ap->recorded_hash, bp->recorded_hash, SHA256_DIGEST_SIZE) == 0){
+
+        fprintf(fp, "replicas: the recordings agree\n");
+        return 0;
+    }
+    if(prevp){
+        fprintf(fp, "replicas: agree up to the ");
+        checkpoint_verify_record_print(fp, prevp);
+        fprintf(fp, "\n");
+    }else{
+        fprintf(fp, "replicas: no record in common\n");
+    }
+    ep = &ap->entries[i];
+    if(i == entry_ct){
+        fprintf(fp, "replicas: %s\n", ap->entry_ct == bp->entry_ct ?
+            "the final hashes differ, the divergence is behind the last record" :
+            "one recording has more entries, record the same tape_idx range");
+    }else if(ep->type != bp->entries[i].type || ep->tape_idx != bp->entries[i].tape_idx ||
+        ep->inst_amount_or_offset != bp->entries[i].inst_amount_or_offset ||
+        (ep->type != TAPE_REPLAY_ENTRY_CHECKPOINT && ep->type != TAPE_REPLAY_ENTRY_TRACE)){
+
+        fprintf(fp, "replicas: entry %llu differs (type %u / %u, tape_idx %llu / %llu), not the "
+            "same entries\n", (unsigned long long)i, ep->type, bp->entries[i].type,
+            (unsigned long long)ep->tape_idx, (unsigned long long)bp->entries[i].tape_idx);
+    }else{
+        fprintf(fp, "replicas: first different record, entry %llu: ", (unsigned long long)i);
+        checkpoint_verify_record_print(fp, ep);
+        fprintf(fp, ", the divergence is in the insts behind the previous one\n");
+        if(ep->type == TAPE_REPLAY_ENTRY_TRACE && ap->trace_inst_ct > 1){
+            fprintf(fp, "  (%llu insts, record with a smaller trace interval to narrow it, 1 "
+                "gives the inst)\n", (unsigned long long)ap->trace_inst_ct);
+        }
+        if(checkpoint_verify_replicas_diff(vp, fp, ep->type == TAPE_REPLAY_ENTRY_TRACE,
+            ep->data, ep->len, bp->entries[i].data, bp->entries[i].len) != 0){
+
+            return -1;
+        }
+    }
+    seg_idx = checkpoint_verify_entry_segment(vp, i);
+    fprintf(fp, "replicas: this build %s A and %s B over segment %llu\n",
+        vp->segments[seg_idx].match_flag ? "reproduces" : "does NOT reproduce",
+        op->segments[checkpoint_verify_entry_segment(op, i)].match_flag ? "reproduces" :
+            "does NOT reproduce", (unsigned long long)seg_idx);
+    return 1;
+}
+
+void
+checkpoint_verify_print(FILE* fp, const checkpoint_verify_t* vp){
+    const checkpoint_verify_segment_t* sp;
+    const cell_runtime_tape_entry_t* entries = vp->tape.entries;
+    uint64_t i, sum_ns = 0, inst_ct = 0;
+    for(i = 0; i < vp->segment_ct; i++){
+        sp = &vp->segments[i];
+        sum_ns += sp->ns;
+        inst_ct += sp->inst_ct;
+        fprintf(fp, "segment %llu: entries [%llu, %llu)", (unsigned long long)i,
+            (unsigned long long)sp->first_entry,
+            (unsigned long long)(sp->first_entry + sp->entry_ct));
+        if(sp->entry_ct){
+            fprintf(fp, " tape_idx %llu..%llu",
+                (unsigned long long)entries[sp->first_entry].tape_idx,
+                (unsigned long long)entries[sp->first_entry + sp->entry_ct - 1].tape_idx);
+        }
+        fprintf(fp, ", %llu insts", (unsigned long long)sp->inst_ct);
+        if(vp->tape.trace_inst_ct){
+            fprintf(fp, ", %llu trace records", (unsigned long long)sp->trace_ct);
+        }
+        fprintf(fp, ", %.3f s, %s\n", (double)sp->ns / 1e9, !sp->done_flag ? "not run" :
+            sp->match_flag ? "match" :
+            sp->trace_mismatch_entry != CHECKPOINT_VERIFY_ENTRY_NONE ?
+                "MISMATCH with a trace record" :
+            sp->end_state ? "MISMATCH with the next checkpoint" :
+                "MISMATCH with the recorded hash");
+    }
+    fprintf(fp, "%llu segments, %llu guest insts on %u threads: %.3f s, %.3f s of segments "
+        "(%.2fx)\n", (unsigned long long)vp->segment_ct, (unsigned long long)inst_ct,
+        vp->thread_ct, (double)vp->total_ns / 1e9, (double)sum_ns / 1e9,
+        vp->total_ns ? (double)sum_ns / (double)vp->total_ns : 0);
+}
+
+#ifdef CHECKPOINT_VERIFY_MAIN
+// ret int: 0 if every segment matches | 2 if one does not, see fp | -1 if failed
+int
+checkpoint_verify_main_one(checkpoint_verify_t* vp, const char* path, uint32_t thread_ct,
+    FILE* fp){
+
+    cpu_lockstep_report_t report;
+    uint64_t seg_idx;
+    int ret;
+    if(checkpoint_verify_run(vp, thread_ct) != 0){
+        fprintf(stderr, "checkpoint_verify: could not run %s\n", path);
+        return -1;
+    }
+    checkpoint_verify_print(fp, vp);
+    seg_idx = checkpoint_verify_first_mismatch(vp);
+    if(seg_idx == vp->segment_ct){
+        fprintf(fp, "match\n");
+        return 0;
+    }
+    fprintf(fp, "first divergent segment: %llu\n", (unsigned long long)seg_idx);
+    if(checkpoint_verify_diff(vp, seg_idx, fp) != 0){
+        fprintf(fp, "  no checkpoint behind it, only the final hash\n");
+    }
+    ret = checkpoint_verify_locate(vp, seg_idx, &report);
+    if(ret == 1){
+        cpu_lockstep_report_print(fp, &report);
+    }else if(ret == 0){
+        fprintf(fp, "lockstep: the fast path of the cpu agrees with its plain dispatch over the "
+            "segment, compare with a replica (-r) to bound the divergence\n");
+    }else{
+        fprintf(fp, "lockstep: not available for this tape\n");
+    }
+    return 2;
+}
+
+int
+main(int argc, char** argv){
+    checkpoint_verify_t v, other;
+    const char* chunk_dir = ".";
+    const char* path = 0;
+    const char* other_path = 0;
+    long cpu_ct = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t thread_ct = cpu_ct > 0 ? (uint32_t)cpu_ct : 1;
+    int i, ret, other_ret;
+    for(i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-d") == 0 && i + 1 < argc){
+            chunk_dir = argv[++i];
+        }else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc){
+            thread_ct = (uint32_t)strtoul(argv[++i], 0, 0);
+        }else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc){
+            other_path = argv[++i];
+        }else{
+            path = argv[i];
+        }
+    }
+    if(path == 0){
+        fprintf(stderr, "usage: checkpoint_verify [-d chunk_store_dir] [-j thread_ct] "
+            "[-r other_replica_file] file\n");
+        return 1;
+    }
+    if(checkpoint_verify_init(&v, path, chunk_dir) != 0){
+        fprintf(stderr, "checkpoint_verify: could not load %s\n", path);
+        checkpoint_verify_destroy(&v);
+        return 1;
+    }
+    if(other_path == 0){
+        ret = checkpoint_verify_main_one(&v, path, thread_ct, stdout);
+        checkpoint_verify_destroy(&v);
+        return ret < 0 ? 1 : ret;
+    }
+    if(checkpoint_verify_init(&other, other_path, chunk_dir) != 0){
+        fprintf(stderr, "checkpoint_verify: could not load %s\n", other_path);
+        checkpoint_verify_destroy(&other);
+        checkpoint_verify_destroy(&v);
+        return 1;
+    }
+    printf("A: %s\n", path);
+    ret = checkpoint_verify_main_one(&v, path, thread_ct, stdout);
+    printf("B: %s\n", other_path);
+    other_ret = checkpoint_verify_main_one(&other, other_path, thread_ct, stdout);
+    if(ret >= 0 && other_ret >= 0){
+        ret = checkpoint_verify_replicas(&v, &other, stdout);
+        ret = ret < 0 ? 1 : ret == 1 ? 2 : 0;
+    }else{
+        ret = 1;
+    }
+    checkpoint_verify_destroy(&other);
+    checkpoint_verify_destroy(&v);
+    return ret;
+}
+#endif
+
+#endif
@@ -0,0 +1,342 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** content-addressed chunk store **
+// host side, NOT a md part: the backend of the disk device (io_device_disk_md.h).
+// A chunk is stored once in `<dir>/<hex of its sha256>` no matter how many blocks of how many
+// cells refer to it. A direct-mapped cache keeps the recently used chunks in memory, and a
+// worker thread loads the prefetch hints of the device into the cache in the background.
+//
+// The store never decides anything the guest could observe: the content of a chunk is fixed
+// by its name, a cache miss only costs a synchronous read. What is read from a file or got
+// through `missing_cb` is hashed and compared with the name before it is cached or returned,
+// a truncated or corrupted chunk counts as a missing one.
+//
+// the block map deltas are appended to `delta_logp` as records of
+// (u32 block no little-endian, 32 bytes hash), for the checkpoint and the state transfer.
+
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<unistd.h>
+#include "../io_device/io_device_disk_md.h"
+
+#define CHUNK_STORE_PATH_MAX        512
+#define CHUNK_STORE_PREFETCH_Q_LEN  1024    // power of 2
+
+typedef struct {
+    io_device_disk_hash_t hash;
+    uint8_t valid_flag;
+    uint8_t data[IO_DEVICE_DISK_BLOCK_SIZE];
+} chunk_store_cache_slot_t;
+
+typedef struct {
+    char dir[CHUNK_STORE_PATH_MAX];
+    chunk_store_cache_slot_t* slots;
+    uint32_t slot_ct;               // power of 2
+    FILE* delta_logp;               // could be NULL
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    io_device_disk_hash_t prefetch_q[CHUNK_STORE_PREFETCH_Q_LEN];
+    uint32_t prefetch_q_head;
+    uint32_t prefetch_q_ct;
+    uint8_t stop_flag;
+    pthread_t worker;
+    uint8_t* prefetch_buf;          // the worker's
+
+    // a chunk missing from the local store, fetch it from somewhere else into dst
+    // ret int: 0 if success | -1 if failed, then the device gets the error
+    int (*missing_cb)(void* cb_arg, const io_device_disk_hash_t* hashp, uint8_t* dst);
+    void* missing_cb_arg;
+
+    uint64_t hit_ct;
+    uint64_t miss_ct;
+    uint64_t prefetch_load_ct;
+    uint64_t bad_chunk_ct;          // read or got with another hash than its name
+
+    io_device_disk_backend_t backend;   // handed to the disk device
+} chunk_store_t;
+
+void
+chunk_store_path(chunk_store_t* csp, const io_device_disk_hash_t* hashp, char* path){
+    static const char hex[] = "0123456789abcdef";
+    size_t len = strlen(csp->dir);
+    uint8_t i;
+    memcpy(path, csp->dir, len);
+    path[len++] = '/';
+    for(i = 0; i < SHA256_DIGEST_SIZE; i++){
+        path[len++] = hex[hashp->u8[i] >> 4];
+        path[len++] = hex[hashp->u8[i] & 0x0f];
+    }
+    path[len] = 0;
+}
+
+chunk_store_cache_slot_t*
+chunk_store_slot(chunk_store_t* csp, const io_device_disk_hash_t* hashp){
+    uint32_t idx = ((uint32_t)hashp->u8[0]) | (((uint32_t)hashp->u8[1]) << 8) |
+        (((uint32_t)hashp->u8[2]) << 16) | (((uint32_t)hashp->u8[3]) << 24);
+    return &csp->slots[idx & (csp->slot_ct - 1)];
+}
+
+// ret int: 0 if the chunk is cached and copied to dst | -1 if not
+// lock held
+int
+chunk_store_cache_get_locked(chunk_store_t* csp, const io_device_disk_hash_t* hashp, uint8_t* dst){
+    chunk_store_cache_slot_t* slotp = chunk_store_slot(csp, hashp);
+    if(!slotp->valid_flag || memcmp(&slotp->hash, hashp, sizeof(*hashp)) != 0){
+        return -1;
+    }
+    if(dst){
+        memcpy(dst, slotp->data, IO_DEVICE_DISK_BLOCK_SIZE);
+    }
+    return 0;
+}
+
+// lock held
+void
+chunk_store_cache_put_locked(chunk_store_t* csp, const io_device_disk_hash_t* hashp,
+    const uint8_t* src){
+
+    chunk_store_cache_slot_t* slotp = chunk_store_slot(csp, hashp);
+    slotp->hash = *hashp;
+    memcpy(slotp->data, src, IO_DEVICE_DISK_BLOCK_SIZE);
+    slotp->valid_flag = 1;
+}
+
+// ret int: 0 if the content of data has the hash | -1 if not
+int
+chunk_store_check(chunk_store_t* csp, const io_device_disk_hash_t* hashp, const uint8_t* data){
+    io_device_disk_hash_t hash;
+    sha256(data, IO_DEVICE_DISK_BLOCK_SIZE, hash.u8);
+    if(memcmp(&hash, hashp, sizeof(hash)) != 0){
+        __atomic_add_fetch(&csp->bad_chunk_ct, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+// ret int: 0 if success | -1 if the chunk is not in the local store or is corrupted
+int
+chunk_store_load_file(chunk_store_t* csp, const io_device_disk_hash_t* hashp, uint8_t* dst){
+    char path[CHUNK_STORE_PATH_MAX + 2 * SHA256_DIGEST_SIZE + 2];
+    FILE* fp;
+    size_t n;
+    chunk_store_path(csp, hashp, path);
+    fp = fopen(path, "rb");
+    if(fp == NULL){
+        return -1;
+    }
+    n = fread(dst, 1, IO_DEVICE_DISK_BLOCK_SIZE, fp);
+    fclose(fp);
+    if(n != IO_DEVICE_DISK_BLOCK_SIZE){
+        return -1;
+    }
+    return chunk_store_check(csp, hashp, dst);
+}
+
+void*
+chunk_store_prefetch_worker(void* arg){
+    chunk_store_t* csp = (chunk_store_t*)arg;
+    io_device_disk_hash_t hash;
+    uint8_t* buf = csp->prefetch_buf;
+    pthread_mutex_lock(&csp->lock);
+    for(;;){
+        while(csp->prefetch_q_ct == 0 && !csp->stop_flag){
+            pthread_cond_wait(&csp->cond, &csp->lock);
+        }
+        if(csp->stop_flag){
+            break;
+        }
+        hash = csp->prefetch_q[csp->prefetch_q_head];
+        csp->prefetch_q_head = (csp->prefetch_q_head + 1) & (CHUNK_STORE_PREFETCH_Q_LEN - 1);
+        csp->prefetch_q_ct--;
+        if(chunk_store_cache_get_locked(csp, &hash, NULL) == 0){
+            continue;
+        }
+        pthread_mutex_unlock(&csp->lock);
+        if(chunk_store_load_file(csp, &hash, buf) == 0){
+            pthread_mutex_lock(&csp->lock);
+            chunk_store_cache_put_locked(csp, &hash, buf);
+            csp->prefetch_load_ct++;
+        }else{
+            pthread_mutex_lock(&csp->lock);
+        }
+    }
+    pthread_mutex_unlock(&csp->lock);
+    return NULL;
+}
+
+// io_device_disk_backend_t.chunk_get
+int
+chunk_store_chunk_get(void* ctx, const io_device_disk_hash_t* hashp, uint8_t* dst){
+    chunk_store_t* csp = (chunk_store_t*)ctx;
+    pthread_mutex_lock(&csp->lock);
+    if(chunk_store_cache_get_locked(csp, hashp, dst) == 0){
+        csp->hit_ct++;
+        pthread_mutex_unlock(&csp->lock);
+        return 0;
+    }
+    csp->miss_ct++;
+    pthread_mutex_unlock(&csp->lock);
+    if(chunk_store_load_file(csp, hashp, dst) != 0){
+        if(csp->missing_cb == NULL || csp->missing_cb(csp->missing_cb_arg, hashp, dst) != 0 ||
+            chunk_store_check(csp, hashp, dst) != 0){
+            fprintf(stderr, "chunk_store: chunk missing\n");
+            return -1;
+        }
+    }
+    pthread_mutex_lock(&csp->lock);
+    chunk_store_cache_put_locked(csp, hashp, dst);
+    pthread_mutex_unlock(&csp->lock);
+    return 0;
+}
+
+// io_device_disk_backend_t.chunk_put
+// the file is written under a temporary name unique to this writer and renamed, so a chunk
+// file is either complete or absent. Cells putting the same chunk at the same time each
+// write their own temporary file, the rename losing to an identical chunk is a dedup.
+// The chunk stays cached even if it could not be written
+int
+chunk_store_chunk_put(void* ctx, const io_device_disk_hash_t* hashp, const uint8_t* src){
+    chunk_store_t* csp = (chunk_store_t*)ctx;
+    char path[CHUNK_STORE_PATH_MAX + 2 * SHA256_DIGEST_SIZE + 2];
+    char tmp_path[sizeof(path) + 8];
+    FILE* fp;
+    ssize_t n;
+    uint32_t done = 0;
+    int fd;
+    pthread_mutex_lock(&csp->lock);
+    chunk_store_cache_put_locked(csp, hashp, src);
+    pthread_mutex_unlock(&csp->lock);
+    chunk_store_path(csp, hashp, path);
+    fp = fopen(path, "rb");
+    if(fp){ // dedup
+        fclose(fp);
+        return 0;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    fd = mkstemp(tmp_path);
+    if(fd < 0){
+        fprintf(stderr, "chunk_store: write %s failed\n", path);
+        return -1;
+    }
+    while(done < IO_DEVICE_DISK_BLOCK_SIZE){
+        n = write(fd, src + done, IO_DEVICE_DISK_BLOCK_SIZE - done);
+        if(n <= 0){
+            break;
+        }
+        done += (uint32_t)n;
+    }
+    if(close(fd) != 0 || done != IO_DEVICE_DISK_BLOCK_SIZE){
+        unlink(tmp_path);
+        fprintf(stderr, "chunk_store: write %s failed\n", path);
+        return -1;
+    }
+    if(rename(tmp_path, path) != 0){
+        unlink(tmp_path);
+        fp = fopen(path, "rb");
+        if(fp == NULL){
+            fprintf(stderr, "chunk_store: write %s failed\n", path);
+            return -1;
+        }
+        fclose(fp); // put by another writer meanwhile, same name hence same content
+    }
+    return 0;
+}
+
+// io_device_disk_backend_t.chunk_prefetch
+// a full queue drops the hint
+void
+chunk_store_chunk_prefetch(void* ctx, const io_device_disk_hash_t* hashp){
+    chunk_store_t* csp = (chunk_store_t*)ctx;
+    pthread_mutex_lock(&csp->lock);
+    if(csp->prefetch_q_ct < CHUNK_STORE_PREFETCH_Q_LEN &&
+        chunk_store_cache_get_locked(csp, hashp, NULL) != 0){
+        csp->prefetch_q[(csp->prefetch_q_head + csp->prefetch_q_ct) &
+            (CHUNK_STORE_PREFETCH_Q_LEN - 1)] = *hashp;
+        csp->prefetch_q_ct++;
+        pthread_cond_signal(&csp->cond);
+    }
+    pthread_mutex_unlock(&csp->lock);
+}
+
+// io_device_disk_backend_t.block_map_delta
+void
+chunk_store_block_map_delta(void* ctx, uint32_t block_no, const io_device_disk_hash_t* hashp){
+    chunk_store_t* csp = (chunk_store_t*)ctx;
+    uint8_t rec[4 + SHA256_DIGEST_SIZE];
+    if(csp->delta_logp == NULL){
+        return;
+    }
+    rec[0] = (uint8_t)block_no;
+    rec[1] = (uint8_t)(block_no >> 8);
+    rec[2] = (uint8_t)(block_no >> 16);
+    rec[3] = (uint8_t)(block_no >> 24);
+    memcpy(rec + 4, hashp->u8, SHA256_DIGEST_SIZE);
+    fwrite(rec, 1, sizeof(rec), csp->delta_logp);
+}
+
+// dir must exist, cache_slot_ct is a power of 2
+// ret int: 0 if success | -1 if failed
+int
+chunk_store_init(chunk_store_t* csp, const char* dir, uint32_t cache_slot_ct, FILE* delta_logp){
+    if(strlen(dir) >= CHUNK_STORE_PATH_MAX){
+        return -1;
+    }
+    memset(csp, 0, sizeof(*csp));
+    strcpy(csp->dir, dir);
+    csp->slot_ct = cache_slot_ct;
+    csp->slots = calloc(cache_slot_ct, sizeof(chunk_store_cache_slot_t));
+    csp->prefetch_buf = malloc(IO_DEVICE_DISK_BLOCK_SIZE);
+    if(csp->slots == NULL || csp->prefetch_buf == NULL){
+        free(csp->slots);
+        free(csp->prefetch_buf);
+        return -1;
+    }
+    csp->delta_logp = delta_logp;
+    pthread_mutex_init(&csp->lock, NULL);
+    pthread_cond_init(&csp->cond, NULL);
+    csp->backend.chunk_get = chunk_store_chunk_get;
+    csp->backend.chunk_put = chunk_store_chunk_put;
+    csp->backend.chunk_prefetch = chunk_store_chunk_prefetch;
+    csp->backend.block_map_delta = chunk_store_block_map_delta;
+    csp->backend.ctx = csp;
+    if(pthread_create(&csp->worker, NULL, chunk_store_prefetch_worker, csp) != 0){
+        free(csp->slots);
+        free(csp->prefetch_buf);
+        return -1;
+    }
+    return 0;
+}
+
+void
+chunk_store_destroy(chunk_store_t* csp){
+    pthread_mutex_lock(&csp->lock);
+    csp->stop_flag = 1;
+    pthread_cond_signal(&csp->cond);
+    pthread_mutex_unlock(&csp->lock);
+    pthread_join(csp->worker, NULL);
+    pthread_mutex_destroy(&csp->lock);
+    pthread_cond_destroy(&csp->cond);
+    free(csp->slots);
+    free(csp->prefetch_buf);
+}
+
+#endif
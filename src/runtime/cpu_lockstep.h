@@ -0,0 +1,774 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** differential lockstep of the cpu **
+// host side, NOT a md part: two computers run the same tape side by side, the fast one as it
+// is built and the reference one whose cpu has its reference_flag set (no predecode cache,
+// no idle loop fast forward, the generic dp). Both have to end every step of
+// CPU_LOCKSTEP_STEP_INST_CT insts in the same state:
+//  - R, cpsr, spsr, the VFP registers, the inst counter and the wait for interrupt flag of
+//    the cpu
+//  - the deadline of the next device event and the amount of bytes sent by the uart
+//  - every RAM page written by either side during the step
+// the uart tx ring and the whole RAM are compared at the end of every mdf.
+//
+// the RAM of both sides is write protected between two steps, the fault_cb records the
+// pages written during the step and saves the original of a page at its first write since
+// the latest checkpoint. On the first difference both sides are rewound to that checkpoint,
+// which only copies back the saved pages, and run again with a growing inst budget until
+// the first inst whose result differs is found.
+//
+// the reference is NOT an independent model of the ARM architecture: both sides run the very
+// same inst handlers, only the shortcuts the fast path takes around them differ. So the
+// lockstep checks the predecode cache and its invalidation, the idle loop fast forward and
+// the specialized dp against the plain dispatch, and nothing else. A wrong handler is wrong
+// on both sides alike and passes, it needs an ARM reference model.
+//
+// only one vCPU. `cpu_lockstep_fuzz_case` drives the lockstep with random inst streams,
+// build the fuzzer with CPU_LOCKSTEP_MAIN defined after including turingcell_computer_md.c,
+// `make check` builds and runs it:
+//     cpu_lockstep [-s first_seed] [-c case_ct] [-n insts_per_case]
+// a failing case is reproduced by its seed alone.
+
+#ifndef CPU_LOCKSTEP_H
+#define CPU_LOCKSTEP_H
+
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#define CPU_LOCKSTEP_STEP_INST_CT       ((uint64_t)64)
+#define CPU_LOCKSTEP_CHECKPOINT_STEP_CT 64      // steps between two checkpoints at most
+#define CPU_LOCKSTEP_UNDO_PAGE_CT       1024    // per side
+#define CPU_LOCKSTEP_DIRTY_PAGE_CT      256     // per side per step, full compare beyond
+#define CPU_LOCKSTEP_PADDR_NONE         ((uint32_t)0xffffffff)
+
+// where the first difference has been seen
+#define CPU_LOCKSTEP_WHERE_NONE         0
+#define CPU_LOCKSTEP_WHERE_PRE          1   // pre_cpu_exec_phase
+#define CPU_LOCKSTEP_WHERE_INST         2   // located to one inst
+#define CPU_LOCKSTEP_WHERE_STEP         3   // only located to one step, see the report
+#define CPU_LOCKSTEP_WHERE_POST         4   // post_cpu_exec_phase
+#define CPU_LOCKSTEP_WHERE_IO           5   // io entry of the tape
+
+typedef struct {
+    uint32_t R[31];
+    uint32_t cpsr;
+    uint32_t spsr[6];
+    uint32_t vfp_S[32];
+    uint32_t vfp_fpscr;
+    uint32_t vfp_fpexc;
+    uint32_t wait_for_interrupt_flag;
+    uint64_t inst_executed_ct_total;
+    uint64_t event_deadline;
+    uint64_t uart_tx_ct;
+} cpu_lockstep_state_t;
+
+typedef struct {
+    uint8_t where;
+    uint64_t tape_idx;
+    uint64_t inst_ct;               // inst counter in front of the differing inst or step
+    uint32_t PC;                    // of the differing inst, CPU_LOCKSTEP_WHERE_INST only
+    uint32_t inst;
+    cpu_lockstep_state_t fast;      // right after it
+    cpu_lockstep_state_t ref;
+    uint32_t ram_diff_paddr;        // first differing byte | CPU_LOCKSTEP_PADDR_NONE
+    uint8_t uart_diff_flag;         // the tx rings differ
+} cpu_lockstep_report_t;
+
+typedef struct {
+    turingcell_computer_t* cp;
+    uint32_t uart_tx_ring_size;     // header and data
+
+    // checkpoint
+    turingcell_computer_t* saved_cp;
+    io_device_uart_tx_ring_t* saved_uart_txp;
+    uint8_t* undo_hostp;            // CPU_LOCKSTEP_UNDO_PAGE_CT pages
+    uint32_t undo_pfns[CPU_LOCKSTEP_UNDO_PAGE_CT];
+    uint32_t undo_ct;
+    uint8_t undo_overflow_flag;     // a page could not be saved, the checkpoint is lost
+    uint32_t* undo_bits;            // bit i for page frame number i, set if saved
+
+    // pages written during the current step, writable until the step is compared
+    uint32_t dirty_pfns[CPU_LOCKSTEP_DIRTY_PAGE_CT];
+    uint32_t dirty_ct;
+    uint8_t dirty_overflow_flag;
+} cpu_lockstep_side_t;
+
+typedef struct {
+    cpu_lockstep_side_t fast;
+    cpu_lockstep_side_t ref;
+    uint32_t ram_size;
+    uint64_t checkpoint_offset;     // inst offset of the checkpoint inside the current mdf
+} cpu_lockstep_t;
+
+// ** sides **
+
+uint8_t
+cpu_lockstep_fault_cb(void* cb_arg, phys_mem_page_t* pagep, uint32_t paddr){
+    cpu_lockstep_side_t* sp = (cpu_lockstep_side_t*)cb_arg;
+    uint32_t pfn = paddr >> PHYS_MEM_PAGE_SHIFT;
+    if(pagep->ram_hostp == 0){
+        return 0;
+    }
+    if(((sp->undo_bits[pfn >> 5] >> (pfn & 31)) & 1) == 0){
+        if(sp->undo_ct == CPU_LOCKSTEP_UNDO_PAGE_CT){
+            sp->undo_overflow_flag = 1;
+        }else{
+            memcpy(sp->undo_hostp + (sp->undo_ct << PHYS_MEM_PAGE_SHIFT), pagep->ram_hostp,
+                PHYS_MEM_PAGE_SIZE);
+            sp->undo_pfns[sp->undo_ct] = pfn;
+            sp->undo_ct++;
+            sp->undo_bits[pfn >> 5] |= ((uint32_t)1) << (pfn & 31);
+        }
+    }
+    if(sp->dirty_ct == CPU_LOCKSTEP_DIRTY_PAGE_CT){
+        sp->dirty_overflow_flag = 1;
+    }else{
+        sp->dirty_pfns[sp->dirty_ct] = pfn;
+        sp->dirty_ct++;
+    }
+    pagep->ram_write_hostp = pagep->ram_hostp;
+    return 1;
+}
+
+// ret int: 0 if success | -1 if failed
+int
+cpu_lockstep_side_init(cpu_lockstep_side_t* sp, uint32_t ram_size, uint32_t uart_tx_size){
+    sp->cp = 0;
+    sp->uart_tx_ring_size = sizeof(io_device_uart_tx_ring_t) + uart_tx_size;
+    sp->saved_cp = (turingcell_computer_t*)malloc(sizeof(turingcell_computer_t));
+    sp->saved_uart_txp = (io_device_uart_tx_ring_t*)malloc(sp->uart_tx_ring_size);
+    sp->undo_hostp = (uint8_t*)malloc(CPU_LOCKSTEP_UNDO_PAGE_CT << PHYS_MEM_PAGE_SHIFT);
+    sp->undo_bits = (uint32_t*)calloc(((ram_size >> PHYS_MEM_PAGE_SHIFT) + 31) >> 5,
+        sizeof(uint32_t));
+    sp->undo_ct = 0;
+    sp->undo_overflow_flag = 0;
+    sp->dirty_ct = 0;
+    sp->dirty_overflow_flag = 0;
+    if(!sp->saved_cp || !sp->saved_uart_txp || !sp->undo_hostp || !sp->undo_bits){
+        return -1;
+    }
+    return 0;
+}
+
+void
+cpu_lockstep_side_destroy(cpu_lockstep_side_t* sp){
+    free(sp->saved_cp);
+    free(sp->saved_uart_txp);
+    free(sp->undo_hostp);
+    free(sp->undo_bits);
+}
+
+// always_inline
+inline void
+cpu_lockstep_side_protect_all(cpu_lockstep_side_t* sp){
+    uint32_t pfn;
+    for(pfn = 0; pfn < (sp->cp->ram_size >> PHYS_MEM_PAGE_SHIFT); pfn++){
+        sp->cp->pmmp->pages[pfn].ram_write_hostp = 0;
+    }
+}
+
+// the step has been compared, its pages are write protected again
+// always_inline
+inline void
+cpu_lockstep_side_end_step(cpu_lockstep_side_t* sp){
+    uint32_t k;
+    if_unlikely(sp->dirty_overflow_flag){
+        cpu_lockstep_side_protect_all(sp);
+    }else{
+        for(k = 0; k < sp->dirty_ct; k++){
+            sp->cp->pmmp->pages[sp->dirty_pfns[k]].ram_write_hostp = 0;
+        }
+    }
+    sp->dirty_ct = 0;
+    sp->dirty_overflow_flag = 0;
+}
+
+// at a step boundary only
+// always_inline
+inline void
+cpu_lockstep_side_checkpoint(cpu_lockstep_side_t* sp){
+    uint32_t k, pfn;
+    for(k = 0; k < sp->undo_ct; k++){
+        pfn = sp->undo_pfns[k];
+        sp->undo_bits[pfn >> 5] &= ~(((uint32_t)1) << (pfn & 31));
+    }
+    sp->undo_ct = 0;
+    sp->undo_overflow_flag = 0;
+    memcpy(sp->saved_cp, sp->cp, sizeof(turingcell_computer_t));
+    memcpy(sp->saved_uart_txp, sp->cp->uart.txp, sp->uart_tx_ring_size);
+}
+
+// back to the latest checkpoint, which stays valid
+// always_inline
+inline void
+cpu_lockstep_side_restore(cpu_lockstep_side_t* sp){
+    uint32_t k, pfn;
+    for(k = 0; k < sp->undo_ct; k++){
+        pfn = sp->undo_pfns[k];
+        memcpy(sp->cp->pmmp->pages[pfn].ram_hostp,
+            sp->undo_hostp + (k << PHYS_MEM_PAGE_SHIFT), PHYS_MEM_PAGE_SIZE);
+        sp->cp->pmmp->pages[pfn].ram_write_hostp = 0;
+        sp->undo_bits[pfn >> 5] &= ~(((uint32_t)1) << (pfn & 31));
+    }
+    sp->undo_ct = 0;
+    cpu_lockstep_side_end_step(sp);
+    memcpy(sp->cp, sp->saved_cp, sizeof(turingcell_computer_t));
+    memcpy(sp->cp->uart.txp, sp->saved_uart_txp, sp->uart_tx_ring_size);
+    armv4cpu_code_cache_flush(&sp->cp->cpu); // the restored pages bypassed the code_write_cb
+}
+
+// always_inline
+inline void
+cpu_lockstep_side_capture(cpu_lockstep_side_t* sp, cpu_lockstep_state_t* statep){
+    armv4cpu_md_t* cpup = &sp->cp->cpu;
+    memset(statep, 0, sizeof(cpu_lockstep_state_t));
+    memcpy(statep->R, cpup->R, sizeof(cpup->R));
+    statep->cpsr = cpup->cpsr;
+    memcpy(statep->spsr, cpup->spsr, sizeof(cpup->spsr));
+    memcpy(statep->vfp_S, cpup->vfp_S, sizeof(cpup->vfp_S));
+    statep->vfp_fpscr = cpup->vfp_fpscr;
+    statep->vfp_fpexc = cpup->vfp_fpexc;
+    statep->wait_for_interrupt_flag = cpup->wait_for_interrupt_flag;
+    statep->inst_executed_ct_total = cpup->inst_executed_ct_total;
+    statep->event_deadline = io_event_queue_peek_deadline(&sp->cp->event_queue);
+    statep->uart_tx_ct = sp->cp->uart.tx_ct;
+}
+
+// ** lockstep **
+
+// ret int: 0 if success | -1 if failed
+int
+cpu_lockstep_init(cpu_lockstep_t* lsp, uint32_t ram_size, uint32_t uart_tx_size){
+    lsp->ram_size = ram_size;
+    lsp->checkpoint_offset = 0;
+    if(cpu_lockstep_side_init(&lsp->fast, ram_size, uart_tx_size) != 0 ||
+        cpu_lockstep_side_init(&lsp->ref, ram_size, uart_tx_size) != 0){
+        return -1;
+    }
+    return 0;
+}
+
+void
+cpu_lockstep_destroy(cpu_lockstep_t* lsp){
+    cpu_lockstep_side_destroy(&lsp->fast);
+    cpu_lockstep_side_destroy(&lsp->ref);
+}
+
+// both computers are initialized and hold the same state, RAM at TURINGCELL_COMPUTER_PADDR_RAM
+// ret int: 0 if success | -1 if they could not run in lockstep
+int
+cpu_lockstep_attach(cpu_lockstep_t* lsp, turingcell_computer_t* fast_cp,
+    turingcell_computer_t* ref_cp){
+
+    cpu_lockstep_side_t* sides[2] = {&lsp->fast, &lsp->ref};
+    turingcell_computer_t* cps[2] = {fast_cp, ref_cp};
+    uint8_t i;
+    for(i = 0; i < 2; i++){
+        if(cps[i]->vcpu_ct != 1 || cps[i]->ram_size != lsp->ram_size ||
+            sizeof(io_device_uart_tx_ring_t) + cps[i]->uart.txp->data_size !=
+                sides[i]->uart_tx_ring_size){
+            return -1;
+        }
+    }
+    for(i = 0; i < 2; i++){
+        sides[i]->cp = cps[i];
+        sides[i]->undo_ct = 0;
+        sides[i]->undo_overflow_flag = 0;
+        memset(sides[i]->undo_bits, 0,
+            (((lsp->ram_size >> PHYS_MEM_PAGE_SHIFT) + 31) >> 5) * sizeof(uint32_t));
+        sides[i]->dirty_ct = 0;
+        sides[i]->dirty_overflow_flag = 0;
+        cps[i]->pmmp->fault_cb = cpu_lockstep_fault_cb;
+        cps[i]->pmmp->fault_cb_arg = sides[i];
+        cpu_lockstep_side_protect_all(sides[i]);
+    }
+    ref_cp->cpu.reference_flag = 1;
+    return 0;
+}
+
+// ret u32: paddr of the first byte of the page which differs | CPU_LOCKSTEP_PADDR_NONE
+// always_inline
+inline uint32_t
+cpu_lockstep_page_diff(cpu_lockstep_t* lsp, uint32_t pfn){
+    uint8_t* a = lsp->fast.cp->pmmp->pages[pfn].ram_hostp;
+    uint8_t* b = lsp->ref.cp->pmmp->pages[pfn].ram_hostp;
+    uint32_t i;
+    if_likely(memcmp(a, b, PHYS_MEM_PAGE_SIZE) == 0){
+        return CPU_LOCKSTEP_PADDR_NONE;
+    }
+    for(i = 0; a[i] == b[i]; i++){
+    }
+    return (pfn << PHYS_MEM_PAGE_SHIFT) + i;
+}
+
+// compare the state and the pages written during the step, or the whole RAM
+// ret u8: 0 if the sides agree | 1 if not, the state of both is in the report
+uint8_t
+cpu_lockstep_compare(cpu_lockstep_t* lsp, uint8_t full_flag, cpu_lockstep_report_t* rp){
+    cpu_lockstep_side_t* sides[2] = {&lsp->fast, &lsp->ref};
+    uint32_t pfn, k, paddr = CPU_LOCKSTEP_PADDR_NONE;
+    uint8_t i;
+    cpu_lockstep_side_capture(&lsp->fast, &rp->fast);
+    cpu_lockstep_side_capture(&lsp->ref, &rp->ref);
+    if(lsp->fast.dirty_overflow_flag || lsp->ref.dirty_overflow_flag){
+        full_flag = 1;
+    }
+    if(full_flag){
+        for(pfn = 0; pfn < (lsp->ram_size >> PHYS_MEM_PAGE_SHIFT); pfn++){
+            paddr = cpu_lockstep_page_diff(lsp, pfn);
+            if(paddr != CPU_LOCKSTEP_PADDR_NONE){
+                break;
+            }
+        }
+    }else{
+        for(i = 0; i < 2 && paddr == CPU_LOCKSTEP_PADDR_NONE; i++){
+            for(k = 0; k < sides[i]->dirty_ct; k++){
+                paddr = cpu_lockstep_page_diff(lsp, sides[i]->dirty_pfns[k]);
+                if(paddr != CPU_LOCKSTEP_PADDR_NONE){
+                    break;
+                }
+            }
+        }
+    }
+    rp->ram_diff_paddr = paddr;
+    rp->uart_diff_flag = 0;
+    if(full_flag){
+        rp->uart_diff_flag = memcmp(lsp->fast.cp->uart.txp, lsp->ref.cp->uart.txp,
+            lsp->fast.uart_tx_ring_size) != 0;
+    }
+    return memcmp(&rp->fast, &rp->ref, sizeof(cpu_lockstep_state_t)) != 0 ||
+        paddr != CPU_LOCKSTEP_PADDR_NONE || rp->uart_diff_flag;
+}
+
+// always_inline
+inline void
+cpu_lockstep_end_step(cpu_lockstep_t* lsp){
+    cpu_lockstep_side_end_step(&lsp->fast);
+    cpu_lockstep_side_end_step(&lsp->ref);
+}
+
+// always_inline
+inline void
+cpu_lockstep_checkpoint(cpu_lockstep_t* lsp, uint64_t offset){
+    cpu_lockstep_side_checkpoint(&lsp->fast);
+    cpu_lockstep_side_checkpoint(&lsp->ref);
+    lsp->checkpoint_offset = offset;
+}
+
+// always_inline
+inline void
+cpu_lockstep_restore(cpu_lockstep_t* lsp){
+    cpu_lockstep_side_restore(&lsp->fast);
+    cpu_lockstep_side_restore(&lsp->ref);
+}
+
+// always_inline
+inline void
+cpu_lockstep_exec(cpu_lockstep_t* lsp, uint64_t inst_amount){
+    turingcell_computer_cpu_exec_phase(lsp->fast.cp, inst_amount);
+    turingcell_computer_cpu_exec_phase(lsp->ref.cp, inst_amount);
+}
+
+// the step at inst offset step_offset of the mdf differs, find its first differing inst
+void
+cpu_lockstep_locate(cpu_lockstep_t* lsp, uint64_t step_offset, uint64_t step_inst_ct,
+    cpu_lockstep_report_t* rp){
+
+    cpu_lockstep_report_t r;
+    uint64_t offset, step, b;
+    uint8_t* hostp;
+    rp->where = CPU_LOCKSTEP_WHERE_STEP;
+    rp->inst_ct = lsp->ref.cp->cpu.inst_executed_ct_total - step_inst_ct;
+    if(lsp->fast.undo_overflow_flag || lsp->ref.undo_overflow_flag){
+        return;
+    }
+    // replay up to the step, the very same steps as before
+    cpu_lockstep_restore(lsp);
+    for(offset = lsp->checkpoint_offset; offset < step_offset; offset += step){
+        step = step_offset - offset;
+        if(step > CPU_LOCKSTEP_STEP_INST_CT){
+            step = CPU_LOCKSTEP_STEP_INST_CT;
+        }
+        cpu_lockstep_exec(lsp, step);
+        cpu_lockstep_end_step(lsp);
+    }
+    if(lsp->fast.undo_overflow_flag || lsp->ref.undo_overflow_flag){
+        return;
+    }
+    cpu_lockstep_checkpoint(lsp, step_offset);
+    // b insts in one go, so an idle loop across the insts is fast forwarded as it was
+    for(b = 1; b <= step_inst_ct; b++){
+        cpu_lockstep_restore(lsp);
+        cpu_lockstep_exec(lsp, b);
+        if(!cpu_lockstep_compare(lsp, 0, &r)){
+            continue;
+        }
+        cpu_lockstep_restore(lsp);
+        cpu_lockstep_exec(lsp, b - 1);
+        cpu_lockstep_end_step(lsp);
+        r.where = CPU_LOCKSTEP_WHERE_INST;
+        r.tape_idx = rp->tape_idx;
+        r.inst_ct = lsp->ref.cp->cpu.inst_executed_ct_total;
+        r.PC = lsp->ref.cp->cpu.R[REGIDX_PC];
+        hostp = phys_mem_map_ram_hostp(lsp->ref.cp->pmmp, r.PC & ~(uint32_t)3);
+        r.inst = hostp ? phys_mem_load_le32(hostp) : 0;
+        *rp = r;
+        return;
+    }
+}
+
+// one mdf on both sides
+// ret u8: 0 if the sides agree | 1 if not, see the report
+uint8_t
+cpu_lockstep_mdf_exec(cpu_lockstep_t* lsp, uint64_t tape_idx, uint64_t inst_amount,
+    cpu_lockstep_report_t* rp){
+
+    uint64_t offset, step;
+    uint32_t step_ct = 0;
+    rp->where = CPU_LOCKSTEP_WHERE_NONE;
+    rp->tape_idx = tape_idx;
+    lsp->fast.cp->applied_tape_idx = tape_idx;
+    lsp->ref.cp->applied_tape_idx = tape_idx;
+    turingcell_computer_pre_cpu_exec_phase(lsp->fast.cp);
+    turingcell_computer_pre_cpu_exec_phase(lsp->ref.cp);
+    if(cpu_lockstep_compare(lsp, 0, rp)){
+        rp->where = CPU_LOCKSTEP_WHERE_PRE;
+        rp->inst_ct = rp->ref.inst_executed_ct_total;
+        return 1;
+    }
+    cpu_lockstep_end_step(lsp);
+    cpu_lockstep_checkpoint(lsp, 0);
+    for(offset = 0; offset < inst_amount; offset += step){
+        step = inst_amount - offset;
+        if(step > CPU_LOCKSTEP_STEP_INST_CT){
+            step = CPU_LOCKSTEP_STEP_INST_CT;
+        }
+        cpu_lockstep_exec(lsp, step);
+        if_unlikely(cpu_lockstep_compare(lsp, 0, rp)){
+            cpu_lockstep_locate(lsp, offset, step, rp);
+            return 1;
+        }
+        cpu_lockstep_end_step(lsp);
+        step_ct++;
+        if(step_ct == CPU_LOCKSTEP_CHECKPOINT_STEP_CT ||
+            lsp->fast.undo_ct + CPU_LOCKSTEP_DIRTY_PAGE_CT > CPU_LOCKSTEP_UNDO_PAGE_CT ||
+            lsp->ref.undo_ct + CPU_LOCKSTEP_DIRTY_PAGE_CT > CPU_LOCKSTEP_UNDO_PAGE_CT){
+            cpu_lockstep_checkpoint(lsp, offset + step);
+            step_ct = 0;
+        }
+    }
+    turingcell_computer_post_cpu_exec_phase(lsp->fast.cp);
+    turingcell_computer_post_cpu_exec_phase(lsp->ref.cp);
+    if(cpu_lockstep_compare(lsp, 1, rp)){
+        rp->where = CPU_LOCKSTEP_WHERE_POST;
+        rp->inst_ct = rp->ref.inst_executed_ct_total;
+        return 1;
+    }
+    cpu_lockstep_end_step(lsp);
+    return 0;
+}
+
+// ret u8: 0 if the sides agree | 1 if not, see the report
+// always_inline
+inline uint8_t
+cpu_lockstep_io_end(cpu_lockstep_t* lsp, uint64_t tape_idx, cpu_lockstep_report_t* rp){
+    rp->tape_idx = tape_idx;
+    if(cpu_lockstep_compare(lsp, 0, rp)){
+        rp->where = CPU_LOCKSTEP_WHERE_IO;
+        rp->inst_ct = rp->ref.inst_executed_ct_total;
+        return 1;
+    }
+    rp->where = CPU_LOCKSTEP_WHERE_NONE;
+    cpu_lockstep_end_step(lsp);
+    return 0;
+}
+
+// ret u8: 0 if the sides agree | 1 if not, see the report
+// the result of `mdf_computer_io_input` is the one of the fast side, the same on both sides
+uint8_t
+cpu_lockstep_io_input(cpu_lockstep_t* lsp, uint64_t tape_idx, uint8_t dev_id,
+    const uint8_t* data, uint32_t len, uint8_t* io_retp, cpu_lockstep_report_t* rp){
+
+    *io_retp = mdf_computer_io_input(lsp->fast.cp, tape_idx, dev_id, data, len);
+    mdf_computer_io_input(lsp->ref.cp, tape_idx, dev_id, data, len);
+    return cpu_lockstep_io_end(lsp, tape_idx, rp);
+}
+
+// ret u8: 0 if the sides agree | 1 if not, see the report
+uint8_t
+cpu_lockstep_io_output(cpu_lockstep_t* lsp, uint64_t tape_idx, uint8_t dev_id,
+    uint64_t offset, uint32_t len, uint8_t* io_retp, cpu_lockstep_report_t* rp){
+
+    *io_retp = mdf_computer_io_output(lsp->fast.cp, tape_idx, dev_id, offset, len);
+    mdf_computer_io_output(lsp->ref.cp, tape_idx, dev_id, offset, len);
+    return cpu_lockstep_io_end(lsp, tape_idx, rp);
+}
+
+void
+cpu_lockstep_report_print(FILE* fp, const cpu_lockstep_report_t* rp){
+    static const char* where_names[] = {"none", "pre_cpu_exec_phase", "inst", "step",
+        "post_cpu_exec_phase", "io"};
+    const cpu_lockstep_state_t* f = &rp->fast;
+    const cpu_lockstep_state_t* r = &rp->ref;
+    uint32_t i;
+    fprintf(fp, "lockstep: differs at %s, tape_idx %llu, inst_ct %llu\n", where_names[rp->where],
+        (unsigned long long)rp->tape_idx, (unsigned long long)rp->inst_ct);
+    if(rp->where == CPU_LOCKSTEP_WHERE_INST){
+        fprintf(fp, "  PC %08x inst %08x\n", rp->PC, rp->inst);
+    }
+    fprintf(fp, "             fast      ref\n");
+    for(i = 0; i < 31; i++){
+        fprintf(fp, "  R[%2u]  %08x %08x%s\n", i, f->R[i], r->R[i], f->R[i] != r->R[i] ? " *" : "");
+    }
+    fprintf(fp, "  cpsr   %08x %08x%s\n", f->cpsr, r->cpsr, f->cpsr != r->cpsr ? " *" : "");
+    for(i = 2; i < 6; i++){
+        fprintf(fp, "  spsr%u  %08x %08x%s\n", i, f->spsr[i], r->spsr[i],
+            f->spsr[i] != r->spsr[i] ? " *" : "");
+    }
+    for(i = 0; i < 32; i++){ // the differing ones only
+        if(f->vfp_S[i] != r->vfp_S[i]){
+            fprintf(fp, "  S[%2u]  %08x %08x *\n", i, f->vfp_S[i], r->vfp_S[i]);
+        }
+    }
+    fprintf(fp, "  fpscr  %08x %08x%s\n", f->vfp_fpscr, r->vfp_fpscr,
+        f->vfp_fpscr != r->vfp_fpscr ? " *" : "");
+    fprintf(fp, "  fpexc  %08x %08x%s\n", f->vfp_fpexc, r->vfp_fpexc,
+        f->vfp_fpexc != r->vfp_fpexc ? " *" : "");
+    fprintf(fp, "  wfi    %8u %8u%s\n", f->wait_for_interrupt_flag, r->wait_for_interrupt_flag,
+        f->wait_for_interrupt_flag != r->wait_for_interrupt_flag ? " *" : "");
+    fprintf(fp, "  inst_ct %llu %llu%s\n", (unsigned long long)f->inst_executed_ct_total,
+        (unsigned long long)r->inst_executed_ct_total,
+        f->inst_executed_ct_total != r->inst_executed_ct_total ? " *" : "");
+    fprintf(fp, "  event_deadline %llu %llu%s\n", (unsigned long long)f->event_deadline,
+        (unsigned long long)r->event_deadline, f->event_deadline != r->event_deadline ? " *" : "");
+    fprintf(fp, "  uart_tx_ct %llu %llu%s\n", (unsigned long long)f->uart_tx_ct,
+        (unsigned long long)r->uart_tx_ct, f->uart_tx_ct != r->uart_tx_ct ? " *" : "");
+    if(rp->ram_diff_paddr != CPU_LOCKSTEP_PADDR_NONE){
+        fprintf(fp, "  RAM differs first at paddr %08x\n", rp->ram_diff_paddr);
+    }
+    if(rp->uart_diff_flag){
+        fprintf(fp, "  uart tx ring differs\n");
+    }
+}
+
+// ** fuzzer **
+// the RAM of a case is filled with random insts: about half dp (including what shares its
+// encoding space: multiplies, extra loads and stores, misc), single and multiple loads and
+// stores, short branches, and fully random words. The registers start mostly inside the
+// RAM. The vectors return to the inst after an undefined inst, a SWI, a data abort or an
+// interrupt, anything else restarts at a RAM address derived from lr, so a case never gets
+// stuck in one exception loop. Every mdf restarts both sides at a random inst too, which
+// bounds the time spent in a loop without exit.
+
+#define CPU_LOCKSTEP_FUZZ_RAM_SIZE      ((uint32_t)0x00010000)
+#define CPU_LOCKSTEP_FUZZ_UART_TX_SIZE  4096
+#define CPU_LOCKSTEP_FUZZ_MDF_INST_CT   ((uint64_t)1024)
+#define CPU_LOCKSTEP_FUZZ_CODE_PADDR    ((uint32_t)0x00000100)
+
+const uint32_t gl_cpu_lockstep_fuzz_vectors[] = {
+    0xea000006,     // 0x00 reset       b restart
+    0xe1b0f00e,     // 0x04 und         movs pc, lr
+    0xe1b0f00e,     // 0x08 swi         movs pc, lr
+    0xea000003,     // 0x0c prefetch    b restart
+    0xe25ef004,     // 0x10 data abort  subs pc, lr, #4
+    0xea000001,     // 0x14             b restart
+    0xe25ef004,     // 0x18 irq         subs pc, lr, #4
+    0xe25ef004,     // 0x1c fiq         subs pc, lr, #4
+    0xe20eccfc,     // 0x20 restart     and r12, lr, #0xfc00
+    0xe28ccc01,     // 0x24             add r12, r12, #CPU_LOCKSTEP_FUZZ_CODE_PADDR
+    0xe1a0f00c,     // 0x28             mov pc, r12
+};
+
+typedef struct {
+    turingcell_computer_t* cps[2];  // fast, ref
+    uint8_t* ram_hostps[2];
+    phys_mem_map_t* pmmps[2];
+    io_device_uart_tx_ring_t* uart_txps[2];
+    io_device_disk_hash_t disk_block_map[1];
+    io_device_disk_backend_t disk_backend;  // no block, never called
+    cpu_lockstep_t ls;
+} cpu_lockstep_fuzz_t;
+
+// xorshift64*
+// always_inline
+inline uint32_t
+cpu_lockstep_fuzz_rand(uint64_t* statep){
+    *statep ^= *statep >> 12;
+    *statep ^= *statep << 25;
+    *statep ^= *statep >> 27;
+    return (uint32_t)((*statep * (uint64_t)0x2545f4914f6cdd1d) >> 32);
+}
+
+// always_inline
+inline uint32_t
+cpu_lockstep_fuzz_inst(uint64_t* statep){
+    uint32_t r = cpu_lockstep_fuzz_rand(statep);
+    uint32_t s = cpu_lockstep_fuzz_rand(statep);
+    uint32_t cond = (s & 1) ? (uint32_t)0xe : (s >> 28);
+    uint32_t sel = (s >> 1) % 100;
+    int32_t offset;
+    if(sel < 50){       // dp, Rd of TST TEQ CMP CMN is SBZ, 15 would stall in USR and SYS mode
+        if((r & (uint32_t)0x01900000) == (uint32_t)0x01100000){
+            r &= ~(uint32_t)0x0000f000;
+        }
+        return (cond << 28) | (r & (uint32_t)0x03ffffff);
+    }
+    if(sel < 65){       // LDR STR LDRB STRB
+        return (cond << 28) | ((uint32_t)1 << 26) | (r & (uint32_t)0x03ffffff);
+    }
+    if(sel < 75){       // LDM STM
+        return (cond << 28) | ((uint32_t)4 << 25) | (r & (uint32_t)0x01ffffff);
+    }
+    if(sel < 85){       // B BL, at most 16 insts away, backwards only if conditional
+        offset = cond == (uint32_t)0xe ? (int32_t)((s >> 8) % 16) + 1 :
+            (int32_t)((s >> 8) % 33) - 16;
+        return (cond << 28) | ((uint32_t)5 << 25) | (r & ((uint32_t)1 << 24)) |
+            ((uint32_t)offset & (uint32_t)0x00ffffff);
+    }
+    return r;
+}
+
+// ret int: 0 if success | -1 if failed
+int
+cpu_lockstep_fuzz_init(cpu_lockstep_fuzz_t* fp){
+    uint8_t i;
+    for(i = 0; i < 2; i++){
+        fp->cps[i] = (turingcell_computer_t*)malloc(sizeof(turingcell_computer_t));
+        fp->ram_hostps[i] = (uint8_t*)malloc(CPU_LOCKSTEP_FUZZ_RAM_SIZE);
+        fp->pmmps[i] = (phys_mem_map_t*)malloc(sizeof(phys_mem_map_t));
+        fp->uart_txps[i] = (io_device_uart_tx_ring_t*)malloc(
+            sizeof(io_device_uart_tx_ring_t) + CPU_LOCKSTEP_FUZZ_UART_TX_SIZE);
+        if(!fp->cps[i] || !fp->ram_hostps[i] || !fp->pmmps[i] || !fp->uart_txps[i]){
+            return -1;
+        }
+    }
+    memset(fp->disk_block_map, 0, sizeof(fp->disk_block_map));
+    memset(&fp->disk_backend, 0, sizeof(fp->disk_backend));
+    return cpu_lockstep_init(&fp->ls, CPU_LOCKSTEP_FUZZ_RAM_SIZE, CPU_LOCKSTEP_FUZZ_UART_TX_SIZE);
+}
+
+void
+cpu_lockstep_fuzz_destroy(cpu_lockstep_fuzz_t* fp){
+    uint8_t i;
+    for(i = 0; i < 2; i++){
+        free(fp->cps[i]);
+        free(fp->ram_hostps[i]);
+        free(fp->pmmps[i]);
+        free(fp->uart_txps[i]);
+    }
+    cpu_lockstep_destroy(&fp->ls);
+}
+
+// ret u8: 0 if the sides agree for inst_ct insts | 1 if not, see the report
+uint8_t
+cpu_lockstep_fuzz_case(cpu_lockstep_fuzz_t* fp, uint64_t seed, uint64_t inst_ct,
+    cpu_lockstep_report_t* rp){
+
+    static const uint32_t modes[] = {CPUMODEN_USR, CPUMODEN_FIQ, CPUMODEN_IRQ, CPUMODEN_SVC,
+        CPUMODEN_ABT, CPUMODEN_UND, CPUMODEN_SYS};
+    turingcell_computer_host_env_t env;
+    uint64_t state = seed * (uint64_t)0x9e3779b97f4a7c15 + 1;
+    uint64_t tape_idx = 0, ct;
+    uint32_t i, r;
+    uint8_t k;
+    for(i = 0; i < CPU_LOCKSTEP_FUZZ_RAM_SIZE; i += 4){
+        phys_mem_store_le32(fp->ram_hostps[0] + i, cpu_lockstep_fuzz_inst(&state));
+    }
+    for(i = 0; i < sizeof(gl_cpu_lockstep_fuzz_vectors) / sizeof(uint32_t); i++){
+        phys_mem_store_le32(fp->ram_hostps[0] + i * 4, gl_cpu_lockstep_fuzz_vectors[i]);
+    }
+    memcpy(fp->ram_hostps[1], fp->ram_hostps[0], CPU_LOCKSTEP_FUZZ_RAM_SIZE);
+    memset(fp->cps[0], 0, sizeof(turingcell_computer_t));
+    for(i = 0; i < 31; i++){
+        r = cpu_lockstep_fuzz_rand(&state);
+        fp->cps[0]->cpu.R[i] = (r & 3) ? (r >> 2) & (CPU_LOCKSTEP_FUZZ_RAM_SIZE - 4) : r;
+    }
+    for(i = 0; i < 6; i++){
+        fp->cps[0]->cpu.spsr[i] = (cpu_lockstep_fuzz_rand(&state) & (uint32_t)0xf0000000) |
+            0xc0 | modes[cpu_lockstep_fuzz_rand(&state) % 7];
+    }
+    fp->cps[0]->cpu.cpsr = (cpu_lockstep_fuzz_rand(&state) & (uint32_t)0xf0000000) |
+        0xc0 | modes[cpu_lockstep_fuzz_rand(&state) % 7];
+    memcpy(fp->cps[1], fp->cps[0], sizeof(turingcell_computer_t));
+
+    for(k = 0; k < 2; k++){
+        memset(&env, 0, sizeof(env));
+        env.ram_hostp = fp->ram_hostps[k];
+        env.ram_size = CPU_LOCKSTEP_FUZZ_RAM_SIZE;
+        env.pmmp = fp->pmmps[k];
+        env.uart_txp = fp->uart_txps[k];
+        env.uart_tx_size = CPU_LOCKSTEP_FUZZ_UART_TX_SIZE;
+        env.disk_block_map = fp->disk_block_map;
+        env.disk_block_ct = 0;
+        env.disk_backendp = &fp->disk_backend;
+        turingcell_computer_init(fp->cps[k], &env);
+        memset(fp->uart_txps[k]->data, 0, CPU_LOCKSTEP_FUZZ_UART_TX_SIZE);
+    }
+    if(cpu_lockstep_attach(&fp->ls, fp->cps[0], fp->cps[1]) != 0){
+        return 1;
+    }
+    for(ct = 0; ct < inst_ct; ct += CPU_LOCKSTEP_FUZZ_MDF_INST_CT){
+        r = cpu_lockstep_fuzz_rand(&state) % ((CPU_LOCKSTEP_FUZZ_RAM_SIZE -
+            CPU_LOCKSTEP_FUZZ_CODE_PADDR) >> 2);
+        for(k = 0; k < 2; k++){
+            fp->cps[k]->cpu.R[REGIDX_PC] = CPU_LOCKSTEP_FUZZ_CODE_PADDR + (r << 2);
+        }
+        if(cpu_lockstep_mdf_exec(&fp->ls, tape_idx++, CPU_LOCKSTEP_FUZZ_MDF_INST_CT, rp)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#ifdef CPU_LOCKSTEP_MAIN
+int
+main(int argc, char** argv){
+    cpu_lockstep_fuzz_t f;
+    cpu_lockstep_report_t report;
+    uint64_t seed = 1, case_ct = 1000, inst_ct = 20000, i;
+    uint64_t failed_ct = 0;
+    int a;
+    for(a = 1; a < argc; a++){
+        if(strcmp(argv[a], "-s") == 0 && a + 1 < argc){
+            seed = strtoull(argv[++a], 0, 0);
+        }else if(strcmp(argv[a], "-c") == 0 && a + 1 < argc){
+            case_ct = strtoull(argv[++a], 0, 0);
+        }else if(strcmp(argv[a], "-n") == 0 && a + 1 < argc){
+            inst_ct = strtoull(argv[++a], 0, 0);
+        }
+    }
+    if(cpu_lockstep_fuzz_init(&f) != 0){
+        fprintf(stderr, "cpu_lockstep: out of memory\n");
+        return 1;
+    }
+    for(i = 0; i < case_ct; i++){
+        if(cpu_lockstep_fuzz_case(&f, seed + i, inst_ct, &report)){
+            fprintf(stdout, "seed %llu FAILED\n", (unsigned long long)(seed + i));
+            cpu_lockstep_report_print(stdout, &report);
+            fflush(stdout);
+            failed_ct++;
+        }
+    }
+    fprintf(stdout, "cpu_lockstep: %llu cases from seed %llu, %llu insts each, %llu failed\n",
+        (unsigned long long)case_ct, (unsigned long long)seed, (unsigned long long)inst_ct,
+        (unsigned long long)failed_ct);
+    cpu_lockstep_fuzz_destroy(&f);
+    return failed_ct == 0 ? 0 : 2;
+}
+#endif
+
+#endif
@@ -0,0 +1,657 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** cpu microbenchmark **
+// host side, NOT a md part: the emulated MIPS of synthetic inst streams, one per inst class,
+// and of a few small kernels, each one run by `mdf_computer_exec` on a fresh computer.
+//
+// a class stream is its body of CPU_MICROBENCH_UNROLL insts inside an endless loop, the loop
+// is far longer than ARMV4CPU_IDLE_LOOP_MAX_SPAN_BYTES and bumps a counter, so the idle loop
+// fast forward never kicks in. The guest code is encoded right here, no assembler needed.
+//
+// the output is one JSON object per line and per bench:
+//  {"bench":"dp_imm","guest_insts":N,"host_ns":N,"mips":F,"host_cycles_per_inst":F,"state":"%08x"}
+// `state` is the crc32 of the registers, the psrs and the RAM after the run (see
+// `cpu_microbench_state`): the guest is deterministic, so a different state for the same
+// guest_insts means the change altered the behavior of the class, not only its speed. host_cycles_per_inst is 0 where there is no cycle counter.
+//
+// a baseline is just a saved output; `cpu_microbench_compare` reads one and prints the MIPS
+// delta and the state match of every bench. Build the harness with CPU_MICROBENCH_MAIN defined
+// after including turingcell_computer_md.c, `make bench` builds and runs it:
+//     cpu_microbench [-n guest_insts_per_bench] [-b baseline.jsonl] [bench_name_prefix]
+
+#ifndef CPU_MICROBENCH_H
+#define CPU_MICROBENCH_H
+
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include "../common/crc32_md.h"
+
+#define CPU_MICROBENCH_RAM_SIZE         ((uint32_t)0x00100000)
+#define CPU_MICROBENCH_UART_TX_SIZE     4096
+#define CPU_MICROBENCH_CODE_PADDR       ((uint32_t)0x00001000)
+#define CPU_MICROBENCH_LEAF_PADDR       ((uint32_t)0x00000100)     // `mov pc, lr`
+#define CPU_MICROBENCH_DATA_PADDR       ((uint32_t)0x00080000)
+#define CPU_MICROBENCH_UNROLL           64
+#define CPU_MICROBENCH_MDF_INST_CT      ((uint64_t)1 << 20)        // inst amount of one mdf
+#define CPU_MICROBENCH_WARMUP_INST_CT   ((uint64_t)1 << 20)
+#define CPU_MICROBENCH_BENCH_CT_MAX     32
+
+// ** encoders **
+// cond AL unless said otherwise, op2 is one of the CPU_MICROBENCH_OP2_* forms
+
+#define CPU_MICROBENCH_AL               ((uint32_t)0xe)
+
+#define CPU_MICROBENCH_OP2_IMM(imm8, rot) \
+    (((uint32_t)1 << 25) | ((uint32_t)(rot) << 8) | (uint32_t)(imm8))
+#define CPU_MICROBENCH_OP2_IMMSHIFT(rm, type, amount) \
+    (((uint32_t)(amount) << 7) | ((uint32_t)(type) << 5) | (uint32_t)(rm))
+#define CPU_MICROBENCH_OP2_REGSHIFT(rm, type, rs) \
+    (((uint32_t)(rs) << 8) | ((uint32_t)(type) << 5) | ((uint32_t)1 << 4) | (uint32_t)(rm))
+
+#define CPU_MICROBENCH_DP_AND   0
+#define CPU_MICROBENCH_DP_EOR   1
+#define CPU_MICROBENCH_DP_SUB   2
+#define CPU_MICROBENCH_DP_ADD   4
+#define CPU_MICROBENCH_DP_ADC   5
+#define CPU_MICROBENCH_DP_TST   8
+#define CPU_MICROBENCH_DP_CMP   10
+#define CPU_MICROBENCH_DP_ORR   12
+#define CPU_MICROBENCH_DP_MOV   13
+#define CPU_MICROBENCH_DP_BIC   14
+#define CPU_MICROBENCH_DP_MVN   15
+
+// always_inline
+inline uint32_t
+cpu_microbench_dp(uint32_t cond, uint32_t opcode, uint32_t s_flag, uint32_t rd, uint32_t rn,
+    uint32_t op2){
+
+    return (cond << 28) | (opcode << 21) | (s_flag << 20) | (rn << 16) | (rd << 12) | op2;
+}
+
+// LDR STR LDRB STRB, immediate offset
+// always_inline
+inline uint32_t
+cpu_microbench_ldr_str(uint32_t load_flag, uint32_t byte_flag, uint32_t rd, uint32_t rn,
+    uint32_t pre_flag, uint32_t write_back_flag, int32_t offset){
+
+    uint32_t u_flag = offset >= 0;
+    uint32_t imm12 = (uint32_t)(offset >= 0 ? offset : -offset);
+    return (CPU_MICROBENCH_AL << 28) | ((uint32_t)1 << 26) | (pre_flag << 24) | (u_flag << 23) |
+        (byte_flag << 22) | (write_back_flag << 21) | (load_flag << 20) | (rn << 16) |
+        (rd << 12) | imm12;
+}
+
+// LDM STM, IA if up_flag else DB
+// always_inline
+inline uint32_t
+cpu_microbench_ldm_stm(uint32_t load_flag, uint32_t up_flag, uint32_t rn, uint32_t write_back_flag,
+    uint32_t reg_list){
+
+    return (CPU_MICROBENCH_AL << 28) | ((uint32_t)4 << 25) | ((up_flag ^ 1) << 24) |
+        (up_flag << 23) | (write_back_flag << 21) | (load_flag << 20) | (rn << 16) | reg_list;
+}
+
+// MUL MLA
+// always_inline
+inline uint32_t
+cpu_microbench_mul(uint32_t acc_flag, uint32_t rd, uint32_t rm, uint32_t rs, uint32_t rn){
+    return (CPU_MICROBENCH_AL << 28) | (acc_flag << 21) | (rd << 16) | (rn << 12) | (rs << 8) |
+        ((uint32_t)9 << 4) | rm;
+}
+
+// UMULL UMLAL SMULL SMLAL
+// always_inline
+inline uint32_t
+cpu_microbench_mull(uint32_t signed_flag, uint32_t acc_flag, uint32_t rdlo, uint32_t rdhi,
+    uint32_t rm, uint32_t rs){
+
+    return (CPU_MICROBENCH_AL << 28) | ((uint32_t)1 << 23) | (signed_flag << 22) |
+        (acc_flag << 21) | (rdhi << 16) | (rdlo << 12) | (rs << 8) | ((uint32_t)9 << 4) | rm;
+}
+
+// B BL from the inst at paddr to target
+// always_inline
+inline uint32_t
+cpu_microbench_b(uint32_t cond, uint32_t link_flag, uint32_t paddr, uint32_t target){
+    return (cond << 28) | ((uint32_t)5 << 25) | (link_flag << 24) |
+        (((target - paddr - 8) >> 2) & (uint32_t)0x00ffffff);
+}
+
+#define CPU_MICROBENCH_INST_MOV_PC_LR   ((uint32_t)0xe1a0f00e)
+#define CPU_MICROBENCH_INST_MOVS_PC_LR  ((uint32_t)0xe1b0f00e)
+#define CPU_MICROBENCH_INST_SWI         ((uint32_t)0xef000000)
+
+// ** guest programs **
+
+typedef struct {
+    uint32_t* ramp;         // guest RAM as words
+    uint32_t paddr;         // of the next inst
+} cpu_microbench_emitter_t;
+
+// always_inline
+inline void
+cpu_microbench_emit(cpu_microbench_emitter_t* ep, uint32_t inst){
+    ep->ramp[ep->paddr >> 2] = inst;
+    ep->paddr += 4;
+}
+
+// always_inline
+inline void
+cpu_microbench_emit_mov_imm(cpu_microbench_emitter_t* ep, uint32_t rd, uint32_t imm8, uint32_t rot){
+    cpu_microbench_emit(ep, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_MOV, 0, rd, 0,
+        CPU_MICROBENCH_OP2_IMM(imm8, rot)));
+}
+
+// the body of a class stream, inst i of CPU_MICROBENCH_UNROLL
+typedef uint32_t (*cpu_microbench_class_inst_fn_t)(uint32_t paddr, uint32_t i);
+
+uint32_t
+cpu_microbench_class_dp_imm(uint32_t paddr, uint32_t i){
+    static const uint32_t opcodes[4] = {
+        CPU_MICROBENCH_DP_ADD, CPU_MICROBENCH_DP_EOR, CPU_MICROBENCH_DP_SUB, CPU_MICROBENCH_DP_ORR};
+    return cpu_microbench_dp(CPU_MICROBENCH_AL, opcodes[i & 3], 0, i & 7, (i + 1) & 7,
+        CPU_MICROBENCH_OP2_IMM(i + 1, i & 15));
+}
+
+uint32_t
+cpu_microbench_class_dp_immshift(uint32_t paddr, uint32_t i){
+    static const uint32_t opcodes[4] = {
+        CPU_MICROBENCH_DP_ADD, CPU_MICROBENCH_DP_EOR, CPU_MICROBENCH_DP_SUB, CPU_MICROBENCH_DP_BIC};
+    return cpu_microbench_dp(CPU_MICROBENCH_AL, opcodes[i & 3], 0, i & 7, (i + 1) & 7,
+        CPU_MICROBENCH_OP2_IMMSHIFT((i + 2) & 7, i & 3, (i * 5 + 1) & 31));
+}
+
+uint32_t
+cpu_microbench_class_dp_regshift(uint32_t paddr, uint32_t i){
+    static const uint32_t opcodes[4] = {
+        CPU_MICROBENCH_DP_ADD, CPU_MICROBENCH_DP_EOR, CPU_MICROBENCH_DP_ORR, CPU_MICROBENCH_DP_SUB};
+    return cpu_microbench_dp(CPU_MICROBENCH_AL, opcodes[i & 3], 0, i & 7, (i + 1) & 7,
+        CPU_MICROBENCH_OP2_REGSHIFT((i + 2) & 7, i & 3, 8 + (i & 1)));
+}
+
+// the setup leaves Z and C set: NE and CC fail
+uint32_t
+cpu_microbench_class_cond_fail(uint32_t paddr, uint32_t i){
+    return cpu_microbench_dp(i & 1 ? 0x1 : 0x3, CPU_MICROBENCH_DP_ADD, 0, i & 7, (i + 1) & 7,
+        CPU_MICROBENCH_OP2_IMM(1, 0));
+}
+
+uint32_t
+cpu_microbench_class_mul(uint32_t paddr, uint32_t i){
+    switch(i & 3){
+        case 0:
+            return cpu_microbench_mul(0, 0, 1, 2, 0);
+        case 1:
+            return cpu_microbench_mul(1, 3, 1, 2, 3);
+        case 2:
+            return cpu_microbench_mull(0, 0, 4, 5, 1, 2);
+        default:
+            return cpu_microbench_mull(1, 1, 6, 7, 1, 2);
+    }
+}
+
+// r10 points to the data
+uint32_t
+cpu_microbench_class_ldr_str(uint32_t paddr, uint32_t i){
+    int32_t offset = (int32_t)((i & 15) << 2);
+    switch(i & 3){
+        case 0:
+            return cpu_microbench_ldr_str(1, 0, 0, 10, 1, 0, offset);
+        case 1:
+            return cpu_microbench_ldr_str(0, 0, 0, 10, 1, 0, offset + 64);
+        case 2:
+            return cpu_microbench_ldr_str(1, 1, 1, 10, 1, 0, offset + 1);
+        default:
+            return cpu_microbench_ldr_str(0, 1, 1, 10, 1, 0, offset + 66);
+    }
+}
+
+uint32_t
+cpu_microbench_class_ldm_stm(uint32_t paddr, uint32_t i){
+    return cpu_microbench_ldm_stm(i & 1, 1, 10, 0, 0x00ff);
+}
+
+// every B jumps to the next inst
+uint32_t
+cpu_microbench_class_branch(uint32_t paddr, uint32_t i){
+    return cpu_microbench_b(CPU_MICROBENCH_AL, 0, paddr, paddr + 4);
+}
+
+// CMP or TST, then a B<cond> to the next inst which is taken or not by the fresh flags
+uint32_t
+cpu_microbench_class_compare_branch(uint32_t paddr, uint32_t i){
+    static const uint32_t conds[4] = {0x0, 0x1, 0xa, 0xb};    // EQ NE GE LT
+    if(i & 1){
+        return cpu_microbench_b(conds[(i >> 1) & 3], 0, paddr, paddr + 4);
+    }
+    return cpu_microbench_dp(CPU_MICROBENCH_AL,
+        i & 2 ? CPU_MICROBENCH_DP_TST : CPU_MICROBENCH_DP_CMP,
+        1, 0, (i >> 2) & 7, CPU_MICROBENCH_OP2_IMM(0x44, 0));
+}
+
+// BL to a leaf which returns at once, half of the insts are the return
+uint32_t
+cpu_microbench_class_call(uint32_t paddr, uint32_t i){
+    return cpu_microbench_b(CPU_MICROBENCH_AL, 1, paddr, CPU_MICROBENCH_LEAF_PADDR);
+}
+
+// SWI to a handler which returns at once, half of the insts are the return
+uint32_t
+cpu_microbench_class_exception(uint32_t paddr, uint32_t i){
+    return CPU_MICROBENCH_INST_SWI;
+}
+
+// vectors, the leaf, the common setup, then the endless loop over the body
+void
+cpu_microbench_build_class(uint32_t* ramp, cpu_microbench_class_inst_fn_t fn){
+    cpu_microbench_emitter_t e = {ramp, 0};
+    uint32_t loop_paddr, i;
+    cpu_microbench_emit(&e, cpu_microbench_b(CPU_MICROBENCH_AL, 0, 0, CPU_MICROBENCH_CODE_PADDR));
+    cpu_microbench_emit(&e, CPU_MICROBENCH_INST_MOVS_PC_LR);   // undefined
+    cpu_microbench_emit(&e, CPU_MICROBENCH_INST_MOVS_PC_LR);   // swi
+    e.paddr = CPU_MICROBENCH_LEAF_PADDR;
+    cpu_microbench_emit(&e, CPU_MICROBENCH_INST_MOV_PC_LR);
+
+    e.paddr = CPU_MICROBENCH_CODE_PADDR;
+    for(i = 0; i < 8; i++){
+        cpu_microbench_emit_mov_imm(&e, i, 0x11 * (i + 1), i);
+    }
+    cpu_microbench_emit_mov_imm(&e, 8, 3, 0);
+    cpu_microbench_emit_mov_imm(&e, 9, 7, 0);
+    cpu_microbench_emit_mov_imm(&e, 10, CPU_MICROBENCH_DATA_PADDR >> 12, 10);
+    cpu_microbench_emit_mov_imm(&e, 11, 0, 0);
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_CMP, 1, 0, 0,
+        CPU_MICROBENCH_OP2_IMMSHIFT(0, 0, 0)));     // Z C
+    loop_paddr = e.paddr;
+    for(i = 0; i < CPU_MICROBENCH_UNROLL; i++){
+        cpu_microbench_emit(&e, fn(e.paddr, i));
+    }
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ADD, 0, 11, 11,
+        CPU_MICROBENCH_OP2_IMM(1, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_b(CPU_MICROBENCH_AL, 0, e.paddr, loop_paddr));
+}
+
+// copy 4KB with LDMIA/STMIA of 4 regs, again and again
+void
+cpu_microbench_build_memcpy(uint32_t* ramp){
+    cpu_microbench_emitter_t e = {ramp, CPU_MICROBENCH_CODE_PADDR};
+    uint32_t outer_paddr, inner_paddr;
+    ramp[0] = cpu_microbench_b(CPU_MICROBENCH_AL, 0, 0, CPU_MICROBENCH_CODE_PADDR);
+    outer_paddr = e.paddr;
+    cpu_microbench_emit_mov_imm(&e, 0, CPU_MICROBENCH_DATA_PADDR >> 12, 10);           // src
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ADD, 0, 1, 0,
+        CPU_MICROBENCH_OP2_IMM(1, 10)));                                               // dst
+    cpu_microbench_emit_mov_imm(&e, 2, 1, 10);                                         // 4KB
+    inner_paddr = e.paddr;
+    cpu_microbench_emit(&e, cpu_microbench_ldm_stm(1, 1, 0, 1, 0x00f0));
+    cpu_microbench_emit(&e, cpu_microbench_ldm_stm(0, 1, 1, 1, 0x00f0));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_SUB, 1, 2, 2,
+        CPU_MICROBENCH_OP2_IMM(16, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_b(0x1, 0, e.paddr, inner_paddr));            // BNE
+    cpu_microbench_emit(&e, cpu_microbench_b(CPU_MICROBENCH_AL, 0, e.paddr, outer_paddr));
+}
+
+// bitwise crc32 (reflected, 0xedb88320) of 256 bytes, again and again
+void
+cpu_microbench_build_crc32(uint32_t* ramp){
+    cpu_microbench_emitter_t e = {ramp, CPU_MICROBENCH_CODE_PADDR};
+    uint32_t outer_paddr, byte_paddr, bit_paddr;
+    ramp[0] = cpu_microbench_b(CPU_MICROBENCH_AL, 0, 0, CPU_MICROBENCH_CODE_PADDR);
+    // r5 = 0xedb88320
+    cpu_microbench_emit_mov_imm(&e, 5, 0xed, 4);
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ORR, 0, 5, 5,
+        CPU_MICROBENCH_OP2_IMM(0xb8, 8)));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ORR, 0, 5, 5,
+        CPU_MICROBENCH_OP2_IMM(0x83, 12)));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ORR, 0, 5, 5,
+        CPU_MICROBENCH_OP2_IMM(0x20, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_MOV, 0, 0, 0,
+        CPU_MICROBENCH_OP2_IMM(0, 0)));
+    outer_paddr = e.paddr;
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_MVN, 0, 0, 0,
+        CPU_MICROBENCH_OP2_IMMSHIFT(0, 0, 0)));                                        // ~crc
+    cpu_microbench_emit_mov_imm(&e, 1, CPU_MICROBENCH_DATA_PADDR >> 12, 10);
+    cpu_microbench_emit_mov_imm(&e, 2, 1, 12);                                         // 256
+    byte_paddr = e.paddr;
+    cpu_microbench_emit(&e, cpu_microbench_ldr_str(1, 1, 3, 1, 0, 0, 1));               // ldrb r3, [r1], #1
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_EOR, 0, 0, 0,
+        CPU_MICROBENCH_OP2_IMMSHIFT(3, 0, 0)));
+    cpu_microbench_emit_mov_imm(&e, 4, 8, 0);
+    bit_paddr = e.paddr;
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_MOV, 1, 0, 0,
+        CPU_MICROBENCH_OP2_IMMSHIFT(0, 1, 1)));                                        // lsr #1
+    cpu_microbench_emit(&e, cpu_microbench_dp(0x2, CPU_MICROBENCH_DP_EOR, 0, 0, 0,
+        CPU_MICROBENCH_OP2_IMMSHIFT(5, 0, 0)));                                        // EORCS
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_SUB, 1, 4, 4,
+        CPU_MICROBENCH_OP2_IMM(1, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_b(0x1, 0, e.paddr, bit_paddr));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_SUB, 1, 2, 2,
+        CPU_MICROBENCH_OP2_IMM(1, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_b(0x1, 0, e.paddr, byte_paddr));
+    cpu_microbench_emit(&e, cpu_microbench_b(CPU_MICROBENCH_AL, 0, e.paddr, outer_paddr));
+}
+
+// a Dhrystone like mix: a call with a frame on the stack, record field updates, a 16 bytes
+// string compare and a data dependent branch, again and again
+void
+cpu_microbench_build_mix(uint32_t* ramp){
+    cpu_microbench_emitter_t e = {ramp, CPU_MICROBENCH_CODE_PADDR};
+    uint32_t proc_paddr = CPU_MICROBENCH_CODE_PADDR + 0x400;
+    uint32_t loop_paddr, strcmp_paddr, bne_paddr;
+    ramp[0] = cpu_microbench_b(CPU_MICROBENCH_AL, 0, 0, CPU_MICROBENCH_CODE_PADDR);
+    cpu_microbench_emit_mov_imm(&e, 13, 7, 8);                                         // sp 0x70000
+    cpu_microbench_emit_mov_imm(&e, 10, CPU_MICROBENCH_DATA_PADDR >> 12, 10);
+    cpu_microbench_emit_mov_imm(&e, 11, 0, 0);
+    loop_paddr = e.paddr;
+    cpu_microbench_emit(&e, cpu_microbench_b(CPU_MICROBENCH_AL, 1, e.paddr, proc_paddr));
+    // strcmp of two zero filled 16 bytes strings
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ADD, 0, 6, 10,
+        CPU_MICROBENCH_OP2_IMM(1, 12)));                                               // +0x100
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ADD, 0, 8, 10,
+        CPU_MICROBENCH_OP2_IMM(2, 12)));                                               // +0x200
+    cpu_microbench_emit_mov_imm(&e, 9, 16, 0);
+    strcmp_paddr = e.paddr;
+    cpu_microbench_emit(&e, cpu_microbench_ldr_str(1, 1, 5, 6, 0, 0, 1));
+    cpu_microbench_emit(&e, cpu_microbench_ldr_str(1, 1, 7, 8, 0, 0, 1));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_CMP, 1, 0, 5,
+        CPU_MICROBENCH_OP2_IMMSHIFT(7, 0, 0)));
+    bne_paddr = e.paddr;
+    e.paddr += 4;   // BNE to the end of the strcmp, patched below
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_SUB, 1, 9, 9,
+        CPU_MICROBENCH_OP2_IMM(1, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_b(0x1, 0, e.paddr, strcmp_paddr));
+    ramp[bne_paddr >> 2] = cpu_microbench_b(0x1, 0, bne_paddr, e.paddr);
+    // if((ct & 3) == 2) r1 += 5 else r1 -= 1; r2 = r1 * r0
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_AND, 0, 0, 11,
+        CPU_MICROBENCH_OP2_IMM(3, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_CMP, 1, 0, 0,
+        CPU_MICROBENCH_OP2_IMM(2, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_dp(0x0, CPU_MICROBENCH_DP_ADD, 0, 1, 1,
+        CPU_MICROBENCH_OP2_IMM(5, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_dp(0x1, CPU_MICROBENCH_DP_SUB, 0, 1, 1,
+        CPU_MICROBENCH_OP2_IMM(1, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_mul(0, 2, 1, 0, 0));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ADD, 0, 11, 11,
+        CPU_MICROBENCH_OP2_IMM(1, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_b(CPU_MICROBENCH_AL, 0, e.paddr, loop_paddr));
+
+    // proc: push {r4, lr}; rec.a++; rec.b = max(rec.a, rec.b); rec.c = rec.a + rec.b; pop {r4, pc}
+    e.paddr = proc_paddr;
+    cpu_microbench_emit(&e, cpu_microbench_ldm_stm(0, 0, 13, 1, 0x4010));
+    cpu_microbench_emit(&e, cpu_microbench_ldr_str(1, 0, 3, 10, 1, 0, 0));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ADD, 0, 3, 3,
+        CPU_MICROBENCH_OP2_IMM(1, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_ldr_str(0, 0, 3, 10, 1, 0, 0));
+    cpu_microbench_emit(&e, cpu_microbench_ldr_str(1, 0, 4, 10, 1, 0, 4));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_CMP, 1, 0, 3,
+        CPU_MICROBENCH_OP2_IMMSHIFT(4, 0, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_dp(0xc, CPU_MICROBENCH_DP_MOV, 0, 4, 0,
+        CPU_MICROBENCH_OP2_IMMSHIFT(3, 0, 0)));                                        // MOVGT
+    cpu_microbench_emit(&e, cpu_microbench_ldr_str(0, 0, 4, 10, 1, 0, 4));
+    cpu_microbench_emit(&e, cpu_microbench_dp(CPU_MICROBENCH_AL, CPU_MICROBENCH_DP_ADD, 0, 4, 3,
+        CPU_MICROBENCH_OP2_IMMSHIFT(4, 0, 0)));
+    cpu_microbench_emit(&e, cpu_microbench_ldr_str(0, 0, 4, 10, 1, 0, 8));
+    cpu_microbench_emit(&e, cpu_microbench_ldm_stm(1, 1, 13, 1, 0x8010));
+}
+
+// ** runner **
+
+typedef struct {
+    const char* name;
+    cpu_microbench_class_inst_fn_t class_fn;    // a class stream if not NULL
+    void (*build_fn)(uint32_t* ramp);           // a kernel otherwise
+} cpu_microbench_bench_t;
+
+const cpu_microbench_bench_t gl_cpu_microbench_benches[] = {
+    {"dp_imm", cpu_microbench_class_dp_imm, 0},
+    {"dp_immshift", cpu_microbench_class_dp_immshift, 0},
+    {"dp_regshift", cpu_microbench_class_dp_regshift, 0},
+    {"cond_fail", cpu_microbench_class_cond_fail, 0},
+    {"mul", cpu_microbench_class_mul, 0},
+    {"ldr_str", cpu_microbench_class_ldr_str, 0},
+    {"ldm_stm", cpu_microbench_class_ldm_stm, 0},
+    {"branch", cpu_microbench_class_branch, 0},
+    {"compare_branch", cpu_microbench_class_compare_branch, 0},
+    {"call", cpu_microbench_class_call, 0},
+    {"exception", cpu_microbench_class_exception, 0},
+    {"k_memcpy", 0, cpu_microbench_build_memcpy},
+    {"k_crc32", 0, cpu_microbench_build_crc32},
+    {"k_mix", 0, cpu_microbench_build_mix},
+};
+
+#define CPU_MICROBENCH_BENCH_CT \
+    (sizeof(gl_cpu_microbench_benches) / sizeof(gl_cpu_microbench_benches[0]))
+
+typedef struct {
+    char name[32];
+    uint64_t guest_inst_ct;
+    uint64_t host_ns;
+    double mips;
+    double host_cycles_per_inst;
+    uint32_t state;
+} cpu_microbench_result_t;
+
+// host resources of the computer, reused by every bench
+typedef struct {
+    turingcell_computer_t* cp;
+    uint8_t* ram_hostp;
+    phys_mem_map_t* pmmp;
+    io_device_uart_tx_ring_t* uart_txp;
+    io_device_disk_hash_t disk_block_map[1];
+} cpu_microbench_t;
+
+// always_inline
+inline uint64_t
+cpu_microbench_host_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// ret u64: the time stamp counter | 0 if the host has none
+// always_inline
+inline uint64_t
+cpu_microbench_host_cycles(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// ret int: 0 if success | -1 if failed
+int
+cpu_microbench_init(cpu_microbench_t* bp){
+    bp->cp = (turingcell_computer_t*)malloc(sizeof(turingcell_computer_t));
+    bp->ram_hostp = (uint8_t*)malloc(CPU_MICROBENCH_RAM_SIZE);
+    bp->pmmp = (phys_mem_map_t*)malloc(sizeof(phys_mem_map_t));
+    bp->uart_txp = (io_device_uart_tx_ring_t*)malloc(
+        sizeof(io_device_uart_tx_ring_t) + CPU_MICROBENCH_UART_TX_SIZE);
+    memset(bp->disk_block_map, 0, sizeof(bp->disk_block_map));
+    if(!bp->cp || !bp->ram_hostp || !bp->pmmp || !bp->uart_txp){
+        return -1;
+    }
+    return 0;
+}
+
+void
+cpu_microbench_destroy(cpu_microbench_t* bp){
+    free(bp->cp);
+    free(bp->ram_hostp);
+    free(bp->pmmp);
+    free(bp->uart_txp);
+}
+
+// the registers, the cpsr, the spsrs and the whole RAM after a run: the code of the bench,
+// its data region and its stack
+// always_inline
+inline uint32_t
+cpu_microbench_state(cpu_microbench_t* bp){
+    armv4cpu_md_t* cpup = &bp->cp->cpu;
+    uint32_t crc = crc32_update(0, (const uint8_t*)cpup->R, sizeof(cpup->R));
+    crc = crc32_update(crc, (const uint8_t*)&cpup->cpsr, sizeof(cpup->cpsr));
+    crc = crc32_update(crc, (const uint8_t*)cpup->spsr, sizeof(cpup->spsr));
+    return crc32_update(crc, bp->ram_hostp, CPU_MICROBENCH_RAM_SIZE);
+}
+
+// guest_inst_ct is rounded up to a multiple of CPU_MICROBENCH_MDF_INST_CT
+void
+cpu_microbench_run_one(cpu_microbench_t* bp, const cpu_microbench_bench_t* benchp,
+    uint64_t guest_inst_ct, cpu_microbench_result_t* rp){
+
+    turingcell_computer_host_env_t env;
+    uint64_t tape_idx = 0, ct, start_ns, start_cycles, cycles;
+    memset(&env, 0, sizeof(env));
+    env.ram_hostp = bp->ram_hostp;
+    env.ram_size = CPU_MICROBENCH_RAM_SIZE;
+    env.pmmp = bp->pmmp;
+    env.uart_txp = bp->uart_txp;
+    env.uart_tx_size = CPU_MICROBENCH_UART_TX_SIZE;
+    env.disk_block_map = bp->disk_block_map;
+    env.disk_block_ct = 0;
+
+    memset(bp->ram_hostp, 0, CPU_MICROBENCH_RAM_SIZE);
+    if(benchp->class_fn){
+        cpu_microbench_build_class((uint32_t*)bp->ram_hostp, benchp->class_fn);
+    }else{
+        benchp->build_fn((uint32_t*)bp->ram_hostp);
+    }
+    memset(bp->cp, 0, sizeof(turingcell_computer_t));
+    bp->cp->cpu.cpsr = 0xd3;    // svc, irq and fiq masked
+    turingcell_computer_init(bp->cp, &env);
+
+    mdf_computer_exec(bp->cp, tape_idx++, CPU_MICROBENCH_WARMUP_INST_CT);
+    start_ns = cpu_microbench_host_ns();
+    start_cycles = cpu_microbench_host_cycles();
+    for(ct = 0; ct < guest_inst_ct; ct += CPU_MICROBENCH_MDF_INST_CT){
+        mdf_computer_exec(bp->cp, tape_idx++, CPU_MICROBENCH_MDF_INST_CT);
+    }
+    cycles = cpu_microbench_host_cycles() - start_cycles;
+    rp->host_ns = cpu_microbench_host_ns() - start_ns;
+    if(rp->host_ns == 0){
+        rp->host_ns = 1;
+    }
+    snprintf(rp->name, sizeof(rp->name), "%s", benchp->name);
+    rp->guest_inst_ct = ct;
+    rp->mips = (double)ct * 1000.0 / (double)rp->host_ns;
+    rp->host_cycles_per_inst = (double)cycles / (double)ct;
+    rp->state = cpu_microbench_state(bp);
+}
+
+void
+cpu_microbench_print(FILE* fp, const cpu_microbench_result_t* rp){
+    fprintf(fp, "{\"bench\":\"%s\",\"guest_insts\":%llu,\"host_ns\":%llu,\"mips\":%.2f,"
+        "\"host_cycles_per_inst\":%.2f,\"state\":\"%08x\"}\n",
+        rp->name, (unsigned long long)rp->guest_inst_ct, (unsigned long long)rp->host_ns,
+        rp->mips, rp->host_cycles_per_inst, rp->state);
+}
+
+// ret u8: 1 if line is a result printed by `cpu_microbench_print` | 0 if not
+uint8_t
+cpu_microbench_parse(const char* line, cpu_microbench_result_t* rp){
+    unsigned long long guest_inst_ct, host_ns;
+    if(sscanf(line, "{\"bench\":\"%31[^\"]\",\"guest_insts\":%llu,\"host_ns\":%llu,\"mips\":%lf,"
+        "\"host_cycles_per_inst\":%lf,\"state\":\"%x\"}", rp->name, &guest_inst_ct, &host_ns,
+        &rp->mips, &rp->host_cycles_per_inst, &rp->state) != 6){
+        return 0;
+    }
+    rp->guest_inst_ct = guest_inst_ct;
+    rp->host_ns = host_ns;
+    return 1;
+}
+
+// print the delta of every result against the baseline file
+// ret int: amount of benches whose state differs from the baseline | -1 if no baseline
+int
+cpu_microbench_compare(FILE* fp, const char* baseline_path,
+    const cpu_microbench_result_t* results, uint32_t result_ct){
+
+    cpu_microbench_result_t base;
+    char line[512];
+    uint32_t i;
+    int diff_ct = 0;
+    FILE* basep = fopen(baseline_path, "r");
+    if(!basep){
+        return -1;
+    }
+    while(fgets(line, sizeof(line), basep)){
+        if(!cpu_microbench_parse(line, &base)){
+            continue;
+        }
+        for(i = 0; i < result_ct; i++){
+            if(strcmp(results[i].name, base.name) != 0){
+                continue;
+            }
+            fprintf(fp, "%-12s %9.2f -> %9.2f MIPS %+7.2f%%  state %s\n", base.name,
+                base.mips, results[i].mips, (results[i].mips - base.mips) * 100.0 / base.mips,
+                results[i].guest_inst_ct != base.guest_inst_ct ? "n/a" :
+                    results[i].state == base.state ? "same" : "DIFF");
+            if(results[i].guest_inst_ct == base.guest_inst_ct && results[i].state != base.state){
+                diff_ct++;
+            }
+        }
+    }
+    fclose(basep);
+    return diff_ct;
+}
+
+#ifdef CPU_MICROBENCH_MAIN
+int
+main(int argc, char** argv){
+    cpu_microbench_t b;
+    cpu_microbench_result_t results[CPU_MICROBENCH_BENCH_CT_MAX];
+    uint64_t guest_inst_ct = (uint64_t)64 << 20;
+    const char* baseline_path = 0;
+    const char* prefix = "";
+    uint32_t i, result_ct = 0;
+    int diff_ct = 0;
+    for(i = 1; i < (uint32_t)argc; i++){
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < (uint32_t)argc){
+            guest_inst_ct = strtoull(argv[++i], 0, 0);
+        }else if(strcmp(argv[i], "-b") == 0 && i + 1 < (uint32_t)argc){
+            baseline_path = argv[++i];
+        }else{
+            prefix = argv[i];
+        }
+    }
+    if(cpu_microbench_init(&b) != 0){
+        fprintf(stderr, "cpu_microbench: out of memory\n");
+        return 1;
+    }
+    for(i = 0; i < CPU_MICROBENCH_BENCH_CT; i++){
+        if(strncmp(gl_cpu_microbench_benches[i].name, prefix, strlen(prefix)) != 0){
+            continue;
+        }
+        cpu_microbench_run_one(&b, &gl_cpu_microbench_benches[i], guest_inst_ct,
+            &results[result_ct]);
+        cpu_microbench_print(stdout, &results[result_ct]);
+        fflush(stdout);
+        result_ct++;
+    }
+    if(baseline_path){
+        diff_ct = cpu_microbench_compare(stderr, baseline_path, results, result_ct);
+        if(diff_ct < 0){
+            fprintf(stderr, "cpu_microbench: could not read %s\n", baseline_path);
+        }
+    }
+    cpu_microbench_destroy(&b);
+    return diff_ct == 0 ? 0 : 2;
+}
+#endif
+
+#endif
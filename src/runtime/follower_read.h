@@ -0,0 +1,579 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** follower reads **
+// host side, NOT a md part: queries of the guest state of a cell answered by any replica from
+// its local state, without a consensus round, so the read traffic scales with the replicas.
+// Every answer is tagged with the applied tape idx it has been read at.
+//  - at least X: the answer reflects every tape entry up to X at least (1 if not applied yet)
+//  - linearizable: X is the commit index of the cell, confirmed once with the leader through
+//    the commit_idx_cb given to follower_read_init (a read index, no tape entry), then read as
+//    above
+//
+// the executor never waits for a reader. At the end of a turn of the cell (tape hook of
+// cell_runtime.h) it publishes a view: the applied tape idx, a copy of the small state (cpu
+// registers, device registers, see "paged and small state" in turingcell_computer_md.c) and
+// the paged state, RAM and disk block map, as it is, copy on write:
+//  - the RAM is watched (turingcell_computer_ram_watch), the first write to a page after the
+//    view is published saves the page into the view first
+//  - the disk block map is watched (turingcell_computer_disk_watch_start), the page holding a
+//    delta is saved the same way before the delta is applied
+// a reader takes a page of the view if saved, otherwise the live one, and checks afterwards
+// that the page has not been saved meanwhile, like a seqlock. A view whose pool of saved
+// pages runs out is broken, its readers retry on a newer one. By default the pool of a view
+// holds 1 / 2^FOLLOWER_READ_POOL_SHIFT of the paged state, the FOLLOWER_READ_VIEW_CT views a
+// quarter of it.
+//
+// the uart output is served from the tx ring in shared memory, the device output buffer,
+// up to what has been published at the view. Its bytes are reused once acked, the answer
+// starts at the acked offset at the latest.
+//
+// the views are recycled once no reader holds them; a reader only ever holds a view for one
+// query, a view is taken and released with a short mutex the executor only ever trylocks.
+//
+// usage, before the cell runs:
+//     follower_read_init(&fr, cp, pool_page_ct, commit_idx_cb, commit_idx_cb_arg);
+//     follower_read_attach(&fr, cellp);
+//     ... from any thread: follower_read_ram(&fr, min_tape_idx, paddr, buf, len, &tape_idx);
+// and follower_read_detach / follower_read_destroy once the cell does not run any more.
+//
+// must be included after turingcell_computer_md.c
+
+#ifndef FOLLOWER_READ_H
+#define FOLLOWER_READ_H
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<sched.h>
+#include<time.h>
+#include "cell_runtime.h"
+
+#define FOLLOWER_READ_VIEW_CT           4
+#define FOLLOWER_READ_POOL_SHIFT        4       // default saved pages per view: page_ct >> it
+#define FOLLOWER_READ_POOL_PAGE_CT_MIN  16
+#define FOLLOWER_READ_MEMBER_CT_MAX     1024
+#define FOLLOWER_READ_ACQUIRE_TRY_CT    8
+
+#define FOLLOWER_READ_OK                0
+#define FOLLOWER_READ_NOT_YET           1       // no view at min_tape_idx yet, retry
+#define FOLLOWER_READ_ERROR             (-1)    // out of range, or not available
+
+typedef struct {
+    const char* name;                   // as visited, e.g. "cpup->R"
+    uint32_t nth;                       // occurrence of the name, the vCPU for "cpup->*"
+    uint32_t offset;                    // in the small state
+    uint32_t len;
+} follower_read_member_t;
+
+typedef struct {
+    pthread_mutex_t lock;               // guards reader_ct and valid_flag
+    uint32_t reader_ct;
+    uint8_t valid_flag;                 // published and not recycled since
+    uint8_t broken_flag;                // atomic, a page could not be saved
+    uint64_t tape_idx;
+    uint64_t uart_published_ct;
+    uint8_t* small_state;
+    uint32_t* slots;                    // per page: 1 + pool idx | 0 if live, atomic
+    uint32_t* pool_pages;               // page of every pool idx, to clear the slots
+    uint8_t* pool;
+    uint32_t pool_ct;                   // executor only
+} follower_read_view_t;
+
+typedef struct {
+    cell_runtime_tape_hook_t hook;
+    cell_runtime_tape_hook_t* next_hookp;   // called after this one, e.g. a tape recorder
+    turingcell_computer_t* cp;
+    cell_runtime_cell_t* cellp;
+
+    turingcell_computer_disk_watch_t disk_watch;
+
+    uint32_t page_ct;                   // of the paged state
+    uint32_t pool_page_ct;
+    follower_read_member_t members[FOLLOWER_READ_MEMBER_CT_MAX];
+    uint32_t member_ct;
+    uint32_t small_state_len;
+
+    follower_read_view_t views[FOLLOWER_READ_VIEW_CT];
+    uint32_t live_mask;                 // executor only, views whose pages are preserved
+    int32_t latest;                     // atomic, newest view | -1
+    uint64_t published_tape_idx;        // executor only
+    uint8_t published_flag;
+
+    // linearizable reads: the commit index of the cell, confirmed with the leader | NULL
+    uint64_t (*commit_idx_cb)(void* cb_arg);
+    void* commit_idx_cb_arg;
+} follower_read_t;
+
+// ** executor side **
+
+void
+follower_read_member_visit_fn(void* arg, const char* name, void* p, uint64_t len){
+    follower_read_t* frp = (follower_read_t*)arg;
+    follower_read_member_t* mp;
+    uint32_t i, nth = 0;
+    if(frp->member_ct == FOLLOWER_READ_MEMBER_CT_MAX){
+        return;
+    }
+    for(i = 0; i < frp->member_ct; i++){
+        if(frp->members[i].name == name || strcmp(frp->members[i].name, name) == 0){
+            nth++;
+        }
+    }
+    mp = &frp->members[frp->member_ct];
+    mp->name = name;
+    mp->nth = nth;
+    mp->offset = frp->small_state_len;
+    mp->len = (uint32_t)len;
+    frp->member_ct++;
+    frp->small_state_len += (uint32_t)len;
+}
+
+// save the page into every live view which still shares it with the computer, right
+// before it is written
+void
+follower_read_preserve(follower_read_t* frp, uint32_t page, const uint8_t* src, uint32_t len){
+    follower_read_view_t* vp;
+    uint32_t i;
+    uint8_t saved_flag = 0;
+    for(i = 0; i < FOLLOWER_READ_VIEW_CT; i++){
+        vp = &frp->views[i];
+        if(!((frp->live_mask >> i) & 1) || vp->slots[page]){
+            continue;
+        }
+        if(vp->pool_ct == frp->pool_page_ct){
+            __atomic_store_n(&vp->broken_flag, 1, __ATOMIC_RELEASE);
+            frp->live_mask &= ~((uint32_t)1 << i);
+            saved_flag = 1;
+            continue;
+        }
+        memcpy(vp->pool + ((uint64_t)vp->pool_ct << PHYS_MEM_PAGE_SHIFT), src, len);
+        vp->pool_pages[vp->pool_ct] = page;
+        vp->pool_ct++;
+        __atomic_store_n(&vp->slots[page], vp->pool_ct, __ATOMIC_RELEASE);
+        saved_flag = 1;
+    }
+    if(saved_flag){ // before the write of the page, a reader of the live page sees the slot
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+// turingcell_computer_ram_write_cb_t
+void
+follower_read_ram_write_cb(void* cb_arg, uint32_t ram_pfn){
+    follower_read_t* frp = (follower_read_t*)cb_arg;
+    follower_read_preserve(frp, ram_pfn,
+        frp->cp->ram_hostp + ((uint64_t)ram_pfn << PHYS_MEM_PAGE_SHIFT), PHYS_MEM_PAGE_SIZE);
+}
+
+// turingcell_computer_disk_delta_cb_t
+void
+follower_read_disk_delta_cb(void* cb_arg, uint32_t block_no){
+    follower_read_t* frp = (follower_read_t*)cb_arg;
+    uint32_t page = turingcell_computer_state_block_map_page(frp->cp, block_no);
+    const uint8_t* src;
+    uint32_t len;
+    src = turingcell_computer_state_page(frp->cp, page, &len);
+    follower_read_preserve(frp, page, src, len);
+}
+
+// ret u8: 1 if the view is not held by any reader and has been taken out of service | 0 if not
+uint8_t
+follower_read_view_retire(follower_read_t* frp, uint32_t idx){
+    follower_read_view_t* vp = &frp->views[idx];
+    if(pthread_mutex_trylock(&vp->lock) != 0){ // a reader is at it, never wait
+        return 0;
+    }
+    if(vp->reader_ct){
+        pthread_mutex_unlock(&vp->lock);
+        return 0;
+    }
+    vp->valid_flag = 0;
+    pthread_mutex_unlock(&vp->lock);
+    frp->live_mask &= ~((uint32_t)1 << idx);
+    return 1;
+}
+
+// the state of the computer right now becomes the newest view, if a view is free
+void
+follower_read_publish(follower_read_t* frp){
+    turingcell_computer_t* cp = frp->cp;
+    int32_t latest = __atomic_load_n(&frp->latest, __ATOMIC_RELAXED);
+    follower_read_view_t* vp;
+    uint32_t i, idx = FOLLOWER_READ_VIEW_CT;
+    // the views older than the latest are not handed out any more, retire what is free
+    for(i = 0; i < FOLLOWER_READ_VIEW_CT; i++){
+        vp = &frp->views[i];
+        if((int32_t)i == latest && !__atomic_load_n(&vp->broken_flag, __ATOMIC_RELAXED)){
+            continue;
+        }
+        if((vp->valid_flag || ((frp->live_mask >> i) & 1)) && !follower_read_view_retire(frp, i)){
+            continue;
+        }
+        if(idx == FOLLOWER_READ_VIEW_CT){
+            idx = i;
+        }
+    }
+    if(idx == FOLLOWER_READ_VIEW_CT){ // every view is held, the next turn tries again
+        return;
+    }
+    vp = &frp->views[idx];
+    for(i = 0; i < vp->pool_ct; i++){
+        vp->slots[vp->pool_pages[i]] = 0;
+    }
+    vp->pool_ct = 0;
+    vp->broken_flag = 0;
+    vp->tape_idx = cp->applied_tape_idx;
+    vp->uart_published_ct = __atomic_load_n(&cp->uart.txp->published_ct, __ATOMIC_RELAXED);
+    turingcell_computer_small_state_save(cp, 0, vp->small_state);
+    turingcell_computer_ram_watch_rearm(cp);
+    pthread_mutex_lock(&vp->lock);
+    vp->valid_flag = 1;
+    pthread_mutex_unlock(&vp->lock);
+    frp->live_mask |= (uint32_t)1 << idx;
+    __atomic_store_n(&frp->latest, (int32_t)idx, __ATOMIC_RELEASE);
+    frp->published_tape_idx = cp->applied_tape_idx;
+    frp->published_flag = 1;
+}
+
+// cell_runtime_tape_hook_t.fn, a view at the end of every turn which applied anything
+void
+follower_read_hook_fn(void* ctx, turingcell_computer_t* cp,
+    const cell_runtime_tape_entry_t* entryp){
+
+    follower_read_t* frp = (follower_read_t*)ctx;
+    if(entryp == NULL &&
+        (!frp->published_flag || cp->applied_tape_idx != frp->published_tape_idx)){
+        follower_read_publish(frp);
+    }
+    if(frp->next_hookp){
+        frp->next_hookp->fn(frp->next_hookp->ctx, cp, entryp);
+    }
+}
+
+// pool_page_ct of 0 means the paged state >> FOLLOWER_READ_POOL_SHIFT; commit_idx_cb gives the
+// commit index of the cell, confirmed with the leader, NULL if there are no linearizable reads
+// ret int: 0 if success | -1 if failed
+int
+follower_read_init(follower_read_t* frp, turingcell_computer_t* cp, uint32_t pool_page_ct,
+    uint64_t (*commit_idx_cb)(void* cb_arg), void* commit_idx_cb_arg){
+
+    follower_read_view_t* vp;
+    uint32_t i;
+    memset(frp, 0, sizeof(*frp));
+    frp->cp = cp;
+    frp->latest = -1;
+    frp->page_ct = turingcell_computer_state_page_ct(cp);
+    if(pool_page_ct == 0){
+        pool_page_ct = frp->page_ct >> FOLLOWER_READ_POOL_SHIFT;
+        if(pool_page_ct < FOLLOWER_READ_POOL_PAGE_CT_MIN){
+            pool_page_ct = FOLLOWER_READ_POOL_PAGE_CT_MIN;
+        }
+    }
+    frp->pool_page_ct = pool_page_ct;
+    frp->commit_idx_cb = commit_idx_cb;
+    frp->commit_idx_cb_arg = commit_idx_cb_arg;
+    turingcell_computer_small_state_visit(cp, 0, follower_read_member_visit_fn, frp);
+    frp->hook.fn = follower_read_hook_fn;
+    frp->hook.ctx = frp;
+    for(i = 0; i < FOLLOWER_READ_VIEW_CT; i++){
+        vp = &frp->views[i];
+        if(pthread_mutex_init(&vp->lock, NULL) != 0){
+            return -1;
+        }
+        vp->small_state = malloc(frp->small_state_len ? frp->small_state_len : 1);
+        vp->slots = calloc(frp->page_ct ? frp->page_ct : 1, sizeof(uint32_t));
+        vp->pool_pages = malloc(frp->pool_page_ct * sizeof(uint32_t));
+        vp->pool = malloc((uint64_t)frp->pool_page_ct << PHYS_MEM_PAGE_SHIFT);
+        if(!vp->small_state || !vp->slots || !vp->pool_pages || !vp->pool){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// before the cell runs (or between two of its turns, with its hook not in use): the views
+// are published by the tape hook of the cell, which chains to the hook set so far
+void
+follower_read_attach(follower_read_t* frp, cell_runtime_cell_t* cellp){
+    turingcell_computer_t* cp = frp->cp;
+    frp->cellp = cellp;
+    frp->next_hookp = __atomic_load_n(&cellp->tape_hookp, __ATOMIC_ACQUIRE);
+    turingcell_computer_disk_watch_start(cp, &frp->disk_watch, follower_read_disk_delta_cb, frp);
+    turingcell_computer_ram_watch(cp, follower_read_ram_write_cb, frp);
+    follower_read_publish(frp);
+    __atomic_store_n(&cellp->tape_hookp, &frp->hook, __ATOMIC_RELEASE);
+}
+
+// the cell is not running, its page table (that of its last worker) is still there
+void
+follower_read_detach(follower_read_t* frp){
+    turingcell_computer_t* cp = frp->cp;
+    __atomic_store_n(&frp->cellp->tape_hookp, frp->next_hookp, __ATOMIC_RELEASE);
+    turingcell_computer_ram_watch(cp, NULL, NULL);
+    turingcell_computer_disk_watch_stop(cp, &frp->disk_watch);
+}
+
+// no reader left
+void
+follower_read_destroy(follower_read_t* frp){
+    uint32_t i;
+    for(i = 0; i < FOLLOWER_READ_VIEW_CT; i++){
+        free(frp->views[i].small_state);
+        free(frp->views[i].slots);
+        free(frp->views[i].pool_pages);
+        free(frp->views[i].pool);
+        pthread_mutex_destroy(&frp->views[i].lock);
+    }
+}
+
+// ** reader side **
+
+// ret follower_read_view_t*: the newest view, if at min_tape_idx at least | NULL if none yet
+follower_read_view_t*
+follower_read_acquire(follower_read_t* frp, uint64_t min_tape_idx){
+    follower_read_view_t* vp;
+    int32_t idx;
+    uint32_t i;
+    for(i = 0; i < FOLLOWER_READ_ACQUIRE_TRY_CT; i++){
+        idx = __atomic_load_n(&frp->latest, __ATOMIC_ACQUIRE);
+        if(idx < 0){
+            return NULL;
+        }
+        vp = &frp->views[idx];
+        pthread_mutex_lock(&vp->lock);
+        if(vp->valid_flag && !__atomic_load_n(&vp->broken_flag, __ATOMIC_ACQUIRE)){
+            if(vp->tape_idx < min_tape_idx){
+                pthread_mutex_unlock(&vp->lock);
+                return NULL;
+            }
+            vp->reader_ct++;
+            pthread_mutex_unlock(&vp->lock);
+            return vp;
+        }
+        pthread_mutex_unlock(&vp->lock); // recycled right after it was looked up
+        sched_yield();
+    }
+    return NULL;
+}
+
+void
+follower_read_release(follower_read_view_t* vp){
+    pthread_mutex_lock(&vp->lock);
+    vp->reader_ct--;
+    pthread_mutex_unlock(&vp->lock);
+}
+
+// [off, off + len) of the page as of the view, live is the page in the computer
+// ret int: 0 if success | -1 if the view broke meanwhile
+int
+follower_read_view_page(follower_read_view_t* vp, uint32_t page, const uint8_t* live,
+    uint32_t off, uint8_t* dst, uint32_t len){
+
+    uint32_t slot = __atomic_load_n(&vp->slots[page], __ATOMIC_ACQUIRE);
+    if(slot == 0){
+        memcpy(dst, live + off, len);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        slot = __atomic_load_n(&vp->slots[page], __ATOMIC_ACQUIRE);
+        if(slot == 0){ // not written since the view, or not saved
+            return __atomic_load_n(&vp->broken_flag, __ATOMIC_ACQUIRE) ? -1 : 0;
+        }
+    }
+    memcpy(dst, vp->pool + ((uint64_t)(slot - 1) << PHYS_MEM_PAGE_SHIFT) + off, len);
+    return 0;
+}
+
+// guest RAM [paddr, paddr + len) as of a view at min_tape_idx at least
+// ret int: FOLLOWER_READ_OK, the idx of the view in *tape_idxp | FOLLOWER_READ_NOT_YET
+//          | FOLLOWER_READ_ERROR if the range is not RAM
+int
+follower_read_ram(follower_read_t* frp, uint64_t min_tape_idx, uint32_t paddr, uint8_t* dst,
+    uint32_t len, uint64_t* tape_idxp){
+
+    turingcell_computer_t* cp = frp->cp;
+    follower_read_view_t* vp;
+    uint32_t off, n, done;
+    if(paddr < TURINGCELL_COMPUTER_PADDR_RAM ||
+        (uint64_t)paddr - TURINGCELL_COMPUTER_PADDR_RAM + len > cp->ram_size){
+        return FOLLOWER_READ_ERROR;
+    }
+    paddr -= TURINGCELL_COMPUTER_PADDR_RAM;
+    for(;;){
+        vp = follower_read_acquire(frp, min_tape_idx);
+        if(vp == NULL){
+            return FOLLOWER_READ_NOT_YET;
+        }
+        for(done = 0; done < len; done += n){
+            off = (paddr + done) & PHYS_MEM_PAGE_MASK;
+            n = PHYS_MEM_PAGE_SIZE - off;
+            if(n > len - done){
+                n = len - done;
+            }
+            if(follower_read_view_page(vp, (paddr + done) >> PHYS_MEM_PAGE_SHIFT,
+                cp->ram_hostp + ((paddr + done) & ~(uint32_t)PHYS_MEM_PAGE_MASK), off,
+                dst + done, n) != 0){
+                break;
+            }
+        }
+        *tape_idxp = vp->tape_idx;
+        follower_read_release(vp);
+        if(done == len){
+            return FOLLOWER_READ_OK;
+        }
+    }
+}
+
+// content of a disk block as of a view at min_tape_idx at least
+// ret int: FOLLOWER_READ_OK | FOLLOWER_READ_NOT_YET | FOLLOWER_READ_ERROR if no such block or
+//          the backend failed to get it
+int
+follower_read_disk_block(follower_read_t* frp, uint64_t min_tape_idx, uint32_t block_no,
+    uint8_t* dst, uint64_t* tape_idxp){
+
+    turingcell_computer_t* cp = frp->cp;
+    io_device_disk_hash_t hash;
+    follower_read_view_t* vp;
+    const uint8_t* live;
+    uint32_t page, len;
+    int ret;
+    if(block_no >= cp->disk.block_ct){
+        return FOLLOWER_READ_ERROR;
+    }
+    page = turingcell_computer_state_block_map_page(cp, block_no);
+    live = turingcell_computer_state_page(cp, page, &len);
+    do{
+        vp = follower_read_acquire(frp, min_tape_idx);
+        if(vp == NULL){
+            return FOLLOWER_READ_NOT_YET;
+        }
+        ret = follower_read_view_page(vp, page, live,
+            (block_no % TURINGCELL_COMPUTER_BLOCK_MAP_PAGE_HASH_CT) * sizeof(io_device_disk_hash_t),
+            hash.u8, sizeof(hash));
+        *tape_idxp = vp->tape_idx;
+        follower_read_release(vp);
+    }while(ret != 0);
+    // a chunk never changes, it can be got after the view is released
+    if(io_device_disk_read_block(&hash, frp->disk_watch.innerp, 0, dst) != 0){
+        return FOLLOWER_READ_ERROR;
+    }
+    return FOLLOWER_READ_OK;
+}
+
+// a member of the small state as of a view at min_tape_idx at least, by its name in
+// `turingcell_computer_state_visit` and its occurrence (the vCPU for "cpup->*")
+// ret int: FOLLOWER_READ_OK | FOLLOWER_READ_NOT_YET | FOLLOWER_READ_ERROR if no such member
+//          or len differs
+int
+follower_read_member(follower_read_t* frp, uint64_t min_tape_idx, const char* name,
+    uint32_t nth, void* dst, uint32_t len, uint64_t* tape_idxp){
+
+    follower_read_member_t* mp = NULL;
+    follower_read_view_t* vp;
+    uint32_t i;
+    for(i = 0; i < frp->member_ct; i++){
+        if(frp->members[i].nth == nth && strcmp(frp->members[i].name, name) == 0){
+            mp = &frp->members[i];
+            break;
+        }
+    }
+    if(mp == NULL || mp->len != len){
+        return FOLLOWER_READ_ERROR;
+    }
+    vp = follower_read_acquire(frp, min_tape_idx);
+    if(vp == NULL){
+        return FOLLOWER_READ_NOT_YET;
+    }
+    memcpy(dst, vp->small_state + mp->offset, len);
+    *tape_idxp = vp->tape_idx;
+    follower_read_release(vp);
+    return FOLLOWER_READ_OK;
+}
+
+// uart output from *offsetp on, up to what was sent as of a view at min_tape_idx at least.
+// Bytes already acked could have been reused, *offsetp is moved up to the acked offset then.
+// ret int: amount of bytes copied | -FOLLOWER_READ_NOT_YET
+int
+follower_read_uart(follower_read_t* frp, uint64_t min_tape_idx, uint64_t* offsetp,
+    uint8_t* dst, uint32_t len, uint64_t* tape_idxp){
+
+    const io_device_uart_tx_ring_t* txp = frp->cp->uart.txp;
+    uint32_t mask = txp->data_size - 1;
+    follower_read_view_t* vp;
+    uint64_t end, acked, o;
+    vp = follower_read_acquire(frp, min_tape_idx);
+    if(vp == NULL){
+        return -FOLLOWER_READ_NOT_YET;
+    }
+    end = vp->uart_published_ct;
+    *tape_idxp = vp->tape_idx;
+    follower_read_release(vp);
+    for(;;){
+        acked = __atomic_load_n(&txp->acked_ct, __ATOMIC_ACQUIRE);
+        if(*offsetp < acked){
+            *offsetp = acked;
+        }
+        if(*offsetp >= end){
+            return 0;
+        }
+        if(end - *offsetp < len){
+            len = (uint32_t)(end - *offsetp);
+        }
+        for(o = 0; o < len; o++){
+            dst[o] = txp->data[(*offsetp + o) & mask];
+        }
+        // a byte is overwritten only after it has been acked
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&txp->acked_ct, __ATOMIC_ACQUIRE) <= *offsetp){
+            return (int)len;
+        }
+    }
+}
+
+// the commit index of the cell into *idxp, for a linearizable read at it
+// ret int: FOLLOWER_READ_OK | FOLLOWER_READ_ERROR if no commit_idx_cb was given
+// always_inline
+inline int
+follower_read_linearizable_idx(follower_read_t* frp, uint64_t* idxp){
+    if(frp->commit_idx_cb == NULL){
+        return FOLLOWER_READ_ERROR;
+    }
+    *idxp = frp->commit_idx_cb(frp->commit_idx_cb_arg);
+    return FOLLOWER_READ_OK;
+}
+
+// wait for a view at min_tape_idx at least, polling
+// ret int: FOLLOWER_READ_OK | FOLLOWER_READ_NOT_YET if timed out
+int
+follower_read_wait(follower_read_t* frp, uint64_t min_tape_idx, uint64_t timeout_ns){
+    struct timespec ts, now;
+    follower_read_view_t* vp;
+    uint64_t start_ns;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    for(;;){
+        vp = follower_read_acquire(frp, min_tape_idx);
+        if(vp){
+            follower_read_release(vp);
+            return FOLLOWER_READ_OK;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if((uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec - start_ns >= timeout_ns){
+            return FOLLOWER_READ_NOT_YET;
+        }
+        sched_yield();
+    }
+}
+
+#endif
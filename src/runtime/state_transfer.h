@@ -0,0 +1,537 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** state transfer **
+// host side, NOT a md part: the state of a running cell streamed to a new replica (a
+// membership change) while the cell keeps applying its tape, so the pause of the cell is
+// proportional to what it writes during the last round, not to its RAM.
+//
+// the source works at the end of the turns of the cell (tape hook of cell_runtime.h):
+//  - pre-copy: the pages of the paged state (RAM, then the disk block map, see "paged and
+//    small state" in turingcell_computer_md.c) are sent in rounds, at most page_budget pages
+//    per turn. The first round sends every page, each next one the pages written since they
+//    were sent: the RAM is watched (turingcell_computer_ram_watch), a page is write protected
+//    again right after it is sent; the disk block map is watched too
+//    (turingcell_computer_disk_watch_start).
+//  - final delta: once a round leaves final_page_ct dirty pages at most, or after round_max
+//    rounds, the remaining dirty pages, the small state (cpu registers, device registers, the
+//    uart tx ring with its data) and the applied tape idx X are sent in one turn end. The
+//    receiver holds the state at X then, its cell joins by applying the tape entries after X.
+// the chunks of the disk are content addressed and never change, only their hashes are
+// sent: the backend of the receiver gets them by hash like any other replica.
+//
+// messages, each a state_transfer_msg_t followed by len bytes of data:
+//     BEGIN        state_transfer_geometry_t, the receiver must have the same configuration
+//     PAGE ...     the page, len 0 if it is all zeros
+//     SMALL_STATE  the small state at tape_idx
+//     END          the state hash at tape_idx if verify_flag, nothing otherwise
+// send_cb is called on the worker running the cell, it must not wait for the receiver.
+//
+// the RAM watch and the disk backend of an observer attached before (follower_read.h) are
+// chained to, detach in the reverse order of attach.
+//
+// usage, source:
+//     state_transfer_init(&st, cp, send_cb, send_cb_arg);
+//     state_transfer_attach(&st, cellp);       before the cell runs, or between two turns
+//     ... poll state_transfer_phase(&st) until STATE_TRANSFER_PHASE_DONE
+//     state_transfer_detach(&st); state_transfer_destroy(&st);  once the cell does not run
+// receiver, with a computer of the same configuration fresh from `turingcell_computer_init`:
+//     state_transfer_receiver_init(&rx, cp);
+//     for every message: state_transfer_receive(&rx, &msg, data) until STATE_TRANSFER_JOINED,
+//     then the cell applies the tape from rx.tape_idx + 1 on
+//
+// must be included after turingcell_computer_md.c
+
+#ifndef STATE_TRANSFER_H
+#define STATE_TRANSFER_H
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include "cell_runtime.h"
+
+#define STATE_TRANSFER_PAGE_BUDGET          256     // default pages sent per turn
+#define STATE_TRANSFER_FINAL_PAGE_CT        64      // default dirty pages left for the final
+#define STATE_TRANSFER_ROUND_MAX            8       // default pre-copy rounds at most
+#define STATE_TRANSFER_SMALL_FLAGS          TURINGCELL_COMPUTER_SMALL_TX_DATA
+
+#define STATE_TRANSFER_MSG_BEGIN            1
+#define STATE_TRANSFER_MSG_PAGE             2
+#define STATE_TRANSFER_MSG_SMALL_STATE      3
+#define STATE_TRANSFER_MSG_END              4
+
+#define STATE_TRANSFER_PHASE_PRECOPY        0
+#define STATE_TRANSFER_PHASE_DONE           1
+#define STATE_TRANSFER_PHASE_FAILED         2       // send_cb failed
+
+#define STATE_TRANSFER_MORE                 0
+#define STATE_TRANSFER_JOINED               1
+#define STATE_TRANSFER_ERROR                (-1)
+
+typedef struct {
+    uint32_t type;                      // STATE_TRANSFER_MSG_*
+    uint32_t page;                      // PAGE: of the paged state
+    uint32_t len;                       // of the data
+    uint32_t round;                     // of the pre-copy
+    uint64_t tape_idx;                  // SMALL_STATE and END: the state is at it
+} state_transfer_msg_t;
+
+typedef struct {
+    uint64_t ram_size;
+    uint32_t block_ct;
+    uint32_t page_ct;
+    uint32_t small_state_len;
+    uint32_t reserved;                  // 0
+} state_transfer_geometry_t;
+
+// ret int: 0 if success | -1 if failed, the transfer is given up
+typedef int (*state_transfer_send_cb_t)(void* cb_arg, const state_transfer_msg_t* msgp,
+    const uint8_t* data);
+
+typedef struct {
+    cell_runtime_tape_hook_t hook;
+    cell_runtime_tape_hook_t* next_hookp;   // called after this one
+    turingcell_computer_t* cp;
+    cell_runtime_cell_t* cellp;
+
+    turingcell_computer_disk_watch_t disk_watch;
+    // the RAM watch set before, chained to
+    turingcell_computer_ram_write_cb_t inner_ram_write_cb;
+    void* inner_ram_write_cb_arg;
+    uint8_t watch_released_flag;
+
+    state_transfer_send_cb_t send_cb;
+    void* send_cb_arg;
+    // tunables, may be changed between init and attach
+    uint32_t page_budget;
+    uint32_t final_page_ct;
+    uint32_t round_max;
+    uint8_t verify_flag;                // the END carries the state hash, costs a pass on RAM
+
+    uint32_t page_ct;                   // of the paged state
+    uint32_t small_state_len;
+    uint8_t* small_state;
+    uint64_t* dirty_bits;               // bit per page, written since it was sent
+    uint32_t dirty_ct;
+    uint32_t cursor;                    // next page of the round to look at
+    uint32_t round;
+    uint8_t begun_flag;
+    uint8_t phase;                      // STATE_TRANSFER_PHASE_*, atomic
+
+    // results, valid once done
+    uint64_t sent_page_ct;
+    uint32_t final_delta_page_ct;       // pages sent in the final delta, with the cell paused
+    uint64_t tape_idx;                  // of the final delta
+} state_transfer_t;
+
+// ** source side **
+
+// always_inline
+inline void
+state_transfer_mark(state_transfer_t* stp, uint32_t page){
+    uint64_t bit = (uint64_t)1 << (page & 63);
+    if(!(stp->dirty_bits[page >> 6] & bit)){
+        stp->dirty_bits[page >> 6] |= bit;
+        stp->dirty_ct++;
+    }
+}
+
+// turingcell_computer_ram_write_cb_t
+void
+state_transfer_ram_write_cb(void* cb_arg, uint32_t ram_pfn){
+    state_transfer_t* stp = (state_transfer_t*)cb_arg;
+    if(stp->phase == STATE_TRANSFER_PHASE_PRECOPY){
+        state_transfer_mark(stp, ram_pfn);
+    }
+    if(stp->inner_ram_write_cb){
+        stp->inner_ram_write_cb(stp->inner_ram_write_cb_arg, ram_pfn);
+    }
+}
+
+// turingcell_computer_disk_delta_cb_t
+void
+state_transfer_disk_delta_cb(void* cb_arg, uint32_t block_no){
+    state_transfer_t* stp = (state_transfer_t*)cb_arg;
+    if(stp->phase == STATE_TRANSFER_PHASE_PRECOPY){
+        state_transfer_mark(stp, turingcell_computer_state_block_map_page(stp->cp, block_no));
+    }
+}
+
+// always_inline
+inline int
+state_transfer_send(state_transfer_t* stp, uint32_t type, uint32_t page, uint32_t len,
+    const uint8_t* data){
+
+    state_transfer_msg_t msg;
+    msg.type = type;
+    msg.page = page;
+    msg.len = len;
+    msg.round = stp->round;
+    msg.tape_idx = stp->cp->applied_tape_idx;
+    return stp->send_cb(stp->send_cb_arg, &msg, data);
+}
+
+// ret int: 0 if success | -1 if send_cb failed
+int
+state_transfer_send_page(state_transfer_t* stp, uint32_t page){
+    turingcell_computer_t* cp = stp->cp;
+    const uint8_t* src;
+    uint32_t len, i;
+    stp->dirty_bits[page >> 6] &= ~((uint64_t)1 << (page & 63));
+    stp->dirty_ct--;
+    src = turingcell_computer_state_page(cp, page, &len);
+    if(page < turingcell_computer_state_ram_page_ct(cp)){
+        // its next write marks it again
+        turingcell_computer_ram_watch_rearm_page(cp, page);
+    }
+    for(i = 0; i < len && src[i] == 0; i++){
+    }
+    stp->sent_page_ct++;
+    return state_transfer_send(stp, STATE_TRANSFER_MSG_PAGE, page, i == len ? 0 : len, src);
+}
+
+// the next dirty page from the cursor on, in this round
+// ret u32: the page | page_ct if none left in the round
+// always_inline
+inline uint32_t
+state_transfer_next_dirty(state_transfer_t* stp){
+    uint32_t page = stp->cursor;
+    uint64_t word;
+    while(page < stp->page_ct){
+        word = stp->dirty_bits[page >> 6] >> (page & 63);
+        if(word){
+            page += (uint32_t)__builtin_ctzll(word);
+            return page < stp->page_ct ? page : stp->page_ct;
+        }
+        page = (page | 63) + 1;
+    }
+    return stp->page_ct;
+}
+
+// stop marking, the watch set before is given back right away if still ours
+void
+state_transfer_finish(state_transfer_t* stp, uint8_t phase){
+    turingcell_computer_t* cp = stp->cp;
+    if(cp->ram_write_cb == state_transfer_ram_write_cb && cp->ram_write_cb_arg == stp){
+        turingcell_computer_ram_watch(cp, stp->inner_ram_write_cb, stp->inner_ram_write_cb_arg);
+        stp->watch_released_flag = 1;
+    }
+    __atomic_store_n(&stp->phase, phase, __ATOMIC_RELEASE);
+}
+
+// the remaining dirty pages, the small state and the end, in this turn end
+// ret int: 0 if success | -1 if send_cb failed
+int
+state_transfer_send_final(state_transfer_t* stp){
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint32_t page;
+    stp->cursor = 0;
+    stp->final_delta_page_ct = stp->dirty_ct;
+    while((page = state_transfer_next_dirty(stp)) < stp->page_ct){
+        if(state_transfer_send_page(stp, page) != 0){
+            return -1;
+        }
+        stp->cursor = page + 1;
+    }
+    turingcell_computer_small_state_save(stp->cp, STATE_TRANSFER_SMALL_FLAGS, stp->small_state);
+    if(state_transfer_send(stp, STATE_TRANSFER_MSG_SMALL_STATE, 0, stp->small_state_len,
+        stp->small_state) != 0){
+
+        return -1;
+    }
+    stp->tape_idx = stp->cp->applied_tape_idx;
+    if(stp->verify_flag){
+        turingcell_computer_state_hash(stp->cp, digest);
+        return state_transfer_send(stp, STATE_TRANSFER_MSG_END, 0, SHA256_DIGEST_SIZE, digest);
+    }
+    return state_transfer_send(stp, STATE_TRANSFER_MSG_END, 0, 0, NULL);
+}
+
+// one turn end of the pre-copy: up to page_budget dirty pages, the final delta once the
+// rounds have converged
+// ret int: 0 if success | 1 if the final delta has been sent | -1 if send_cb failed
+int
+state_transfer_step(state_transfer_t* stp){
+    state_transfer_geometry_t geo;
+    uint32_t page, n = 0;
+    if(!stp->begun_flag){
+        memset(&geo, 0, sizeof(geo));
+        geo.ram_size = stp->cp->ram_size;
+        geo.block_ct = stp->cp->disk.block_ct;
+        geo.page_ct = stp->page_ct;
+        geo.small_state_len = stp->small_state_len;
+        if(state_transfer_send(stp, STATE_TRANSFER_MSG_BEGIN, 0, sizeof(geo),
+            (const uint8_t*)&geo) != 0){
+
+            return -1;
+        }
+        stp->begun_flag = 1;
+    }
+    while(n < stp->page_budget){
+        page = state_transfer_next_dirty(stp);
+        if(page == stp->page_ct){ // end of the round
+            stp->round++;
+            stp->cursor = 0;
+            if(stp->dirty_ct <= stp->final_page_ct || stp->round >= stp->round_max){
+                return state_transfer_send_final(stp) == 0 ? 1 : -1;
+            }
+            continue;
+        }
+        if(state_transfer_send_page(stp, page) != 0){
+            return -1;
+        }
+        stp->cursor = page + 1;
+        n++;
+    }
+    return 0;
+}
+
+// cell_runtime_tape_hook_t.fn, a step at the end of every turn until done
+void
+state_transfer_hook_fn(void* ctx, turingcell_computer_t* cp,
+    const cell_runtime_tape_entry_t* entryp){
+
+    state_transfer_t* stp = (state_transfer_t*)ctx;
+    int ret;
+    if(entryp == NULL && stp->phase == STATE_TRANSFER_PHASE_PRECOPY){
+        ret = state_transfer_step(stp);
+        if(ret != 0){
+            state_transfer_finish(stp, ret > 0 ? STATE_TRANSFER_PHASE_DONE :
+                STATE_TRANSFER_PHASE_FAILED);
+        }
+    }
+    if(stp->next_hookp){
+        stp->next_hookp->fn(stp->next_hookp->ctx, cp, entryp);
+    }
+}
+
+// page_budget, final_page_ct, round_max and verify_flag get their defaults
+// ret int: 0 if success | -1 if failed
+int
+state_transfer_init(state_transfer_t* stp, turingcell_computer_t* cp,
+    state_transfer_send_cb_t send_cb, void* send_cb_arg){
+
+    memset(stp, 0, sizeof(*stp));
+    stp->cp = cp;
+    stp->send_cb = send_cb;
+    stp->send_cb_arg = send_cb_arg;
+    stp->page_budget = STATE_TRANSFER_PAGE_BUDGET;
+    stp->final_page_ct = STATE_TRANSFER_FINAL_PAGE_CT;
+    stp->round_max = STATE_TRANSFER_ROUND_MAX;
+    stp->page_ct = turingcell_computer_state_page_ct(cp);
+    stp->small_state_len = turingcell_computer_small_state_len(cp, STATE_TRANSFER_SMALL_FLAGS);
+    stp->hook.fn = state_transfer_hook_fn;
+    stp->hook.ctx = stp;
+    stp->small_state = malloc(stp->small_state_len ? stp->small_state_len : 1);
+    stp->dirty_bits = calloc((stp->page_ct + 63) / 64 + 1, sizeof(uint64_t));
+    return stp->small_state && stp->dirty_bits ? 0 : -1;
+}
+
+// before the cell runs (or between two of its turns, with its hook not in use): every page
+// is dirty, the first round starts with the next turn end
+void
+state_transfer_attach(state_transfer_t* stp, cell_runtime_cell_t* cellp){
+    turingcell_computer_t* cp = stp->cp;
+    uint32_t page;
+    stp->cellp = cellp;
+    stp->next_hookp = __atomic_load_n(&cellp->tape_hookp, __ATOMIC_ACQUIRE);
+    for(page = 0; page < stp->page_ct; page++){
+        state_transfer_mark(stp, page);
+    }
+    turingcell_computer_disk_watch_start(cp, &stp->disk_watch, state_transfer_disk_delta_cb, stp);
+    stp->inner_ram_write_cb = cp->ram_write_cb;
+    stp->inner_ram_write_cb_arg = cp->ram_write_cb_arg;
+    turingcell_computer_ram_watch(cp, state_transfer_ram_write_cb, stp);
+    __atomic_store_n(&cellp->tape_hookp, &stp->hook, __ATOMIC_RELEASE);
+}
+
+// ret u8: STATE_TRANSFER_PHASE_*, from any thread
+// always_inline
+inline uint8_t
+state_transfer_phase(state_transfer_t* stp){
+    return __atomic_load_n(&stp->phase, __ATOMIC_ACQUIRE);
+}
+
+// the cell is not running; done or not, the transfer is over
+void
+state_transfer_detach(state_transfer_t* stp){
+    turingcell_computer_t* cp = stp->cp;
+    __atomic_store_n(&stp->cellp->tape_hookp, stp->next_hookp, __ATOMIC_RELEASE);
+    if(!stp->watch_released_flag){
+        turingcell_computer_ram_watch(cp, stp->inner_ram_write_cb, stp->inner_ram_write_cb_arg);
+        stp->watch_released_flag = 1;
+    }
+    turingcell_computer_disk_watch_stop(cp, &stp->disk_watch);
+}
+
+void
+state_transfer_destroy(state_transfer_t* stp){
+    free(stp->small_state);
+    free(stp->dirty_bits);
+}
+
+// state_transfer_send_cb_t writing the messages to the fd pointed by cb_arg, e.g. a socket
+// to the new replica; it blocks on a full pipe, a queue in between keeps the worker going
+int
+state_transfer_fd_send_cb(void* cb_arg, const state_transfer_msg_t* msgp, const uint8_t* data){
+    int fd = *(int*)cb_arg;
+    const uint8_t* p = (const uint8_t*)msgp;
+    uint64_t len = sizeof(*msgp);
+    ssize_t n;
+    uint8_t i;
+    for(i = 0; i < 2; i++){
+        while(len){
+            n = write(fd, p, len);
+            if(n <= 0){
+                return -1;
+            }
+            p += n;
+            len -= (uint64_t)n;
+        }
+        p = data;
+        len = msgp->len;
+    }
+    return 0;
+}
+
+// ** receiver side **
+
+typedef struct {
+    turingcell_computer_t* cp;
+    uint32_t page_ct;
+    uint32_t small_state_len;
+    uint8_t begun_flag;
+    uint8_t small_state_flag;
+    uint64_t tape_idx;                  // the state is at it once joined
+} state_transfer_receiver_t;
+
+// cp is fresh from `turingcell_computer_init`, in the configuration of the source
+void
+state_transfer_receiver_init(state_transfer_receiver_t* rxp, turingcell_computer_t* cp){
+    memset(rxp, 0, sizeof(*rxp));
+    rxp->cp = cp;
+    rxp->page_ct = turingcell_computer_state_page_ct(cp);
+    rxp->small_state_len = turingcell_computer_small_state_len(cp, STATE_TRANSFER_SMALL_FLAGS);
+}
+
+// apply one message, in the order sent
+// ret int: STATE_TRANSFER_MORE | STATE_TRANSFER_JOINED, the state is at rxp->tape_idx
+//          | STATE_TRANSFER_ERROR if malformed, of another configuration or the hash differs
+int
+state_transfer_receive(state_transfer_receiver_t* rxp, const state_transfer_msg_t* msgp,
+    const uint8_t* data){
+
+    turingcell_computer_t* cp = rxp->cp;
+    state_transfer_geometry_t geo;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint8_t* dst;
+    uint32_t len;
+    if(msgp->type != STATE_TRANSFER_MSG_BEGIN && !rxp->begun_flag){
+        return STATE_TRANSFER_ERROR;
+    }
+    switch(msgp->type){
+        case STATE_TRANSFER_MSG_BEGIN:
+            if(msgp->len != sizeof(geo)){
+                return STATE_TRANSFER_ERROR;
+            }
+            memcpy(&geo, data, sizeof(geo));
+            if(geo.ram_size != cp->ram_size || geo.block_ct != cp->disk.block_ct ||
+                geo.page_ct != rxp->page_ct || geo.small_state_len != rxp->small_state_len){
+
+                return STATE_TRANSFER_ERROR;
+            }
+            rxp->begun_flag = 1;
+            return STATE_TRANSFER_MORE;
+        case STATE_TRANSFER_MSG_PAGE:
+            if(msgp->page >= rxp->page_ct){
+                return STATE_TRANSFER_ERROR;
+            }
+            dst = turingcell_computer_state_page(cp, msgp->page, &len);
+            if(msgp->len == 0){
+                memset(dst, 0, len);
+            }else if(msgp->len == len){
+                memcpy(dst, data, len);
+            }else{
+                return STATE_TRANSFER_ERROR;
+            }
+            return STATE_TRANSFER_MORE;
+        case STATE_TRANSFER_MSG_SMALL_STATE:
+            if(msgp->len != rxp->small_state_len){
+                return STATE_TRANSFER_ERROR;
+            }
+            turingcell_computer_small_state_load(cp, STATE_TRANSFER_SMALL_FLAGS, data);
+            rxp->small_state_flag = 1;
+            return STATE_TRANSFER_MORE;
+        case STATE_TRANSFER_MSG_END:
+            if(!rxp->small_state_flag || (msgp->len && msgp->len != SHA256_DIGEST_SIZE)){
+                return STATE_TRANSFER_ERROR;
+            }
+            turingcell_computer_state_loaded(cp);
+            if(msgp->len){
+                turingcell_computer_state_hash(cp, digest);
+                if(memcmp(digest, data, SHA256_DIGEST_SIZE) != 0){
+                    return STATE_TRANSFER_ERROR;
+                }
+            }
+            rxp->tape_idx = cp->applied_tape_idx;
+            return STATE_TRANSFER_JOINED;
+        default:
+            return STATE_TRANSFER_ERROR;
+    }
+}
+
+// read and apply the messages of state_transfer_fd_send_cb from fd until joined
+// ret int: STATE_TRANSFER_JOINED | STATE_TRANSFER_ERROR, also on a short read
+int
+state_transfer_receive_fd(state_transfer_receiver_t* rxp, int fd){
+    state_transfer_msg_t msg;
+    uint8_t* buf = malloc(rxp->small_state_len > PHYS_MEM_PAGE_SIZE ?
+        rxp->small_state_len : PHYS_MEM_PAGE_SIZE);
+    uint8_t* p;
+    uint64_t len;
+    ssize_t n;
+    uint8_t i;
+    int ret = STATE_TRANSFER_MORE;
+    if(buf == NULL){
+        return STATE_TRANSFER_ERROR;
+    }
+    while(ret == STATE_TRANSFER_MORE){
+        p = (uint8_t*)&msg;
+        len = sizeof(msg);
+        for(i = 0; i < 2 && ret == STATE_TRANSFER_MORE; i++){
+            while(len){
+                n = read(fd, p, len);
+                if(n <= 0){
+                    ret = STATE_TRANSFER_ERROR;
+                    break;
+                }
+                p += n;
+                len -= (uint64_t)n;
+            }
+            if(i == 0 && msg.len > PHYS_MEM_PAGE_SIZE && msg.len > rxp->small_state_len){
+                ret = STATE_TRANSFER_ERROR;
+            }
+            p = buf;
+            len = msg.len;
+        }
+        if(ret == STATE_TRANSFER_MORE){
+            ret = state_transfer_receive(rxp, &msg, buf);
+        }
+    }
+    free(buf);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,904 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** tape record / replay **
+// host side, NOT a md part: a reproducible end-to-end measurement out of the tape of a
+// production cell, which doubles as a determinism check.
+//
+// the recorder writes the state of a cell (see "persistent state" in turingcell_computer_md.c),
+// then every tape entry applied to it, then the state hash after the last one. The replay loads
+// the state into a fresh computer and applies the entries back to back at full speed, no
+// consensus and no queue, and reports mdf/s, the emulated MIPS and how the time of an mdf
+// splits over pre_cpu_exec_phase / cpu_exec_phase / post_cpu_exec_phase, mean and p99 out of
+// the phase histograms of the computer. The final state hash must be the recorded one,
+// otherwise the execution is not deterministic (or the recording was made by another build).
+//
+// file, every integer in host byte order:
+//     header      u64 magic, u32 version, u32 ram_size, u32 uart_tx_size, u32 disk_block_ct,
+//                 u8 vcpu_ct, u64 state_len, u64 trace_inst_ct (version 3)
+//     state       state_len bytes, the stream of `turingcell_computer_state_visit`
+//     entry ...   u8 type (CELL_RUNTIME_TAPE_ENTRY_* or TAPE_REPLAY_ENTRY_CHECKPOINT / TRACE),
+//                 u8 dev_id, u32 len, u64 tape_idx, u64 inst_amount_or_offset, then len bytes
+//                 of data for IO_INPUT, state_len bytes of state for a CHECKPOINT (version 2),
+//                 len bytes of trace record for a TRACE (version 3)
+//     end         u8 0, then the sha256 of the state after the last entry
+// a checkpoint is the state after the entries in front of it, its tape_idx is the last
+// applied one. A trace record (see "trace" below) is the state in the middle of the mdf of
+// the EXEC entry in front of it, tape_idx is the one of that entry and inst_amount_or_offset
+// the inst counter. The replay skips both, `checkpoint_verify` re-executes the segments
+// between the checkpoints in parallel and checks every trace record on the way.
+// the disk chunks are not in the file, the replay reads them from the chunk store of the cell.
+//
+// a recording is attached to a live cell through its tape hook (cell_runtime.h):
+//     tape_record_begin(&rec, path, entry_ct_max);
+//     tape_record_set_checkpoint_interval(&rec, interval);      optional
+//     tape_record_set_trace_interval(&rec, inst_ct);            optional
+//     tape_record_set_first_tape_idx(&rec, tape_idx);           optional
+//     __atomic_store_n(&cellp->tape_hookp, &rec.hook, __ATOMIC_RELEASE);
+//     wait until tape_record_done(&rec), or tape_record_stop(&rec) to end it earlier
+//     __atomic_store_n(&cellp->tape_hookp, NULL, __ATOMIC_RELEASE);
+// the snapshot is taken on the worker at the first entry it sees (from first_tape_idx on, so
+// that the replicas of a cell record the same entries), the file is finished and
+// closed on the worker too, at the end of the turn which reaches entry_ct_max or sees the
+// stop. rec must stay valid until the cell has run one more turn after the hook is removed.
+//
+// Build the tool with TAPE_REPLAY_MAIN defined after including turingcell_computer_md.c,
+// `make` does so into build/:
+//     tape_replay [-d chunk_store_dir] [-j helper_thread_ct] file
+//
+// must be included after turingcell_computer_md.c
+
+#ifndef TAPE_REPLAY_H
+#define TAPE_REPLAY_H
+
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include "chunk_store.h"
+#include "vcpu_thread_pool.h"
+#include "cell_runtime.h"
+
+#define TAPE_REPLAY_MAGIC           ((uint64_t)0x3145504154435447)     // "GTCTAPE1"
+#define TAPE_REPLAY_VERSION         3
+#define TAPE_REPLAY_VERSION_MIN     1       // a version 1 file has no checkpoint, 2 no trace
+#define TAPE_REPLAY_ENTRY_END       0
+#define TAPE_REPLAY_ENTRY_CHECKPOINT 0x80   // beside the CELL_RUNTIME_TAPE_ENTRY_*
+#define TAPE_REPLAY_ENTRY_TRACE     0x81
+#define TAPE_REPLAY_CHUNK_CACHE_SLOT_CT 1024
+
+// ** trace **
+// a finer grain than the checkpoints: every trace_inst_ct guest insts (the step watch of
+// turingcell_computer_md.c) a record of the state at that point,
+//     small state     `turingcell_computer_small_state_save` without the uart tx data, the
+//                     registers of every vCPU and every device field
+//     u32 dirty_ct    then dirty_ct times u32 ram_pfn, u8[32] sha256 of the page, for every RAM
+//                     page written since the previous record (or the checkpoint or the head
+//                     state in front of it), ascending ram_pfn
+// two computers in the same state write the same bytes, records are compared byte by byte.
+// The block map of the disk is only covered by the checkpoints.
+// the written pages are told by the RAM watch of the computer, which a follower read view
+// (follower_read.h) needs too, a cell is not traced while it serves follower reads.
+
+typedef void (*tape_replay_trace_emit_fn_t)(void* ctx, turingcell_computer_t* cp,
+    const uint8_t* rec, uint32_t len);
+
+typedef struct {
+    turingcell_computer_t* cp;
+    uint32_t small_len;
+    uint32_t* dirty_bits;               // a bit per RAM page, written since the last record
+    uint8_t* rec;                       // a record, all the RAM pages dirty at most
+    tape_replay_trace_emit_fn_t emit_fn;
+    void* emit_ctx;
+} tape_replay_trace_t;
+
+#define TAPE_REPLAY_TRACE_PAGE_LEN  (4 + SHA256_DIGEST_SIZE)
+
+void
+tape_replay_trace_ram_write_cb(void* cb_arg, uint32_t ram_pfn){
+    tape_replay_trace_t* tp = (tape_replay_trace_t*)cb_arg;
+    tp->dirty_bits[ram_pfn >> 5] |= ((uint32_t)1) << (ram_pfn & 31);
+}
+
+// visit the written pages in ascending order and write protect them again
+// ret u32: amount of pages
+uint32_t
+tape_replay_trace_take_dirty(tape_replay_trace_t* tp, uint8_t* dst){
+    turingcell_computer_t* cp = tp->cp;
+    uint32_t i, bits, ram_pfn, ct = 0;
+    for(i = 0; i < (turingcell_computer_state_ram_page_ct(cp) + 31) >> 5; i++){
+        for(bits = tp->dirty_bits[i]; bits; bits &= bits - 1){
+            ram_pfn = (i << 5) + (uint32_t)__builtin_ctz(bits);
+            if(dst){
+                memcpy(dst, &ram_pfn, 4);
+                sha256(cp->ram_hostp + ((uint64_t)ram_pfn << PHYS_MEM_PAGE_SHIFT),
+                    PHYS_MEM_PAGE_SIZE, dst + 4);
+                dst += TAPE_REPLAY_TRACE_PAGE_LEN;
+            }
+            turingcell_computer_ram_watch_rearm_page(cp, ram_pfn);
+            ct++;
+        }
+        tp->dirty_bits[i] = 0;
+    }
+    return ct;
+}
+
+void
+tape_replay_trace_step_cb(void* cb_arg, uint64_t now){
+    tape_replay_trace_t* tp = (tape_replay_trace_t*)cb_arg;
+    uint32_t dirty_ct;
+    turingcell_computer_small_state_save(tp->cp, 0, tp->rec);
+    dirty_ct = tape_replay_trace_take_dirty(tp, tp->rec + tp->small_len + 4);
+    memcpy(tp->rec + tp->small_len, &dirty_ct, 4);
+    tp->emit_fn(tp->emit_ctx, tp->cp,
+        tp->rec, tp->small_len + 4 + dirty_ct * TAPE_REPLAY_TRACE_PAGE_LEN);
+}
+
+// a record every inst_ct insts (rounded up to whole quanta in SMP mode, see cp->step_inst_ct)
+// to emit_fn, on the thread running the computer; not while the computer is running
+// ret int: 0 if success | -1 if the RAM of the computer is watched already or out of memory
+int
+tape_replay_trace_start(tape_replay_trace_t* tp, turingcell_computer_t* cp, uint64_t inst_ct,
+    tape_replay_trace_emit_fn_t emit_fn, void* emit_ctx){
+
+    uint32_t page_ct = turingcell_computer_state_ram_page_ct(cp);
+    memset(tp, 0, sizeof(*tp));
+    if(cp->ram_write_cb){
+        return -1;
+    }
+    tp->cp = cp;
+    tp->small_len = turingcell_computer_small_state_len(cp, 0);
+    tp->dirty_bits = calloc((page_ct + 31) >> 5, sizeof(uint32_t));
+    tp->rec = malloc(tp->small_len + 4 + (uint64_t)page_ct * TAPE_REPLAY_TRACE_PAGE_LEN);
+    if(tp->dirty_bits == NULL || tp->rec == NULL){
+        free(tp->dirty_bits);
+        free(tp->rec);
+        return -1;
+    }
+    tp->emit_fn = emit_fn;
+    tp->emit_ctx = emit_ctx;
+    turingcell_computer_ram_watch(cp, tape_replay_trace_ram_write_cb, tp);
+    turingcell_computer_step_watch(cp, inst_ct, tape_replay_trace_step_cb, tp);
+    return 0;
+}
+
+// forget the pages written so far, the next record starts from the current state (after a
+// checkpoint); not while the computer is running
+void
+tape_replay_trace_restart(tape_replay_trace_t* tp){
+    tape_replay_trace_take_dirty(tp, NULL);
+}
+
+// not while the computer is running, safe after a failed tape_replay_trace_start too
+void
+tape_replay_trace_stop(tape_replay_trace_t* tp){
+    if(tp->cp){
+        turingcell_computer_step_watch(tp->cp, 0, NULL, NULL);
+        turingcell_computer_ram_watch(tp->cp, NULL, NULL);
+    }
+    free(tp->dirty_bits);
+    free(tp->rec);
+    memset(tp, 0, sizeof(*tp));
+}
+
+// ** recorder **
+
+typedef struct {
+    cell_runtime_tape_hook_t hook;
+    FILE* fp;
+    uint64_t entry_ct_max;      // 0: until tape_record_stop
+    uint64_t entry_ct;
+    uint64_t checkpoint_interval;   // entries between two checkpoints, 0: none
+    uint64_t trace_inst_ct;     // insts between two trace records, 0: none
+    uint64_t first_tape_idx;    // entries in front of it are not recorded
+    tape_replay_trace_t trace;
+    uint8_t began_flag;
+    uint8_t error_flag;         // valid once done
+    uint8_t stop_flag;          // atomic
+    uint8_t done_flag;          // atomic
+} tape_record_t;
+
+// always_inline
+inline void
+tape_record_write(tape_record_t* recp, const void* p, uint64_t len){
+    if(len && fwrite(p, 1, len, recp->fp) != len){
+        recp->error_flag = 1;
+    }
+}
+
+void
+tape_record_state_visit_fn(void* arg, const char* name, void* p, uint64_t len){
+    tape_record_write((tape_record_t*)arg, p, len);
+}
+
+void
+tape_replay_count_visit_fn(void* arg, const char* name, void* p, uint64_t len){
+    *(uint64_t*)arg += len;
+}
+
+// always_inline
+inline void
+tape_record_write_state(tape_record_t* recp, turingcell_computer_t* cp){
+    latency_histogram_t* histp =
+        turingcell_computer_metric(cp, TURINGCELL_COMPUTER_METRIC_CHECKPOINT);
+    uint64_t t0 = latency_histogram_probe_begin(histp);
+    turingcell_computer_state_visit(cp, tape_record_state_visit_fn, recp);
+    latency_histogram_probe_end(histp, t0);
+}
+
+void
+tape_record_write_head(tape_record_t* recp, turingcell_computer_t* cp){
+    uint64_t magic = TAPE_REPLAY_MAGIC;
+    uint32_t version = TAPE_REPLAY_VERSION;
+    uint64_t state_len = 0;
+    uint64_t trace_inst_ct = cp->step_inst_ct;
+    turingcell_computer_state_visit(cp, tape_replay_count_visit_fn, &state_len);
+    tape_record_write(recp, &magic, sizeof(magic));
+    tape_record_write(recp, &version, sizeof(version));
+    tape_record_write(recp, &cp->ram_size, sizeof(cp->ram_size));
+    tape_record_write(recp, &cp->uart.txp->data_size, sizeof(cp->uart.txp->data_size));
+    tape_record_write(recp, &cp->disk.block_ct, sizeof(cp->disk.block_ct));
+    tape_record_write(recp, &cp->vcpu_ct, sizeof(cp->vcpu_ct));
+    tape_record_write(recp, &state_len, sizeof(state_len));
+    tape_record_write(recp, &trace_inst_ct, sizeof(trace_inst_ct));
+    tape_record_write_state(recp, cp);
+}
+
+void
+tape_record_write_entry(tape_record_t* recp, const cell_runtime_tape_entry_t* entryp){
+    tape_record_write(recp, &entryp->type, sizeof(entryp->type));
+    tape_record_write(recp, &entryp->dev_id, sizeof(entryp->dev_id));
+    tape_record_write(recp, &entryp->len, sizeof(entryp->len));
+    tape_record_write(recp, &entryp->tape_idx, sizeof(entryp->tape_idx));
+    tape_record_write(recp, &entryp->inst_amount_or_offset, sizeof(entryp->inst_amount_or_offset));
+    if(entryp->type == CELL_RUNTIME_TAPE_ENTRY_IO_INPUT){
+        tape_record_write(recp, entryp->data, entryp->len);
+    }
+}
+
+// the state right after the entries written so far, tape_idx is the last applied one
+void
+tape_record_write_checkpoint(tape_record_t* recp, turingcell_computer_t* cp){
+    cell_runtime_tape_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.type = TAPE_REPLAY_ENTRY_CHECKPOINT;
+    entry.tape_idx = cp->applied_tape_idx;
+    tape_record_write_entry(recp, &entry);
+    tape_record_write_state(recp, cp);
+    if(recp->trace.cp){
+        tape_replay_trace_restart(&recp->trace);
+    }
+}
+
+// tape_replay_trace_emit_fn_t, during the mdf of the latest recorded entry
+void
+tape_record_trace_emit_fn(void* ctx, turingcell_computer_t* cp, const uint8_t* rec,
+    uint32_t len){
+
+    tape_record_t* recp = (tape_record_t*)ctx;
+    cell_runtime_tape_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.type = TAPE_REPLAY_ENTRY_TRACE;
+    entry.len = len;
+    entry.tape_idx = cp->applied_tape_idx;
+    entry.inst_amount_or_offset = turingcell_computer_now(cp);
+    tape_record_write_entry(recp, &entry);
+    tape_record_write(recp, rec, len);
+}
+
+void
+tape_record_finish(tape_record_t* recp, turingcell_computer_t* cp){
+    uint8_t end = TAPE_REPLAY_ENTRY_END;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    tape_replay_trace_stop(&recp->trace);
+    turingcell_computer_state_hash(cp, digest);
+    tape_record_write(recp, &end, sizeof(end));
+    tape_record_write(recp, digest, sizeof(digest));
+    if(fclose(recp->fp) != 0){
+        recp->error_flag = 1;
+    }
+    recp->fp = NULL;
+    __atomic_store_n(&recp->done_flag, 1, __ATOMIC_RELEASE);
+}
+
+// cell_runtime_tape_hook_t.fn, a harness without a cell runtime could call it directly:
+// before every entry it applies, and once with entryp NULL after the last one
+void
+tape_record_hook_fn(void* ctx, turingcell_computer_t* cp, const cell_runtime_tape_entry_t* entryp){
+    tape_record_t* recp = (tape_record_t*)ctx;
+    if(__atomic_load_n(&recp->done_flag, __ATOMIC_ACQUIRE)){
+        return;
+    }
+    if(!recp->began_flag && recp->first_tape_idx &&
+        (entryp == NULL || entryp->tape_idx < recp->first_tape_idx)){
+
+        return;
+    }
+    if(!recp->began_flag){
+        if(recp->trace_inst_ct && tape_replay_trace_start(&recp->trace, cp,
+            recp->trace_inst_ct, tape_record_trace_emit_fn, recp) != 0){
+
+            recp->error_flag = 1;
+        }
+        tape_record_write_head(recp, cp);
+        recp->began_flag = 1;
+    }
+    if(!recp->error_flag && !__atomic_load_n(&recp->stop_flag, __ATOMIC_ACQUIRE) &&
+        (recp->entry_ct_max == 0 || recp->entry_ct < recp->entry_ct_max)){
+
+        if(entryp){
+            if(recp->checkpoint_interval && recp->entry_ct &&
+                recp->entry_ct % recp->checkpoint_interval == 0){
+                tape_record_write_checkpoint(recp, cp);
+            }
+            tape_record_write_entry(recp, entryp);
+            recp->entry_ct++;
+        }
+        return;
+    }
+    // the state is the one right after the last recorded entry
+    tape_record_finish(recp, cp);
+}
+
+// entry_ct_max of 0 records until tape_record_stop
+// ret int: 0 if success | -1 if the file could not be created
+int
+tape_record_begin(tape_record_t* recp, const char* path, uint64_t entry_ct_max){
+    memset(recp, 0, sizeof(*recp));
+    recp->fp = fopen(path, "wb");
+    if(recp->fp == NULL){
+        return -1;
+    }
+    recp->entry_ct_max = entry_ct_max;
+    recp->hook.fn = tape_record_hook_fn;
+    recp->hook.ctx = recp;
+    return 0;
+}
+
+// a checkpoint every interval entries, for `checkpoint_verify` (checkpoint_verify.h),
+// before the hook is attached
+void
+tape_record_set_checkpoint_interval(tape_record_t* recp, uint64_t interval){
+    recp->checkpoint_interval = interval;
+}
+
+// a trace record every inst_ct guest insts, for `checkpoint_verify`, before the hook is
+// attached. The cell must not serve follower reads meanwhile, see "trace" above
+void
+tape_record_set_trace_interval(tape_record_t* recp, uint64_t inst_ct){
+    recp->trace_inst_ct = inst_ct;
+}
+
+// start at the entry tape_idx, before the hook is attached
+void
+tape_record_set_first_tape_idx(tape_record_t* recp, uint64_t tape_idx){
+    recp->first_tape_idx = tape_idx;
+}
+
+void
+tape_record_stop(tape_record_t* recp){
+    __atomic_store_n(&recp->stop_flag, 1, __ATOMIC_RELEASE);
+}
+
+// ret u8: 0 if still recording | 1 if the file is complete (check error_flag)
+// always_inline
+inline uint8_t
+tape_record_done(tape_record_t* recp){
+    return __atomic_load_n(&recp->done_flag, __ATOMIC_ACQUIRE);
+}
+
+// ** replay **
+
+typedef struct {
+    // configuration of the recorded cell
+    uint32_t ram_size;
+    uint32_t uart_tx_size;
+    uint32_t disk_block_ct;
+    uint8_t vcpu_ct;
+
+    uint8_t* file_buf;                  // the whole file, state and entry data point into it
+    uint8_t* state;
+    uint64_t state_len;                 // of the head state and of every checkpoint
+    uint64_t trace_inst_ct;             // 0 if not traced
+    cell_runtime_tape_entry_t* entries; // checkpoints and traces included, with their data
+    uint64_t entry_ct;
+    uint64_t checkpoint_ct;
+    uint64_t trace_ct;
+    uint8_t recorded_hash[SHA256_DIGEST_SIZE];
+} tape_replay_tape_t;
+
+// a computer of the recorded configuration and its host resources
+typedef struct {
+    turingcell_computer_t* cp;
+    turingcell_computer_host_env_t env;
+    vcpu_thread_pool_t pool;
+    uint8_t pool_flag;
+} tape_replay_host_t;
+
+typedef struct {
+    tape_replay_tape_t tape;
+    tape_replay_host_t host;
+    chunk_store_t chunk_store;
+    uint8_t chunk_store_flag;
+    turingcell_computer_metrics_t* metricsp;    // attached to the computer of host
+} tape_replay_t;
+
+typedef struct {
+    uint64_t exec_ct;
+    uint64_t io_input_ct;
+    uint64_t io_output_ct;
+    uint64_t inst_ct;
+    uint64_t pre_ns;                    // sum over the mdf
+    uint64_t cpu_exec_ns;
+    uint64_t post_ns;
+    uint64_t pre_p99_ns;                // lower bound of the histogram bucket
+    uint64_t cpu_exec_p99_ns;
+    uint64_t post_p99_ns;
+    uint64_t io_ns;                     // sum over the io entries
+    uint64_t total_ns;
+    uint64_t backend_error_ct;          // blocks the chunk store failed, see io_device_disk_md.h
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    uint8_t match_flag;
+} tape_replay_result_t;
+
+// always_inline
+inline uint64_t
+tape_replay_host_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct {
+    uint8_t* p;
+    uint8_t* end;
+} tape_replay_cursor_t;
+
+// ret int: 0 if success | -1 if the file ends before
+// always_inline
+inline int
+tape_replay_read(tape_replay_cursor_t* curp, void* dst, uint64_t len){
+    if((uint64_t)(curp->end - curp->p) < len){
+        return -1;
+    }
+    memcpy(dst, curp->p, len);
+    curp->p += len;
+    return 0;
+}
+
+// ret int: 0 if success | -1 if the file ends before | 1 at the end marker
+int
+tape_replay_read_entry(tape_replay_cursor_t* curp, uint64_t state_len,
+    cell_runtime_tape_entry_t* entryp){
+
+    if(tape_replay_read(curp, &entryp->type, sizeof(entryp->type)) != 0){
+        return -1;
+    }
+    if(entryp->type == TAPE_REPLAY_ENTRY_END){
+        return 1;
+    }
+    if(tape_replay_read(curp, &entryp->dev_id, sizeof(entryp->dev_id)) != 0 ||
+        tape_replay_read(curp, &entryp->len, sizeof(entryp->len)) != 0 ||
+        tape_replay_read(curp, &entryp->tape_idx, sizeof(entryp->tape_idx)) != 0 ||
+        tape_replay_read(curp, &entryp->inst_amount_or_offset,
+            sizeof(entryp->inst_amount_or_offset)) != 0){
+
+        return -1;
+    }
+    entryp->data = NULL;
+    if(entryp->type == CELL_RUNTIME_TAPE_ENTRY_IO_INPUT){
+        if((uint64_t)(curp->end - curp->p) < entryp->len){
+            return -1;
+        }
+        entryp->data = curp->p;
+        curp->p += entryp->len;
+    }else if(entryp->type == TAPE_REPLAY_ENTRY_CHECKPOINT){
+        if((uint64_t)(curp->end - curp->p) < state_len){
+            return -1;
+        }
+        entryp->data = curp->p;
+        curp->p += state_len;
+    }else if(entryp->type == TAPE_REPLAY_ENTRY_TRACE){
+        if((uint64_t)(curp->end - curp->p) < entryp->len){
+            return -1;
+        }
+        entryp->data = curp->p;
+        curp->p += entryp->len;
+    }
+    return 0;
+}
+
+// the whole file is read up front, so the replay never waits for the disk
+// ret int: 0 if success | -1 if the file could not be read or is malformed
+int
+tape_replay_load_file(tape_replay_tape_t* tp, const char* path){
+    tape_replay_cursor_t cur;
+    cell_runtime_tape_entry_t entry;
+    uint64_t magic, file_len, i;
+    uint32_t version;
+    FILE* fp;
+    long l;
+    int ret;
+    memset(tp, 0, sizeof(*tp));
+    fp = fopen(path, "rb");
+    if(fp == NULL){
+        return -1;
+    }
+    if(fseek(fp, 0, SEEK_END) != 0 || (l = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0){
+        fclose(fp);
+        return -1;
+    }
+    file_len = (uint64_t)l;
+    tp->file_buf = malloc(file_len ? file_len : 1);
+    if(tp->file_buf == NULL || fread(tp->file_buf, 1, file_len, fp) != file_len){
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    cur.p = tp->file_buf;
+    cur.end = tp->file_buf + file_len;
+    if(tape_replay_read(&cur, &magic, sizeof(magic)) != 0 || magic != TAPE_REPLAY_MAGIC ||
+        tape_replay_read(&cur, &version, sizeof(version)) != 0 ||
+        version < TAPE_REPLAY_VERSION_MIN || version > TAPE_REPLAY_VERSION ||
+        tape_replay_read(&cur, &tp->ram_size, sizeof(tp->ram_size)) != 0 ||
+        tape_replay_read(&cur, &tp->uart_tx_size, sizeof(tp->uart_tx_size)) != 0 ||
+        tape_replay_read(&cur, &tp->disk_block_ct, sizeof(tp->disk_block_ct)) != 0 ||
+        tape_replay_read(&cur, &tp->vcpu_ct, sizeof(tp->vcpu_ct)) != 0 ||
+        tape_replay_read(&cur, &tp->state_len, sizeof(tp->state_len)) != 0 ||
+        (version >= 3 &&
+            tape_replay_read(&cur, &tp->trace_inst_ct, sizeof(tp->trace_inst_ct)) != 0) ||
+        (uint64_t)(cur.end - cur.p) < tp->state_len){
+
+        return -1;
+    }
+    if(tp->vcpu_ct == 0 || tp->vcpu_ct > TURINGCELL_SMP_VCPU_CT_MAX){
+        return -1;
+    }
+    tp->state = cur.p;
+    cur.p += tp->state_len;
+
+    // count, then fill
+    {
+        tape_replay_cursor_t count_cur = cur;
+        while((ret = tape_replay_read_entry(&count_cur, tp->state_len, &entry)) == 0){
+            tp->entry_ct++;
+        }
+        if(ret < 0){
+            return -1;
+        }
+    }
+    tp->entries = malloc((tp->entry_ct ? tp->entry_ct : 1) * sizeof(cell_runtime_tape_entry_t));
+    if(tp->entries == NULL){
+        return -1;
+    }
+    for(i = 0; i < tp->entry_ct; i++){
+        tape_replay_read_entry(&cur, tp->state_len, &tp->entries[i]);
+        if(tp->entries[i].type == TAPE_REPLAY_ENTRY_CHECKPOINT){
+            tp->checkpoint_ct++;
+        }else if(tp->entries[i].type == TAPE_REPLAY_ENTRY_TRACE){
+            tp->trace_ct++;
+        }
+    }
+    tape_replay_read_entry(&cur, tp->state_len, &entry);
+    return tape_replay_read(&cur, tp->recorded_hash, sizeof(tp->recorded_hash));
+}
+
+// safe after a failed tape_replay_load_file too
+void
+tape_replay_tape_free(tape_replay_tape_t* tp){
+    free(tp->entries);
+    free(tp->file_buf);
+}
+
+// always_inline
+inline void
+tape_replay_state_hash(const uint8_t* state, uint64_t state_len,
+    uint8_t digest[SHA256_DIGEST_SIZE]){
+
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, state, state_len);
+    sha256_final(&ctx, digest);
+}
+
+void
+tape_replay_state_load_visit_fn(void* arg, const char* name, void* p, uint64_t len){
+    tape_replay_cursor_t* curp = (tape_replay_cursor_t*)arg;
+    memcpy(p, curp->p, len);
+    curp->p += len;
+}
+
+// the resources of a computer of the configuration of the tape, the computer itself is set
+// up by `tape_replay_host_load`. helper_thread_ct > 0 runs the vCPUs of an SMP computer
+// in parallel.
+// ret int: 0 if success | -1 if failed
+int
+tape_replay_host_init(tape_replay_host_t* hp, const tape_replay_tape_t* tp,
+    const io_device_disk_backend_t* disk_backendp, uint32_t helper_thread_ct){
+
+    turingcell_computer_host_env_t* envp = &hp->env;
+    memset(hp, 0, sizeof(*hp));
+    hp->cp = calloc(1, sizeof(turingcell_computer_t));
+    envp->ram_hostp = calloc(1, tp->ram_size);
+    envp->ram_size = tp->ram_size;
+    envp->pmmp = malloc(sizeof(phys_mem_map_t));
+    envp->uart_txp = calloc(1, sizeof(io_device_uart_tx_ring_t) + tp->uart_tx_size);
+    envp->uart_tx_size = tp->uart_tx_size;
+    envp->disk_block_map = calloc(tp->disk_block_ct ? tp->disk_block_ct : 1,
+        sizeof(io_device_disk_hash_t));
+    envp->disk_block_ct = tp->disk_block_ct;
+    envp->disk_backendp = disk_backendp;
+    envp->vcpu_ct = tp->vcpu_ct;
+    if(hp->cp == NULL || envp->ram_hostp == NULL || envp->pmmp == NULL ||
+        envp->uart_txp == NULL || envp->disk_block_map == NULL){
+
+        return -1;
+    }
+    if(tp->vcpu_ct > 1){
+        envp->smp_pmmps = malloc(tp->vcpu_ct * sizeof(phys_mem_map_t));
+        envp->smp_shadow_hostp = malloc(((uint64_t)tp->vcpu_ct * TURINGCELL_SMP_SHADOW_PAGE_CT)
+            << PHYS_MEM_PAGE_SHIFT);
+        if(envp->smp_pmmps == NULL || envp->smp_shadow_hostp == NULL){
+            return -1;
+        }
+        if(helper_thread_ct){
+            if(vcpu_thread_pool_start(&hp->pool, helper_thread_ct) != 0){
+                return -1;
+            }
+            hp->pool_flag = 1;
+            envp->parallel_run_cb = vcpu_thread_pool_run;
+            envp->parallel_run_ctx = &hp->pool;
+        }
+    }
+    return 0;
+}
+
+// a fresh computer in state, the head state of the tape or the data of a checkpoint entry,
+// as often as needed
+// ret int: 0 if success | -1 if the tape was recorded by a build with another state layout
+int
+tape_replay_host_load(tape_replay_host_t* hp, const tape_replay_tape_t* tp, uint8_t* state){
+    tape_replay_cursor_t cur;
+    uint64_t state_len = 0;
+    turingcell_computer_init(hp->cp, &hp->env);
+    turingcell_computer_state_visit(hp->cp, tape_replay_count_visit_fn, &state_len);
+    if(state_len != tp->state_len){
+        return -1;
+    }
+    cur.p = state;
+    cur.end = state + tp->state_len;
+    turingcell_computer_state_visit(hp->cp, tape_replay_state_load_visit_fn, &cur);
+    turingcell_computer_state_loaded(hp->cp);
+    return 0;
+}
+
+// safe after a failed tape_replay_host_init too
+void
+tape_replay_host_destroy(tape_replay_host_t* hp){
+    if(hp->pool_flag){
+        vcpu_thread_pool_stop(&hp->pool);
+    }
+    free(hp->env.smp_shadow_hostp);
+    free(hp->env.smp_pmmps);
+    free(hp->env.disk_block_map);
+    free(hp->env.uart_txp);
+    free(hp->env.pmmp);
+    free(hp->env.ram_hostp);
+    free(hp->cp);
+}
+
+// a fresh computer of the recorded configuration, in the recorded state
+// ret int: 0 if success | -1 if failed
+int
+tape_replay_init(tape_replay_t* rp, const char* path, const char* chunk_dir,
+    uint32_t helper_thread_ct){
+
+    memset(rp, 0, sizeof(*rp));
+    if(tape_replay_load_file(&rp->tape, path) != 0){
+        return -1;
+    }
+    if(chunk_store_init(&rp->chunk_store, chunk_dir, TAPE_REPLAY_CHUNK_CACHE_SLOT_CT, NULL) != 0){
+        return -1;
+    }
+    rp->chunk_store_flag = 1;
+    if(tape_replay_host_init(&rp->host, &rp->tape, &rp->chunk_store.backend,
+        helper_thread_ct) != 0){
+        return -1;
+    }
+    rp->metricsp = calloc(1, sizeof(turingcell_computer_metrics_t));
+    if(rp->metricsp == NULL ||
+        tape_replay_host_load(&rp->host, &rp->tape, rp->tape.state) != 0){
+
+        return -1;
+    }
+    turingcell_computer_metrics_attach(rp->host.cp, rp->metricsp);
+    return 0;
+}
+
+// safe after a failed tape_replay_init too
+void
+tape_replay_destroy(tape_replay_t* rp){
+    tape_replay_host_destroy(&rp->host);
+    free(rp->metricsp);
+    if(rp->chunk_store_flag){
+        chunk_store_destroy(&rp->chunk_store);
+    }
+    tape_replay_tape_free(&rp->tape);
+}
+
+// the data of the tape stays valid, unlike `cell_runtime_apply_tape_entry`
+// always_inline
+inline void
+tape_replay_apply_entry(turingcell_computer_t* cp, const cell_runtime_tape_entry_t* entryp){
+    switch(entryp->type){
+        case CELL_RUNTIME_TAPE_ENTRY_EXEC:
+            mdf_computer_exec(cp, entryp->tape_idx, entryp->inst_amount_or_offset);
+            break;
+        case CELL_RUNTIME_TAPE_ENTRY_IO_INPUT:
+            mdf_computer_io_input(cp, entryp->tape_idx, entryp->dev_id, entryp->data, entryp->len);
+            break;
+        case CELL_RUNTIME_TAPE_ENTRY_IO_OUTPUT:
+            mdf_computer_io_output(cp, entryp->tape_idx, entryp->dev_id,
+                entryp->inst_amount_or_offset, entryp->len);
+            break;
+        default:    // a checkpoint or a trace record only records the state
+            break;
+    }
+}
+
+// host ns of ticks of `latency_histogram_ticks`, at the rate measured over the run
+// always_inline
+inline uint64_t
+tape_replay_ticks_ns(uint64_t ticks, uint64_t run_ticks, uint64_t run_ns){
+    return run_ticks ? (uint64_t)((double)ticks * run_ns / run_ticks) : 0;
+}
+
+// apply every entry once; the phases of an mdf are timed by the histograms of the computer
+// (see "metrics" in turingcell_computer_md.c), the replay runs with them on like production
+void
+tape_replay_run(tape_replay_t* rp, tape_replay_result_t* resp){
+    turingcell_computer_t* cp = rp->host.cp;
+    latency_histogram_t* hists = rp->metricsp->hists;
+    cell_runtime_tape_entry_t* entryp;
+    uint64_t t0, start_ns, start_ticks, run_ticks, i;
+    memset(resp, 0, sizeof(*resp));
+    memset(rp->metricsp, 0, sizeof(*rp->metricsp));
+    start_ns = tape_replay_host_ns();
+    start_ticks = latency_histogram_ticks();
+    for(i = 0; i < rp->tape.entry_ct; i++){
+        entryp = &rp->tape.entries[i];
+        switch(entryp->type){
+            case CELL_RUNTIME_TAPE_ENTRY_EXEC:
+                tape_replay_apply_entry(cp, entryp);
+                resp->inst_ct += entryp->inst_amount_or_offset;
+                resp->exec_ct++;
+                break;
+            case CELL_RUNTIME_TAPE_ENTRY_IO_INPUT:
+            case CELL_RUNTIME_TAPE_ENTRY_IO_OUTPUT:
+                t0 = tape_replay_host_ns();
+                tape_replay_apply_entry(cp, entryp);
+                resp->io_ns += tape_replay_host_ns() - t0;
+                if(entryp->type == CELL_RUNTIME_TAPE_ENTRY_IO_INPUT){
+                    resp->io_input_ct++;
+                }else{
+                    resp->io_output_ct++;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    run_ticks = latency_histogram_ticks() - start_ticks;
+    resp->total_ns = tape_replay_host_ns() - start_ns;
+    resp->pre_ns = tape_replay_ticks_ns(hists[TURINGCELL_COMPUTER_METRIC_MDF_PRE].sum,
+        run_ticks, resp->total_ns);
+    resp->cpu_exec_ns = tape_replay_ticks_ns(hists[TURINGCELL_COMPUTER_METRIC_MDF_CPU_EXEC].sum,
+        run_ticks, resp->total_ns);
+    resp->post_ns = tape_replay_ticks_ns(hists[TURINGCELL_COMPUTER_METRIC_MDF_POST].sum,
+        run_ticks, resp->total_ns);
+    resp->pre_p99_ns = tape_replay_ticks_ns(latency_histogram_quantile(
+        &hists[TURINGCELL_COMPUTER_METRIC_MDF_PRE], 0.99), run_ticks, resp->total_ns);
+    resp->cpu_exec_p99_ns = tape_replay_ticks_ns(latency_histogram_quantile(
+        &hists[TURINGCELL_COMPUTER_METRIC_MDF_CPU_EXEC], 0.99), run_ticks, resp->total_ns);
+    resp->post_p99_ns = tape_replay_ticks_ns(latency_histogram_quantile(
+        &hists[TURINGCELL_COMPUTER_METRIC_MDF_POST], 0.99), run_ticks, resp->total_ns);
+    resp->backend_error_ct = cp->disk.backend_error_ct + cp->pv_blk.backend_error_ct;
+    turingcell_computer_state_hash(cp, resp->hash);
+    resp->match_flag = memcmp(resp->hash, rp->tape.recorded_hash, SHA256_DIGEST_SIZE) == 0;
+}
+
+void
+tape_replay_print_hash(FILE* fp, const uint8_t digest[SHA256_DIGEST_SIZE]){
+    uint8_t i;
+    for(i = 0; i < SHA256_DIGEST_SIZE; i++){
+        fprintf(fp, "%02x", digest[i]);
+    }
+}
+
+void
+tape_replay_print(FILE* fp, const tape_replay_t* rp, const tape_replay_result_t* resp){
+    double total_s = (double)resp->total_ns / 1e9;
+    double mdf_ns = (double)(resp->pre_ns + resp->cpu_exec_ns + resp->post_ns);
+    uint64_t exec_ct = resp->exec_ct ? resp->exec_ct : 1;
+    if(mdf_ns == 0){
+        mdf_ns = 1;
+    }
+    fprintf(fp, "tape: %llu entries (exec %llu, io_input %llu, io_output %llu, "
+        "checkpoint %llu, trace %llu), %llu guest insts, %u vCPU\n",
+        (unsigned long long)rp->tape.entry_ct, (unsigned long long)resp->exec_ct,
+        (unsigned long long)resp->io_input_ct, (unsigned long long)resp->io_output_ct,
+        (unsigned long long)rp->tape.checkpoint_ct, (unsigned long long)rp->tape.trace_ct,
+        (unsigned long long)resp->inst_ct,
+        (unsigned)rp->tape.vcpu_ct);
+    fprintf(fp, "replay: %.3f s, %.1f mdf/s, %.2f emulated MIPS\n", total_s,
+        total_s > 0 ? (double)resp->exec_ct / total_s : 0,
+        total_s > 0 ? (double)resp->inst_ct / total_s / 1e6 : 0);
+    fprintf(fp, "mdf: pre_cpu_exec %.0f ns (%.2f%%), cpu_exec %.0f ns (%.2f%%), "
+        "post_cpu_exec %.0f ns (%.2f%%) per mdf\n",
+        (double)resp->pre_ns / exec_ct, 100.0 * resp->pre_ns / mdf_ns,
+        (double)resp->cpu_exec_ns / exec_ct, 100.0 * resp->cpu_exec_ns / mdf_ns,
+        (double)resp->post_ns / exec_ct, 100.0 * resp->post_ns / mdf_ns);
+    fprintf(fp, "mdf p99: pre_cpu_exec %llu ns, cpu_exec %llu ns, post_cpu_exec %llu ns\n",
+        (unsigned long long)resp->pre_p99_ns, (unsigned long long)resp->cpu_exec_p99_ns,
+        (unsigned long long)resp->post_p99_ns);
+    fprintf(fp, "io: %.0f ns per entry\n", (double)resp->io_ns /
+        (resp->io_input_ct + resp->io_output_ct ? resp->io_input_ct + resp->io_output_ct : 1));
+    if(resp->backend_error_ct){
+        fprintf(fp, "disk: %llu blocks failed by the chunk store, the guest saw io errors\n",
+            (unsigned long long)resp->backend_error_ct);
+    }
+    fprintf(fp, "state hash: ");
+    tape_replay_print_hash(fp, resp->hash);
+    fprintf(fp, "\nrecorded:   ");
+    tape_replay_print_hash(fp, rp->tape.recorded_hash);
+    fprintf(fp, "\n%s\n", resp->match_flag ? "match" : "MISMATCH: the replay diverged");
+}
+
+#ifdef TAPE_REPLAY_MAIN
+int
+main(int argc, char** argv){
+    tape_replay_t r;
+    tape_replay_result_t result;
+    const char* chunk_dir = ".";
+    const char* path = 0;
+    uint32_t helper_thread_ct = 0;
+    int i;
+    for(i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-d") == 0 && i + 1 < argc){
+            chunk_dir = argv[++i];
+        }else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc){
+            helper_thread_ct = (uint32_t)strtoul(argv[++i], 0, 0);
+        }else{
+            path = argv[i];
+        }
+    }
+    if(path == 0){
+        fprintf(stderr, "usage: tape_replay [-d chunk_store_dir] [-j helper_thread_ct] file\n");
+        return 1;
+    }
+    if(tape_replay_init(&r, path, chunk_dir, helper_thread_ct) != 0){
+        fprintf(stderr, "tape_replay: could not load %s\n", path);
+        tape_replay_destroy(&r);
+        return 1;
+    }
+    tape_replay_run(&r, &result);
+    tape_replay_print(stdout, &r, &result);
+    tape_replay_destroy(&r);
+    return result.match_flag ? 0 : 2;
+}
+#endif
+
+#endif
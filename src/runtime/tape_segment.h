@@ -0,0 +1,325 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** tape segment **
+// host side, NOT a md part: a write-ahead log segment of committed tape entries, in the fixed
+// record layout of cell_runtime.h, which the consensus layer appends to and the runtime
+// applies straight out of a read only mapping. The data of an IO_INPUT is never decoded into
+// a buffer of its own: its entry points into the mapping, which stays mapped until the last
+// entry taken out of it has been applied (cell_runtime_tape_segment_t).
+//
+// file, every integer in host byte order:
+//     header      u64 magic, u32 version, u32 record_align, 16 bytes of 0 (32 bytes)
+//     record ...  cell_runtime_tape_record_t, the data of an IO_INPUT, zeros up to record_align
+// a record of type 0, or the end of the file, ends the segment; the zero filled tail of a
+// preallocated segment reads as its end. The crc of every record covers its header, data and
+// padding, a reader stops at the first record failing it: a torn or corrupted tail is never
+// applied.
+//
+// writer, the consensus layer:
+//     tape_segment_create(&w, path);
+//     tape_segment_append(&w, cell_id, &entry); ... tape_segment_sync(&w);
+//     tape_segment_writer_close(&w);
+// reader:
+//     sp = tape_segment_open(path);
+//     while(tape_segment_next(sp, &cell_id, &entry) == 0){ cell_runtime_submit(...) }
+//     tape_segment_close(sp);    the mapping goes once the submitted entries are applied
+//
+// Build the dump tool with TAPE_SEGMENT_MAIN defined after including turingcell_computer_md.c,
+// `make` does so into build/:
+//     tape_segment file
+//
+// must be included after turingcell_computer_md.c
+
+#ifndef TAPE_SEGMENT_H
+#define TAPE_SEGMENT_H
+
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include "cell_runtime.h"
+#include "../common/crc32_md.h"
+
+#define TAPE_SEGMENT_MAGIC          ((uint64_t)0x3147455354435447)     // "GTCTSEG1"
+#define TAPE_SEGMENT_VERSION        2
+#define TAPE_SEGMENT_PATH_MAX       512
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_align;              // CELL_RUNTIME_TAPE_RECORD_ALIGN
+    uint64_t reserved[2];               // 0
+} tape_segment_head_t;
+
+// ** writer **
+
+typedef struct {
+    int fd;
+    uint64_t size;
+    uint8_t error_flag;
+} tape_segment_writer_t;
+
+// always_inline
+inline void
+tape_segment_write(tape_segment_writer_t* wp, const void* p, uint64_t len){
+    const uint8_t* u8p = (const uint8_t*)p;
+    ssize_t n;
+    while(len && !wp->error_flag){
+        n = write(wp->fd, u8p, len);
+        if(n <= 0){
+            wp->error_flag = 1;
+            return;
+        }
+        u8p += n;
+        len -= (uint64_t)n;
+        wp->size += (uint64_t)n;
+    }
+}
+
+// an existing file is replaced: the new one is written under a temporary name and renamed
+// over it once its header is complete. It is never truncated in place, a reader still mapping
+// the old one would get SIGBUS, it keeps the old content instead
+// ret int: 0 if success | -1 if failed
+int
+tape_segment_create(tape_segment_writer_t* wp, const char* path){
+    char tmp_path[TAPE_SEGMENT_PATH_MAX + 8];
+    tape_segment_head_t head;
+    memset(wp, 0, sizeof(*wp));
+    if(strlen(path) >= TAPE_SEGMENT_PATH_MAX){
+        return -1;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    wp->fd = mkstemp(tmp_path);
+    if(wp->fd < 0){
+        return -1;
+    }
+    memset(&head, 0, sizeof(head));
+    head.magic = TAPE_SEGMENT_MAGIC;
+    head.version = TAPE_SEGMENT_VERSION;
+    head.record_align = CELL_RUNTIME_TAPE_RECORD_ALIGN;
+    tape_segment_write(wp, &head, sizeof(head));
+    if(wp->error_flag || fchmod(wp->fd, 0644) != 0 || rename(tmp_path, path) != 0){
+        close(wp->fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// ret int: 0 if success | -1 if failed (the segment is not usable any more)
+int
+tape_segment_append(tape_segment_writer_t* wp, uint32_t cell_id,
+    const cell_runtime_tape_entry_t* entryp){
+
+    static const uint8_t zeros[CELL_RUNTIME_TAPE_RECORD_ALIGN] = {0};
+    cell_runtime_tape_record_t rec;
+    uint64_t size = cell_runtime_tape_record_size(entryp->type, entryp->len);
+    uint32_t data_len = entryp->type == CELL_RUNTIME_TAPE_ENTRY_IO_INPUT ? entryp->len : 0;
+    uint32_t pad_len = (uint32_t)(size - sizeof(rec) - data_len);
+    memset(&rec, 0, sizeof(rec));
+    rec.type = entryp->type;
+    rec.dev_id = entryp->dev_id;
+    rec.len = entryp->len;
+    rec.cell_id = cell_id;
+    rec.tape_idx = entryp->tape_idx;
+    rec.inst_amount_or_offset = entryp->inst_amount_or_offset;
+    rec.crc = crc32_update(0, (const uint8_t*)&rec, sizeof(rec));
+    rec.crc = crc32_update(rec.crc, entryp->data, data_len);
+    rec.crc = crc32_update(rec.crc, zeros, pad_len);
+    tape_segment_write(wp, &rec, sizeof(rec));
+    tape_segment_write(wp, entryp->data, data_len);
+    tape_segment_write(wp, zeros, pad_len);
+    return wp->error_flag ? -1 : 0;
+}
+
+// the records appended so far are durable
+// ret int: 0 if success | -1 if failed
+int
+tape_segment_sync(tape_segment_writer_t* wp){
+    if(!wp->error_flag && fdatasync(wp->fd) != 0){
+        wp->error_flag = 1;
+    }
+    return wp->error_flag ? -1 : 0;
+}
+
+// ret int: 0 if success | -1 if anything failed since the creation
+int
+tape_segment_writer_close(tape_segment_writer_t* wp){
+    if(close(wp->fd) != 0){
+        wp->error_flag = 1;
+    }
+    return wp->error_flag ? -1 : 0;
+}
+
+// ** reader **
+
+typedef struct {
+    cell_runtime_tape_segment_t seg;    // the reference of the owner is taken at open
+    uint8_t* map;
+    uint64_t size;
+    uint64_t offset;                    // of the next record
+} tape_segment_t;
+
+// cell_runtime_tape_segment_t.release_fn
+void
+tape_segment_release_fn(cell_runtime_tape_segment_t* segp){
+    tape_segment_t* sp = (tape_segment_t*)segp;
+    munmap(sp->map, sp->size);
+    free(sp);
+}
+
+// ret tape_segment_t*: the mapped segment | NULL if it could not be, or is not a segment of
+//  this layout
+tape_segment_t*
+tape_segment_open(const char* path){
+    tape_segment_head_t* headp;
+    tape_segment_t* sp;
+    struct stat st;
+    void* p;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+    if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(tape_segment_head_t)){
+        close(fd);
+        return NULL;
+    }
+    // page aligned, hence aligned to CELL_RUNTIME_TAPE_RECORD_ALIGN as every record
+    p = mmap(NULL, (uint64_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED){
+        return NULL;
+    }
+    headp = (tape_segment_head_t*)p;
+    sp = malloc(sizeof(tape_segment_t));
+    if(sp == NULL || headp->magic != TAPE_SEGMENT_MAGIC ||
+        headp->version != TAPE_SEGMENT_VERSION ||
+        headp->record_align != CELL_RUNTIME_TAPE_RECORD_ALIGN){
+
+        free(sp);
+        munmap(p, (uint64_t)st.st_size);
+        return NULL;
+    }
+    sp->seg.ref_ct = 1;
+    sp->seg.release_fn = tape_segment_release_fn;
+    sp->map = (uint8_t*)p;
+    sp->size = (uint64_t)st.st_size;
+    sp->offset = sizeof(tape_segment_head_t);
+    return sp;
+}
+
+// the entry of the next record, its data points into the mapping (no copy), with a reference
+// to the segment the runtime drops once the entry is applied
+// ret int: 0 if success | 1 at the end of the segment | -1 if the record is cut short,
+//  malformed or fails its crc (a torn or corrupted tail), it and what follows are not read
+int
+tape_segment_next(tape_segment_t* sp, uint32_t* cell_idp, cell_runtime_tape_entry_t* entryp){
+    const cell_runtime_tape_record_t* recp;
+    cell_runtime_tape_record_t rec;
+    uint64_t size;
+    uint32_t crc;
+    if(sp->size - sp->offset < sizeof(cell_runtime_tape_record_t)){
+        return sp->offset == sp->size ? 1 : -1;
+    }
+    recp = (const cell_runtime_tape_record_t*)(sp->map + sp->offset);
+    if(recp->type == 0){
+        return 1;
+    }
+    if(recp->type > CELL_RUNTIME_TAPE_ENTRY_IO_OUTPUT || recp->reserved0){
+        return -1;
+    }
+    size = cell_runtime_tape_record_size(recp->type, recp->len);
+    if(sp->size - sp->offset < size){
+        return -1;
+    }
+    rec = *recp;
+    rec.crc = 0;
+    crc = crc32_update(0, (const uint8_t*)&rec, sizeof(rec));
+    crc = crc32_update(crc, (const uint8_t*)(recp + 1), (uint32_t)(size - sizeof(rec)));
+    if(crc != recp->crc){
+        return -1;
+    }
+    cell_runtime_tape_record_entry(recp, &sp->seg, entryp);
+    *cell_idp = recp->cell_id;
+    sp->offset += size;
+    return 0;
+}
+
+// the owner is done with the segment, the mapping goes with the last entry taken out of it
+void
+tape_segment_close(tape_segment_t* sp){
+    cell_runtime_tape_segment_put(&sp->seg);
+}
+
+// submit every remaining entry of the segment to cells[cell_id], retrying on a full queue
+// ret int: 0 if success | -1 if a record is malformed or its cell_id not below cell_ct
+int
+tape_segment_submit_all(tape_segment_t* sp, cell_runtime_t* rtp, cell_runtime_cell_t** cells,
+    uint32_t cell_ct){
+
+    cell_runtime_tape_entry_t entry;
+    uint32_t cell_id;
+    int ret;
+    while((ret = tape_segment_next(sp, &cell_id, &entry)) == 0){
+        if(cell_id >= cell_ct){
+            if(entry.segp){
+                cell_runtime_tape_segment_put(entry.segp);
+            }
+            return -1;
+        }
+        while(cell_runtime_submit(rtp, cells[cell_id], &entry) != 0){
+            sched_yield();
+        }
+    }
+    return ret == 1 ? 0 : -1;
+}
+
+#ifdef TAPE_SEGMENT_MAIN
+int
+main(int argc, char** argv){
+    cell_runtime_tape_entry_t entry;
+    tape_segment_t* sp;
+    uint32_t cell_id;
+    uint64_t ct = 0;
+    int ret;
+    if(argc < 2){
+        fprintf(stderr, "usage: tape_segment file\n");
+        return 1;
+    }
+    sp = tape_segment_open(argv[1]);
+    if(sp == NULL){
+        fprintf(stderr, "tape_segment: %s is not a segment of this layout\n", argv[1]);
+        return 1;
+    }
+    while((ret = tape_segment_next(sp, &cell_id, &entry)) == 0){
+        printf("cell %u tape_idx %llu type %u dev %u len %u inst_amount_or_offset %llu\n",
+            cell_id, (unsigned long long)entry.tape_idx, entry.type, entry.dev_id, entry.len,
+            (unsigned long long)entry.inst_amount_or_offset);
+        if(entry.segp){
+            cell_runtime_tape_segment_put(entry.segp);
+        }
+        ct++;
+    }
+    printf("%llu records%s\n", (unsigned long long)ct, ret < 0 ? ", torn or corrupted tail" : "");
+    tape_segment_close(sp);
+    return ret < 0 ? 2 : 0;
+}
+#endif
+
+#endif
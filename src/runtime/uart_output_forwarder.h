@@ -0,0 +1,314 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** uart output forwarder **
+// host side, NOT a md part: it runs in its own thread beside the executor of one replica and
+// reads the uart tx ring in the shared memory segment in place.
+//
+// Only the designated replica forwards. It hands every published span to `deliver_cb`
+// without copying, tagged with its tape idx and global offset, then proposes
+// `mdf_computer_io_output(offset, len)` to the tape via `propose_ack_cb` for all the bytes
+// delivered since the last proposal. The span is freed when that tape entry is applied by all
+// replicas.
+//
+// a proposal could be lost (a dropped message, a leader change), and the uart only takes the
+// acknowledgement which continues exactly from acked_ct, so every later one would be ignored
+// and the tx ring would stay full. Thus the forwarder keeps the proposed position apart from
+// the delivered one: when acked_ct has not moved for ack_timeout_ns since the last proposal,
+// or after `uart_output_forwarder_term_change`, it proposes again from acked_ct. A duplicated
+// acknowledgement is ignored by the uart.
+//
+// exactly-once: after a failover the new designated replica restarts from the replicated
+// acked_ct, so a span could be delivered twice but never lost. The consumer keeps the
+// high-water mark of the offsets it has taken and drops anything below it.
+//
+// Build the self check with UART_OUTPUT_FORWARDER_MAIN defined after including
+// turingcell_computer_md.c, `make check` builds and runs it.
+
+#ifndef UART_OUTPUT_FORWARDER_H
+#define UART_OUTPUT_FORWARDER_H
+
+#include<stdint.h>
+#include<time.h>
+#include "../io_device/io_device_uart_md.h"
+
+#define UART_OUTPUT_FORWARDER_ACK_TIMEOUT_NS    ((uint64_t)200000000)  // default, 200ms
+
+typedef struct {
+    const io_device_uart_tx_ring_t* txp;
+    uint8_t designated_flag;
+    uint8_t term_change_flag;   // set by another thread, see `uart_output_forwarder_term_change`
+    uint64_t forwarded_ct;      // bytes [acked_ct, forwarded_ct) are delivered but not acked yet
+    uint64_t proposed_ct;       // bytes [acked_ct, proposed_ct) are proposed, <= forwarded_ct
+    uint64_t seen_acked_ct;     // acked_ct at the latest poll
+    uint64_t ack_wait_ns;       // since then or since the latest proposal, whichever is later
+    uint64_t ack_timeout_ns;
+    uint64_t seg_idx;           // next seg to look at
+    // ptr points into the shared memory segment, valid until the span is acked
+    void (*deliver_cb)(void* cb_arg, uint64_t tape_idx, uint64_t offset,
+        const uint8_t* ptr, uint32_t len);
+    void (*propose_ack_cb)(void* cb_arg, uint64_t offset, uint32_t len);
+    void* cb_arg;
+} uart_output_forwarder_t;
+
+uint64_t
+uart_output_forwarder_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void
+uart_output_forwarder_init(uart_output_forwarder_t* fp, const io_device_uart_tx_ring_t* txp){
+    fp->txp = txp;
+    fp->designated_flag = 0;
+    fp->term_change_flag = 0;
+    fp->forwarded_ct = 0;
+    fp->proposed_ct = 0;
+    fp->seen_acked_ct = 0;
+    fp->ack_wait_ns = 0;
+    fp->ack_timeout_ns = UART_OUTPUT_FORWARDER_ACK_TIMEOUT_NS;
+    fp->seg_idx = 0;
+}
+
+// resume from the replicated state of the ring
+void
+uart_output_forwarder_become_designated(uart_output_forwarder_t* fp){
+    uint64_t seg_ct = __atomic_load_n(&fp->txp->seg_published_ct, __ATOMIC_ACQUIRE);
+    fp->designated_flag = 1;
+    fp->forwarded_ct = __atomic_load_n(&fp->txp->acked_ct, __ATOMIC_ACQUIRE);
+    fp->proposed_ct = fp->forwarded_ct;
+    fp->seen_acked_ct = fp->forwarded_ct;
+    fp->ack_wait_ns = uart_output_forwarder_now_ns();
+    fp->seg_idx = seg_ct > IO_DEVICE_UART_TX_SEG_CT ? seg_ct - IO_DEVICE_UART_TX_SEG_CT : 0;
+}
+
+void
+uart_output_forwarder_resign(uart_output_forwarder_t* fp){
+    fp->designated_flag = 0;
+}
+
+// the consensus layer has a new term, the proposals of the former one could be lost
+// could be called from any thread
+void
+uart_output_forwarder_term_change(uart_output_forwarder_t* fp){
+    __atomic_store_n(&fp->term_change_flag, 1, __ATOMIC_RELEASE);
+}
+
+// deliver a contiguous piece of one seg, split at the wrap point of the data ring
+void
+uart_output_forwarder_deliver(uart_output_forwarder_t* fp, uint64_t tape_idx,
+    uint64_t start, uint64_t end){
+
+    uint32_t mask = fp->txp->data_size - 1;
+    uint32_t len;
+    while(start < end){
+        len = fp->txp->data_size - (uint32_t)(start & mask);
+        if(end - start < len){
+            len = (uint32_t)(end - start);
+        }
+        fp->deliver_cb(fp->cb_arg, tape_idx, start, &fp->txp->data[start & mask], len);
+        start += len;
+    }
+}
+
+// propose the acknowledgement of the delivered bytes, again from acked_ct if the former
+// proposal looks lost
+// ret u8: 1 if anything was proposed | 0 if not
+uint8_t
+uart_output_forwarder_propose(uart_output_forwarder_t* fp){
+    uint64_t acked_ct = __atomic_load_n(&fp->txp->acked_ct, __ATOMIC_ACQUIRE);
+    uint64_t now_ns = uart_output_forwarder_now_ns();
+    if(acked_ct != fp->seen_acked_ct){
+        fp->seen_acked_ct = acked_ct;
+        fp->ack_wait_ns = now_ns;
+    }
+    if(fp->proposed_ct < acked_ct){ // acked by the proposals of a former designated replica
+        fp->proposed_ct = acked_ct;
+    }
+    if(acked_ct < fp->proposed_ct &&
+        (__atomic_exchange_n(&fp->term_change_flag, 0, __ATOMIC_ACQ_REL) ||
+            now_ns - fp->ack_wait_ns >= fp->ack_timeout_ns)){
+        fp->proposed_ct = acked_ct;
+    }
+    if(fp->proposed_ct == fp->forwarded_ct){
+        return 0;
+    }
+    // at most data_size bytes are not acked
+    fp->propose_ack_cb(fp->cb_arg, fp->proposed_ct, (uint32_t)(fp->forwarded_ct - fp->proposed_ct));
+    fp->proposed_ct = fp->forwarded_ct;
+    fp->ack_wait_ns = now_ns;
+    return 1;
+}
+
+// ret u8: 1 if anything was forwarded or proposed | 0 if nothing new
+uint8_t
+uart_output_forwarder_poll(uart_output_forwarder_t* fp){
+    const io_device_uart_tx_ring_t* txp = fp->txp;
+    const io_device_uart_tx_seg_t* segp;
+    uint64_t published_ct, seg_ct, start, end;
+    uint8_t progress_flag = 0;
+    if(!fp->designated_flag){
+        return 0;
+    }
+    seg_ct = __atomic_load_n(&txp->seg_published_ct, __ATOMIC_ACQUIRE);
+    published_ct = __atomic_load_n(&txp->published_ct, __ATOMIC_ACQUIRE);
+    while(fp->seg_idx < seg_ct && fp->forwarded_ct < published_ct){
+        segp = &txp->segs[fp->seg_idx & (IO_DEVICE_UART_TX_SEG_CT - 1)];
+        // the end of the latest seg grows while the seg ring is full
+        end = __atomic_load_n(&segp->end_offset, __ATOMIC_ACQUIRE);
+        if(end > published_ct){
+            end = published_ct;
+        }
+        start = segp->start_offset > fp->forwarded_ct ? segp->start_offset : fp->forwarded_ct;
+        if(start < end){
+            uart_output_forwarder_deliver(fp, segp->tape_idx, start, end);
+            fp->forwarded_ct = end;
+            progress_flag = 1;
+        }
+        if(fp->forwarded_ct < segp->end_offset || fp->seg_idx + 1 == seg_ct){
+            break;
+        }
+        fp->seg_idx++;
+    }
+    return uart_output_forwarder_propose(fp) | progress_flag;
+}
+
+#ifdef UART_OUTPUT_FORWARDER_MAIN
+// the self check: a guest fills a small tx ring again and again while the forwarder delivers
+// it. The tape is simulated, the proposals of a round are applied to the uart at the end of
+// it, except one which is dropped. Every byte has to be delivered in order and acked, once by
+// the timeout and once by a term change.
+
+#include<stdio.h>
+#include<stdlib.h>
+
+#define UART_OUTPUT_FORWARDER_CHECK_DATA_SIZE   256
+#define UART_OUTPUT_FORWARDER_CHECK_BYTE_CT     ((uint64_t)20000)
+#define UART_OUTPUT_FORWARDER_CHECK_ROUND_MAX   100000
+
+typedef struct {
+    uint64_t offsets[16];
+    uint32_t lens[16];
+    uint32_t queued_ct;
+    uint32_t proposal_ct;
+    uint32_t drop_proposal_idx;     // 1 for the first proposal
+    uint64_t taken_ct;              // high-water mark of the consumer
+    uint8_t bad_flag;
+} uart_output_forwarder_check_t;
+
+void
+uart_output_forwarder_check_deliver_cb(void* cb_arg, uint64_t tape_idx, uint64_t offset,
+    const uint8_t* ptr, uint32_t len){
+
+    uart_output_forwarder_check_t* cp = (uart_output_forwarder_check_t*)cb_arg;
+    uint32_t i;
+    if(offset + len <= cp->taken_ct){
+        return;
+    }
+    if(offset > cp->taken_ct){
+        cp->bad_flag = 1;
+        return;
+    }
+    for(i = (uint32_t)(cp->taken_ct - offset); i < len; i++){
+        if(ptr[i] != (uint8_t)((offset + i) * 7)){
+            cp->bad_flag = 1;
+        }
+    }
+    cp->taken_ct = offset + len;
+}
+
+void
+uart_output_forwarder_check_propose_ack_cb(void* cb_arg, uint64_t offset, uint32_t len){
+    uart_output_forwarder_check_t* cp = (uart_output_forwarder_check_t*)cb_arg;
+    cp->proposal_ct++;
+    if(cp->proposal_ct == cp->drop_proposal_idx || cp->queued_ct == 16){
+        return;
+    }
+    cp->offsets[cp->queued_ct] = offset;
+    cp->lens[cp->queued_ct] = len;
+    cp->queued_ct++;
+}
+
+// ret: amount of rounds until every byte is acked | 0 if that never happened
+uint64_t
+uart_output_forwarder_check_run(io_device_uart_t* up, io_device_uart_tx_ring_t* txp,
+    uint64_t ack_timeout_ns, uint64_t term_change_round){
+
+    uart_output_forwarder_t f;
+    uart_output_forwarder_check_t check;
+    uint64_t tape_idx = 0, round;
+    uint32_t i;
+    memset(up, 0, sizeof(io_device_uart_t));
+    memset(&check, 0, sizeof(check));
+    check.drop_proposal_idx = 3;
+    io_device_uart_hwreset(up, txp, UART_OUTPUT_FORWARDER_CHECK_DATA_SIZE);
+    up->dev.tape_idxp = &tape_idx;
+    uart_output_forwarder_init(&f, txp);
+    f.deliver_cb = uart_output_forwarder_check_deliver_cb;
+    f.propose_ack_cb = uart_output_forwarder_check_propose_ack_cb;
+    f.cb_arg = &check;
+    f.ack_timeout_ns = ack_timeout_ns;
+    uart_output_forwarder_become_designated(&f);
+    for(round = 1; round <= UART_OUTPUT_FORWARDER_CHECK_ROUND_MAX; round++){
+        while(up->tx_ct < UART_OUTPUT_FORWARDER_CHECK_BYTE_CT &&
+            io_device_uart_tx_byte(up, (uint8_t)(up->tx_ct * 7))){
+        }
+        io_device_uart_post_cpu_exec_phase_handler(&up->dev, 0);
+        tape_idx++;
+        if(round == term_change_round){
+            uart_output_forwarder_term_change(&f);
+        }
+        uart_output_forwarder_poll(&f);
+        for(i = 0; i < check.queued_ct; i++){
+            io_device_uart_io_output_consume_buffer(&up->dev, 0, check.offsets[i], check.lens[i]);
+        }
+        check.queued_ct = 0;
+        if(check.bad_flag){
+            return 0;
+        }
+        if(txp->acked_ct == UART_OUTPUT_FORWARDER_CHECK_BYTE_CT &&
+            check.taken_ct == UART_OUTPUT_FORWARDER_CHECK_BYTE_CT){
+            return round;
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char** argv){
+    io_device_uart_t* up = (io_device_uart_t*)malloc(sizeof(io_device_uart_t));
+    io_device_uart_tx_ring_t* txp = (io_device_uart_tx_ring_t*)malloc(
+        sizeof(io_device_uart_tx_ring_t) + UART_OUTPUT_FORWARDER_CHECK_DATA_SIZE);
+    uint64_t stalled_round_ct, timeout_round_ct, term_round_ct;
+    if(!up || !txp){
+        fprintf(stderr, "uart_output_forwarder: out of memory\n");
+        return 1;
+    }
+    // without any retry the guest stalls for good once the 3rd proposal is dropped
+    stalled_round_ct = uart_output_forwarder_check_run(up, txp, (uint64_t)-1, 0);
+    timeout_round_ct = uart_output_forwarder_check_run(up, txp, 0, 0);
+    term_round_ct = uart_output_forwarder_check_run(up, txp, (uint64_t)-1, 1000);
+    fprintf(stdout, "uart_output_forwarder: one proposal dropped, without retry %s, retried "
+        "on timeout %s, retried on term change %s\n",
+        stalled_round_ct ? "drained (wrong)" : "stalled",
+        timeout_round_ct ? "drained" : "stalled (wrong)",
+        term_round_ct > 1000 ? "drained" : "wrong");
+    free(up);
+    free(txp);
+    return !stalled_round_ct && timeout_round_ct && term_round_ct > 1000 ? 0 : 2;
+}
+#endif
+
+#endif
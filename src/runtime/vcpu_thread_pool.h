@@ -0,0 +1,168 @@
+// Copyright 2019 Sen Han <00hnes@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ** vCPU thread pool **
+// host side, NOT a md part: runs the vCPUs of one SMP computer in parallel, it is the
+// `parallel_run_cb` of turingcell_computer_host_env_t.
+//
+// one job at a time: the caller publishes (fn, arg, ct) under a new generation, then it and
+// the helper threads take the indices one by one until all are taken, and the caller waits
+// until all are done and no helper is inside the job any more, so a late helper could never
+// take an index of the next job with the counter of this one.
+//
+// which thread runs which vCPU never changes the result (see turingcell_smp_md.h).
+
+#ifndef VCPU_THREAD_POOL_H
+#define VCPU_THREAD_POOL_H
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<pthread.h>
+
+#define VCPU_THREAD_POOL_THREAD_CT_MAX  64
+
+typedef struct {
+    pthread_t threads[VCPU_THREAD_POOL_THREAD_CT_MAX];
+    uint32_t thread_ct;                 // helpers, the caller of a job is one more worker
+
+    pthread_mutex_t lock;
+    pthread_cond_t job_cond;
+    pthread_cond_t done_cond;
+    uint64_t generation;                // of the latest job, protected by lock
+    uint8_t stop_flag;
+
+    void (*fn)(void* arg, uint32_t idx);
+    void* arg;
+    uint32_t ct;
+    uint32_t next_idx;                  // atomic
+    uint32_t done_ct;                   // protected by lock
+    uint32_t active_ct;                 // helpers inside the job, protected by lock
+} vcpu_thread_pool_t;
+
+// ret u32: amount of indices this thread ran
+uint32_t
+vcpu_thread_pool_take(vcpu_thread_pool_t* tpp){
+    uint32_t idx, ran_ct = 0;
+    for(;;){
+        idx = __atomic_fetch_add(&tpp->next_idx, 1, __ATOMIC_ACQ_REL);
+        if(idx >= tpp->ct){
+            return ran_ct;
+        }
+        tpp->fn(tpp->arg, idx);
+        ran_ct++;
+    }
+}
+
+// always_inline
+inline void
+vcpu_thread_pool_done(vcpu_thread_pool_t* tpp, uint32_t ran_ct, uint8_t helper_flag){
+    pthread_mutex_lock(&tpp->lock);
+    tpp->done_ct += ran_ct;
+    if(helper_flag){
+        tpp->active_ct--;
+    }
+    if(tpp->done_ct == tpp->ct && tpp->active_ct == 0){
+        pthread_cond_signal(&tpp->done_cond);
+    }
+    pthread_mutex_unlock(&tpp->lock);
+}
+
+void*
+vcpu_thread_pool_thread_main(void* arg){
+    vcpu_thread_pool_t* tpp = (vcpu_thread_pool_t*)arg;
+    uint64_t seen_generation = 0;
+    for(;;){
+        pthread_mutex_lock(&tpp->lock);
+        while(tpp->generation == seen_generation && !tpp->stop_flag){
+            pthread_cond_wait(&tpp->job_cond, &tpp->lock);
+        }
+        if(tpp->stop_flag){
+            pthread_mutex_unlock(&tpp->lock);
+            return NULL;
+        }
+        seen_generation = tpp->generation;
+        tpp->active_ct++;
+        pthread_mutex_unlock(&tpp->lock);
+        vcpu_thread_pool_done(tpp, vcpu_thread_pool_take(tpp), 1);
+    }
+}
+
+// turingcell_computer_parallel_run_cb_t
+void
+vcpu_thread_pool_run(void* ctx, void (*fn)(void* arg, uint32_t idx), void* arg, uint32_t ct){
+    vcpu_thread_pool_t* tpp = (vcpu_thread_pool_t*)ctx;
+    pthread_mutex_lock(&tpp->lock);
+    while(tpp->active_ct){ // a helper still leaving the previous job
+        pthread_cond_wait(&tpp->done_cond, &tpp->lock);
+    }
+    tpp->fn = fn;
+    tpp->arg = arg;
+    tpp->ct = ct;
+    tpp->done_ct = 0;
+    __atomic_store_n(&tpp->next_idx, 0, __ATOMIC_RELEASE);
+    tpp->generation++;
+    pthread_cond_broadcast(&tpp->job_cond);
+    pthread_mutex_unlock(&tpp->lock);
+
+    vcpu_thread_pool_done(tpp, vcpu_thread_pool_take(tpp), 0);
+
+    pthread_mutex_lock(&tpp->lock);
+    while(tpp->done_ct != tpp->ct || tpp->active_ct){
+        pthread_cond_wait(&tpp->done_cond, &tpp->lock);
+    }
+    pthread_mutex_unlock(&tpp->lock);
+}
+
+// thread_ct helpers, a computer with N vCPUs wants N - 1
+// ret int: 0 if success | -1 if failed
+int
+vcpu_thread_pool_start(vcpu_thread_pool_t* tpp, uint32_t thread_ct){
+    uint32_t i;
+    if(thread_ct > VCPU_THREAD_POOL_THREAD_CT_MAX){
+        thread_ct = VCPU_THREAD_POOL_THREAD_CT_MAX;
+    }
+    pthread_mutex_init(&tpp->lock, NULL);
+    pthread_cond_init(&tpp->job_cond, NULL);
+    pthread_cond_init(&tpp->done_cond, NULL);
+    tpp->generation = 0;
+    tpp->stop_flag = 0;
+    tpp->ct = 0;
+    tpp->next_idx = 0;
+    tpp->done_ct = 0;
+    tpp->active_ct = 0;
+    for(i = 0; i < thread_ct; i++){
+        if(pthread_create(&tpp->threads[i], NULL, vcpu_thread_pool_thread_main, tpp) != 0){
+            break;
+        }
+    }
+    tpp->thread_ct = i;
+    return i == thread_ct ? 0 : -1;
+}
+
+void
+vcpu_thread_pool_stop(vcpu_thread_pool_t* tpp){
+    uint32_t i;
+    pthread_mutex_lock(&tpp->lock);
+    tpp->stop_flag = 1;
+    pthread_cond_broadcast(&tpp->job_cond);
+    pthread_mutex_unlock(&tpp->lock);
+    for(i = 0; i < tpp->thread_ct; i++){
+        pthread_join(tpp->threads[i], NULL);
+    }
+    pthread_cond_destroy(&tpp->done_cond);
+    pthread_cond_destroy(&tpp->job_cond);
+    pthread_mutex_destroy(&tpp->lock);
+}
+
+#endif